@@ -0,0 +1,410 @@
+/*
+  \file   decoders_bench.cpp
+  \brief  Сравнение разбора полей Type-1 и Type-14 по constexpr схеме с разбором, который был в type1Record::load
+          и type14Record::load до перехода на схемы (цепочка getTagById()/dataCopy()/atoi())
+
+  Записи разбираются на теги один раз до замеров, замеряется только заполнение полей по готовым тегам.
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. decoders_bench.cpp nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o decoders_bench
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+#include "nistgen.h"
+
+//!Поля Type-1 в прежнем виде
+struct baselineType1
+{
+   unsigned ver_;
+   std::vector<std::pair<unsigned,unsigned> > file_content_;
+   std::string transaction_, transaction_date_;
+   unsigned priority_;
+   std::string destination_, originating_, control_number_, responce_control_number_;
+   double scanning_res_, transmitting_res_;
+   std::string domain_, g_mean_time_, char_sets_;
+};
+
+//!Поля Type-14 в прежнем виде
+struct baselineType14
+{
+   unsigned char idc_, imp_, slc_, pbx_, fgp_;
+   unsigned hll_, vll_, hps_, vps_;
+   std::string ori_, tcd_, cga_, com_;
+   const unsigned char* image_data_;
+   unsigned image_data_size_;
+};
+
+/*!Прежний разбор полей из type1Record::load без изменений, кроме отладочного вывода.
+   До перехода на схемы запись создавалась заново для каждой транзакции, поэтому CNT очищается перед разбором
+*/
+static bool baselineDecode1(const nistRecord& rec, baselineType1& out)
+{
+   out.file_content_.clear();
+   std::vector<unsigned char> tag_data;
+   const nistTag* tag = rec.getTagById(2);
+   if(tag)
+   {
+      //1.002 VER
+      tag_data = tag->dataCopy();
+      out.ver_ = atoi((char*)&tag_data.front());
+   }
+   tag = rec.getTagById(3);
+   if(tag)
+   {
+      //1.003 CNT
+      tag_data = tag->dataCopy();
+      std::vector<unsigned char>::iterator pair_delim_pos;
+      while((pair_delim_pos = std::find(tag_data.begin(), tag_data.end(), nistParser::RS()))!=tag_data.end())
+      {
+         std::vector<unsigned char> pair;
+         pair.assign(tag_data.begin(),pair_delim_pos);
+         tag_data.erase(tag_data.begin(),pair_delim_pos+1);
+         std::vector<unsigned char>::iterator items_delim_pos = std::find(pair.begin(), pair.end(), nistParser::US());
+         if(items_delim_pos!=pair.end())
+         {
+            std::vector<unsigned char> left_part;
+            left_part.assign(pair.begin(),items_delim_pos);
+            left_part.push_back(0);
+            pair.erase(pair.begin(),items_delim_pos+1);
+            pair.push_back(0);
+            char* end = 0;
+            unsigned rec_type = std::strtoul((char*)&left_part.front(),&end,10);
+            unsigned idc = std::strtoul((char*)&pair.front(),&end,10);
+            if(rec_type!=1)
+            {
+               out.file_content_.push_back(std::pair<unsigned,unsigned>(rec_type,idc));
+            }
+         }
+         else
+         {
+            return false;
+         }
+      }
+      if(tag_data.size())
+      {
+         std::vector<unsigned char>::iterator items_delim_pos = std::find(tag_data.begin(), tag_data.end(), nistParser::US());
+         if(items_delim_pos!=tag_data.end())
+         {
+            std::vector<unsigned char> left_part;
+            left_part.assign(tag_data.begin(),items_delim_pos);
+            left_part.push_back(0);
+            tag_data.erase(tag_data.begin(),items_delim_pos+1);
+            tag_data.push_back(0);
+            char* end = 0;
+            unsigned rec_type = std::strtoul((char*)&left_part.front(),&end,10);
+            unsigned idc = std::strtoul((char*)&tag_data.front(),&end,10);
+            out.file_content_.push_back(std::pair<unsigned,unsigned>(rec_type,idc));
+         }
+      }
+   }
+   tag = rec.getTagById(4);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.transaction_ = (char*)&tag_data.front();
+   }
+   tag = rec.getTagById(5);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.transaction_date_ = (char*)&tag_data.front();
+   }
+   tag = rec.getTagById(6);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.priority_ = atoi((char*)&tag_data.front());
+   }
+   tag = rec.getTagById(7);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.destination_ = (char*)&tag_data.front();
+   }
+   tag = rec.getTagById(8);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.originating_ = (char*)&tag_data.front();
+   }
+   tag = rec.getTagById(9);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.control_number_ = (char*)&tag_data.front();
+   }
+   tag = rec.getTagById(10);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.responce_control_number_ = (char*)&tag_data.front();
+   }
+   tag = rec.getTagById(11);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.scanning_res_ = atof((char*)&tag_data.front());
+   }
+   tag = rec.getTagById(12);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.transmitting_res_ = atof((char*)&tag_data.front());
+   }
+   tag = rec.getTagById(13);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.domain_ = (char*)&tag_data.front();
+   }
+   tag = rec.getTagById(14);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.g_mean_time_ = (char*)&tag_data.front();
+   }
+   tag = rec.getTagById(15);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      out.char_sets_ = (char*)&tag_data.front();
+   }
+   return out.file_content_.size() > 0 && out.transaction_.length() && out.control_number_.length();
+}
+
+//!Прежний разбор полей из type14Record::load без изменений, кроме отладочного вывода
+static void baselineDecode14(const nistRecord& rec, baselineType14& out)
+{
+   std::vector<unsigned char> tag_data;
+   const nistTag* tag = rec.getTagById(2);
+   if(tag)
+   {
+      //14.002 IDC
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.idc_ = (unsigned char)atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(3);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.imp_ = (unsigned char)atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(4);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.ori_ = (const char*) &tag_data.front();
+      }
+   }
+   tag = rec.getTagById(5);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.tcd_ = (const char*) &tag_data.front();
+      }
+   }
+   tag = rec.getTagById(6);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.hll_ = atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(7);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.vll_ = atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(8);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.slc_ = (unsigned char)atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(9);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.hps_ = atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(10);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.vps_ = atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(11);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.cga_ = (const char*)&tag_data.front();
+      }
+   }
+   tag = rec.getTagById(12);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.pbx_ = (unsigned char)atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(13);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.fgp_ = (unsigned char)atoi((char*)&tag_data.front());
+      }
+   }
+   tag = rec.getTagById(20);
+   if(tag)
+   {
+      tag_data = tag->dataCopy();
+      if(tag_data.size())
+      {
+         out.com_ = (char*)&tag_data.front();
+      }
+   }
+   tag = rec.getTagById(999);
+   if(tag)
+   {
+      //Field 14.999: Image data (DAT)
+      out.image_data_ = tag->data();
+      out.image_data_size_ = tag->data_size();
+   }
+   else
+   {
+      out.image_data_ = 0;
+      out.image_data_size_ = 0;
+   }
+}
+
+template<class F>
+static double measure(const char* name, unsigned iterations, F f)
+{
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   for(unsigned i=0;i<iterations;i++)
+   {
+      f();
+   }
+   double ns = std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now() - start).count()/iterations;
+   printf("%-34s %10.1f ns/record\n",name,ns);
+   return ns;
+}
+
+int main(int argc, char** argv)
+{
+   unsigned iterations = argc>1 ? atoi(argv[1]) : 200000;
+   std::string rs(1,(char)nistParser::RS());
+   std::string us(1,(char)nistParser::US());
+
+   std::vector<std::pair<unsigned,std::string> > f14;
+   f14.push_back(std::make_pair(2u,std::string("05")));
+   f14.push_back(std::make_pair(3u,std::string("1")));
+   f14.push_back(std::make_pair(4u,std::string("RU000001X")));
+   f14.push_back(std::make_pair(5u,std::string("20150419")));
+   f14.push_back(std::make_pair(6u,std::string("1600")));
+   f14.push_back(std::make_pair(7u,std::string("1500")));
+   f14.push_back(std::make_pair(8u,std::string("1")));
+   f14.push_back(std::make_pair(9u,std::string("1000")));
+   f14.push_back(std::make_pair(10u,std::string("1000")));
+   f14.push_back(std::make_pair(11u,std::string("WSQ20")));
+   f14.push_back(std::make_pair(12u,std::string("8")));
+   f14.push_back(std::make_pair(13u,std::string("13")));
+   f14.push_back(std::make_pair(20u,std::string("plain right four fingers")));
+   std::string str14 = nistGenerator::taggedRecord(14,f14,std::string(4096,'\xA5'));
+   std::vector<unsigned char> rec14(str14.begin(),str14.end());
+
+   std::vector<std::pair<unsigned,std::string> > f1;
+   f1.push_back(std::make_pair(2u,std::string("0400")));
+   f1.push_back(std::make_pair(3u,"1" + us + "3" + rs + "2" + us + "00" + rs + "14" + us + "01" + rs + "14" + us + "02"));
+   f1.push_back(std::make_pair(4u,std::string("CAR")));
+   f1.push_back(std::make_pair(5u,std::string("20150419")));
+   f1.push_back(std::make_pair(6u,std::string("4")));
+   f1.push_back(std::make_pair(7u,std::string("DEST00001")));
+   f1.push_back(std::make_pair(8u,std::string("ORIG00001")));
+   f1.push_back(std::make_pair(9u,std::string("1500000001A")));
+   f1.push_back(std::make_pair(11u,std::string("19.68")));
+   f1.push_back(std::make_pair(12u,std::string("19.68")));
+   f1.push_back(std::make_pair(13u,"INT-I" + us + "4.22"));
+   f1.push_back(std::make_pair(14u,std::string("20150419120000Z")));
+   std::string str1 = nistGenerator::taggedRecord(1,f1);
+   std::vector<unsigned char> rec1(str1.begin(),str1.end());
+
+   //Теги разбираются один раз, оба способа заполняют поля по одним и тем же тегам
+   unsigned offset = 0;
+   type14Record new14;
+   if(!new14.load(rec14,offset))
+   {
+      printf("can't load Type-14 record\n");
+      return 1;
+   }
+   offset = 0;
+   type1Record new1;
+   if(!new1.load(rec1,offset))
+   {
+      printf("can't load Type-1 record\n");
+      return 1;
+   }
+   baselineType14 old14_fields = baselineType14();
+   baselineType1 old1_fields = baselineType1();
+   if(!baselineDecode1(new1,old1_fields))
+   {
+      printf("baseline can't decode Type-1 record\n");
+      return 1;
+   }
+   baselineDecode14(new14,old14_fields);
+   if(old14_fields.hll_!=new14.getHLL() || old14_fields.fgp_!=new14.getFGP() || old14_fields.cga_!=new14.getCGA() ||
+      old1_fields.file_content_.size()!=new1.getRecordsCnt() || old1_fields.control_number_!=new1.getTCN())
+   {
+      printf("decoders disagree\n");
+      return 1;
+   }
+
+   printf("Type-14, %u tags, %u bytes\n",new14.tagsCnt(),(unsigned)rec14.size());
+   double old14 = measure("getTagById/dataCopy/atoi",iterations,[&]{baselineDecode14(new14,old14_fields);});
+   double cur14 = measure("type14Record::decodeFields",iterations,[&]{new14.decodeFields();});
+   printf("field decode speedup %.2fx\n\n",old14/cur14);
+
+   printf("Type-1, %u tags, %u bytes\n",new1.tagsCnt(),(unsigned)rec1.size());
+   double old1 = measure("getTagById/dataCopy/atoi",iterations,[&]{baselineDecode1(new1,old1_fields);});
+   double cur1 = measure("type1Record::decodeFields",iterations,[&]{new1.decodeFields();});
+   printf("field decode speedup %.2fx\n",old1/cur1);
+   return 0;
+}
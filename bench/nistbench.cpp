@@ -0,0 +1,283 @@
+/*
+  \file   nistbench.cpp
+  \brief  Набор тестов производительности разбора на синтетических транзакциях
+
+  Для каждого набора записей (см. presets) генерируется транзакция nistGenerator и измеряется:
+     tag     - разбор тегов nistTag::load по всем текстовым записям
+     record  - разбор текстовых записей базовым nistRecord::load
+     parse   - nistParser::load из буфера в памяти
+     validate - nistValidator::validate того же буфера
+     records - выборка nistParser::getRecords по всем типам и по всем парам (тип, IDC)
+     write   - nistParser::write во временный файл
+     json    - nistJsonWriter с изображениями в base64 во временный файл
+     xmlw    - nistXmlWriter во временный файл (записи Type-1, 2, 10, 14)
+     xmlr    - nistXmlReader::load этого файла в тот же parser
+  Результат выводится в МБ/с и нс на тег, для parse дополнительно количество выделений памяти на транзакцию.
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. nistbench.cpp nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp ../nistjson.cpp ../nistxml.cpp ../nistvalidate.cpp -o nistbench
+  Запуск:
+     ./nistbench [число повторов] [размер изображения] [metrics]
+  С параметром metrics включается сбор nistMetrics (для оценки его стоимости), срез выводится в конце в JSON.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+#include "nistgen.h"
+#include "nistmetrics.h"
+#include "nistjson.h"
+#include "nistxml.h"
+#include "nistvalidate.h"
+
+//!Счетчик выделений памяти, считается во всем процессе
+static unsigned long long alloc_cnt = 0;
+
+void* operator new(size_t size)
+{
+   alloc_cnt++;
+   void* res = malloc(size ? size : 1);
+   if(!res)
+   {
+      throw std::bad_alloc();
+   }
+   return res;
+}
+
+void operator delete(void* ptr) noexcept
+{
+   free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+   free(ptr);
+}
+
+typedef std::chrono::steady_clock benchClock;
+
+static double elapsedNs(benchClock::time_point start)
+{
+   return std::chrono::duration<double,std::nano>(benchClock::now() - start).count();
+}
+
+struct benchPreset
+{
+   const char* name_;
+   unsigned type2_fields_;
+   unsigned type4_cnt_;
+   unsigned type9_cnt_;
+   unsigned type10_cnt_;
+   unsigned type14_cnt_;
+   unsigned type15_cnt_;
+};
+
+static const benchPreset presets[] =
+{
+   //name       T2 fields T4 T9 T10 T14 T15
+   {"demog",    200,       0, 0,  0,  0,  0},
+   {"tenprint",  30,       0, 0,  0, 14,  0},
+   {"legacy",    30,      14,10,  0,  0,  0},
+   {"mugshot",   30,       0, 0,  3,  0,  0},
+   {"mixed",     60,       4,10,  2, 14,  4},
+};
+
+static void printRow(const char* preset, const char* stage, double ns, unsigned iterations, size_t bytes, unsigned tags)
+{
+   double per_iter = ns/iterations;
+   double mb_s = per_iter>0 ? bytes/(per_iter/1e9)/(1024.0*1024.0) : 0;
+   printf("%-10s %-8s %12.0f %10.1f %10.1f\n",preset,stage,per_iter,mb_s,tags ? per_iter/tags : 0.0);
+}
+
+//!Разбирает теги текстовой записи, начинающейся с offset, так же как nistRecord::load
+static unsigned tokenize(const std::vector<unsigned char>& data, unsigned offset, unsigned record_size)
+{
+   unsigned tags = 0;
+   unsigned offset_to_end = offset + record_size - 1;
+   nistTag tag;
+   while(tag.load(data,offset,offset_to_end))
+   {
+      tags++;
+      if(data[offset]==nistParser::FS() || offset==offset_to_end)
+      {
+         break;
+      }
+      offset++;
+   }
+   return tags;
+}
+
+static void runPreset(const benchPreset& preset, unsigned iterations, unsigned image_size, const std::string& out_name)
+{
+   nistGenConfig config;
+   config.type2_fields_ = preset.type2_fields_;
+   config.type4_cnt_ = preset.type4_cnt_;
+   config.type9_cnt_ = preset.type9_cnt_;
+   config.type10_cnt_ = preset.type10_cnt_;
+   config.type14_cnt_ = preset.type14_cnt_;
+   config.type15_cnt_ = preset.type15_cnt_;
+   config.image_size_ = image_size;
+   nistGenerator gen(config);
+   std::vector<unsigned char> data = gen.generate();
+   unsigned tags = gen.tagsCnt();
+
+   nistParser parser;
+   if(!parser.load(data))
+   {
+      printf("%-10s failed to parse generated transaction\n",preset.name_);
+      return;
+   }
+   //Расположение текстовых записей для разбора тегов и записей по отдельности
+   std::vector<std::pair<unsigned,unsigned> > tagged;
+   std::vector<unsigned> types;
+   tagged.push_back(std::make_pair(0u,parser.getFileHeader()->record_size_));
+   types.push_back(1);
+   for(unsigned type=2;type<=99;type++)
+   {
+      nistRecordRange recs = parser.getRecords(type);
+      for(unsigned rec_no=0;rec_no<recs.size();rec_no++)
+      {
+         if(type!=4 && type!=7 && type!=8)
+         {
+            tagged.push_back(std::make_pair(recs[rec_no]->offset_,recs[rec_no]->record_size_));
+            types.push_back(type);
+         }
+      }
+   }
+   size_t tagged_bytes = 0;
+   for(unsigned rec_no=0;rec_no<tagged.size();rec_no++)
+   {
+      tagged_bytes += tagged[rec_no].second;
+   }
+
+   benchClock::time_point start = benchClock::now();
+   unsigned check = 0;
+   for(unsigned iter=0;iter<iterations;iter++)
+   {
+      for(unsigned rec_no=0;rec_no<tagged.size();rec_no++)
+      {
+         check += tokenize(data,tagged[rec_no].first,tagged[rec_no].second);
+      }
+   }
+   printRow(preset.name_,"tag",elapsedNs(start),iterations,tagged_bytes,tags);
+   if(check!=tags*iterations)
+   {
+      printf("%-10s tag count mismatch %u != %u\n",preset.name_,check/iterations,tags);
+   }
+
+   nistRecord rec;
+   start = benchClock::now();
+   for(unsigned iter=0;iter<iterations;iter++)
+   {
+      for(unsigned rec_no=0;rec_no<tagged.size();rec_no++)
+      {
+         unsigned offset = tagged[rec_no].first;
+         rec.load(data,offset,types[rec_no]);
+      }
+   }
+   printRow(preset.name_,"record",elapsedNs(start),iterations,tagged_bytes,tags);
+
+   unsigned long long allocs = alloc_cnt;
+   start = benchClock::now();
+   for(unsigned iter=0;iter<iterations;iter++)
+   {
+      parser.load(data);
+   }
+   double ns = elapsedNs(start);
+   allocs = alloc_cnt - allocs;
+   printRow(preset.name_,"parse",ns,iterations,data.size(),tags);
+   printf("%-10s %-8s %12.1f allocations per transaction\n",preset.name_,"",(double)allocs/iterations);
+
+   nistValidator validator;
+   std::vector<nistViolation> violations;
+   start = benchClock::now();
+   for(unsigned iter=0;iter<iterations;iter++)
+   {
+      violations.clear();
+      validator.validate(&data[0],data.size(),violations);
+   }
+   printRow(preset.name_,"validate",elapsedNs(start),iterations,data.size(),tags);
+   if(!violations.empty())
+   {
+      printf("%-10s %u violations, first: %s\n",preset.name_,(unsigned)violations.size(),nistViolationText(violations[0].code_));
+   }
+
+   start = benchClock::now();
+   for(unsigned iter=0;iter<iterations;iter++)
+   {
+      for(unsigned type=2;type<=99;type++)
+      {
+         check += parser.getRecords(type).size();
+      }
+      for(unsigned idc=0;idc<64;idc++)
+      {
+         check += parser.getRecords(4,idc).size() + parser.getRecords(14,idc).size();
+      }
+   }
+   printRow(preset.name_,"records",elapsedNs(start),iterations,0,0);
+
+   unsigned write_iterations = iterations/10 ? iterations/10 : 1;
+   start = benchClock::now();
+   for(unsigned iter=0;iter<write_iterations;iter++)
+   {
+      parser.write(out_name);
+   }
+   printRow(preset.name_,"write",elapsedNs(start),write_iterations,data.size(),tags);
+
+   start = benchClock::now();
+   for(unsigned iter=0;iter<write_iterations;iter++)
+   {
+      nistJsonWriter::writeFile(parser,out_name);
+   }
+   printRow(preset.name_,"json",elapsedNs(start),write_iterations,data.size(),tags);
+
+   start = benchClock::now();
+   for(unsigned iter=0;iter<write_iterations;iter++)
+   {
+      nistXmlWriter::writeFile(parser,out_name);
+   }
+   printRow(preset.name_,"xmlw",elapsedNs(start),write_iterations,data.size(),tags);
+
+   std::vector<unsigned char> xml;
+   nistParser::readFile(out_name,xml);
+   nistXmlReader xml_reader;
+   start = benchClock::now();
+   for(unsigned iter=0;iter<write_iterations;iter++)
+   {
+      if(!xml_reader.load((const char*)&xml[0],xml.size(),parser))
+      {
+         printf("%s: XML load error %s\n",preset.name_,xml_reader.getError().c_str());
+         break;
+      }
+   }
+   printRow(preset.name_,"xmlr",elapsedNs(start),write_iterations,xml.size(),0);
+}
+
+int main(int argc, char* argv[])
+{
+   unsigned iterations = argc>1 ? atoi(argv[1]) : 200;
+   unsigned image_size = argc>2 ? atoi(argv[2]) : 32*1024;
+   if(!iterations)
+   {
+      iterations = 1;
+   }
+   bool metrics = argc>3 && std::string(argv[3])=="metrics";
+   nistMetrics::enable(metrics);
+   std::string out_name = "nistbench.out";
+   printf("%-10s %-8s %12s %10s %10s\n","preset","stage","ns/iter","MB/s","ns/tag");
+   for(unsigned preset_no=0;preset_no<sizeof(presets)/sizeof(presets[0]);preset_no++)
+   {
+      runPreset(presets[preset_no],iterations,image_size,out_name);
+   }
+   remove(out_name.c_str());
+   if(metrics)
+   {
+      printf("%s\n",nistMetrics::snapshot().json().c_str());
+   }
+   return 0;
+}
@@ -0,0 +1,261 @@
+/*
+  \file   nistgen.cpp
+  \brief  Детерминированный генератор синтетических ANSI-NIST транзакций
+*/
+
+#include <cstdio>
+#include <cstring>
+
+#include "nistparser.h"
+#include "nistgen.h"
+
+nistGenConfig::nistGenConfig()
+{
+   seed_ = 1;
+   type2_fields_ = 20;
+   type2_field_size_ = 24;
+   type4_cnt_ = 0;
+   type9_cnt_ = 0;
+   minutiae_cnt_ = 40;
+   type10_cnt_ = 0;
+   type14_cnt_ = 14;
+   type15_cnt_ = 0;
+   image_size_ = 32*1024;
+}
+
+nistGenerator::nistGenerator(const nistGenConfig& config)
+   : config_(config)
+{
+   state_ = config.seed_ ? config.seed_ : 1;
+   tags_cnt_ = 0;
+}
+
+unsigned nistGenerator::next()
+{
+   //xorshift32
+   state_ ^= state_ << 13;
+   state_ ^= state_ >> 17;
+   state_ ^= state_ << 5;
+   return state_;
+}
+
+std::string nistGenerator::digits(unsigned len)
+{
+   std::string res(len,'0');
+   for(unsigned pos=0;pos<len;pos++)
+   {
+      res[pos] = '0' + next()%10;
+   }
+   return res;
+}
+
+std::string nistGenerator::image()
+{
+   std::string res(config_.image_size_,0);
+   for(unsigned pos=0;pos<res.size();pos++)
+   {
+      res[pos] = (char)(next()>>24);
+   }
+   //Сигнатура WSQ
+   if(res.size()>=4)
+   {
+      res[0] = (char)0xFF;
+      res[1] = (char)0xA0;
+      res[2] = (char)0xFF;
+      res[3] = (char)0xA8;
+   }
+   return res;
+}
+
+std::string nistGenerator::taggedRecord(unsigned type, const std::vector<std::pair<unsigned,std::string> >& fields,
+                                        const std::string& image)
+{
+   std::string rest;
+   for(unsigned field_no=0;field_no<fields.size();field_no++)
+   {
+      char tag[16];
+      snprintf(tag,sizeof(tag),"%u.%03u:",type,fields[field_no].first);
+      rest += tag + fields[field_no].second;
+      rest += (char)nistParser::GS();
+   }
+   if(image.size())
+   {
+      rest += std::to_string(type) + ".999:" + image;
+   }
+   else if(rest.size())
+   {
+      rest.resize(rest.size() - 1);
+   }
+   rest += (char)nistParser::FS();
+   std::string head = std::to_string(type) + ".001:";
+   unsigned len = head.size() + rest.size() + 1;
+   std::string rec;
+   for(;;)
+   {
+      rec = head + std::to_string(len) + (char)nistParser::GS() + rest;
+      if(rec.size()==len)
+      {
+         break;
+      }
+      len = rec.size();
+   }
+   return rec;
+}
+
+typedef std::vector<std::pair<unsigned,std::string> > fieldList;
+
+static void addField(fieldList& fields, unsigned tag, const std::string& value)
+{
+   fields.push_back(std::make_pair(tag,value));
+}
+
+static std::string idcStr(unsigned idc)
+{
+   char buf[8];
+   snprintf(buf,sizeof(buf),"%02u",idc);
+   return buf;
+}
+
+std::vector<unsigned char> nistGenerator::generate()
+{
+   std::string us(1,(char)nistParser::US());
+   std::string rs(1,(char)nistParser::RS());
+   std::vector<std::pair<unsigned,unsigned> > content;
+   std::string body;
+   unsigned idc = 0;
+   tags_cnt_ = 0;
+
+   fieldList t2;
+   addField(t2,2,idcStr(idc));
+   addField(t2,3,"0422");
+   for(unsigned field_no=0;field_no<config_.type2_fields_;field_no++)
+   {
+      addField(t2,4 + field_no,digits(config_.type2_field_size_));
+   }
+   body += taggedRecord(2,t2);
+   tags_cnt_ += t2.size() + 1;
+   content.push_back(std::make_pair(2u,idc));
+
+   for(unsigned rec_no=0;rec_no<config_.type4_cnt_;rec_no++)
+   {
+      idc++;
+      unsigned char hdr[18];
+      unsigned len = sizeof(hdr) + config_.image_size_;
+      hdr[0] = len>>24;
+      hdr[1] = len>>16;
+      hdr[2] = len>>8;
+      hdr[3] = len;
+      hdr[4] = idc;
+      hdr[5] = 1;
+      hdr[6] = 1 + rec_no%10;
+      memset(hdr + 7,255,5);
+      hdr[12] = 0;
+      hdr[13] = 800>>8;
+      hdr[14] = 800&0xFF;
+      hdr[15] = 750>>8;
+      hdr[16] = 750&0xFF;
+      hdr[17] = 1;
+      body.append((const char*)hdr,sizeof(hdr));
+      body += image();
+      content.push_back(std::make_pair(4u,idc));
+   }
+
+   for(unsigned rec_no=0;rec_no<config_.type9_cnt_;rec_no++)
+   {
+      idc++;
+      std::string fmd;
+      for(unsigned minutia=0;minutia<config_.minutiae_cnt_;minutia++)
+      {
+         if(minutia)
+         {
+            fmd += rs;
+         }
+         fmd += std::to_string(minutia + 1) + us + std::to_string(next()%800) + us + std::to_string(next()%750) + us +
+                std::to_string(next()%180) + us + std::to_string(1 + next()%2) + us + std::to_string(next()%101);
+      }
+      fieldList t9;
+      addField(t9,2,idcStr(idc));
+      addField(t9,3,"1");
+      addField(t9,4,"U");
+      addField(t9,126,"27" + us + "513" + us + "1");
+      addField(t9,134,std::to_string(1 + rec_no%10));
+      addField(t9,136,std::to_string(config_.minutiae_cnt_));
+      addField(t9,137,fmd);
+      body += taggedRecord(9,t9);
+      tags_cnt_ += t9.size() + 1;
+      content.push_back(std::make_pair(9u,idc));
+   }
+
+   for(unsigned rec_no=0;rec_no<config_.type10_cnt_;rec_no++)
+   {
+      idc++;
+      fieldList t10;
+      addField(t10,2,idcStr(idc));
+      addField(t10,3,"FACE");
+      addField(t10,4,"GEN000001");
+      addField(t10,5,"20150419");
+      addField(t10,6,"480");
+      addField(t10,7,"600");
+      addField(t10,8,"1");
+      addField(t10,9,"96");
+      addField(t10,10,"96");
+      addField(t10,11,"JPEGB");
+      addField(t10,12,"YCC");
+      addField(t10,20,"F");
+      body += taggedRecord(10,t10,image());
+      tags_cnt_ += t10.size() + 2;
+      content.push_back(std::make_pair(10u,idc));
+   }
+
+   for(unsigned type=14;type<=15;type++)
+   {
+      unsigned cnt = type==14 ? config_.type14_cnt_ : config_.type15_cnt_;
+      for(unsigned rec_no=0;rec_no<cnt;rec_no++)
+      {
+         idc++;
+         fieldList fields;
+         addField(fields,2,idcStr(idc));
+         addField(fields,3,type==14 ? "1" : "10");
+         addField(fields,4,"GEN000001");
+         addField(fields,5,"20150419");
+         addField(fields,6,"800");
+         addField(fields,7,"750");
+         addField(fields,8,"1");
+         addField(fields,9,"500");
+         addField(fields,10,"500");
+         addField(fields,11,"WSQ20");
+         addField(fields,12,"8");
+         addField(fields,13,std::to_string(type==14 ? 1 + rec_no%14 : 21 + rec_no%10));
+         body += taggedRecord(type,fields,image());
+         tags_cnt_ += fields.size() + 2;
+         content.push_back(std::make_pair(type,idc));
+      }
+   }
+
+   std::string cnt = "1" + us + std::to_string(content.size());
+   for(unsigned rec_no=0;rec_no<content.size();rec_no++)
+   {
+      cnt += rs + std::to_string(content[rec_no].first) + us + idcStr(content[rec_no].second);
+   }
+   fieldList t1;
+   addField(t1,2,"0400");
+   addField(t1,3,cnt);
+   addField(t1,4,"CAR");
+   addField(t1,5,"20150419");
+   addField(t1,6,"4");
+   addField(t1,7,"DEST00001");
+   addField(t1,8,"GEN000001");
+   addField(t1,9,"15" + digits(8) + "A");
+   addField(t1,11,"19.68");
+   addField(t1,12,"19.68");
+   addField(t1,13,"INT-I" + us + "4.22");
+   addField(t1,14,"20150419120000Z");
+   std::string header = taggedRecord(1,t1);
+   tags_cnt_ += t1.size() + 1;
+
+   std::vector<unsigned char> res;
+   res.reserve(header.size() + body.size());
+   res.insert(res.end(),header.begin(),header.end());
+   res.insert(res.end(),body.begin(),body.end());
+   return res;
+}
@@ -0,0 +1,53 @@
+/*
+  \file   nistgen.h
+  \brief  Детерминированный генератор синтетических ANSI-NIST транзакций для тестов производительности
+*/
+
+#ifndef NIST_GEN_H
+#define NIST_GEN_H
+
+#include <string>
+#include <vector>
+
+///! Состав синтетической транзакции
+struct nistGenConfig
+{
+   nistGenConfig();
+   //!Начальное значение генератора, одинаковые настройки дают побайтно одинаковый файл
+   unsigned seed_;
+   //!Количество пользовательских полей Type-2 (2.004 и далее) и их длина
+   unsigned type2_fields_;
+   unsigned type2_field_size_;
+   unsigned type4_cnt_;
+   unsigned type9_cnt_;
+   //!Количество минуций в каждой записи Type-9
+   unsigned minutiae_cnt_;
+   unsigned type10_cnt_;
+   unsigned type14_cnt_;
+   unsigned type15_cnt_;
+   //!Размер данных изображения в байтах
+   unsigned image_size_;
+};
+
+///! Генератор транзакций Type-1 + N x Type-2/4/9/10/14/15
+class nistGenerator
+{
+public:
+   nistGenerator(const nistGenConfig& config);
+   //!Формирует транзакцию. Данные изображений случайные и содержат байты разделителей
+   std::vector<unsigned char> generate();
+   //!Количество тегов в текстовых записях последней сформированной транзакции
+   unsigned tagsCnt()const{return tags_cnt_;}
+   //!Формирует текстовую запись, значение LEN учитывает собственную длину
+   static std::string taggedRecord(unsigned type, const std::vector<std::pair<unsigned,std::string> >& fields,
+                                   const std::string& image = std::string());
+private:
+   unsigned next();
+   std::string digits(unsigned len);
+   std::string image();
+   nistGenConfig config_;
+   unsigned state_;
+   unsigned tags_cnt_;
+};
+
+#endif // NIST_GEN_H
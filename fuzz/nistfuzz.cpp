@@ -0,0 +1,73 @@
+/*
+  \file   nistfuzz.cpp
+  \brief  Цель libFuzzer для nistParser::load
+
+  Каждый вход разбирается дважды: строго и с force, затем читаются все теги и данные изображений
+  загруженных записей, чтобы санитайзер поймал ссылки за пределы буфера.
+
+  Сборка (clang):
+     clang++ -g -O1 -std=c++11 -fsanitize=fuzzer,address,undefined -DNIST_NO_DEBUG_OUTPUT -I.. nistfuzz.cpp ../nistparser.cpp ../nistmetrics.cpp -o nistfuzz
+  Запуск:
+     ./nistfuzz -max_len=65536 corpus/
+  Без libFuzzer (gcc) с -DNIST_FUZZ_MAIN собирается программа, которая прогоняет файлы-аргументы:
+     g++ -g -O1 -std=c++11 -fsanitize=address,undefined -DNIST_FUZZ_MAIN -DNIST_NO_DEBUG_OUTPUT -I.. nistfuzz.cpp ../nistparser.cpp ../nistmetrics.cpp -o nistfuzz
+*/
+
+#include <cstdio>
+#include <vector>
+
+#include "nistparser.h"
+
+//!Сумма по всем байтам, на которые ссылается разобранная транзакция
+static unsigned touch(const nistParser& parser)
+{
+   unsigned sum = 0;
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      for(unsigned tag_no=0;tag_no<rec->tagsCnt();tag_no++)
+      {
+         const nistTag* tag = rec->getTag(tag_no);
+         for(unsigned pos=0;pos<tag->data_size();pos++)
+         {
+            sum += tag->data()[pos];
+         }
+      }
+      const unsigned char* image = rec->getImgData();
+      for(unsigned pos=0;image && pos<rec->getImgDataSize();pos++)
+      {
+         sum += image[pos];
+      }
+   }
+   return sum;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size)
+{
+   static volatile unsigned sink = 0;
+   //Разбор прямо из буфера libFuzzer: чтение за его концом сразу видно санитайзеру
+   nistParser parser;
+   parser.load(data,size);
+   sink += touch(parser);
+   parser.load(data,size,true);
+   sink += touch(parser);
+   return 0;
+}
+
+#ifdef NIST_FUZZ_MAIN
+int main(int argc, char* argv[])
+{
+   for(int arg=1;arg<argc;arg++)
+   {
+      std::vector<unsigned char> data;
+      if(!nistParser::readFile(argv[arg],data))
+      {
+         printf("can't read %s\n",argv[arg]);
+         return 1;
+      }
+      LLVMFuzzerTestOneInput(data.empty() ? 0 : &data[0],data.size());
+   }
+   printf("%d inputs passed\n",argc - 1);
+   return 0;
+}
+#endif
@@ -0,0 +1,146 @@
+/*
+  \file   nistbase64.h
+  \brief  Кодирование и потоковое декодирование base64 для выгрузки изображений в текстовые форматы
+*/
+
+#ifndef NIST_BASE64_H
+#define NIST_BASE64_H
+
+#include <cstddef>
+
+/*! Кодирует size байт из data в out, дополняя последнюю неполную тройку символами '='.
+    В out должно быть не меньше (size + 2)/3*4 байт. Возвращает количество записанных символов.
+    При кодировании по частям размер всех частей, кроме последней, должен быть кратен 3
+*/
+inline size_t nistBase64Encode(const unsigned char* data, size_t size, char* out)
+{
+   static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+   char* start = out;
+   size_t pos = 0;
+   for(;pos + 3<=size;pos += 3)
+   {
+      unsigned value = data[pos]<<16 | data[pos + 1]<<8 | data[pos + 2];
+      *out++ = chars[value>>18];
+      *out++ = chars[(value>>12) & 0x3F];
+      *out++ = chars[(value>>6) & 0x3F];
+      *out++ = chars[value & 0x3F];
+   }
+   if(pos<size)
+   {
+      unsigned value = data[pos]<<16 | (pos + 1<size ? data[pos + 1]<<8 : 0);
+      *out++ = chars[value>>18];
+      *out++ = chars[(value>>12) & 0x3F];
+      *out++ = pos + 1<size ? chars[(value>>6) & 0x3F] : '=';
+      *out++ = '=';
+   }
+   return out - start;
+}
+
+///! Потоковый декодер base64: текст может поступать частями, пробельные символы пропускаются
+class nistBase64Decoder
+{
+public:
+   nistBase64Decoder() : acc_(0), bits_(0), ok_(true) {}
+   /*! Декодирует size символов text в out, в out должно быть не меньше size/4*3 + 3 байт.
+       Возвращает количество записанных байт. Недопустимый символ сбрасывает ok()
+   */
+   size_t decode(const char* text, size_t size, unsigned char* out)
+   {
+      const unsigned char* table = decodeTable();
+      const unsigned char* p = (const unsigned char*)text;
+      const unsigned char* end = p + size;
+      unsigned char* start = out;
+      for(;;)
+      {
+         //Целые четверки без пробелов и дополнения декодируются без ветвлений по символам
+         if(!bits_)
+         {
+            while(end - p>=4)
+            {
+               unsigned a = table[p[0]], b = table[p[1]], c = table[p[2]], d = table[p[3]];
+               if((a | b | c | d) & 0xC0)
+               {
+                  break;
+               }
+               unsigned value = a<<18 | b<<12 | c<<6 | d;
+               out[0] = (unsigned char)(value>>16);
+               out[1] = (unsigned char)(value>>8);
+               out[2] = (unsigned char)value;
+               out += 3;
+               p += 4;
+            }
+         }
+         if(p>=end)
+         {
+            break;
+         }
+         unsigned value = table[*p++];
+         if(value==skip_)
+         {
+            continue;
+         }
+         if(value==invalid_)
+         {
+            ok_ = false;
+            continue;
+         }
+         acc_ = acc_<<6 | value;
+         bits_ += 6;
+         if(bits_>=8)
+         {
+            bits_ -= 8;
+            *out++ = (unsigned char)(acc_>>bits_);
+         }
+      }
+      return out - start;
+   }
+   /*! Считает символы base64 в size символах text без декодирования, недопустимый символ сбрасывает ok.
+       decode для текста с symbols символами (в одной или нескольких частях) запишет symbols*3/4 байт
+   */
+   static size_t symbols(const char* text, size_t size, bool& ok)
+   {
+      const unsigned char* table = decodeTable();
+      const unsigned char* p = (const unsigned char*)text;
+      const unsigned char* end = p + size;
+      size_t res = 0;
+      for(;p<end;p++)
+      {
+         unsigned value = table[*p];
+         res += value<skip_ ? 1 : 0;
+         ok = ok && value!=invalid_;
+      }
+      return res;
+   }
+   bool ok() const{return ok_;}
+   void reset(){acc_ = 0; bits_ = 0; ok_ = true;}
+private:
+   static const unsigned char skip_ = 0x40;
+   static const unsigned char invalid_ = 0x80;
+   //!Значение символа base64 или skip_ для пробелов и '=', invalid_ для прочих символов
+   static const unsigned char* decodeTable()
+   {
+      static const unsigned char* table = buildTable();
+      return table;
+   }
+   static const unsigned char* buildTable()
+   {
+      static unsigned char table[256];
+      static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+      for(unsigned no=0;no<256;no++)
+      {
+         table[no] = invalid_;
+      }
+      for(unsigned no=0;no<64;no++)
+      {
+         table[(unsigned char)chars[no]] = no;
+      }
+      table[(unsigned char)'='] = table[(unsigned char)' '] = table[(unsigned char)'\t'] = 
+         table[(unsigned char)'\r'] = table[(unsigned char)'\n'] = skip_;
+      return table;
+   }
+   unsigned acc_;
+   unsigned bits_;
+   bool ok_;
+};
+
+#endif // NIST_BASE64_H
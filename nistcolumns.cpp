@@ -0,0 +1,447 @@
+/*
+  \file   nistcolumns.cpp
+  \brief  Колоночная выгрузка метаданных записей для статистики по большим массивам транзакций
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <cstring>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "nistcolumns.h"
+
+static const nistColumnInfo column_info[nistColumnsCnt] =
+{
+   {"txn",  nistColumnU32},
+   {"type", nistColumnU8},
+   {"rec",  nistColumnU16},
+   {"idc",  nistColumnU8},
+   {"tot",  nistColumnString},
+   {"ori",  nistColumnString},
+   {"dai",  nistColumnString},
+   {"tcn",  nistColumnString},
+   {"dat",  nistColumnString},
+   {"imp",  nistColumnU8},
+   {"fgp",  nistColumnU8},
+   {"hll",  nistColumnU32},
+   {"vll",  nistColumnU32},
+   {"slc",  nistColumnU8},
+   {"hps",  nistColumnU32},
+   {"vps",  nistColumnU32},
+   {"bpx",  nistColumnU8},
+   {"cga",  nistColumnString},
+   {"date", nistColumnString},
+   {"imt",  nistColumnString},
+   {"image_size", nistColumnU32},
+};
+
+static const char file_magic[8] = {'N','I','S','T','C','O','L','1'};
+static const char group_magic[4] = {'N','C','R','G'};
+static const unsigned byte_order_mark = 0x01020304;
+
+static size_t padding(size_t size)
+{
+   return (8 - size%8)%8;
+}
+
+nistColumnBatch::nistColumnBatch()
+   :rows_(0),transactions_(0)
+{
+}
+
+void nistColumnBatch::clear()
+{
+   for(unsigned col=0;col<nistColumnsCnt;col++)
+   {
+      data_[col].clear();
+      ends_[col].clear();
+   }
+   rows_ = 0;
+   transactions_ = 0;
+}
+
+void nistColumnBatch::putNumber(unsigned col, unsigned value)
+{
+   std::vector<unsigned char>& data = data_[col];
+   size_t size = column_info[col].type_;
+   data.resize(data.size() + size);
+   unsigned char* p = &data[data.size() - size];
+   switch(size)
+   {
+      case 1: *p = (unsigned char)value; break;
+      case 2: {unsigned short v = (unsigned short)value; memcpy(p,&v,2);} break;
+      default: memcpy(p,&value,4);
+   }
+}
+
+void nistColumnBatch::putString(unsigned col, const char* data, size_t size)
+{
+   data_[col].insert(data_[col].end(),data,data + size);
+   ends_[col].push_back(data_[col].size());
+}
+
+void nistColumnBatch::addRecord(const nistRecord& rec, unsigned rec_no, unsigned idc)
+{
+   nistImageInfo info;
+   nistGetImageInfo(rec,info);
+   putNumber(nistColType,rec.type());
+   putNumber(nistColRec,rec_no);
+   putNumber(nistColIdc,idc);
+   putNumber(nistColImp,info.imp_);
+   putNumber(nistColFgp,info.fgp_);
+   putNumber(nistColHll,info.hll_);
+   putNumber(nistColVll,info.vll_);
+   putNumber(nistColSlc,info.slc_);
+   putNumber(nistColHps,info.hps_);
+   putNumber(nistColVps,info.vps_);
+   putNumber(nistColBpx,info.bpx_);
+   putString(nistColCga,info.cga_);
+   putString(nistColDate,*info.date_);
+   putString(nistColImt,*info.imt_);
+   putNumber(nistColImageSize,rec.getImgDataSize());
+}
+
+void nistColumnBatch::add(const nistParser& parser)
+{
+   const type1Record* header = parser.getFileHeader();
+   unsigned first_row = rows_;
+   putNumber(nistColType,1);
+   putNumber(nistColRec,0);
+   putNumber(nistColIdc,0);
+   for(unsigned col=nistColImp;col<nistColumnsCnt;col++)
+   {
+      if(column_info[col].type_==nistColumnString)
+      {
+         putString(col,"",0);
+      }
+      else
+      {
+         putNumber(col,0);
+      }
+   }
+   rows_++;
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      unsigned type = rec->type();
+      if(type==4 || type==10 || type==13 || type==14 || type==15)
+      {
+         addRecord(*rec,rec_no + 1,header->getRecordIDC(rec_no));
+         rows_++;
+      }
+   }
+   //Поля транзакции одинаковы во всех ее строках
+   for(unsigned row=first_row;row<rows_;row++)
+   {
+      putNumber(nistColTxn,transactions_);
+      putString(nistColTot,header->getTOT());
+      putString(nistColOri,header->getORI());
+      putString(nistColDai,header->getDAI());
+      putString(nistColTcn,header->getTCN());
+      putString(nistColDat,header->getDAT());
+   }
+   transactions_++;
+}
+
+nistColumnWriter::nistColumnWriter()
+   :out_(0),transactions_(0),rows_(0)
+{
+}
+
+nistColumnWriter::~nistColumnWriter()
+{
+   close();
+}
+
+bool nistColumnWriter::open(const std::string& file_name)
+{
+   close();
+   out_ = fopen(file_name.c_str(),"wb");
+   if(!out_)
+   {
+      dbg0("nistColumnWriter::open can't create %s\n",file_name.c_str());
+      return false;
+   }
+   transactions_ = 0;
+   rows_ = 0;
+   std::vector<unsigned char> header(file_magic,file_magic + sizeof(file_magic));
+   unsigned words[2] = {byte_order_mark,nistColumnsCnt};
+   header.insert(header.end(),(const unsigned char*)words,(const unsigned char*)words + sizeof(words));
+   for(unsigned col=0;col<nistColumnsCnt;col++)
+   {
+      size_t len = strlen(column_info[col].name_);
+      header.push_back(column_info[col].type_);
+      header.push_back((unsigned char)len);
+      header.insert(header.end(),column_info[col].name_,column_info[col].name_ + len);
+   }
+   header.resize(header.size() + padding(header.size()));
+   return fwrite(&header[0],1,header.size(),out_)==header.size();
+}
+
+bool nistColumnWriter::putSection(const void* data, size_t size)
+{
+   static const unsigned char zeros[8] = {0};
+   unsigned long long section = size;
+   return fwrite(&section,sizeof(section),1,out_)==1 &&
+          (!size || fwrite(data,1,size,out_)==size) &&
+          fwrite(zeros,1,padding(size),out_)==padding(size);
+}
+
+bool nistColumnWriter::append(nistColumnBatch& batch)
+{
+   if(!batch.rows_)
+   {
+      return true;
+   }
+   std::lock_guard<std::mutex> lock(mutex_);
+   if(!out_)
+   {
+      return false;
+   }
+   //Номера транзакций пакета становятся номерами в файле
+   unsigned* txn = (unsigned*)&batch.data_[nistColTxn][0];
+   for(unsigned row=0;row<batch.rows_;row++)
+   {
+      txn[row] += transactions_;
+   }
+   bool res = fwrite(group_magic,1,sizeof(group_magic),out_)==sizeof(group_magic) &&
+              fwrite(&batch.rows_,sizeof(batch.rows_),1,out_)==1;
+   for(unsigned col=0;res && col<nistColumnsCnt;col++)
+   {
+      const std::vector<unsigned char>& data = batch.data_[col];
+      if(column_info[col].type_==nistColumnString)
+      {
+         const std::vector<unsigned>& ends = batch.ends_[col];
+         res = putSection(&ends[0],ends.size()*sizeof(unsigned));
+      }
+      res = res && putSection(data.empty() ? 0 : &data[0],data.size());
+   }
+   if(!res)
+   {
+      dbg0("nistColumnWriter::append write error\n");
+      return false;
+   }
+   transactions_ += batch.transactions_;
+   rows_ += batch.rows_;
+   batch.clear();
+   return true;
+}
+
+bool nistColumnWriter::close()
+{
+   std::lock_guard<std::mutex> lock(mutex_);
+   if(!out_)
+   {
+      return true;
+   }
+   bool res = fclose(out_)==0;
+   out_ = 0;
+   return res;
+}
+
+nistColumnReader::nistColumnReader()
+   :map_(0),size_(0)
+{
+}
+
+nistColumnReader::~nistColumnReader()
+{
+   close();
+}
+
+void nistColumnReader::close()
+{
+#ifndef WIN32
+   if(map_ && content_.empty())
+   {
+      munmap((void*)map_,size_);
+   }
+#endif
+   map_ = 0;
+   size_ = 0;
+   content_.clear();
+   groups_.clear();
+}
+
+const nistColumnInfo* nistColumnReader::columns()
+{
+   return column_info;
+}
+
+int nistColumnReader::findColumn(const std::string& name)
+{
+   for(unsigned col=0;col<nistColumnsCnt;col++)
+   {
+      if(name==column_info[col].name_)
+      {
+         return col;
+      }
+   }
+   return -1;
+}
+
+/*!Читает секцию по смещению pos: размер, данные и выравнивание.
+   Возвращает начало данных или 0, если секция выходит за конец файла
+*/
+static const unsigned char* takeSection(const unsigned char* map, size_t map_size, size_t& pos, unsigned long long& size)
+{
+   if(map_size - pos<sizeof(size))
+   {
+      return 0;
+   }
+   memcpy(&size,map + pos,sizeof(size));
+   pos += sizeof(size);
+   if(size>map_size - pos)
+   {
+      return 0;
+   }
+   const unsigned char* data = map + pos;
+   pos += size;
+   pos += padding(size);
+   return pos<=map_size ? data : 0;
+}
+
+bool nistColumnReader::open(const std::string& file_name)
+{
+   close();
+#ifndef WIN32
+   int fd = ::open(file_name.c_str(),O_RDONLY);
+   struct stat st;
+   if(fd<0 || fstat(fd,&st)!=0)
+   {
+      if(fd>=0)
+      {
+         ::close(fd);
+      }
+      dbg0("nistColumnReader::open can't open %s\n",file_name.c_str());
+      return false;
+   }
+   size_ = st.st_size;
+   void* map = size_ ? mmap(0,size_,PROT_READ,MAP_SHARED,fd,0) : MAP_FAILED;
+   ::close(fd);
+   if(map==MAP_FAILED)
+   {
+      dbg0("nistColumnReader::open can't map %s\n",file_name.c_str());
+      size_ = 0;
+      return false;
+   }
+   map_ = (const unsigned char*)map;
+#else
+   if(!nistParser::readFile(file_name,content_) || content_.empty())
+   {
+      return false;
+   }
+   map_ = &content_[0];
+   size_ = content_.size();
+#endif
+
+   size_t pos = sizeof(file_magic);
+   unsigned words[2];
+   if(size_<pos + sizeof(words) || memcmp(map_,file_magic,sizeof(file_magic)))
+   {
+      dbg0("nistColumnReader::open %s is not a column file\n",file_name.c_str());
+      close();
+      return false;
+   }
+   memcpy(words,map_ + pos,sizeof(words));
+   pos += sizeof(words);
+   if(words[0]!=byte_order_mark || words[1]!=nistColumnsCnt)
+   {
+      dbg0("nistColumnReader::open %s byte order or columns mismatch\n",file_name.c_str());
+      close();
+      return false;
+   }
+   for(unsigned col=0;col<nistColumnsCnt;col++)
+   {
+      if(size_ - pos<2 || map_[pos]!=column_info[col].type_ || size_ - pos - 2<map_[pos + 1] ||
+         memcmp(map_ + pos + 2,column_info[col].name_,map_[pos + 1]) || column_info[col].name_[map_[pos + 1]])
+      {
+         dbg0("nistColumnReader::open %s column %u mismatch\n",file_name.c_str(),col);
+         close();
+         return false;
+      }
+      pos += 2 + map_[pos + 1];
+   }
+   pos += padding(pos);
+
+   //Недописанная последняя группа отбрасывается
+   while(size_ - pos>=sizeof(group_magic) + sizeof(unsigned) && !memcmp(map_ + pos,group_magic,sizeof(group_magic)))
+   {
+      group grp;
+      memcpy(&grp.rows_,map_ + pos + sizeof(group_magic),sizeof(grp.rows_));
+      size_t group_pos = pos + sizeof(group_magic) + sizeof(grp.rows_);
+      bool ok = true;
+      for(unsigned col=0;ok && col<nistColumnsCnt;col++)
+      {
+         unsigned long long size = 0;
+         grp.strings_[col] = 0;
+         if(column_info[col].type_==nistColumnString)
+         {
+            grp.data_[col] = takeSection(map_,size_,group_pos,size);
+            ok = grp.data_[col] && size==(unsigned long long)grp.rows_*sizeof(unsigned);
+            grp.strings_[col] = ok ? takeSection(map_,size_,group_pos,size) : 0;
+            ok = ok && grp.strings_[col] && (!grp.rows_ || ((const unsigned*)grp.data_[col])[grp.rows_ - 1]<=size);
+         }
+         else
+         {
+            grp.data_[col] = takeSection(map_,size_,group_pos,size);
+            ok = grp.data_[col] && size==(unsigned long long)grp.rows_*column_info[col].type_;
+         }
+      }
+      if(!ok)
+      {
+         dbg0("nistColumnReader::open %s incomplete group at %u\n",file_name.c_str(),(unsigned)pos);
+         break;
+      }
+      groups_.push_back(grp);
+      pos = group_pos;
+   }
+   return true;
+}
+
+const void* nistColumnReader::column(unsigned group, unsigned col, nistColumnType type) const
+{
+   if(group>=groups_.size() || col>=nistColumnsCnt || column_info[col].type_!=type)
+   {
+      return 0;
+   }
+   return groups_[group].data_[col];
+}
+
+const unsigned char* nistColumnReader::u8(unsigned group, unsigned col) const
+{
+   return (const unsigned char*)column(group,col,nistColumnU8);
+}
+
+const unsigned short* nistColumnReader::u16(unsigned group, unsigned col) const
+{
+   return (const unsigned short*)column(group,col,nistColumnU16);
+}
+
+const unsigned* nistColumnReader::u32(unsigned group, unsigned col) const
+{
+   return (const unsigned*)column(group,col,nistColumnU32);
+}
+
+const char* nistColumnReader::str(unsigned group, unsigned col, unsigned row, unsigned& size) const
+{
+   const unsigned* ends = (const unsigned*)column(group,col,nistColumnString);
+   if(!ends || row>=groups_[group].rows_)
+   {
+      size = 0;
+      return 0;
+   }
+   unsigned begin = row ? ends[row - 1] : 0;
+   size = ends[row]>=begin ? ends[row] - begin : 0;
+   return (const char*)groups_[group].strings_[col] + begin;
+}
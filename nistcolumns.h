@@ -0,0 +1,165 @@
+/*
+  \file   nistcolumns.h
+  \brief  Колоночная выгрузка метаданных записей для статистики по большим массивам транзакций
+
+  Формат файла (порядок байт - как у записавшей машины, проверяется по маркеру в заголовке):
+     заголовок:  "NISTCOL1", u32 маркер 0x01020304, u32 число колонок,
+                 для каждой колонки u8 тип (nistColumnType), u8 длина имени, имя;
+                 дополняется нулями до границы 8 байт
+     группы строк, по одной на каждый nistColumnWriter::append:
+                 "NCRG", u32 число строк, затем для каждой колонки секции данных:
+                 числовая колонка - u64 размер, значения;
+                 строковая колонка - u64 размер, u32 смещения конца строк (по одному на строку),
+                                     u64 размер, байты строк подряд;
+                 каждая секция дополняется нулями до границы 8 байт
+  Групп может быть сколько угодно, файл читается последовательным проходом, поэтому дописанный
+  до сбоя файл остается читаемым до последней полной группы. Секции выровнены, и читатель
+  использует их прямо из отображенного в память файла.
+
+  Строки таблицы: на каждую транзакцию строка Type-1 (type = 1, поля изображения пустые) и по строке
+  на каждую запись Type-4/10/13/14/15. Поля Type-1 повторяются в строках записей, чтобы группировать
+  записи по ORI/TOT без соединения таблиц.
+*/
+
+#ifndef NIST_COLUMNS_H
+#define NIST_COLUMNS_H
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+
+///! Тип колонки; для числовых значение равно размеру элемента в байтах
+enum nistColumnType
+{
+   nistColumnU8 = 1,
+   nistColumnU16 = 2,
+   nistColumnU32 = 4,
+   nistColumnString = 0x10
+};
+
+///! Колонки в порядке хранения
+enum nistColumn
+{
+   nistColTxn,         ///<u32 Номер транзакции в файле
+   nistColType,        ///<u8  Тип записи
+   nistColRec,         ///<u16 Номер записи в транзакции (0 - Type-1)
+   nistColIdc,         ///<u8  IDC из CNT
+   nistColTot,         ///<1.004 TOT
+   nistColOri,         ///<1.008 ORI
+   nistColDai,         ///<1.007 DAI
+   nistColTcn,         ///<1.009 TCN
+   nistColDat,         ///<1.005 DAT
+   nistColImp,         ///<u8  IMP
+   nistColFgp,         ///<u8  FGP/PLP
+   nistColHll,         ///<u32 HLL
+   nistColVll,         ///<u32 VLL
+   nistColSlc,         ///<u8  SLC
+   nistColHps,         ///<u32 HPS, для Type-4 - ISR
+   nistColVps,         ///<u32 VPS
+   nistColBpx,         ///<u8  BPX
+   nistColCga,         ///<CGA, для Type-4 - код десятичным числом
+   nistColDate,        ///<Дата съемки: PHD, LCD, TCD, PCD
+   nistColImt,         ///<10.003 IMT
+   nistColImageSize,   ///<u32 Размер данных изображения
+   nistColumnsCnt
+};
+
+struct nistColumnInfo
+{
+   const char* name_;
+   nistColumnType type_;
+};
+
+///! Строки одной группы, собираются в рабочем потоке без блокировок
+class nistColumnBatch
+{
+public:
+   nistColumnBatch();
+   //!Добавляет строки транзакции
+   void add(const nistParser& parser);
+   unsigned rows() const{return rows_;}
+   unsigned transactions() const{return transactions_;}
+   //!Очищает пакет, буферы сохраняют емкость
+   void clear();
+private:
+   friend class nistColumnWriter;
+   void putNumber(unsigned col, unsigned value);
+   void putString(unsigned col, const char* data, size_t size);
+   void putString(unsigned col, const std::string& str){putString(col,str.data(),str.size());}
+   void addRecord(const nistRecord& rec, unsigned rec_no, unsigned idc);
+
+   //!Значения числовых колонок или байты строковых
+   std::vector<unsigned char> data_[nistColumnsCnt];
+   //!Смещения конца строк для строковых колонок
+   std::vector<unsigned> ends_[nistColumnsCnt];
+   unsigned rows_;
+   unsigned transactions_;
+};
+
+/*! Запись колоночного файла. append() можно вызывать из нескольких потоков: пакет пишется
+    группой строк целиком под mutex, номера транзакций назначаются в порядке записи групп
+*/
+class nistColumnWriter
+{
+public:
+   nistColumnWriter();
+   ~nistColumnWriter();
+   //!Создает файл и пишет заголовок
+   bool open(const std::string& file_name);
+   //!Пишет пакет группой строк и очищает его. Пустой пакет пропускается
+   bool append(nistColumnBatch& batch);
+   bool close();
+   unsigned long long rows() const{return rows_;}
+private:
+   nistColumnWriter(const nistColumnWriter&);
+   nistColumnWriter& operator=(const nistColumnWriter&);
+   bool putSection(const void* data, size_t size);
+
+   FILE* out_;
+   std::mutex mutex_;
+   unsigned transactions_;
+   unsigned long long rows_;
+};
+
+///! Чтение колоночного файла через отображение в память, данные колонок не копируются
+class nistColumnReader
+{
+public:
+   nistColumnReader();
+   ~nistColumnReader();
+   bool open(const std::string& file_name);
+   void close();
+   unsigned groups() const{return groups_.size();}
+   unsigned rows(unsigned group) const{return groups_[group].rows_;}
+   //!Значения числовой колонки группы; тип должен совпадать с типом колонки, иначе 0
+   const unsigned char* u8(unsigned group, unsigned col) const;
+   const unsigned short* u16(unsigned group, unsigned col) const;
+   const unsigned* u32(unsigned group, unsigned col) const;
+   //!Строка row строковой колонки, size - ее длина. Строка не завершается нулем
+   const char* str(unsigned group, unsigned col, unsigned row, unsigned& size) const;
+   //!Описание колонок и поиск колонки по имени, -1 если нет
+   static const nistColumnInfo* columns();
+   static int findColumn(const std::string& name);
+private:
+   nistColumnReader(const nistColumnReader&);
+   nistColumnReader& operator=(const nistColumnReader&);
+   const void* column(unsigned group, unsigned col, nistColumnType type) const;
+
+   struct group
+   {
+      unsigned rows_;
+      //!Начало данных колонки; для строковых - массив смещений, байты в strings_
+      const unsigned char* data_[nistColumnsCnt];
+      const unsigned char* strings_[nistColumnsCnt];
+   };
+   std::vector<group> groups_;
+   const unsigned char* map_;
+   size_t size_;
+   //!Содержимое файла, если отображение в память недоступно
+   std::vector<unsigned char> content_;
+};
+
+#endif // NIST_COLUMNS_H
@@ -0,0 +1,116 @@
+/*
+  \file   nistcopy.cpp
+  \brief  Копирование данных исходного файла транзакции средствами ядра
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <cstdio>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=27))
+#define NIST_COPY_FILE_RANGE
+#endif
+#endif
+
+#include "nistcopy.h"
+
+int nistOpenSource(const std::string& file, const nistParser& parser, const unsigned char*& base)
+{
+   //Смещение данных тега отсчитывается от начала буфера, по первому тегу Type-1 находится начало буфера
+   const nistTag* first = parser.getFileHeader()->getTag(0);
+   base = first && first->data() ? first->data() - first->offset_ : 0;
+#ifdef __linux__
+   if(file.empty() || !base || parser.isModified())
+   {
+      return -1;
+   }
+   int fd = ::open(file.c_str(),O_RDONLY);
+   struct stat st;
+   if(fd>=0 && fstat(fd,&st)==0)
+   {
+      unsigned long long end = parser.getFileHeader()->recordSize();
+      for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+      {
+         const nistRecord* rec = parser.getRecord(rec_no);
+         unsigned long long rec_end = (unsigned long long)rec->offset_ + rec->recordSize();
+         end = rec_end>end ? rec_end : end;
+      }
+      if((unsigned long long)st.st_size>=end)
+      {
+         return fd;
+      }
+   }
+   if(fd>=0)
+   {
+      ::close(fd);
+   }
+   dbg0("nistOpenSource: %s does not match the loaded transaction, writing from memory\n",file.c_str());
+#else
+   (void)file;
+#endif
+   return -1;
+}
+
+void nistCloseSource(int fd)
+{
+#ifndef WIN32
+   if(fd>=0)
+   {
+      ::close(fd);
+   }
+#else
+   (void)fd;
+#endif
+}
+
+unsigned long long nistKernelCopy(int source_fd, unsigned long long offset, int out_fd, unsigned long long size)
+{
+   unsigned long long done = 0;
+#ifdef __linux__
+   if(source_fd<0 || out_fd<0)
+   {
+      return 0;
+   }
+#ifdef NIST_COPY_FILE_RANGE
+   loff_t range_offset = offset;
+   while(done<size)
+   {
+      ssize_t copied = copy_file_range(source_fd,&range_offset,out_fd,0,size - done,0);
+      if(copied<=0)
+      {
+         break;
+      }
+      done += copied;
+   }
+#endif
+   //copy_file_range недоступен (старое ядро, разные файловые системы) - sendfile с того же места
+   off_t send_offset = offset + done;
+   while(done<size)
+   {
+      ssize_t copied = sendfile(out_fd,source_fd,&send_offset,size - done);
+      if(copied<=0)
+      {
+         break;
+      }
+      done += copied;
+   }
+#else
+   (void)source_fd;
+   (void)offset;
+   (void)out_fd;
+   (void)size;
+#endif
+   return done;
+}
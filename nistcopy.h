@@ -0,0 +1,30 @@
+/*
+  \file   nistcopy.h
+  \brief  Копирование данных исходного файла транзакции средствами ядра
+
+  Внутренний модуль выгрузки изображений, слияния и правки транзакций. Данные тегов загруженной транзакции
+  лежат в буфере парсера по тем же смещениям, что и в исходном файле, поэтому их можно копировать
+  из файла в файл без чтения в память процесса: copy_file_range (glibc 2.27), затем sendfile.
+  Вне Linux ядро не используется, вызывающий пишет данные из буфера.
+*/
+
+#ifndef NIST_COPY_H
+#define NIST_COPY_H
+
+#include <string>
+
+#include "nistparser.h"
+
+/*!Открывает исходный файл транзакции для копирования ядром и возвращает его дескриптор или -1.
+   base - начало буфера парсера, смещение данных в файле равно data - base. Файл должен содержать загруженную
+   транзакцию целиком; после редактирования (isModified) записи не соответствуют файлу
+*/
+int nistOpenSource(const std::string& file, const nistParser& parser, const unsigned char*& base);
+//!Закрывает дескриптор nistOpenSource, -1 пропускается
+void nistCloseSource(int fd);
+/*!Копирует ядром до size байт файла source_fd с offset в текущую позицию дескриптора out_fd.
+   Возвращает число скопированных байт, остаток вызывающий пишет сам. Позиция source_fd не меняется
+*/
+unsigned long long nistKernelCopy(int source_fd, unsigned long long offset, int out_fd, unsigned long long size);
+
+#endif // NIST_COPY_H
@@ -0,0 +1,639 @@
+/*
+  \file   nistdedup.cpp
+  \brief  Хеш содержимого изображений и хранилище изображений с адресацией по содержимому
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#else
+#include <direct.h>
+#endif
+
+#include "nistdedup.h"
+
+static const unsigned long long prime1 = 0x9E3779B185EBCA87ull;
+static const unsigned long long prime2 = 0xC2B2AE3D27D4EB4Full;
+static const unsigned long long prime3 = 0x165667B19E3779F9ull;
+static const unsigned long long prime4 = 0x85EBCA77C2B2AE63ull;
+static const unsigned long long prime5 = 0x27D4EB2F165667C5ull;
+
+static const char ref_magic[8] = {'N','I','S','T','R','E','F','1'};
+static const size_t ref_header_size = 24;
+static const size_t ref_entry_size = 32;
+
+static inline unsigned long long rotl(unsigned long long value, int bits)
+{
+   return (value<<bits) | (value>>(64 - bits));
+}
+
+//!Чтение little-endian независимо от выравнивания и порядка байт машины
+static inline unsigned long long read64(const unsigned char* p)
+{
+   unsigned long long value;
+   memcpy(&value,p,sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+   value = __builtin_bswap64(value);
+#endif
+   return value;
+}
+
+static inline unsigned read32(const unsigned char* p)
+{
+   return p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned)p[3]<<24);
+}
+
+static inline unsigned long long mixRound(unsigned long long acc, unsigned long long input)
+{
+   acc += input*prime2;
+   acc = rotl(acc,31);
+   return acc*prime1;
+}
+
+static inline unsigned long long mergeRound(unsigned long long acc, unsigned long long value)
+{
+   acc ^= mixRound(0,value);
+   return acc*prime1 + prime4;
+}
+
+static inline unsigned long long avalanche(unsigned long long h)
+{
+   h ^= h>>33;
+   h *= prime2;
+   h ^= h>>29;
+   h *= prime3;
+   h ^= h>>32;
+   return h;
+}
+
+//!Добавляет к h хвост короче 32 байт
+static unsigned long long finish(unsigned long long h, const unsigned char* p, const unsigned char* end)
+{
+   for(;p + 8<=end;p+=8)
+   {
+      h ^= mixRound(0,read64(p));
+      h = rotl(h,27)*prime1 + prime4;
+   }
+   if(p + 4<=end)
+   {
+      h ^= read32(p)*prime1;
+      h = rotl(h,23)*prime2 + prime3;
+      p += 4;
+   }
+   for(;p<end;p++)
+   {
+      h ^= (*p)*prime5;
+      h = rotl(h,11)*prime1;
+   }
+   return avalanche(h);
+}
+
+nistImageHash nistHashImage(const unsigned char* data, size_t size)
+{
+   const unsigned char* p = data;
+   const unsigned char* end = data + size;
+   unsigned long long lo;
+   unsigned long long hi;
+   if(size>=32)
+   {
+      unsigned long long v1 = prime1 + prime2;
+      unsigned long long v2 = prime2;
+      unsigned long long v3 = 0;
+      unsigned long long v4 = 0 - prime1;
+      //Потоки не зависят друг от друга, цепочки умножений идут параллельно
+      for(const unsigned char* last = end - 32;p<=last;p+=32)
+      {
+         v1 = mixRound(v1,read64(p));
+         v2 = mixRound(v2,read64(p + 8));
+         v3 = mixRound(v3,read64(p + 16));
+         v4 = mixRound(v4,read64(p + 24));
+      }
+      lo = rotl(v1,1) + rotl(v2,7) + rotl(v3,12) + rotl(v4,18);
+      lo = mergeRound(lo,v1);
+      lo = mergeRound(lo,v2);
+      lo = mergeRound(lo,v3);
+      lo = mergeRound(lo,v4);
+      //Вторая свертка: другие сдвиги и обратный порядок
+      hi = rotl(v1,18) + rotl(v2,12) + rotl(v3,7) + rotl(v4,1) + prime3;
+      hi = mergeRound(hi,v4);
+      hi = mergeRound(hi,v3);
+      hi = mergeRound(hi,v2);
+      hi = mergeRound(hi,v1);
+   }
+   else
+   {
+      lo = prime5;
+      hi = prime3;
+   }
+   lo += size;
+   hi += size*prime4;
+   nistImageHash res;
+   res.lo_ = finish(lo,p,end);
+   res.hi_ = finish(hi,p,end);
+   return res;
+}
+
+std::string nistImageHash::hex() const
+{
+   char buf[33];
+   snprintf(buf,sizeof(buf),"%016llx%016llx",hi_,lo_);
+   return buf;
+}
+
+static void put32(unsigned char* p, unsigned value)
+{
+   for(int no=0;no<4;no++)
+   {
+      p[no] = (unsigned char)(value>>(8*no));
+   }
+}
+
+static void put64(unsigned char* p, unsigned long long value)
+{
+   for(int no=0;no<8;no++)
+   {
+      p[no] = (unsigned char)(value>>(8*no));
+   }
+}
+
+static bool makeDir(const std::string& path)
+{
+#ifdef WIN32
+   return _mkdir(path.c_str())==0 || errno==EEXIST;
+#else
+   return mkdir(path.c_str(),0755)==0 || errno==EEXIST;
+#endif
+}
+
+static bool writeFile(const std::string& path, const unsigned char* data, size_t size)
+{
+   FILE* out = fopen(path.c_str(),"wb");
+   bool res = out && (size==0 || fwrite(data,1,size,out)==size);
+   if(out && fclose(out)!=0)
+   {
+      res = false;
+   }
+   return res;
+}
+
+//!Имя временного файла рядом с path, уникальное для потока
+static std::string tempPath(const std::string& path)
+{
+   static std::atomic<unsigned> counter(0);
+   char suffix[64];
+#ifdef WIN32
+   snprintf(suffix,sizeof(suffix),".tmp.%u",counter++);
+#else
+   snprintf(suffix,sizeof(suffix),".tmp.%d.%u",(int)getpid(),counter++);
+#endif
+   return path + suffix;
+}
+
+//!Имя транзакции - имя файла без каталогов
+static bool validName(const std::string& name)
+{
+   return !name.empty() && name[0]!='.' && name.find('/')==std::string::npos && name.find('\\')==std::string::npos;
+}
+
+static std::string baseName(const std::string& path)
+{
+   size_t pos = path.find_last_of("/\\");
+   return pos==std::string::npos ? path : path.substr(pos + 1);
+}
+
+nistImageStore::nistImageStore(const std::string& root, unsigned threads)
+   :root_(root),threads_(threads),min_size_(256)
+{
+   if(!threads_)
+   {
+      threads_ = std::thread::hardware_concurrency();
+   }
+   if(!threads_)
+   {
+      threads_ = 1;
+   }
+   if(!root_.empty() && root_[root_.size() - 1]!='/')
+   {
+      root_ += '/';
+   }
+   memset(&stats_,0,sizeof(stats_));
+}
+
+void nistImageStore::setError(const std::string& msg)
+{
+   std::lock_guard<std::mutex> lock(mutex_);
+   dbg0("nistImageStore: %s\n",msg.c_str());
+   err_msg_ = msg;
+}
+
+std::string nistImageStore::objectPath(const nistImageHash& hash) const
+{
+   std::string hex = hash.hex();
+   return root_ + "objects/" + hex.substr(0,2) + "/" + hex.substr(2);
+}
+
+std::string nistImageStore::transactionPath(const std::string& name) const
+{
+   return root_ + "transactions/" + name;
+}
+
+bool nistImageStore::open()
+{
+   if(!makeDir(root_) || !makeDir(root_ + "objects") || !makeDir(root_ + "transactions"))
+   {
+      setError("can't create store directories in " + root_);
+      return false;
+   }
+   static const char digits[] = "0123456789abcdef";
+   for(int hi=0;hi<16;hi++)
+   {
+      for(int lo=0;lo<16;lo++)
+      {
+         char sub[3] = {digits[hi],digits[lo],0};
+         if(!makeDir(root_ + "objects/" + sub))
+         {
+            setError("can't create store directories in " + root_);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+bool nistImageStore::hashImages(const nistParser& parser, const unsigned char* base, size_t size, std::vector<nistPayloadRef>& refs) const
+{
+   refs.clear();
+   if(parser.isModified())
+   {
+      return false;
+   }
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      const unsigned char* data = rec->getImgData();
+      unsigned data_size = rec->getImgDataSize();
+      //Изображение должно лежать в буфере транзакции, иначе его нечем заменить при восстановлении
+      if(!data || data_size<min_size_ || data<base || data>base + size || data_size>(size_t)(base + size - data))
+      {
+         continue;
+      }
+      nistPayloadRef ref;
+      ref.offset_ = data - base;
+      ref.size_ = data_size;
+      refs.push_back(ref);
+   }
+   std::sort(refs.begin(),refs.end(),[](const nistPayloadRef& a, const nistPayloadRef& b){return a.offset_<b.offset_;});
+   size_t cnt = 0;
+   for(size_t no=0;no<refs.size();no++)
+   {
+      if(cnt && refs[cnt - 1].offset_ + refs[cnt - 1].size_>refs[no].offset_)
+      {
+         continue;
+      }
+      refs[cnt] = refs[no];
+      refs[cnt].hash_ = nistHashImage(base + refs[cnt].offset_,refs[cnt].size_);
+      cnt++;
+   }
+   refs.resize(cnt);
+   return true;
+}
+
+//!Совпадает ли файл path побайтно с data; файл читается частями
+static bool sameContent(const std::string& path, const unsigned char* data, size_t size)
+{
+   FILE* in = fopen(path.c_str(),"rb");
+   if(!in)
+   {
+      return false;
+   }
+   unsigned char chunk[64*1024];
+   size_t pos = 0;
+   bool res = true;
+   while(res)
+   {
+      size_t got = fread(chunk,1,sizeof(chunk),in);
+      if(!got)
+      {
+         break;
+      }
+      res = got<=size - pos && !memcmp(chunk,data + pos,got);
+      pos += got;
+   }
+   fclose(in);
+   return res && pos==size;
+}
+
+nistImageStore::payloadState nistImageStore::storePayload(const unsigned char* data, const nistPayloadRef& ref)
+{
+   std::string path = objectPath(ref.hash_);
+   struct stat st;
+   if(stat(path.c_str(),&st)!=0)
+   {
+      //Файл появляется под своим именем только целиком
+      std::string tmp = tempPath(path);
+      bool res = writeFile(tmp,data,ref.size_);
+#ifdef WIN32
+      res = res && rename(tmp.c_str(),path.c_str())==0;
+#else
+      //link не заменяет файл, записанный тем временем другим потоком или процессом
+      bool exists = false;
+      if(res && link(tmp.c_str(),path.c_str())!=0)
+      {
+         exists = errno==EEXIST;
+         res = false;
+      }
+#endif
+      remove(tmp.c_str());
+      if(res)
+      {
+         return payloadStored;
+      }
+#ifndef WIN32
+      if(!exists)
+#endif
+      {
+         setError("can't write " + path);
+         return payloadError;
+      }
+   }
+   //Хеш совпал: изображение заменяется ссылкой, только если данные совпадают побайтно
+   if(!sameContent(path,data,ref.size_))
+   {
+      dbg0("nistImageStore: hash collision with %s, image is kept in the transaction\n",path.c_str());
+      return payloadCollision;
+   }
+   return payloadExists;
+}
+
+bool nistImageStore::storePayloads(const unsigned char* base, std::vector<nistPayloadRef>& refs, unsigned& unique, unsigned long long& written)
+{
+   size_t cnt = 0;
+   for(size_t no=0;no<refs.size();no++)
+   {
+      switch(storePayload(base + refs[no].offset_,refs[no]))
+      {
+         case payloadError:
+            return false;
+         case payloadCollision:
+            //Изображение остается в байтах транзакции
+            continue;
+         case payloadStored:
+            unique++;
+            written += refs[no].size_;
+            break;
+         case payloadExists:
+            break;
+      }
+      refs[cnt++] = refs[no];
+   }
+   refs.resize(cnt);
+   return true;
+}
+
+bool nistImageStore::writeRefs(const std::string& name, const unsigned char* base, size_t size, const std::vector<nistPayloadRef>& refs, unsigned long long& written)
+{
+   std::vector<unsigned char> out(ref_header_size + refs.size()*ref_entry_size);
+   memcpy(&out[0],ref_magic,sizeof(ref_magic));
+   put32(&out[8],(unsigned)refs.size());
+   put32(&out[12],0);
+   put64(&out[16],size);
+   unsigned long long pos = 0;
+   for(size_t no=0;no<refs.size();no++)
+   {
+      unsigned char* entry = &out[ref_header_size + no*ref_entry_size];
+      put64(entry,refs[no].offset_);
+      put32(entry + 8,refs[no].size_);
+      put32(entry + 12,0);
+      put64(entry + 16,refs[no].hash_.lo_);
+      put64(entry + 24,refs[no].hash_.hi_);
+      out.insert(out.end(),base + pos,base + refs[no].offset_);
+      pos = refs[no].offset_ + refs[no].size_;
+   }
+   out.insert(out.end(),base + pos,base + size);
+
+   std::string path = transactionPath(name);
+   std::string tmp = tempPath(path);
+   bool res = writeFile(tmp,&out[0],out.size());
+#ifdef WIN32
+   remove(path.c_str());
+#endif
+   res = res && rename(tmp.c_str(),path.c_str())==0;
+   if(!res)
+   {
+      remove(tmp.c_str());
+      setError("can't write " + path);
+      return false;
+   }
+   written += out.size();
+   return true;
+}
+
+bool nistImageStore::put(const nistParser& parser, const unsigned char* base, size_t size, const std::string& name)
+{
+   if(!validName(name))
+   {
+      setError("invalid transaction name " + name);
+      return false;
+   }
+   std::vector<nistPayloadRef> refs;
+   if(!hashImages(parser,base,size,refs))
+   {
+      setError("transaction " + name + " was modified after load");
+      return false;
+   }
+   unsigned unique = 0;
+   unsigned long long written = 0;
+   if(!storePayloads(base,refs,unique,written) || !writeRefs(name,base,size,refs,written))
+   {
+      return false;
+   }
+   std::lock_guard<std::mutex> lock(mutex_);
+   stats_.transactions_++;
+   stats_.images_ += refs.size();
+   stats_.unique_ += unique;
+   stats_.bytes_in_ += size;
+   for(size_t no=0;no<refs.size();no++)
+   {
+      stats_.image_bytes_ += refs[no].size_;
+   }
+   stats_.bytes_written_ += written;
+   return true;
+}
+
+bool nistImageStore::putFile(const std::string& transaction, const std::string& name)
+{
+   std::vector<unsigned char> data;
+   nistParser parser;
+   if(!nistParser::readFile(transaction,data) || !parser.load(data.data(),data.size()))
+   {
+      setError("can't load " + transaction);
+      return false;
+   }
+   return put(parser,data.data(),data.size(),name.empty() ? baseName(transaction) : name);
+}
+
+bool nistImageStore::putFiles(const std::vector<std::string>& transactions)
+{
+   std::atomic<size_t> next(0);
+   std::atomic<bool> res(true);
+   auto worker = [&]()
+   {
+      //Парсер и буфер потока используются повторно для всех его файлов
+      nistParser parser;
+      std::vector<unsigned char> data;
+      for(size_t no=next++;no<transactions.size();no=next++)
+      {
+         if(!nistParser::readFile(transactions[no],data) || !parser.load(data.data(),data.size()))
+         {
+            setError("can't load " + transactions[no]);
+            res = false;
+            continue;
+         }
+         if(!put(parser,data.data(),data.size(),baseName(transactions[no])))
+         {
+            res = false;
+         }
+      }
+   };
+   std::vector<std::thread> workers;
+   unsigned cnt = transactions.size()<threads_ ? (unsigned)transactions.size() : threads_;
+   for(unsigned no=1;no<cnt;no++)
+   {
+      workers.push_back(std::thread(worker));
+   }
+   worker();
+   for(unsigned no=0;no<workers.size();no++)
+   {
+      workers[no].join();
+   }
+   return res;
+}
+
+//!Читает файл изображения точно в size байт dest
+static bool readPayload(const std::string& path, unsigned char* dest, size_t size)
+{
+   FILE* in = fopen(path.c_str(),"rb");
+   if(!in)
+   {
+      return false;
+   }
+   bool res = fread(dest,1,size,in)==size && fgetc(in)==EOF;
+   fclose(in);
+   return res;
+}
+
+static unsigned long long get64(const unsigned char* p)
+{
+   unsigned long long value = 0;
+   for(int no=7;no>=0;no--)
+   {
+      value = (value<<8) | p[no];
+   }
+   return value;
+}
+
+bool nistImageStore::get(const std::string& name, std::vector<unsigned char>& data)
+{
+   std::vector<unsigned char> refs_data;
+   if(!validName(name) || !nistParser::readFile(transactionPath(name),refs_data))
+   {
+      setError("can't read transaction " + name);
+      return false;
+   }
+   const unsigned char* p = refs_data.data();
+   if(refs_data.size()<ref_header_size || memcmp(p,ref_magic,sizeof(ref_magic)))
+   {
+      setError("bad transaction file " + name);
+      return false;
+   }
+   unsigned long long cnt = read32(p + 8);
+   unsigned long long size = get64(p + 16);
+   if(cnt>(refs_data.size() - ref_header_size)/ref_entry_size)
+   {
+      setError("bad transaction file " + name);
+      return false;
+   }
+   const unsigned char* rest = p + ref_header_size + cnt*ref_entry_size;
+   const unsigned char* rest_end = p + refs_data.size();
+   //Ссылки упорядочены, не перекрываются и вместе с остатком дают ровно size байт
+   unsigned long long pos = 0;
+   unsigned long long images = 0;
+   for(unsigned long long no=0;no<cnt;no++)
+   {
+      const unsigned char* entry = p + ref_header_size + no*ref_entry_size;
+      unsigned long long offset = get64(entry);
+      unsigned long long ref_size = read32(entry + 8);
+      if(offset<pos || offset>size || ref_size>size - offset)
+      {
+         setError("bad transaction file " + name);
+         return false;
+      }
+      pos = offset + ref_size;
+      images += ref_size;
+   }
+   if(size - images!=(unsigned long long)(rest_end - rest))
+   {
+      setError("bad transaction file " + name);
+      return false;
+   }
+
+   data.resize(size);
+   pos = 0;
+   for(unsigned long long no=0;no<cnt;no++)
+   {
+      const unsigned char* entry = p + ref_header_size + no*ref_entry_size;
+      nistPayloadRef ref;
+      ref.offset_ = get64(entry);
+      ref.size_ = read32(entry + 8);
+      ref.hash_.lo_ = get64(entry + 16);
+      ref.hash_.hi_ = get64(entry + 24);
+      size_t gap = ref.offset_ - pos;
+      if(gap)
+      {
+         memcpy(&data[pos],rest,gap);
+      }
+      rest += gap;
+      std::string path = objectPath(ref.hash_);
+      if(ref.size_ && (!readPayload(path,&data[ref.offset_],ref.size_) || nistHashImage(&data[ref.offset_],ref.size_)!=ref.hash_))
+      {
+         setError("missing or damaged image " + path);
+         return false;
+      }
+      pos = ref.offset_ + ref.size_;
+   }
+   if(rest<rest_end)
+   {
+      memcpy(&data[pos],rest,rest_end - rest);
+   }
+   return true;
+}
+
+bool nistImageStore::load(const std::string& name, nistParser& parser)
+{
+   std::vector<unsigned char> data;
+   if(!get(name,data))
+   {
+      return false;
+   }
+   if(!parser.loadSwap(data))
+   {
+      setError("can't load restored transaction " + name);
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,133 @@
+/*
+  \file   nistdedup.h
+  \brief  Хеш содержимого изображений и хранилище изображений с адресацией по содержимому
+
+  Повторные передачи одного субъекта обычно содержат побайтно одинаковые изображения (Type-4, Type-14 и т.п.).
+  Хранилище записывает каждое уникальное изображение один раз, а транзакцию - как ее байты без изображений
+  и ссылки на них. Каталог хранилища:
+     objects/<2 hex>/<30 hex>   данные изображения, имя - 128-битный хеш; файл не перезаписывается
+     transactions/<имя>         транзакция со ссылками
+  Файл транзакции со ссылками, числа little-endian:
+     char magic[8]  "NISTREF1"
+     u32 число ссылок, u32 0
+     u64 размер исходной транзакции
+     ссылки по возрастанию смещения: u64 смещение в исходной транзакции, u32 размер, u32 0, u64 hash lo, u64 hash hi
+     байты исходной транзакции без изображений, на которые есть ссылки
+  Восстановленная транзакция совпадает с исходной побайтно: ее байты можно записать в файл как есть
+  или загрузить обычным nistParser.
+*/
+
+#ifndef NIST_DEDUP_H
+#define NIST_DEDUP_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+
+///! 128-битный хеш содержимого
+struct nistImageHash
+{
+   unsigned long long lo_;
+   unsigned long long hi_;
+   bool operator==(const nistImageHash& other) const{return lo_==other.lo_ && hi_==other.hi_;}
+   bool operator!=(const nistImageHash& other) const{return !(*this==other);}
+   bool operator<(const nistImageHash& other) const{return hi_<other.hi_ || (hi_==other.hi_ && lo_<other.lo_);}
+   //!32 шестнадцатеричные цифры, hi_ затем lo_
+   std::string hex() const;
+};
+
+/*! Быстрый некриптографический хеш. Данные обрабатываются блоками по 32 байта в четырех независимых
+    64-битных потоках, поэтому умножения разных потоков выполняются процессором параллельно; 128 бит
+    результата получаются двумя разными свертками состояния. Значение не зависит от порядка байт машины
+*/
+nistImageHash nistHashImage(const unsigned char* data, size_t size);
+
+///! Изображение транзакции, вынесенное в хранилище
+struct nistPayloadRef
+{
+   //!Смещение и размер данных изображения в исходной транзакции
+   unsigned long long offset_;
+   unsigned size_;
+   nistImageHash hash_;
+};
+
+///! Счетчики хранилища с момента создания объекта
+struct nistStoreStats
+{
+   unsigned transactions_;
+   //!Изображения, вынесенные в ссылки
+   unsigned images_;
+   //!Изображения, записанные в хранилище впервые
+   unsigned unique_;
+   //!Размер исходных транзакций
+   unsigned long long bytes_in_;
+   //!Размер вынесенных изображений
+   unsigned long long image_bytes_;
+   //!Записано данных изображений и транзакций со ссылками
+   unsigned long long bytes_written_;
+};
+
+/*! Хранилище изображений с адресацией по содержимому. put* разбирают транзакции, хешируют данные
+    изображений (getImgData()) и записывают транзакцию со ссылками; изображение, которое уже есть
+    в хранилище, не записывается. putFiles загружает и хеширует транзакции в нескольких потоках, у каждого
+    потока свой парсер и буфер. Хеш некриптографический, поэтому при совпадении хеша данные сравниваются
+    с уже записанными побайтно; при коллизии изображение остается в транзакции.
+*/
+class nistImageStore
+{
+public:
+   //!threads == 0 - по числу процессоров
+   nistImageStore(const std::string& root, unsigned threads = 0);
+   //!Создает каталоги хранилища, если их нет
+   bool open();
+   //!Изображения меньше min_size остаются в транзакции
+   void setMinSize(unsigned min_size){min_size_ = min_size;}
+   /*! Изображения транзакции по возрастанию смещения. base и size - буфер, из которого загружен parser;
+       изображения вне буфера и перекрывающиеся пропускаются. Измененная транзакция (isModified) не
+       соответствует буферу, для нее false
+   */
+   bool hashImages(const nistParser& parser, const unsigned char* base, size_t size, std::vector<nistPayloadRef>& refs) const;
+   //!Сохраняет транзакцию, загруженную из base/size, под именем name (имя файла без каталогов)
+   bool put(const nistParser& parser, const unsigned char* base, size_t size, const std::string& name);
+   //!Сохраняет файл транзакции под именем name, по умолчанию - под именем файла
+   bool putFile(const std::string& transaction, const std::string& name = std::string());
+   //!Сохраняет файлы транзакций параллельно под их именами файлов; false, если хотя бы один не сохранен
+   bool putFiles(const std::vector<std::string>& transactions);
+   //!Восстанавливает байты транзакции; данные изображений сверяются с их хешем
+   bool get(const std::string& name, std::vector<unsigned char>& data);
+   //!Восстанавливает транзакцию и загружает ее в parser без копирования буфера
+   bool load(const std::string& name, nistParser& parser);
+   const nistStoreStats& stats() const{return stats_;}
+   const std::string& getError() const{return err_msg_;}
+private:
+   nistImageStore(const nistImageStore&);
+   nistImageStore& operator=(const nistImageStore&);
+   enum payloadState
+   {
+      payloadStored,      ///<Записано впервые
+      payloadExists,      ///<Уже есть в хранилище, данные совпадают побайтно
+      payloadCollision,   ///<Под тем же хешем лежат другие данные
+      payloadError
+   };
+   /*! Сохраняет данные изображений, которых еще нет в хранилище. Ссылки на изображения, хеш которых
+       совпал с хешем других данных, удаляются из refs - такие изображения остаются в транзакции
+   */
+   bool storePayloads(const unsigned char* base, std::vector<nistPayloadRef>& refs, unsigned& unique, unsigned long long& written);
+   payloadState storePayload(const unsigned char* data, const nistPayloadRef& ref);
+   bool writeRefs(const std::string& name, const unsigned char* base, size_t size, const std::vector<nistPayloadRef>& refs, unsigned long long& written);
+   void setError(const std::string& msg);
+   std::string objectPath(const nistImageHash& hash) const;
+   std::string transactionPath(const std::string& name) const;
+
+   std::string root_;
+   unsigned threads_;
+   unsigned min_size_;
+   //!Защищает stats_ и err_msg_
+   std::mutex mutex_;
+   nistStoreStats stats_;
+   std::string err_msg_;
+};
+
+#endif // NIST_DEDUP_H
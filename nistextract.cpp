@@ -0,0 +1,314 @@
+/*
+  \file   nistextract.cpp
+  \brief  Параллельная выгрузка изображений записей ANSI-NIST транзакций в файлы
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <thread>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "nistcopy.h"
+#include "nistextract.h"
+
+nistImageFormat nistDetectImageFormat(const std::string& cga, const unsigned char* data, size_t size)
+{
+   static const unsigned char jp2[] = {0x00,0x00,0x00,0x0C,0x6A,0x50,0x20,0x20,0x0D,0x0A,0x87,0x0A};
+   static const unsigned char png[] = {0x89,'P','N','G',0x0D,0x0A,0x1A,0x0A};
+   if(size>=4 && data[0]==0xFF && data[1]==0xA0 && data[2]==0xFF && data[3]==0xA8)
+   {
+      return nistImageWsq;
+   }
+   if(size>=3 && data[0]==0xFF && data[1]==0xD8 && data[2]==0xFF)
+   {
+      return nistImageJpeg;
+   }
+   if(size>=sizeof(jp2) && !memcmp(data,jp2,sizeof(jp2)))
+   {
+      return nistImageJp2;
+   }
+   if(size>=4 && data[0]==0xFF && data[1]==0x4F && data[2]==0xFF && data[3]==0x51)
+   {
+      return nistImageJ2k;
+   }
+   if(size>=sizeof(png) && !memcmp(data,png,sizeof(png)))
+   {
+      return nistImagePng;
+   }
+   //Сигнатура не распознана, формат по CGA
+   if(cga.compare(0,3,"WSQ")==0 || cga=="1")
+   {
+      return nistImageWsq;
+   }
+   if(cga=="JPEGB" || cga=="JPEGL" || cga=="2" || cga=="3")
+   {
+      return nistImageJpeg;
+   }
+   if(cga=="JP2" || cga=="JP2L" || cga=="4" || cga=="5")
+   {
+      return nistImageJp2;
+   }
+   if(cga=="PNG" || cga=="6")
+   {
+      return nistImagePng;
+   }
+   return nistImageRaw;
+}
+
+const char* nistImageExtension(nistImageFormat format)
+{
+   switch(format)
+   {
+      case nistImageWsq: return "wsq";
+      case nistImageJpeg: return "jpg";
+      case nistImageJp2: return "jp2";
+      case nistImageJ2k: return "j2k";
+      case nistImagePng: return "png";
+      default: return "raw";
+   }
+}
+
+//!Запись с изображением: Type-4, 7, 8 и текстовые записи изображений
+static bool isImageRecord(unsigned type)
+{
+   return (type>=4 && type<=8 && type!=5 && type!=6) || type==10 || (type>=13 && type<=17) || type==19 || type==20;
+}
+
+//!CGA записи: числовой код Type-4 или значение поля N.011 текстовых записей
+static std::string recordCGA(const nistRecord& rec)
+{
+   if(rec.type()==4)
+   {
+      char code[4];
+      snprintf(code,sizeof(code),"%u",static_cast<const type4Record&>(rec).getCGA());
+      return code;
+   }
+   const nistTag* tag = rec.type()>=10 ? rec.getTagById(11) : 0;
+   if(tag && tag->data())
+   {
+      return std::string((const char*)tag->data(),tag->data_size());
+   }
+   return std::string();
+}
+
+//!Символы TCN, допустимые в имени файла; остальные заменяются на '_'
+static std::string fileNamePart(const std::string& str)
+{
+   std::string res = str.empty() ? "notcn" : str;
+   for(size_t pos=0;pos<res.size();pos++)
+   {
+      char c = res[pos];
+      if(!((c>='0' && c<='9') || (c>='A' && c<='Z') || (c>='a' && c<='z') || c=='-' || c=='.'))
+      {
+         res[pos] = '_';
+      }
+   }
+   return res;
+}
+
+nistImageExtractor::nistImageExtractor(const std::string& out_dir, unsigned threads)
+   :out_dir_(out_dir),threads_(threads)
+{
+   if(!threads_)
+   {
+      threads_ = std::thread::hardware_concurrency();
+   }
+   if(!threads_)
+   {
+      threads_ = 1;
+   }
+   if(!out_dir_.empty() && out_dir_[out_dir_.size() - 1]!='/')
+   {
+      out_dir_ += '/';
+   }
+}
+
+unsigned nistImageExtractor::threads(size_t jobs) const
+{
+   return jobs<threads_ ? (unsigned)jobs : threads_;
+}
+
+std::string nistImageExtractor::reserveName(const std::string& name, unsigned rec_no)
+{
+   std::lock_guard<std::mutex> lock(names_mutex_);
+   if(names_.insert(name).second)
+   {
+      return name;
+   }
+   char suffix[32];
+   snprintf(suffix,sizeof(suffix),"_%u",rec_no + 1);
+   std::string res = name + suffix;
+   for(unsigned no=2;!names_.insert(res).second;no++)
+   {
+      snprintf(suffix,sizeof(suffix),"_%u_%u",rec_no + 1,no);
+      res = name + suffix;
+   }
+   return res;
+}
+
+void nistImageExtractor::plan(const nistParser& parser, std::vector<nistImageFile>& files)
+{
+   const type1Record* header = parser.getFileHeader();
+   std::string tcn = fileNamePart(header->getTCN());
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      unsigned type = rec->type();
+      if(!isImageRecord(type) || !rec->getImgData() || !rec->getImgDataSize())
+      {
+         continue;
+      }
+      nistImageFile file;
+      file.rec_no_ = rec_no;
+      file.type_ = type;
+      file.idc_ = header->getRecordIDC(rec_no);
+      //Позиция пальца/ладони есть только у записей отпечатков
+      bool has_fgp = type==4 || type==13 || type==14 || type==15 || type==19;
+      file.fgp_ = has_fgp ? static_cast<const type4Record*>(rec)->getFGP() : 0;
+      file.data_ = rec->getImgData();
+      file.size_ = rec->getImgDataSize();
+      file.format_ = nistDetectImageFormat(recordCGA(*rec),file.data_,file.size_);
+      file.ok_ = false;
+
+      char suffix[64];
+      snprintf(suffix,sizeof(suffix),"_%02u_%02u",file.idc_,file.fgp_);
+      std::string name = reserveName(tcn + suffix,rec_no);
+      file.path_ = out_dir_ + name + "." + nistImageExtension(file.format_);
+      files.push_back(file);
+   }
+}
+
+bool nistImageExtractor::writeImage(const nistImageFile& file, int source_fd, const unsigned char* base)
+{
+#ifdef WIN32
+   FILE* out = fopen(file.path_.c_str(),"wb");
+   bool res = out && fwrite(file.data_,1,file.size_,out)==file.size_;
+   if(out && fclose(out)!=0)
+   {
+      res = false;
+   }
+#else
+   int out = ::open(file.path_.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+   if(out<0)
+   {
+      dbg0("nistImageExtractor::writeImage can't create %s\n",file.path_.c_str());
+      return false;
+   }
+   size_t done = base ? nistKernelCopy(source_fd,file.data_ - base,out,file.size_) : 0;
+   while(done<file.size_)
+   {
+      ssize_t written = ::write(out,file.data_ + done,file.size_ - done);
+      if(written<=0)
+      {
+         break;
+      }
+      done += written;
+   }
+   bool res = ::close(out)==0 && done==file.size_;
+#endif
+   if(!res)
+   {
+      dbg0("nistImageExtractor::writeImage write error %s\n",file.path_.c_str());
+   }
+   return res;
+}
+
+bool nistImageExtractor::extract(const nistParser& parser, std::vector<nistImageFile>& files, const std::string& source_file)
+{
+   size_t first = files.size();
+   plan(parser,files);
+   const unsigned char* base = 0;
+   int source_fd = nistOpenSource(source_file,parser,base);
+
+   std::atomic<size_t> next(first);
+   std::atomic<bool> res(true);
+   auto worker = [&]()
+   {
+      for(size_t no=next++;no<files.size();no=next++)
+      {
+         files[no].ok_ = writeImage(files[no],source_fd,base);
+         if(!files[no].ok_)
+         {
+            res = false;
+         }
+      }
+   };
+   std::vector<std::thread> workers;
+   unsigned cnt = threads(files.size() - first);
+   for(unsigned no=1;no<cnt;no++)
+   {
+      workers.push_back(std::thread(worker));
+   }
+   worker();
+   for(unsigned no=0;no<workers.size();no++)
+   {
+      workers[no].join();
+   }
+   nistCloseSource(source_fd);
+   return res;
+}
+
+bool nistImageExtractor::extractFiles(const std::vector<std::string>& transactions, std::vector<nistImageFile>& files)
+{
+   std::vector<std::vector<nistImageFile> > results(transactions.size());
+   std::atomic<size_t> next(0);
+   std::atomic<bool> res(true);
+   auto worker = [&]()
+   {
+      //Парсер потока используется повторно для всех его файлов
+      nistParser parser;
+      for(size_t no=next++;no<transactions.size();no=next++)
+      {
+         if(!parser.load(transactions[no]))
+         {
+            dbg0("nistImageExtractor::extractFiles can't load %s\n",transactions[no].c_str());
+            res = false;
+            continue;
+         }
+         std::vector<nistImageFile>& result = results[no];
+         plan(parser,result);
+         const unsigned char* base = 0;
+         int source_fd = nistOpenSource(transactions[no],parser,base);
+         for(size_t file_no=0;file_no<result.size();file_no++)
+         {
+            result[file_no].ok_ = writeImage(result[file_no],source_fd,base);
+            if(!result[file_no].ok_)
+            {
+               res = false;
+            }
+            //Буфер парсера будет занят следующим файлом
+            result[file_no].data_ = 0;
+         }
+         nistCloseSource(source_fd);
+      }
+   };
+   std::vector<std::thread> workers;
+   unsigned cnt = threads(transactions.size());
+   for(unsigned no=1;no<cnt;no++)
+   {
+      workers.push_back(std::thread(worker));
+   }
+   worker();
+   for(unsigned no=0;no<workers.size();no++)
+   {
+      workers[no].join();
+   }
+   for(size_t no=0;no<results.size();no++)
+   {
+      files.insert(files.end(),results[no].begin(),results[no].end());
+   }
+   return res;
+}
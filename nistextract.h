@@ -0,0 +1,89 @@
+/*
+  \file   nistextract.h
+  \brief  Параллельная выгрузка изображений записей ANSI-NIST транзакций в файлы
+*/
+
+#ifndef NIST_EXTRACT_H
+#define NIST_EXTRACT_H
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+
+///! Формат данных изображения, определяет расширение файла
+enum nistImageFormat
+{
+   nistImageRaw,    ///<Несжатое или неизвестное
+   nistImageWsq,
+   nistImageJpeg,   ///<JPEG и JPEG-LS
+   nistImageJp2,    ///<JPEG 2000 в контейнере JP2
+   nistImageJ2k,    ///<Поток JPEG 2000 без контейнера
+   nistImagePng
+};
+
+/*! Определяет формат по сигнатуре данных, а если она не распознана - по CGA:
+    текстовому (WSQ20, JPEGB, JPEGL, JP2, JP2L, PNG, NONE) или числовому коду Type-4
+*/
+nistImageFormat nistDetectImageFormat(const std::string& cga, const unsigned char* data, size_t size);
+//!Расширение файла без точки
+const char* nistImageExtension(nistImageFormat format);
+
+///! Изображение записи и файл, в который оно выгружается
+struct nistImageFile
+{
+   //!Номер записи в транзакции (без Type-1)
+   unsigned rec_no_;
+   unsigned type_;
+   unsigned idc_;
+   unsigned fgp_;
+   nistImageFormat format_;
+   //!Данные в буфере парсера; после extractFiles - 0, буфер уже занят другими файлами
+   const unsigned char* data_;
+   unsigned size_;
+   std::string path_;
+   bool ok_;
+};
+
+/*! Выгрузка изображений в каталог. Имя файла - <TCN>_<IDC>_<FGP>.<расширение>; при совпадении имен
+    добавляется _<номер записи>, а если имя все еще занято - _<n>. Имена уникальны для всех транзакций,
+    выгруженных одним объектом, поэтому транзакции пакета с одинаковым или пустым TCN не затирают файлы
+    друг друга; при параллельной выгрузке пакета суффикс получает та транзакция, которая выгружена позже.
+    Файлы пишутся несколькими потоками.
+    Если известен исходный файл транзакции, данные копируются из него средствами ядра
+    (copy_file_range, затем sendfile), не проходя через память процесса; иначе и при ошибке
+    копирования они пишутся из буфера парсера.
+*/
+class nistImageExtractor
+{
+public:
+   //!threads == 0 - по числу процессоров
+   nistImageExtractor(const std::string& out_dir, unsigned threads = 0);
+   //!Составляет список изображений транзакции и имена файлов, ничего не записывая. Имена резервируются за объектом
+   void plan(const nistParser& parser, std::vector<nistImageFile>& files);
+   /*! Записывает все изображения транзакции параллельно и дописывает их в files.
+       source_file - файл, из которого загружен parser, если он загружался из файла
+   */
+   bool extract(const nistParser& parser, std::vector<nistImageFile>& files, const std::string& source_file = std::string());
+   /*! Выгружает изображения пакета транзакций: каждый поток разбирает свой файл своим парсером
+       и копирует изображения из исходного файла. Результаты дописываются в files в порядке transactions.
+       Возвращает false, если хотя бы один файл не загрузился или не записался
+   */
+   bool extractFiles(const std::vector<std::string>& transactions, std::vector<nistImageFile>& files);
+private:
+   //!Записывает файл изображения из исходного файла source_fd (-1 - из памяти); base - начало буфера транзакции
+   static bool writeImage(const nistImageFile& file, int source_fd, const unsigned char* base);
+   unsigned threads(size_t jobs) const;
+   //!Резервирует name или name с суффиксом, если оно уже выдано; rec_no - номер записи для первого суффикса
+   std::string reserveName(const std::string& name, unsigned rec_no);
+
+   std::string out_dir_;
+   unsigned threads_;
+   //!Имена файлов, выданные этим объектом; защищено names_mutex_
+   std::set<std::string> names_;
+   std::mutex names_mutex_;
+};
+
+#endif // NIST_EXTRACT_H
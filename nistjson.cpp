@@ -0,0 +1,376 @@
+/*
+  \file   nistjson.cpp
+  \brief  Потоковая выгрузка разобранной ANSI-NIST транзакции в JSON
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define NIST_JSON_SSE2
+#endif
+
+#include "nistjson.h"
+#include "nistbase64.h"
+
+//!Размер буфера вывода
+static const size_t json_buffer_size = 64*1024;
+//!Размер порции данных изображения при кодировании base64, кратен 3
+static const size_t base64_chunk = 3*1024;
+
+/*!Возвращает первый байт в [p,end), который нельзя вывести в строку JSON без проверки:
+   управляющий символ (включая разделители US/RS/GS/FS), кавычку, обратную косую черту или байт >= 0x80.
+   Текст Type-2 почти не содержит таких символов, поэтому проверка идет по 16 байт за раз
+*/
+static const unsigned char* findEscape(const unsigned char* p, const unsigned char* end)
+{
+#ifdef NIST_JSON_SSE2
+   const __m128i quote = _mm_set1_epi8('"');
+   const __m128i backslash = _mm_set1_epi8('\\');
+   const __m128i ctrl = _mm_set1_epi8(0x1F);
+   while(end - p >= 16)
+   {
+      __m128i v = _mm_loadu_si128((const __m128i*)p);
+      //max(v, 0x1F) == 0x1F - беззнаковое сравнение v <= 0x1F
+      __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v,quote),_mm_cmpeq_epi8(v,backslash)),
+                                     _mm_cmpeq_epi8(_mm_max_epu8(v,ctrl),ctrl));
+      //Старший бит байта >= 0x80 попадает в маску напрямую
+      int mask = _mm_movemask_epi8(_mm_or_si128(special,v));
+      if(mask)
+      {
+         return p + __builtin_ctz(mask);
+      }
+      p += 16;
+   }
+#endif
+   for(;p<end;p++)
+   {
+      if(*p<0x20 || *p=='"' || *p=='\\' || *p>=0x80)
+      {
+         break;
+      }
+   }
+   return p;
+}
+
+nistJsonWriter::nistJsonWriter(FILE* out)
+{
+   out_ = out;
+   buffer_ = (char*)malloc(json_buffer_size);
+   pos_ = 0;
+   ok_ = out_ && buffer_;
+   image_mode_ = nistJsonImageBase64;
+}
+
+nistJsonWriter::~nistJsonWriter()
+{
+   flush();
+   free(buffer_);
+}
+
+void nistJsonWriter::setImageMode(nistJsonImageMode mode, const std::string& sidecar_prefix)
+{
+   image_mode_ = mode;
+   sidecar_prefix_ = sidecar_prefix;
+}
+
+bool nistJsonWriter::flush()
+{
+   if(ok_ && pos_)
+   {
+      ok_ = fwrite(buffer_,1,pos_,out_)==pos_;
+   }
+   pos_ = 0;
+   return ok_;
+}
+
+void nistJsonWriter::put(const char* data, size_t size)
+{
+   if(!ok_)
+   {
+      return;
+   }
+   if(pos_ + size > json_buffer_size)
+   {
+      flush();
+      if(size > json_buffer_size)
+      {
+         ok_ = ok_ && fwrite(data,1,size,out_)==size;
+         return;
+      }
+   }
+   memcpy(buffer_ + pos_,data,size);
+   pos_ += size;
+}
+
+void nistJsonWriter::put(const char* str)
+{
+   put(str,strlen(str));
+}
+
+void nistJsonWriter::put(char c)
+{
+   if(pos_==json_buffer_size)
+   {
+      flush();
+   }
+   if(ok_)
+   {
+      buffer_[pos_++] = c;
+   }
+}
+
+void nistJsonWriter::putUInt(unsigned long long value)
+{
+   char buf[24];
+   int len = snprintf(buf,sizeof(buf),"%llu",value);
+   put(buf,len);
+}
+
+void nistJsonWriter::putString(const unsigned char* data, size_t size)
+{
+   put('"');
+   const unsigned char* p = data;
+   const unsigned char* end = data + size;
+   while(p<end)
+   {
+      const unsigned char* stop = findEscape(p,end);
+      put((const char*)p,stop - p);
+      if(stop==end)
+      {
+         break;
+      }
+      switch(*stop)
+      {
+         case '"':
+            put("\\\"",2);
+            break;
+         case '\\':
+            put("\\\\",2);
+            break;
+         case '\n':
+            put("\\n",2);
+            break;
+         case '\r':
+            put("\\r",2);
+            break;
+         case '\t':
+            put("\\t",2);
+            break;
+         default:
+            if(*stop>=0x80)
+            {
+               //Правильный UTF-8 выводится как есть, остальные байты - символами Latin-1
+               size_t len = nistUtf8Length(stop,end);
+               if(len)
+               {
+                  put((const char*)stop,len);
+                  p = stop + len;
+                  continue;
+               }
+            }
+            {
+               char buf[8];
+               snprintf(buf,sizeof(buf),"\\u%04x",*stop);
+               put(buf,6);
+            }
+            break;
+      }
+      p = stop + 1;
+   }
+   put('"');
+}
+
+void nistJsonWriter::putValue(const unsigned char* data, size_t size)
+{
+   //У пустого тега может не быть данных
+   if(!size)
+   {
+      put("\"\"",2);
+      return;
+   }
+   if(!memchr(data,nistParser::RS(),size) && !memchr(data,nistParser::US(),size))
+   {
+      putString(data,size);
+      return;
+   }
+   //Подполя разделены RS, элементы внутри подполя - US
+   const unsigned char* end = data + size;
+   const unsigned char* subfield = data;
+   put('[');
+   while(true)
+   {
+      const unsigned char* subfield_end = (const unsigned char*)memchr(subfield,nistParser::RS(),end - subfield);
+      if(!subfield_end)
+      {
+         subfield_end = end;
+      }
+      put('[');
+      const unsigned char* item = subfield;
+      while(true)
+      {
+         const unsigned char* item_end = (const unsigned char*)memchr(item,nistParser::US(),subfield_end - item);
+         if(!item_end)
+         {
+            item_end = subfield_end;
+         }
+         putString(item,item_end - item);
+         if(item_end==subfield_end)
+         {
+            break;
+         }
+         put(',');
+         item = item_end + 1;
+      }
+      put(']');
+      if(subfield_end==end)
+      {
+         break;
+      }
+      put(',');
+      subfield = subfield_end + 1;
+   }
+   put(']');
+}
+
+void nistJsonWriter::putBase64(const unsigned char* data, size_t size)
+{
+   char block[base64_chunk/3*4];
+   put('"');
+   while(size)
+   {
+      size_t chunk = size<base64_chunk ? size : base64_chunk;
+      put(block,nistBase64Encode(data,chunk,block));
+      data += chunk;
+      size -= chunk;
+   }
+   put('"');
+}
+
+void nistJsonWriter::putImage(const unsigned char* data, size_t size, unsigned rec_no, unsigned type)
+{
+   put("{\"size\":");
+   putUInt(size);
+   switch(image_mode_)
+   {
+      case nistJsonImageBase64:
+         put(",\"base64\":");
+         putBase64(data,size);
+         break;
+      case nistJsonImageSidecar:
+         {
+            std::string path = sidecar_prefix_ + std::to_string(rec_no) + "_" + std::to_string(type) + ".bin";
+            FILE* out = fopen(path.c_str(),"wb");
+            if(!out || (size && fwrite(data,1,size,out)!=size))
+            {
+               dbg0("nistJsonWriter::putImage error can't write %s\n",path.c_str());
+               ok_ = false;
+            }
+            if(out)
+            {
+               fclose(out);
+            }
+            put(",\"path\":");
+            putString((const unsigned char*)path.data(),path.size());
+         }
+         break;
+      case nistJsonImageNone:
+         break;
+   }
+   put('}');
+}
+
+bool nistJsonWriter::writeRecord(const nistRecord& rec, unsigned rec_no)
+{
+   put("{\"type\":");
+   putUInt(rec.type());
+   put(",\"offset\":");
+   putUInt(rec.offset_);
+   put(",\"size\":");
+   putUInt(rec.record_size_);
+   if(rec.type()==4 || rec.type()==7 || rec.type()==8)
+   {
+      const type4Record& bin = static_cast<const type4Record&>(rec);
+      put(",\"idc\":");
+      putUInt(bin.getIDC());
+      put(",\"imp\":");
+      putUInt(bin.getIMP());
+      put(",\"fgp\":");
+      putUInt(bin.getFGP());
+      put(",\"isr\":");
+      putUInt(bin.getISR());
+      put(",\"hll\":");
+      putUInt(bin.getHLL());
+      put(",\"vll\":");
+      putUInt(bin.getVLL());
+      put(",\"cga\":");
+      putUInt(bin.getCGA());
+      put(",\"image\":");
+      putImage(rec.getImgData(),rec.getImgDataSize(),rec_no,rec.type());
+   }
+   else
+   {
+      put(",\"fields\":[");
+      for(unsigned tag_no=0;tag_no<rec.tagsCnt();tag_no++)
+      {
+         const nistTag* tag = rec.getTag(tag_no);
+         if(tag_no)
+         {
+            put(',');
+         }
+         put("{\"tag\":");
+         putUInt(tag->tag_no());
+         if(tag->tag_no()==999)
+         {
+            put(",\"image\":");
+            putImage(tag->data(),tag->data_size(),rec_no,rec.type());
+         }
+         else
+         {
+            put(",\"value\":");
+            putValue(tag->data(),tag->data_size());
+         }
+         put('}');
+      }
+      put(']');
+   }
+   put('}');
+   return ok_;
+}
+
+bool nistJsonWriter::write(const nistParser& parser)
+{
+   put("{\"records\":[");
+   writeRecord(*parser.getFileHeader(),0);
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      put(',');
+      writeRecord(*parser.getRecord(rec_no),rec_no + 1);
+   }
+   put("]}\n");
+   return flush();
+}
+
+bool nistJsonWriter::writeFile(const nistParser& parser, const std::string& file_name, nistJsonImageMode mode, const std::string& sidecar_prefix)
+{
+   FILE* out = fopen(file_name.c_str(),"wb");
+   if(!out)
+   {
+      dbg0("nistJsonWriter::writeFile error can't open %s\n",file_name.c_str());
+      return false;
+   }
+   bool res = false;
+   {
+      nistJsonWriter writer(out);
+      writer.setImageMode(mode,sidecar_prefix);
+      res = writer.write(parser);
+   }
+   return fclose(out)==0 && res;
+}
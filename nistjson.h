@@ -0,0 +1,72 @@
+/*
+  \file   nistjson.h
+  \brief  Потоковая выгрузка разобранной ANSI-NIST транзакции в JSON
+*/
+
+#ifndef NIST_JSON_H
+#define NIST_JSON_H
+
+#include <cstdio>
+#include <string>
+
+#include "nistparser.h"
+
+///! Способ вывода данных изображений (тег N.999 и данные бинарных записей)
+enum nistJsonImageMode
+{
+   nistJsonImageBase64,    ///<Строка base64 в самом JSON, кодируется по частям
+   nistJsonImageSidecar,   ///<Отдельный файл рядом с JSON, в JSON выводится путь к нему
+   nistJsonImageNone       ///<Выводится только размер
+};
+
+/*! Потоковый сериализатор транзакции в JSON. Объектная модель не строится, текст пишется по полям через
+    буфер постоянного размера, поэтому расход памяти не зависит от размера транзакции.
+
+    Формат:
+    {"records":[{"type":1,"offset":0,"fields":[{"tag":1,"value":"123"}, ...]}, ...]}
+    Значение поля без разделителей выводится строкой, иначе массивом подполей, каждое подполе - массивом элементов.
+    Для бинарных записей Type-4/7/8 вместо "fields" выводятся поля заголовка.
+    Изображение выводится объектом {"size":N,"base64":"..."} или {"size":N,"path":"..."}.
+*/
+class nistJsonWriter
+{
+public:
+   nistJsonWriter(FILE* out);
+   ~nistJsonWriter();
+   /*!sidecar_prefix - начало имени файлов изображений в режиме nistJsonImageSidecar, 
+      к нему добавляется <номер записи>_<тип>.<расширение>
+   */
+   void setImageMode(nistJsonImageMode mode, const std::string& sidecar_prefix = std::string());
+   //!Выводит транзакцию целиком. Возвращает false при ошибке записи
+   bool write(const nistParser& parser);
+   //!Выводит запись как JSON-объект; rec_no используется в именах файлов изображений
+   bool writeRecord(const nistRecord& rec, unsigned rec_no);
+   //!Сбрасывает буфер в файл
+   bool flush();
+
+   //!Записывает транзакцию в файл file_name
+   static bool writeFile(const nistParser& parser, const std::string& file_name,
+                         nistJsonImageMode mode = nistJsonImageBase64, const std::string& sidecar_prefix = std::string());
+private:
+   nistJsonWriter(const nistJsonWriter&);
+   nistJsonWriter& operator=(const nistJsonWriter&);
+   void put(const char* data, size_t size);
+   void put(const char* str);
+   void put(char c);
+   void putUInt(unsigned long long value);
+   //!Выводит байты строкой JSON с экранированием
+   void putString(const unsigned char* data, size_t size);
+   //!Выводит значение поля: строкой или массивом подполей/элементов
+   void putValue(const unsigned char* data, size_t size);
+   void putImage(const unsigned char* data, size_t size, unsigned rec_no, unsigned type);
+   void putBase64(const unsigned char* data, size_t size);
+
+   FILE* out_;
+   char* buffer_;
+   size_t pos_;
+   bool ok_;
+   nistJsonImageMode image_mode_;
+   std::string sidecar_prefix_;
+};
+
+#endif // NIST_JSON_H
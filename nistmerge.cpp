@@ -0,0 +1,475 @@
+/*
+  \file   nistmerge.cpp
+  \brief  Объединение и разделение ANSI-NIST транзакций без перекодирования записей
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "nistcopy.h"
+#include "nistmerge.h"
+
+//!Диапазоны меньше этого пишутся через буфер потока, копирование ядром не окупает сброс буфера
+static const unsigned long long kernel_copy_min = 16*1024;
+
+//!Поле собираемой записи: номер и данные без идентификатора и разделителя
+struct mergeField
+{
+   unsigned tag_;
+   const unsigned char* data_;
+   unsigned size_;
+};
+
+//!Поля записи, кроме LEN и 999, в порядке записи
+static void recordFields(const nistRecord& rec, std::vector<mergeField>& fields)
+{
+   fields.clear();
+   for(unsigned tag_no=0;tag_no<rec.tagsCnt();tag_no++)
+   {
+      const nistTag* tag = rec.getTag(tag_no);
+      if(tag->tag_no()!=1 && tag->tag_no()!=999)
+      {
+         mergeField field = {tag->tag_no(),tag->data(),tag->data_size()};
+         fields.push_back(field);
+      }
+   }
+}
+
+//!Заменяет поле tag или вставляет его по порядку номеров
+static void setField(std::vector<mergeField>& fields, unsigned tag, const unsigned char* data, unsigned size)
+{
+   mergeField field = {tag,data,size};
+   for(size_t no=0;no<fields.size();no++)
+   {
+      if(fields[no].tag_==tag)
+      {
+         fields[no] = field;
+         return;
+      }
+      if(fields[no].tag_>tag)
+      {
+         fields.insert(fields.begin() + no,field);
+         return;
+      }
+   }
+   fields.push_back(field);
+}
+
+/*!Собирает текстовую запись type из полей в out. Если image != 0, запись продолжается полем 999:
+   в out пишется только его идентификатор, данные изображения (image_size байт) и замыкающий FS
+   дописываются вызывающим. LEN учитывает изображение и собственные цифры
+*/
+static bool encodeRecord(unsigned type, const std::vector<mergeField>& fields, const unsigned char* image,
+                         unsigned long long image_size, std::vector<unsigned char>& out)
+{
+   char prefix[32];
+   unsigned long long size = 0;
+   for(size_t no=0;no<fields.size();no++)
+   {
+      size += snprintf(prefix,sizeof(prefix),"%u.%03u:",type,fields[no].tag_) + (unsigned long long)fields[no].size_ + 1;
+   }
+   unsigned image_id = snprintf(prefix,sizeof(prefix),"%u.999:",type);
+   if(image)
+   {
+      size += image_id + image_size + 1;
+   }
+   unsigned head = snprintf(prefix,sizeof(prefix),"%u.001:",type);
+   char digits[32];
+   unsigned long long len = nistTaggedRecordLen(head + 1 + size,digits);
+   if(len>0xFFFFFFFFull)
+   {
+      return false;
+   }
+   out.clear();
+   out.insert(out.end(),prefix,prefix + head);
+   out.insert(out.end(),digits,digits + strlen(digits));
+   out.push_back(nistParser::GS());
+   for(size_t no=0;no<fields.size();no++)
+   {
+      unsigned id_size = snprintf(prefix,sizeof(prefix),"%u.%03u:",type,fields[no].tag_);
+      out.insert(out.end(),prefix,prefix + id_size);
+      out.insert(out.end(),fields[no].data_,fields[no].data_ + fields[no].size_);
+      out.push_back(nistParser::GS());
+   }
+   if(image)
+   {
+      snprintf(prefix,sizeof(prefix),"%u.999:",type);
+      out.insert(out.end(),prefix,prefix + image_id);
+   }
+   else
+   {
+      out.back() = nistParser::FS();
+   }
+   return true;
+}
+
+/*!Начало текстовой записи в буфере: идентификатор "T.NNN:" перед данными LEN.
+   Смещение данных тега ограничивает поиск началом буфера
+*/
+static const unsigned char* recordStart(const nistRecord& rec)
+{
+   const nistTag* len = rec.getTag(0);
+   if(!len || !len->data() || len->tag_no()!=1)
+   {
+      return 0;
+   }
+   const unsigned char* start = len->data() - 1;
+   unsigned back = 1;
+   while(back<len->offset_ && (isdigit(start[-1]) || start[-1]=='.'))
+   {
+      start--;
+      back++;
+   }
+   return start;
+}
+
+nistComposer::nistComposer()
+{
+}
+
+unsigned nistComposer::addSource(const nistParser& parser, const std::string& source_file)
+{
+   source src = {&parser,source_file};
+   sources_.push_back(src);
+   return sources_.size() - 1;
+}
+
+bool nistComposer::addRecord(unsigned source, unsigned rec_no)
+{
+   if(source>=sources_.size() || rec_no>=sources_[source].parser_->getRecordsCnt())
+   {
+      err_msg_ = "no such record";
+      return false;
+   }
+   unsigned old_idc = sources_[source].parser_->getFileHeader()->getRecordIDC(rec_no);
+   std::pair<unsigned,unsigned> key(source,old_idc);
+   std::map<std::pair<unsigned,unsigned>,unsigned>::const_iterator found = idc_map_.find(key);
+   unsigned idc = old_idc;
+   if(found!=idc_map_.end())
+   {
+      idc = found->second;
+   }
+   else
+   {
+      if(idc_used_.count(idc))
+      {
+         idc = *idc_used_.rbegin() + 1;
+      }
+      idc_map_[key] = idc;
+      idc_used_.insert(idc);
+   }
+   if(idc>255 && nistIsBinaryRecord(sources_[source].parser_->getRecord(rec_no)->type()))
+   {
+      err_msg_ = "IDC of a binary record exceeds 255";
+      return false;
+   }
+   record rec = {source,rec_no,idc};
+   records_.push_back(rec);
+   return true;
+}
+
+bool nistComposer::addRecords(unsigned source)
+{
+   if(source>=sources_.size())
+   {
+      err_msg_ = "no such source";
+      return false;
+   }
+   for(unsigned rec_no=0;rec_no<sources_[source].parser_->getRecordsCnt();rec_no++)
+   {
+      if(!addRecord(source,rec_no))
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+void nistComposer::setHeaderField(unsigned tag, const std::string& value)
+{
+   header_fields_[tag] = value;
+}
+
+void nistComposer::clearRecords()
+{
+   records_.clear();
+   idc_map_.clear();
+   idc_used_.clear();
+   header_fields_.clear();
+}
+
+void nistComposer::clear()
+{
+   clearRecords();
+   sources_.clear();
+   err_msg_.clear();
+}
+
+void nistComposer::addInline(std::vector<segment>& segments, const std::vector<unsigned char>& data)
+{
+   segment seg = {-1,0,inline_.size(),data.size()};
+   inline_.insert(inline_.end(),data.begin(),data.end());
+   segments.push_back(seg);
+}
+
+void nistComposer::addRange(std::vector<segment>& segments, unsigned source, const unsigned char* data, unsigned long long size)
+{
+   segment seg = {(int)source,data,0,size};
+   segments.push_back(seg);
+}
+
+bool nistComposer::buildHeader(std::vector<segment>& segments)
+{
+   std::string cnt = "1";
+   cnt += nistParser::US();
+   cnt += std::to_string(records_.size());
+   char item[32];
+   for(size_t no=0;no<records_.size();no++)
+   {
+      const nistRecord* rec = sources_[records_[no].source_].parser_->getRecord(records_[no].rec_no_);
+      snprintf(item,sizeof(item),"%c%u%c%02u",nistParser::RS(),rec->type(),nistParser::US(),records_[no].idc_);
+      cnt += item;
+   }
+   std::vector<mergeField> fields;
+   recordFields(*sources_[0].parser_->getFileHeader(),fields);
+   setField(fields,3,(const unsigned char*)cnt.data(),cnt.size());
+   for(std::map<unsigned,std::string>::const_iterator it=header_fields_.begin();it!=header_fields_.end();++it)
+   {
+      if(it->first>1 && it->first!=3)
+      {
+         setField(fields,it->first,(const unsigned char*)it->second.data(),it->second.size());
+      }
+   }
+   std::vector<unsigned char> data;
+   if(!encodeRecord(1,fields,0,0,data))
+   {
+      err_msg_ = "Type-1 is too large";
+      return false;
+   }
+   addInline(segments,data);
+   return true;
+}
+
+bool nistComposer::buildRecord(const record& rec, std::vector<segment>& segments)
+{
+   const nistParser& parser = *sources_[rec.source_].parser_;
+   const nistRecord* src = parser.getRecord(rec.rec_no_);
+   unsigned old_idc = parser.getFileHeader()->getRecordIDC(rec.rec_no_);
+   std::vector<unsigned char> data;
+   if(nistIsBinaryRecord(src->type()))
+   {
+      //Заголовок предшествует изображению: LEN (4 байта), затем IDC (1 байт)
+      unsigned header_size = src->recordSize() - src->getImgDataSize();
+      if(!src->getImgData() || header_size<5)
+      {
+         err_msg_ = "binary record without image data";
+         return false;
+      }
+      const unsigned char* header = src->getImgData() - header_size;
+      if(rec.idc_==old_idc)
+      {
+         addRange(segments,rec.source_,header,src->recordSize());
+         return true;
+      }
+      data.assign(header,header + header_size);
+      data[4] = rec.idc_;
+      addInline(segments,data);
+      addRange(segments,rec.source_,src->getImgData(),src->getImgDataSize());
+      return true;
+   }
+   const unsigned char* start = recordStart(*src);
+   if(!start || start[src->recordSize() - 1]!=nistParser::FS())
+   {
+      err_msg_ = "can't locate record type " + std::to_string(src->type());
+      return false;
+   }
+   if(rec.idc_==old_idc)
+   {
+      addRange(segments,rec.source_,start,src->recordSize());
+      return true;
+   }
+   //IDC изменился: поля кодируются заново, изображение берется из исходной записи
+   std::vector<mergeField> fields;
+   recordFields(*src,fields);
+   char idc[16];
+   snprintf(idc,sizeof(idc),"%02u",rec.idc_);
+   setField(fields,2,(const unsigned char*)idc,strlen(idc));
+   const nistTag* image = src->getTagById(999);
+   if(!encodeRecord(src->type(),fields,image ? image->data() : 0,image ? image->data_size() : 0,data))
+   {
+      err_msg_ = "record is too large";
+      return false;
+   }
+   addInline(segments,data);
+   if(image)
+   {
+      addRange(segments,rec.source_,image->data(),image->data_size());
+      data.assign(1,nistParser::FS());
+      addInline(segments,data);
+   }
+   return true;
+}
+
+//!Пишет size байт данных источника: из файла source_fd по смещению data - base, иначе из памяти
+static bool writeRange(FILE* out, int source_fd, const unsigned char* base, const unsigned char* data, unsigned long long size)
+{
+#ifndef WIN32
+   if(source_fd>=0 && size>=kernel_copy_min && fflush(out)==0)
+   {
+      unsigned long long copied = nistKernelCopy(source_fd,data - base,fileno(out),size);
+      data += copied;
+      size -= copied;
+      //Позиция потока out должна учесть данные, записанные в обход него
+      if(copied && fseeko(out,0,SEEK_END)!=0)
+      {
+         return false;
+      }
+   }
+#endif
+   return !size || fwrite(data,1,size,out)==size;
+}
+
+bool nistComposer::write(const std::string& out_file)
+{
+   err_msg_.clear();
+   if(sources_.empty())
+   {
+      err_msg_ = "no sources";
+      return false;
+   }
+   inline_.clear();
+   std::vector<segment> segments;
+   bool res = buildHeader(segments);
+   for(size_t no=0;res && no<records_.size();no++)
+   {
+      res = buildRecord(records_[no],segments);
+   }
+   FILE* out = res ? fopen(out_file.c_str(),"wb") : 0;
+   if(res && !out)
+   {
+      err_msg_ = "can't create " + out_file;
+      res = false;
+   }
+   if(out)
+   {
+      std::vector<int> fds(sources_.size(),-1);
+      std::vector<const unsigned char*> bases(sources_.size(),(const unsigned char*)0);
+      for(size_t no=0;no<sources_.size();no++)
+      {
+         fds[no] = nistOpenSource(sources_[no].file_,*sources_[no].parser_,bases[no]);
+      }
+      for(size_t no=0;res && no<segments.size();no++)
+      {
+         const segment& seg = segments[no];
+         if(seg.source_<0)
+         {
+            res = fwrite(&inline_[seg.inline_offset_],1,seg.size_,out)==seg.size_;
+         }
+         else
+         {
+            res = writeRange(out,fds[seg.source_],bases[seg.source_],seg.data_,seg.size_);
+         }
+      }
+      if(!res)
+      {
+         err_msg_ = "write error " + out_file;
+      }
+      if(fclose(out)!=0)
+      {
+         res = false;
+      }
+      for(size_t no=0;no<fds.size();no++)
+      {
+         nistCloseSource(fds[no]);
+      }
+   }
+   if(!res)
+   {
+      dbg0("nistComposer::write error: %s\n",err_msg_.c_str());
+   }
+   return res;
+}
+
+bool nistMergeFiles(const std::vector<std::string>& in_files, const std::string& out_file, std::string& err_msg)
+{
+   std::vector<nistParser> parsers(in_files.size());
+   nistComposer composer;
+   for(size_t no=0;no<in_files.size();no++)
+   {
+      if(!parsers[no].load(in_files[no]))
+      {
+         err_msg = "can't load " + in_files[no];
+         return false;
+      }
+      if(!composer.addRecords(composer.addSource(parsers[no],in_files[no])))
+      {
+         err_msg = composer.getError();
+         return false;
+      }
+   }
+   bool res = composer.write(out_file);
+   err_msg = composer.getError();
+   return res;
+}
+
+bool nistSplitFile(const std::string& in_file, const std::string& out_prefix, std::vector<std::string>& out_files,
+                   std::string& err_msg)
+{
+   nistParser parser;
+   if(!parser.load(in_file))
+   {
+      err_msg = "can't load " + in_file;
+      return false;
+   }
+   //Субъекты - IDC, у которых есть Type-2; записи с IDC без Type-2 общие для всех субъектов
+   const std::vector<nistIdcGroup>& groups = parser.getIdcGroups();
+   std::set<unsigned> subjects;
+   for(size_t no=0;no<groups.size();no++)
+   {
+      if(!groups[no].type2_.empty())
+      {
+         subjects.insert(groups[no].idc_);
+      }
+   }
+   if(subjects.empty())
+   {
+      err_msg = "no Type-2 records in " + in_file;
+      return false;
+   }
+   const type1Record* header = parser.getFileHeader();
+   nistComposer composer;
+   unsigned source = composer.addSource(parser,in_file);
+   char suffix[32];
+   unsigned subject_no = 0;
+   for(std::set<unsigned>::const_iterator subject=subjects.begin();subject!=subjects.end();++subject)
+   {
+      composer.clearRecords();
+      bool res = true;
+      //Записи субъекта могут чередоваться с записями других субъектов, порядок в файле сохраняется
+      for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+      {
+         unsigned idc = header->getRecordIDC(rec_no);
+         if(idc==*subject || !subjects.count(idc))
+         {
+            res = res && composer.addRecord(source,rec_no);
+         }
+      }
+      snprintf(suffix,sizeof(suffix),"_%03u.int",++subject_no);
+      std::string out_file = out_prefix + suffix;
+      if(!res || !composer.write(out_file))
+      {
+         err_msg = composer.getError();
+         return false;
+      }
+      out_files.push_back(out_file);
+   }
+   return true;
+}
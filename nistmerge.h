@@ -0,0 +1,94 @@
+/*
+  \file   nistmerge.h
+  \brief  Объединение и разделение ANSI-NIST транзакций без перекодирования записей
+*/
+
+#ifndef NIST_MERGE_H
+#define NIST_MERGE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+
+/*! Сборка транзакции из записей загруженных транзакций. Записи ссылаются на исходные байты:
+    текстовая запись с прежним IDC и изображения пишутся как есть, заново кодируются только Type-1 (CNT)
+    и поля записей, IDC которых изменился. Если известен исходный файл транзакции, большие диапазоны
+    копируются из него copy_file_range, не проходя через память процесса.
+
+    IDC перенумеровываются так, чтобы записи разных источников не пересекались: записи одного источника
+    с одинаковым IDC получают одинаковый новый IDC, IDC сохраняется, если он еще не занят,
+    иначе назначается следующий после наибольшего занятого.
+    Парсеры источников должны существовать до окончания write().
+*/
+class nistComposer
+{
+public:
+   nistComposer();
+   /*! Добавляет источник и возвращает его номер. source_file - файл, из которого загружен parser,
+       пустая строка - данные пишутся из буфера парсера. Type-1 результата строится по Type-1 первого источника
+   */
+   unsigned addSource(const nistParser& parser, const std::string& source_file = std::string());
+   //!Добавляет запись rec_no источника (номер в nistParser::getRecord())
+   bool addRecord(unsigned source, unsigned rec_no);
+   //!Добавляет все записи источника
+   bool addRecords(unsigned source);
+   //!Новое значение поля Type-1 результата (TCN, DAT и т.п.); LEN и CNT вычисляются
+   void setHeaderField(unsigned tag, const std::string& value);
+   //!Убирает записи и правки Type-1, источники сохраняются
+   void clearRecords();
+   void clear();
+   //!Записывает собранную транзакцию
+   bool write(const std::string& out_file);
+   unsigned recordsCnt() const{return records_.size();}
+   //!Новый IDC записи no
+   unsigned recordIDC(unsigned no) const{return records_[no].idc_;}
+   const std::string& getError() const{return err_msg_;}
+private:
+   struct source
+   {
+      const nistParser* parser_;
+      std::string file_;
+   };
+   struct record
+   {
+      unsigned source_;
+      unsigned rec_no_;
+      unsigned idc_;
+   };
+   //!Участок результата: байты inline_ (source_ < 0) или данные источника
+   struct segment
+   {
+      int source_;
+      const unsigned char* data_;
+      size_t inline_offset_;
+      unsigned long long size_;
+   };
+   bool buildHeader(std::vector<segment>& segments);
+   bool buildRecord(const record& rec, std::vector<segment>& segments);
+   void addInline(std::vector<segment>& segments, const std::vector<unsigned char>& data);
+   void addRange(std::vector<segment>& segments, unsigned source, const unsigned char* data, unsigned long long size);
+
+   std::vector<source> sources_;
+   std::vector<record> records_;
+   //!Новые IDC по (источник, исходный IDC) и занятые IDC
+   std::map<std::pair<unsigned,unsigned>,unsigned> idc_map_;
+   std::set<unsigned> idc_used_;
+   std::map<unsigned,std::string> header_fields_;
+   std::vector<unsigned char> inline_;
+   std::string err_msg_;
+};
+
+//!Объединяет транзакции in_files в out_file: Type-1 первой, записи всех по порядку
+bool nistMergeFiles(const std::vector<std::string>& in_files, const std::string& out_file, std::string& err_msg);
+
+/*! Разделяет транзакцию с несколькими субъектами: субъект - IDC, у которого есть запись Type-2, в его транзакцию
+    входят все записи с этим IDC из CNT, где бы они ни стояли в файле. Записи с IDC без Type-2 включаются
+    в каждую транзакцию. Файлы называются <out_prefix>_<номер>.int, номера - по возрастанию IDC
+*/
+bool nistSplitFile(const std::string& in_file, const std::string& out_prefix, std::vector<std::string>& out_files,
+                   std::string& err_msg);
+
+#endif // NIST_MERGE_H
@@ -0,0 +1,295 @@
+/*
+  \file   nistmetrics.cpp
+  \brief  Счетчики и таймеры этапов разбора ANSI-NIST файлов
+*/
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "nistmetrics.h"
+
+std::atomic<bool> nistMetrics::enabled_(false);
+thread_local nistMetricsBlock* nistMetrics::local_ = 0;
+
+static const char* counter_names[nistCounterCnt] =
+{
+   "bytes_scanned",
+   "tags_tokenized",
+   "data_copies",
+   "files_loaded",
+   "load_errors"
+};
+
+static const char* phase_names[nistPhaseCnt] =
+{
+   "read",
+   "type1",
+   "decode",
+   "write"
+};
+
+///! Реестр блоков потоков
+struct nistMetricsRegistry
+{
+   std::mutex mutex_;
+   std::vector<nistMetricsBlock*> blocks_;
+   //!Сумма блоков завершившихся потоков
+   nistMetricsSnapshot retired_;
+   //!Срез на момент последнего reset()
+   nistMetricsSnapshot base_;
+};
+
+//!Реестр не разрушается, чтобы потоки, завершающиеся после выхода из main, могли сдать свои блоки
+static nistMetricsRegistry& registry()
+{
+   static nistMetricsRegistry* res = new nistMetricsRegistry();
+   return *res;
+}
+
+///! Владелец блока потока: при завершении потока переносит значения в retired_ и снимает блок с учета
+struct nistMetricsOwner
+{
+   nistMetricsOwner() : block_(0) {}
+   ~nistMetricsOwner()
+   {
+      if(block_)
+      {
+         nistMetricsRegistry& reg = registry();
+         std::lock_guard<std::mutex> lock(reg.mutex_);
+         nistMetricsSnapshot values;
+         block_->read(values);
+         reg.retired_.add(values);
+         reg.blocks_.erase(std::remove(reg.blocks_.begin(),reg.blocks_.end(),block_),reg.blocks_.end());
+         delete block_;
+      }
+   }
+   nistMetricsBlock* block_;
+};
+
+static thread_local nistMetricsOwner metrics_owner;
+
+nistMetricsSnapshot::nistMetricsSnapshot()
+{
+   memset(this,0,sizeof(*this));
+}
+
+static void addArray(uint64_t* dst, const uint64_t* src, unsigned cnt, bool sub)
+{
+   for(unsigned pos=0;pos<cnt;pos++)
+   {
+      dst[pos] = sub ? dst[pos] - src[pos] : dst[pos] + src[pos];
+   }
+}
+
+static void combine(nistMetricsSnapshot& dst, const nistMetricsSnapshot& src, bool sub)
+{
+   addArray(dst.counters_,src.counters_,nistCounterCnt,sub);
+   addArray(dst.phase_ns_,src.phase_ns_,nistPhaseCnt,sub);
+   addArray(dst.phase_cnt_,src.phase_cnt_,nistPhaseCnt,sub);
+   addArray(dst.decode_ns_,src.decode_ns_,nist_metrics_types,sub);
+   addArray(dst.records_,src.records_,nist_metrics_types,sub);
+   addArray(dst.errors_,src.errors_,nist_metrics_types,sub);
+   addArray(dst.size_hist_,src.size_hist_,nist_metrics_buckets,sub);
+}
+
+void nistMetricsSnapshot::add(const nistMetricsSnapshot& other)
+{
+   combine(*this,other,false);
+}
+
+void nistMetricsSnapshot::sub(const nistMetricsSnapshot& other)
+{
+   combine(*this,other,true);
+}
+
+static void appendf(std::string& out, const char* format, ...)
+{
+   char buf[256];
+   va_list args;
+   va_start(args,format);
+   int len = vsnprintf(buf,sizeof(buf),format,args);
+   va_end(args);
+   if(len>0)
+   {
+      out.append(buf,std::min<size_t>(len,sizeof(buf) - 1));
+   }
+}
+
+std::string nistMetricsSnapshot::prometheus(const std::string& prefix) const
+{
+   std::string res;
+   const char* p = prefix.c_str();
+   for(unsigned counter=0;counter<nistCounterCnt;counter++)
+   {
+      appendf(res,"# TYPE %s_%s_total counter\n%s_%s_total %llu\n",p,counter_names[counter],p,counter_names[counter],
+              (unsigned long long)counters_[counter]);
+   }
+   appendf(res,"# TYPE %s_phase_seconds_total counter\n",p);
+   for(unsigned phase=0;phase<nistPhaseCnt;phase++)
+   {
+      appendf(res,"%s_phase_seconds_total{phase=\"%s\"} %.9f\n",p,phase_names[phase],phase_ns_[phase]/1e9);
+   }
+   appendf(res,"# TYPE %s_phase_calls_total counter\n",p);
+   for(unsigned phase=0;phase<nistPhaseCnt;phase++)
+   {
+      appendf(res,"%s_phase_calls_total{phase=\"%s\"} %llu\n",p,phase_names[phase],(unsigned long long)phase_cnt_[phase]);
+   }
+   appendf(res,"# TYPE %s_records_total counter\n",p);
+   for(unsigned type=0;type<nist_metrics_types;type++)
+   {
+      if(records_[type])
+      {
+         appendf(res,"%s_records_total{type=\"%u\"} %llu\n",p,type,(unsigned long long)records_[type]);
+      }
+   }
+   appendf(res,"# TYPE %s_record_errors_total counter\n",p);
+   for(unsigned type=0;type<nist_metrics_types;type++)
+   {
+      if(errors_[type])
+      {
+         appendf(res,"%s_record_errors_total{type=\"%u\"} %llu\n",p,type,(unsigned long long)errors_[type]);
+      }
+   }
+   appendf(res,"# TYPE %s_decode_seconds_total counter\n",p);
+   for(unsigned type=0;type<nist_metrics_types;type++)
+   {
+      if(decode_ns_[type])
+      {
+         appendf(res,"%s_decode_seconds_total{type=\"%u\"} %.9f\n",p,type,decode_ns_[type]/1e9);
+      }
+   }
+   //Гистограмма Prometheus накопительная, le - верхняя граница интервала включительно
+   appendf(res,"# TYPE %s_record_size_bytes histogram\n",p);
+   uint64_t total = 0;
+   for(unsigned bucket=0;bucket<nist_metrics_buckets - 1;bucket++)
+   {
+      total += size_hist_[bucket];
+      appendf(res,"%s_record_size_bytes_bucket{le=\"%llu\"} %llu\n",p,(1ULL<<bucket) - 1,(unsigned long long)total);
+   }
+   total += size_hist_[nist_metrics_buckets - 1];
+   appendf(res,"%s_record_size_bytes_bucket{le=\"+Inf\"} %llu\n",p,(unsigned long long)total);
+   appendf(res,"%s_record_size_bytes_count %llu\n",p,(unsigned long long)total);
+   appendf(res,"%s_record_size_bytes_sum %llu\n",p,(unsigned long long)counters_[nistCounterBytesScanned]);
+   return res;
+}
+
+std::string nistMetricsSnapshot::json() const
+{
+   std::string res = "{\"counters\":{";
+   for(unsigned counter=0;counter<nistCounterCnt;counter++)
+   {
+      appendf(res,"%s\"%s\":%llu",counter ? "," : "",counter_names[counter],(unsigned long long)counters_[counter]);
+   }
+   res += "},\"phases\":{";
+   for(unsigned phase=0;phase<nistPhaseCnt;phase++)
+   {
+      appendf(res,"%s\"%s\":{\"ns\":%llu,\"calls\":%llu}",phase ? "," : "",phase_names[phase],
+              (unsigned long long)phase_ns_[phase],(unsigned long long)phase_cnt_[phase]);
+   }
+   res += "},\"types\":{";
+   bool first = true;
+   for(unsigned type=0;type<nist_metrics_types;type++)
+   {
+      if(records_[type] || errors_[type] || decode_ns_[type])
+      {
+         appendf(res,"%s\"%u\":{\"records\":%llu,\"errors\":%llu,\"decode_ns\":%llu}",first ? "" : ",",type,
+                 (unsigned long long)records_[type],(unsigned long long)errors_[type],(unsigned long long)decode_ns_[type]);
+         first = false;
+      }
+   }
+   res += "},\"record_size_log2\":[";
+   for(unsigned bucket=0;bucket<nist_metrics_buckets;bucket++)
+   {
+      appendf(res,"%s%llu",bucket ? "," : "",(unsigned long long)size_hist_[bucket]);
+   }
+   res += "]}";
+   return res;
+}
+
+nistMetricsBlock::nistMetricsBlock()
+{
+   for(unsigned pos=0;pos<nistCounterCnt;pos++)
+   {
+      counters_[pos].store(0,std::memory_order_relaxed);
+   }
+   for(unsigned pos=0;pos<nistPhaseCnt;pos++)
+   {
+      phase_ns_[pos].store(0,std::memory_order_relaxed);
+      phase_cnt_[pos].store(0,std::memory_order_relaxed);
+   }
+   for(unsigned pos=0;pos<nist_metrics_types;pos++)
+   {
+      decode_ns_[pos].store(0,std::memory_order_relaxed);
+      records_[pos].store(0,std::memory_order_relaxed);
+      errors_[pos].store(0,std::memory_order_relaxed);
+   }
+   for(unsigned pos=0;pos<nist_metrics_buckets;pos++)
+   {
+      size_hist_[pos].store(0,std::memory_order_relaxed);
+   }
+}
+
+static void readArray(uint64_t* dst, const std::atomic<uint64_t>* src, unsigned cnt)
+{
+   for(unsigned pos=0;pos<cnt;pos++)
+   {
+      dst[pos] = src[pos].load(std::memory_order_relaxed);
+   }
+}
+
+void nistMetricsBlock::read(nistMetricsSnapshot& out) const
+{
+   readArray(out.counters_,counters_,nistCounterCnt);
+   readArray(out.phase_ns_,phase_ns_,nistPhaseCnt);
+   readArray(out.phase_cnt_,phase_cnt_,nistPhaseCnt);
+   readArray(out.decode_ns_,decode_ns_,nist_metrics_types);
+   readArray(out.records_,records_,nist_metrics_types);
+   readArray(out.errors_,errors_,nist_metrics_types);
+   readArray(out.size_hist_,size_hist_,nist_metrics_buckets);
+}
+
+nistMetricsBlock& nistMetrics::attach()
+{
+   nistMetricsBlock* block = new nistMetricsBlock();
+   nistMetricsRegistry& reg = registry();
+   {
+      std::lock_guard<std::mutex> lock(reg.mutex_);
+      reg.blocks_.push_back(block);
+   }
+   metrics_owner.block_ = block;
+   local_ = block;
+   return *block;
+}
+
+//!Сумма всех блоков без учета reset(), вызывается под mutex_
+static nistMetricsSnapshot total(nistMetricsRegistry& reg)
+{
+   nistMetricsSnapshot res = reg.retired_;
+   for(unsigned block_no=0;block_no<reg.blocks_.size();block_no++)
+   {
+      nistMetricsSnapshot values;
+      reg.blocks_[block_no]->read(values);
+      res.add(values);
+   }
+   return res;
+}
+
+nistMetricsSnapshot nistMetrics::snapshot()
+{
+   nistMetricsRegistry& reg = registry();
+   std::lock_guard<std::mutex> lock(reg.mutex_);
+   nistMetricsSnapshot res = total(reg);
+   res.sub(reg.base_);
+   return res;
+}
+
+void nistMetrics::reset()
+{
+   nistMetricsRegistry& reg = registry();
+   std::lock_guard<std::mutex> lock(reg.mutex_);
+   reg.base_ = total(reg);
+}
@@ -0,0 +1,181 @@
+/*
+  \file   nistmetrics.h
+  \brief  Счетчики и таймеры этапов разбора ANSI-NIST файлов
+
+  Сбор включается nistMetrics::enable(true). Каждый поток пишет в собственный блок счетчиков
+  без блокировок и атомарных операций чтения-изменения-записи, поэтому событие стоит несколько наносекунд;
+  при выключенном сборе - одно чтение флага. Блоки потоков регистрируются в глобальном списке,
+  nistMetrics::snapshot() суммирует их в согласованный на момент чтения срез.
+*/
+
+#ifndef NIST_METRICS_H
+#define NIST_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+///! Счетчики событий
+enum nistCounter
+{
+   nistCounterBytesScanned,    ///<Байт в разобранных записях
+   nistCounterTagsTokenized,   ///<Тегов в записях, разобранных nistParser::load
+   nistCounterDataCopies,      ///<Копий данных тега nistTag::dataCopy()
+   nistCounterFilesLoaded,     ///<Транзакций, разобранных nistParser::load
+   nistCounterLoadErrors,      ///<Транзакций, разобранных с ошибкой
+   nistCounterCnt
+};
+
+///! Этапы, для которых считается время
+enum nistPhase
+{
+   nistPhaseRead,      ///<Чтение файла nistParser::readFile
+   nistPhaseType1,     ///<Разбор заголовка Type-1
+   nistPhaseDecode,    ///<Разбор записей, дополнительно учитывается по типам записей
+   nistPhaseWrite,     ///<Запись файла nistParser::write
+   nistPhaseCnt
+};
+
+//!Число различаемых типов записей, типы больше 99 учитываются как 0
+static const unsigned nist_metrics_types = 100;
+//!Число интервалов гистограммы размеров записей, интервал i содержит размеры [2^(i-1), 2^i)
+static const unsigned nist_metrics_buckets = 32;
+
+///! Срез значений метрик
+struct nistMetricsSnapshot
+{
+   nistMetricsSnapshot();
+   uint64_t counters_[nistCounterCnt];
+   uint64_t phase_ns_[nistPhaseCnt];
+   uint64_t phase_cnt_[nistPhaseCnt];
+   //!Время разбора, количество записей и ошибок по типам записей
+   uint64_t decode_ns_[nist_metrics_types];
+   uint64_t records_[nist_metrics_types];
+   uint64_t errors_[nist_metrics_types];
+   uint64_t size_hist_[nist_metrics_buckets];
+
+   void add(const nistMetricsSnapshot& other);
+   void sub(const nistMetricsSnapshot& other);
+   //!Текстовый формат Prometheus, имена метрик начинаются с prefix
+   std::string prometheus(const std::string& prefix = "nist") const;
+   std::string json() const;
+};
+
+///! Блок счетчиков одного потока. Пишет только поток-владелец, читают snapshot() и завершение потока
+struct nistMetricsBlock
+{
+   nistMetricsBlock();
+   std::atomic<uint64_t> counters_[nistCounterCnt];
+   std::atomic<uint64_t> phase_ns_[nistPhaseCnt];
+   std::atomic<uint64_t> phase_cnt_[nistPhaseCnt];
+   std::atomic<uint64_t> decode_ns_[nist_metrics_types];
+   std::atomic<uint64_t> records_[nist_metrics_types];
+   std::atomic<uint64_t> errors_[nist_metrics_types];
+   std::atomic<uint64_t> size_hist_[nist_metrics_buckets];
+
+   //!Увеличение без атомарного сложения: писатель один, читатели видят старое или новое значение
+   static void bump(std::atomic<uint64_t>& value, uint64_t delta)
+   {
+      value.store(value.load(std::memory_order_relaxed) + delta,std::memory_order_relaxed);
+   }
+   void read(nistMetricsSnapshot& out) const;
+};
+
+///! Точка доступа к метрикам процесса
+class nistMetrics
+{
+public:
+   static void enable(bool on){enabled_.store(on,std::memory_order_relaxed);}
+   static bool enabled(){return enabled_.load(std::memory_order_relaxed);}
+
+   static void count(nistCounter counter, uint64_t delta = 1)
+   {
+      if(enabled())
+      {
+         nistMetricsBlock::bump(local().counters_[counter],delta);
+      }
+   }
+   //!Учитывает разобранную запись: количество по типу, размер в гистограмме и в nistCounterBytesScanned
+   static void record(unsigned type, unsigned size)
+   {
+      if(enabled())
+      {
+         nistMetricsBlock& block = local();
+         nistMetricsBlock::bump(block.records_[type<nist_metrics_types ? type : 0],1);
+         nistMetricsBlock::bump(block.size_hist_[bucket(size)],1);
+         nistMetricsBlock::bump(block.counters_[nistCounterBytesScanned],size);
+      }
+   }
+   static void error(unsigned type)
+   {
+      if(enabled())
+      {
+         nistMetricsBlock::bump(local().errors_[type<nist_metrics_types ? type : 0],1);
+      }
+   }
+   //!Время этапа; для nistPhaseDecode дополнительно учитывается по типу записи
+   static void phase(nistPhase phase, uint64_t ns, unsigned type = 0)
+   {
+      nistMetricsBlock& block = local();
+      nistMetricsBlock::bump(block.phase_ns_[phase],ns);
+      nistMetricsBlock::bump(block.phase_cnt_[phase],1);
+      if(phase==nistPhaseDecode)
+      {
+         nistMetricsBlock::bump(block.decode_ns_[type<nist_metrics_types ? type : 0],ns);
+      }
+   }
+
+   //!Сумма по всем потокам, включая завершившиеся, за вычетом значений на момент reset()
+   static nistMetricsSnapshot snapshot();
+   //!Обнуляет видимые значения. Блоки потоков не изменяются, запоминается базовый срез
+   static void reset();
+
+   static unsigned bucket(unsigned size)
+   {
+      unsigned res = 0;
+      while(size)
+      {
+         res++;
+         size >>= 1;
+      }
+      return res<nist_metrics_buckets ? res : nist_metrics_buckets - 1;
+   }
+private:
+   static nistMetricsBlock& local()
+   {
+      return local_ ? *local_ : attach();
+   }
+   //!Создает и регистрирует блок текущего потока
+   static nistMetricsBlock& attach();
+   static std::atomic<bool> enabled_;
+   static thread_local nistMetricsBlock* local_;
+};
+
+///! Замер времени этапа в пределах области видимости. Время не измеряется, если сбор выключен
+class nistPhaseTimer
+{
+public:
+   nistPhaseTimer(nistPhase phase, unsigned type = 0)
+      : phase_(phase), type_(type), on_(nistMetrics::enabled())
+   {
+      if(on_)
+      {
+         start_ = std::chrono::steady_clock::now();
+      }
+   }
+   ~nistPhaseTimer()
+   {
+      if(on_)
+      {
+         nistMetrics::phase(phase_,std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count(),type_);
+      }
+   }
+private:
+   nistPhase phase_;
+   unsigned type_;
+   bool on_;
+   std::chrono::steady_clock::time_point start_;
+};
+
+#endif // NIST_METRICS_H
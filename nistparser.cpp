@@ -5,14 +5,14 @@
   \brief  Разбор ANSI-NIST файлов
 */
 
-#if 1
+#ifndef NIST_NO_DEBUG_OUTPUT
 #define dbg0 printf
 #define dbg3 printf
 #define dbg7 printf
 #else
-#define dbg0
-#define dbg3
-#define dbg7 
+#define dbg0(...)
+#define dbg3(...)
+#define dbg7(...)
 #endif
 
 #include <algorithm>
@@ -46,6 +46,7 @@ extern "C" {
 
 
 #include "nistparser.h"
+#include "nistmetrics.h"
 
 #include "pack_set1.h"
 struct Type4Header
@@ -110,6 +111,262 @@ std::string itos(unsigned length)
     return str2;
 }
 
+/*!Записывает текстовую запись type одним вызовом fwrite. body - все байты записи после значения LEN,
+   от GS за полем 1.001 до завершающего FS. LEN равен len, если он задан, иначе вычисляется по размеру body.
+   Возвращает число записанных байт или -1
+*/
+static int writeTagged(FILE* out, unsigned type, const std::string& body, unsigned len)
+{
+    std::string st = std::to_string(type) + ".001:";
+    if (len)
+    {
+        st += itos(len);
+    }
+    else
+    {
+        char digits[24];
+        nistTaggedRecordLen(st.length() + body.length(), digits);
+        st += digits;
+    }
+    st += body;
+    if (fwrite(st.data(), 1, st.length(), out) != st.length())
+    {
+        dbg0("writeTagged: record type %u write error\n", type);
+        return -1;
+    }
+    return st.length();
+}
+
+//!Разбирает десятичное число начиная с p, останавливается на первом нецифровом символе
+static unsigned parseUInt(const unsigned char*& p, const unsigned char* end)
+{
+   unsigned res = 0;
+   while(p<end && *p>='0' && *p<='9')
+   {
+      res = res*10 + (*p - '0');
+      p++;
+   }
+   return res;
+}
+
+//!Разбирает номер записи или тега между begin и end так же, как atoi(), но без копирования в строку
+static unsigned parseNumber(const unsigned char* begin, const unsigned char* end)
+{
+   while(begin<end && (*begin==' ' || (*begin>='\t' && *begin<='\r')))
+   {
+      begin++;
+   }
+   return parseUInt(begin,end);
+}
+
+//!Разбирает шестнадцатеричное число начиная с p
+static unsigned parseHex(const unsigned char*& p, const unsigned char* end)
+{
+   unsigned res = 0;
+   for(;p<end;p++)
+   {
+      unsigned char c = *p;
+      if(c>='0' && c<='9')
+      {
+         res = (res<<4) | (c - '0');
+      }
+      else if(c>='A' && c<='F')
+      {
+         res = (res<<4) | (c - 'A' + 10);
+      }
+      else if(c>='a' && c<='f')
+      {
+         res = (res<<4) | (c - 'a' + 10);
+      }
+      else
+      {
+         break;
+      }
+   }
+   return res;
+}
+
+//!Разбирает не более digits десятичных цифр (поля фиксированной ширины)
+static unsigned parseFixed(const unsigned char*& p, const unsigned char* end, unsigned digits)
+{
+   unsigned res = 0;
+   for(unsigned i=0;i<digits && p<end && *p>='0' && *p<='9';i++,p++)
+   {
+      res = res*10 + (*p - '0');
+   }
+   return res;
+}
+
+/*!Делит подполе, начинающееся с p, на информационные элементы (разделитель US).
+   Возвращает количество найденных элементов, p устанавливается на начало следующего подполя
+*/
+static unsigned splitItems(const unsigned char*& p, const unsigned char* end,
+                           const unsigned char** item_begin, const unsigned char** item_end, unsigned max_items)
+{
+   unsigned items = 0;
+   const unsigned char* item = p;
+   while(p<end && *p!=nistParser::RS())
+   {
+      if(*p==nistParser::US())
+      {
+         if(items<max_items)
+         {
+            item_begin[items] = item;
+            item_end[items] = p;
+         }
+         items++;
+         item = p+1;
+      }
+      p++;
+   }
+   if(items<max_items)
+   {
+      item_begin[items] = item;
+      item_end[items] = p;
+   }
+   items++;
+   if(p<end)
+   {
+      p++;
+   }
+   return items<max_items ? items : max_items;
+}
+
+/*!Курсор по буферу транзакции с проверкой границ. Границы проверяются один раз на запись:
+   LEN и заголовок бинарной записи сверяются с остатком буфера, после чего разбор внутри
+   [pos(), limit()) идет по указателям без проверок на каждый байт
+*/
+class nistCursor
+{
+public:
+   nistCursor(const nistSpan& data, unsigned offset)
+   {
+      begin_ = data.data();
+      end_ = begin_ + data.size();
+      pos_ = offset<data.size() ? begin_ + offset : end_;
+      limit_ = end_;
+   }
+   bool empty() const{return pos_==limit_;}
+   size_t left() const{return limit_ - pos_;}
+   const unsigned char* begin() const{return begin_;}
+   const unsigned char* pos() const{return pos_;}
+   const unsigned char* limit() const{return limit_;}
+   //!Ограничивает курсор записью длины size от текущей позиции; false, если запись выходит за буфер
+   bool record(unsigned long long size)
+   {
+      if(size>left())
+      {
+         return false;
+      }
+      limit_ = pos_ + size;
+      return true;
+   }
+   /*!Копирует заголовок бинарной записи в порядке байтов машины и ограничивает курсор записью.
+      false, если заголовок не помещается или LEN меньше заголовка либо выходит за буфер
+   */
+   template<class H>
+   bool binaryHeader(H& hdr)
+   {
+      if(left()<sizeof(H))
+      {
+         return false;
+      }
+      memcpy(&hdr,pos_,sizeof(H));
+      hdr.len_ = ntohl(hdr.len_);
+      hdr.hll_ = ntohs(hdr.hll_);
+      hdr.vll_ = ntohs(hdr.vll_);
+      return hdr.len_>=sizeof(H) && record(hdr.len_);
+   }
+private:
+   const unsigned char* begin_;
+   const unsigned char* end_;
+   const unsigned char* pos_;
+   const unsigned char* limit_;
+};
+
+nistArena::nistArena(size_t chunk_size)
+{
+   chunk_size_ = chunk_size;
+   cur_ = 0;
+   pos_ = 0;
+   used_ = 0;
+}
+
+nistArena::~nistArena()
+{
+   for(unsigned chunk_no=0;chunk_no<chunks_.size();chunk_no++)
+   {
+      free(chunks_[chunk_no].data_);
+   }
+   chunks_.clear();
+}
+
+nistArena::nistArena(nistArena&& other)
+{
+   chunk_size_ = other.chunk_size_;
+   cur_ = other.cur_;
+   pos_ = other.pos_;
+   used_ = other.used_;
+   chunks_.swap(other.chunks_);
+   other.reset();
+}
+
+nistArena& nistArena::operator=(nistArena&& other)
+{
+   if(this!=&other)
+   {
+      for(unsigned chunk_no=0;chunk_no<chunks_.size();chunk_no++)
+      {
+         free(chunks_[chunk_no].data_);
+      }
+      chunks_.clear();
+      chunks_.swap(other.chunks_);
+      chunk_size_ = other.chunk_size_;
+      cur_ = other.cur_;
+      pos_ = other.pos_;
+      used_ = other.used_;
+      other.reset();
+   }
+   return *this;
+}
+
+void* nistArena::alloc(size_t size, size_t align)
+{
+   while(cur_<chunks_.size())
+   {
+      chunk& ch = chunks_[cur_];
+      size_t start = (reinterpret_cast<size_t>(ch.data_) + pos_ + align - 1) & ~(align - 1);
+      size_t begin = start - reinterpret_cast<size_t>(ch.data_);
+      if(begin + size <= ch.size_)
+      {
+         pos_ = begin + size;
+         used_ += size;
+         return ch.data_ + begin;
+      }
+      cur_++;
+      pos_ = 0;
+   }
+   chunk ch;
+   ch.size_ = std::max(chunk_size_, size + align);
+   ch.data_ = (unsigned char*)malloc(ch.size_);
+   if(!ch.data_)
+   {
+      dbg0("nistArena::alloc error can't allocate %d bytes\n",(int)ch.size_);
+      return 0;
+   }
+   chunks_.push_back(ch);
+   cur_ = chunks_.size() - 1;
+   pos_ = 0;
+   return alloc(size, align);
+}
+
+void nistArena::reset()
+{
+   cur_ = 0;
+   pos_ = 0;
+   used_ = 0;
+}
+
 nistTag::nistTag()
 {
    rec_ = 0;
@@ -128,66 +385,65 @@ nistTag::~nistTag()
    data_ = 0;
 }
 
-bool nistTag::load(const std::vector<unsigned char>& data, unsigned& offset, unsigned offset_to_record_end)
+bool nistTag::load(const nistSpan& data, unsigned& offset, unsigned offset_to_record_end)
 {   
-   if(data.size() && offset<data.size())
+   nistCursor cursor(data,offset);
+   //Конец записи из LEN, который уже пройден, не учитывается, как и раньше
+   bool record_end_known = offset_to_record_end!=0 && offset_to_record_end>=offset;
+   if(!cursor.empty() && record_end_known && !cursor.record(offset_to_record_end - offset + 1))
+   {
+      dbg0("nistTag::load error record end %u beyond data size %u\n",offset_to_record_end,(unsigned)data.size());
+      return false;
+   }
+   if(!cursor.empty())
    {
-      unsigned offset_to_end = offset;
+      const unsigned char* begin = cursor.pos();
+      const unsigned char* limit = cursor.limit();
+      const unsigned char* record_end = record_end_known ? limit - 1 : 0;
       //Ожидает данные в виде <номер записи>.<номер тега>:<данные><разделитель>
-      unsigned dot_offset = 0;   //Смещение на разделитель между номером записи и номером тега
-      unsigned colon_offset = 0; //Смещение на разделитель между номером записи и тега и данными
-      for(unsigned pos=offset;pos<data.size();pos++)
+      const unsigned char* dot = 0;   //Разделитель между номером записи и номером тега
+      const unsigned char* colon = 0; //Разделитель между номером записи и тега и данными
+      const unsigned char* end = 0;   //Разделитель после данных
+      for(const unsigned char* p=begin;p<limit;p++)
       {
          //Разделитель тегов или конец записи
-         if(data[pos]==nistParser::GS() || data[pos]==nistParser::FS() || (offset_to_record_end!=0 && pos==offset_to_record_end))
+         if(*p==nistParser::GS() || *p==nistParser::FS() || p==record_end)
          {
-            offset_to_end = pos;
+            end = p;
             break;
          }
-         if(data[pos]==':' && colon_offset==0)
+         if(*p==':' && !colon)
          {
-            colon_offset = pos;
-            if(dot_offset)
+            colon = p;
+            //Для записей с текстовыми тегами и изображениями - изображение в последнем теге с номером 999
+            if(dot && parseNumber(dot+1,colon)==999)
             {
-               std::vector<char> c_tag;
-               c_tag.resize(colon_offset - dot_offset,0);
-               memcpy(&c_tag.front(),&data.front()+dot_offset+1,colon_offset - dot_offset -1);
-               //Для записей с текстовыми тегами и изображениями - изображение в последнем теге с номером 999
-               if(atoi(&c_tag.front())==999) 
-               {
-                  offset_to_end = offset_to_record_end;
-                  break;
-               }
+               end = record_end;
+               break;
             }
          }
-         if(data[pos]=='.' && dot_offset==0)
+         if(*p=='.' && !dot)
          {
-            dot_offset = pos;
+            dot = p;
          }
       }
 
-      if(dot_offset > offset &&  colon_offset > dot_offset && offset_to_end > dot_offset )
+      if(end && dot > begin &&  colon > dot && end > dot )
       {
-         std::vector<char> c_rec;
-         c_rec.resize(dot_offset-offset+1,0);
-         memcpy(&c_rec.front(),&data.front()+offset,dot_offset-offset);
-         rec_ = atoi(&c_rec.front());
-         std::vector<char> c_tag;
-         c_tag.resize(colon_offset - dot_offset,0);
-         memcpy(&c_tag.front(),&data.front()+dot_offset+1,colon_offset - dot_offset -1);
-         nom_ = atoi(&c_tag.front());
-         offset_ = colon_offset+1;
-         if(offset_to_end > offset_)
+         rec_ = parseNumber(begin,dot);
+         nom_ = parseNumber(dot+1,colon);
+         offset_ = colon + 1 - cursor.begin();
+         if(end > colon + 1)
          {
-            size_ = offset_to_end-offset_;
-            data_ = &data.front()+offset_;
+            size_ = end - colon - 1;
+            data_ = colon + 1;
          }
          else
          {
             size_ = 0;
             data_ = 0;
          }
-         offset = offset_to_end;
+         offset = end - cursor.begin();
          dbg7( (char*)"nistTag::load record %d tag %d\n",rec_,nom_);
          return true;
       }
@@ -206,6 +462,7 @@ bool nistTag::load(const std::vector<unsigned char>& data, unsigned& offset, uns
 std::vector<unsigned char> nistTag::dataCopy() const
 {
    dbg7( (char*)"nistTag::dataCopy record %d tag %d\n",rec_,nom_);
+   nistMetrics::count(nistCounterDataCopies);
    std::vector<unsigned char> res;
    if(size_)
    {
@@ -239,7 +496,7 @@ void nistRecord::clear()
    tags_.clear();
 }
 
-bool nistRecord::load(const std::vector<unsigned char>& data, unsigned& offset,unsigned type, bool force)
+bool nistRecord::load(const nistSpan& data, unsigned& offset,unsigned type, bool force)
 {
    dbg7( (char*)"nistRecord::load record %d\n",type);
    clear();
@@ -249,7 +506,7 @@ bool nistRecord::load(const std::vector<unsigned char>& data, unsigned& offset,u
    if(data.size() && offset<data.size())
    {
       offset_to_start = offset;
-      if(type==1 || type==2 || type==10 || type==14 || type==15 || type==13)
+      if(type!=0 && type!=3 && type!=4 && type!=5 && type!=6 && type!=7 && type!=8)
       {
          nistTag new_tag;
          while(new_tag.load(data,offset,offset_to_end))
@@ -261,16 +518,20 @@ bool nistRecord::load(const std::vector<unsigned char>& data, unsigned& offset,u
             }
             if( new_tag.tag_no()==1) //Смещение на конец записи
             {               
-               std::vector<unsigned char> tag_data;
-               tag_data = new_tag.dataCopy();
-               if(tag_data.size())
+               if(new_tag.data_size())
                {
-                  record_size = atoi((char*)&tag_data.front());
+                  record_size = parseNumber(new_tag.data(),new_tag.data() + new_tag.data_size());
                }
-               if(record_size)
+               if(record_size && (unsigned long)record_size<=data.size() - offset_to_start)
                {
                   offset_to_end = offset_to_start + record_size - 1; //Смещение на замыкающий разделитель, который включается в длину записи
                }
+               else if(record_size)
+               {
+                  dbg0("nistRecord::load error record type %d size %ld beyond data\n",type,record_size);
+                  clear();
+                  return false;
+               }
                else
                {
                   dbg0("nistRecord::load error can't get record type %d size\n",type);
@@ -313,45 +574,31 @@ bool nistRecord::load(const std::vector<unsigned char>& data, unsigned& offset,u
 
 int nistRecord::write(FILE* out, unsigned len)
 {
-    unsigned stpos = ftell(out);
-
     unsigned char gs;
     gs = nistParser::GS();
     unsigned char fs;
     fs = nistParser::FS();
-    std::string st;
-    if (len) 
-    {
-        st = std::to_string(type_) + ".001:" + itos(len);
-    } 
-    else 
-    {
-        st = std::to_string(type_) + ".001:";
-    }
-    fwrite(st.c_str(), 1, st.length(), out);
-    fwrite(&gs, 1, 1, out);
-    
+    std::string body(1, gs);
 
     for (int i = 1; i < tags_.size(); i++) 
     {
         std::string number = fmtz(3, std::to_string(tags_[i].tag_no()));
-        std::string str = std::to_string(type_)+"."+number+":";
-        fwrite(str.c_str(), 1, str.length(), out);
-        fwrite(tags_[i].data(), 1, tags_[i].data_size(), out);
+        body += std::to_string(type_)+"."+number+":";
+        body.append((const char*)tags_[i].data(), tags_[i].data_size());
         if (i + 1 == tags_.size()) 
         {
             if (image_data_)
             {
-                fwrite(image_data_, 1, image_data_size_, out);
+                body.append((const char*)image_data_, image_data_size_);
             }
-            fwrite(&fs, 1, 1, out);
+            body += fs;
         }
         else 
         {
-            fwrite(&gs, 1, 1, out);
+            body += gs;
         }
     }
-    return ftell(out) - stpos;
+    return writeTagged(out, type_, body, len);
 }
 
 //bool nistRecord::writeTag(nistTag& tag, FILE* out)
@@ -360,13 +607,13 @@ int nistRecord::write(FILE* out, unsigned len)
 //}
 
 
-unsigned nistRecord::recordSize()
+unsigned nistRecord::recordSize() const
 {
    dbg7( (char*)"nistRecord::recordSize record type %d size %d\n",type_,record_size_);
    return record_size_;
 }
 
-const nistTag* nistRecord::getTag(unsigned no)
+const nistTag* nistRecord::getTag(unsigned no) const
 {
    if(no<tagsCnt())
    {
@@ -375,7 +622,7 @@ const nistTag* nistRecord::getTag(unsigned no)
    return 0;
 }
 
-const nistTag* nistRecord::getTagById(unsigned id)
+const nistTag* nistRecord::getTagById(unsigned id) const
 {
    for(unsigned tag_no = 0; tag_no<tagsCnt();tag_no++)
    {
@@ -386,257 +633,500 @@ const nistTag* nistRecord::getTagById(unsigned id)
 
 }
 
-type1Record::type1Record()
-   :nistRecord()
+template<class R>
+static const nistFieldSchema<R>* findField(const nistFieldSchema<R>* schema, unsigned schema_size, unsigned tag_no)
 {
-   ver_ = 0;
-   priority_ = 0;
-   scanning_res_ = 0.0;
-   transmitting_res_ = 0.0;
+   unsigned lo = 0;
+   unsigned hi = schema_size;
+   while(lo<hi)
+   {
+      unsigned mid = (lo + hi)/2;
+      if(schema[mid].tag_<tag_no)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+   return (lo<schema_size && schema[lo].tag_==tag_no) ? &schema[lo] : 0;
 }
 
-type1Record::~type1Record()
+//!Разбирает не более width десятичных цифр, для width==0 длина не ограничена
+static inline unsigned parseDigits(const unsigned char* p, const unsigned char* end, unsigned width)
 {
+   if(!width)
+   {
+      return parseUInt(p,end);
+   }
+   unsigned res = 0;
+   for(unsigned i=0;i<width && p+i<end;i++)
+   {
+      unsigned digit = p[i] - '0';
+      if(digit>9)
+      {
+         break;
+      }
+      res = res*10 + digit;
+   }
+   return res;
+}
 
+//!То же для ширины, известной при компиляции
+template<unsigned Width>
+static inline unsigned parseDigits(const unsigned char* p, const unsigned char* end)
+{
+   return parseDigits(p,end,Width);
 }
 
-bool type1Record::load(const std::vector<unsigned char>& data, unsigned& offset,bool force)
+/*!Разбирает значение одного поля. Вид и ширина поля - параметры шаблона, 
+   поэтому для полей constexpr схемы выбор ветки выполняется при компиляции.
+   Возвращает false, если функция разбора nistFieldCustom отвергла данные
+*/
+template<class R, nistFieldKind Kind, unsigned Width>
+static inline bool decodeField(R* rec, const nistFieldSchema<R>& field, const nistTag& tag)
 {
-   if(nistRecord::load(data, offset,1,force))
+   const unsigned char* p = tag.data();
+   const unsigned char* end = p + tag.data_size();
+   switch(Kind)
    {
-      std::vector<unsigned char> tag_data;
-      const nistTag* tag = getTagById(2);
-      if(tag)
-      {
-         //1.002 VER 
-         tag_data = tag->dataCopy();
-         ver_ = atoi((char*)&tag_data.front());
-         if(ver_>0)
-         {
-            dbg7( (char*)"type1Record::load ver %d\n",ver_);
-         }
-         else
-         {
-            dbg3( (char*)"type1Record::load warning invalid ver value %s\n",(char*)&tag_data.front());
-         }
-      }
-      tag = getTagById(3);
-      if(tag)
-      {
-         //1.003 CNT
-         tag_data = tag->dataCopy();
-         std::vector<unsigned char>::iterator pair_delim_pos;
-         while((pair_delim_pos = std::find(tag_data.begin(), tag_data.end(), nistParser::RS()))!=tag_data.end())
-         {
-            std::vector<unsigned char> pair;
-            pair.assign(tag_data.begin(),pair_delim_pos);
-            tag_data.erase(tag_data.begin(),pair_delim_pos+1);
-            std::vector<unsigned char>::iterator items_delim_pos = std::find(pair.begin(), pair.end(), nistParser::US());
-            if(items_delim_pos!=pair.end())
-            {
-               std::vector<unsigned char> left_part;
-               left_part.assign(pair.begin(),items_delim_pos);
-               left_part.push_back(0);
-               pair.erase(pair.begin(),items_delim_pos+1);
-               pair.push_back(0);
-               char* end = 0;
-               unsigned rec_type = std::strtoul((char*)&left_part.front(),&end,10);
-               unsigned idc = std::strtoul((char*)&pair.front(),&end,10);
-               if(rec_type!=1)
-               {
-                  file_content_.push_back(std::pair<unsigned,unsigned>(rec_type,idc));
-               }
-            }
-            else
-            {
-               dbg0("type1Record::load error invalid 1.003 tag data\n");
-               clear();
-               return false;
-            }
-         }
-         if(tag_data.size())
-         {
-            std::vector<unsigned char>::iterator items_delim_pos = std::find(tag_data.begin(), tag_data.end(), nistParser::US());
-            if(items_delim_pos!=tag_data.end())
-            {
-               std::vector<unsigned char> left_part;
-               left_part.assign(tag_data.begin(),items_delim_pos);
-               left_part.push_back(0);
-               tag_data.erase(tag_data.begin(),items_delim_pos+1);
-               tag_data.push_back(0);
-               char* end = 0;
-               unsigned rec_type = std::strtoul((char*)&left_part.front(),&end,10);
-               unsigned idc = std::strtoul((char*)&tag_data.front(),&end,10);
-               file_content_.push_back(std::pair<unsigned,unsigned>(rec_type,idc));
-            }
-         }
-      }
-      tag = getTagById(4);
-      if(tag)
-      {
-         //1.004 TOT
-         tag_data = tag->dataCopy();
-         transaction_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load transaction %s\n",transaction_.c_str());
-      }
-      tag = getTagById(5);
-      if(tag)
-      {
-         //1.005 DAT YYYYMMDD
-         tag_data = tag->dataCopy();
-         transaction_date_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load transaction date %s\n",transaction_date_.c_str());
-      }
-      tag = getTagById(6);
-      if(tag)
-      {
-         //1.006 PRY 1-9 (optional)
-         tag_data = tag->dataCopy();
-         priority_ = atoi((char*)&tag_data.front());
-         dbg7( (char*)"type1Record::load priority %d\n",priority_);
-      }
-      tag = getTagById(7);
-      if(tag)
-      {
-         //1.007 DAI CC/agency (up to 32 chars)
-         tag_data = tag->dataCopy();
-         destination_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load DAI %s\n",destination_.c_str());
-      }
-      tag = getTagById(8);
-      if(tag)
-      {
-         //1.008 ORI CC/agency (up to 32 chars)
-         tag_data = tag->dataCopy();
-         originating_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load ORI %s\n",originating_.c_str());
-      }
-      tag = getTagById(9);
-      if(tag)
-      {
-         //1.009 TCN YYSSSSSSSSA
-         tag_data = tag->dataCopy();
-         control_number_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load TCN %s\n",control_number_.c_str());
-      }
-      tag = getTagById(10);
-      if(tag)
+      case nistFieldUInt:
+         rec->*(field.uint_) = parseDigits<Width>(p,end);
+         break;
+      case nistFieldByte:
+         rec->*(field.byte_) = (unsigned char)parseDigits<Width>(p,end);
+         break;
+      case nistFieldHex:
+         rec->*(field.uint_) = parseHex(p,end);
+         break;
+      case nistFieldString:
+         (rec->*(field.string_)).assign((const char*)p,end - p);
+         break;
+      case nistFieldImage:
+         rec->image_data_ = tag.data();
+         rec->image_data_size_ = tag.data_size();
+         break;
+      case nistFieldCustom:
+         return field.decode_(*rec,p,end);
+   }
+   return true;
+}
+
+//!Наибольшее число полей в схеме записи, отметки о встреченных полях хранятся на стеке
+static const unsigned nist_schema_max_fields = 64;
+
+//!Сообщает об отсутствующих обязательных полях, возвращает их количество
+template<class R>
+static unsigned reportMissing(const nistFieldSchema<R>* schema, unsigned schema_size, const bool* seen, const char* name)
+{
+   //Имя записи нужно только отладочному выводу
+   (void)name;
+   unsigned missing = 0;
+   for(unsigned field_no=0;field_no<schema_size && field_no<nist_schema_max_fields;field_no++)
+   {
+      if(schema[field_no].mandatory_ && !seen[field_no])
       {
-         //1.010 TCR YYSSSSSSSSA
-         tag_data = tag->dataCopy();
-         responce_control_number_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load TCR %s\n",responce_control_number_.c_str());
+         dbg0( (char*)"%s::load error %s tag missing\n",name,schema[field_no].mnemonic_);
+         missing++;
       }
-      tag = getTagById(11);
-      if(tag)
+   }
+   return missing;
+}
+
+/*!Заполняет поля записи по таблице схемы за один проход по тегам, без копирования данных тегов.
+   Поиск поля по номеру тега выполняется во время работы. 
+   Возвращает количество отсутствующих обязательных и ошибочных полей
+*/
+template<class R>
+static unsigned schemaLoad(R* rec, const nistFieldSchema<R>* schema, unsigned schema_size, const char* name)
+{
+   bool seen[nist_schema_max_fields] = {};
+   unsigned errors = 0;
+   for(unsigned tag_no=0;tag_no<rec->tags_.size();tag_no++)
+   {
+      const nistTag& tag = rec->tags_[tag_no];
+      const nistFieldSchema<R>* field = findField(schema,schema_size,tag.tag_no());
+      if(!field)
       {
-         //1.011 NSR 19.68
-         tag_data = tag->dataCopy();
-         scanning_res_ = atof((char*)&tag_data.front());
+         continue;
       }
-      tag = getTagById(12);
-      if(tag)
+      if(field - schema < (int)nist_schema_max_fields)
       {
-         //1.012 NTR 19.68
-         tag_data = tag->dataCopy();
-         transmitting_res_ = atof((char*)&tag_data.front());
+         seen[field - schema] = true;
       }
-      tag = getTagById(13);
-      if(tag)
+      bool ok = true;
+      switch(field->kind_)
       {
-         //1.013 DOM INT-I{US}4.22{GS}
-         tag_data = tag->dataCopy();
-         domain_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load DOM %s\n",domain_.c_str());
+         case nistFieldUInt:
+            ok = decodeField<R,nistFieldUInt,0>(rec,*field,tag);
+            break;
+         case nistFieldByte:
+            ok = decodeField<R,nistFieldByte,0>(rec,*field,tag);
+            break;
+         case nistFieldHex:
+            ok = decodeField<R,nistFieldHex,0>(rec,*field,tag);
+            break;
+         case nistFieldString:
+            ok = decodeField<R,nistFieldString,0>(rec,*field,tag);
+            break;
+         case nistFieldImage:
+            ok = decodeField<R,nistFieldImage,0>(rec,*field,tag);
+            break;
+         case nistFieldCustom:
+            ok = decodeField<R,nistFieldCustom,0>(rec,*field,tag);
+            break;
       }
-      tag = getTagById(14);
-      if(tag)
+      if(!ok)
       {
-         //1.014 GMT CCYYMMDDHHMMSSZ
-         tag_data = tag->dataCopy();
-         g_mean_time_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load GMT %s\n",g_mean_time_.c_str());
+         dbg0( (char*)"%s::load error invalid %s tag data\n",name,field->mnemonic_);
+         errors++;
       }
-      tag = getTagById(15);
-      if(tag)
+      dbg7( (char*)"%s::load %s size %d\n",name,field->mnemonic_,tag.data_size());
+   }
+   return errors + reportMissing(schema,schema_size,seen,name);
+}
+
+/*!Разбор тега по constexpr схеме: цепочка сравнений с номерами тегов, известными при компиляции,
+   которую компилятор сводит к switch. Возвращает номер поля в схеме или -1, если тег в схеме не описан
+*/
+template<class R, const nistFieldSchema<R>* Schema, unsigned I, unsigned N>
+struct schemaSwitch
+{
+   static inline int decode(R* rec, const nistTag& tag, bool& ok)
+   {
+      if(tag.tag_no()==Schema[I].tag_)
       {
-         //1.015 DCS 
-         tag_data = tag->dataCopy();
-         char_sets_ = (char*)&tag_data.front();
-         dbg7( (char*)"type1Record::load DCS %s\n",char_sets_.c_str());
+         ok = decodeField<R,Schema[I].kind_,Schema[I].width_>(rec,Schema[I],tag);
+         return I;
       }
+      return schemaSwitch<R,Schema,I+1,N>::decode(rec,tag,ok);
+   }
+};
 
-      if(file_content_.size() > 0 && transaction_.length() && control_number_.length()) //Анализ первой записи
+template<class R, const nistFieldSchema<R>* Schema, unsigned N>
+struct schemaSwitch<R,Schema,N,N>
+{
+   static inline int decode(R*, const nistTag&, bool&)
+   {
+      return -1;
+   }
+};
+
+/*!То же, что schemaLoad, но для схемы, известной при компиляции. 
+   Используется для часто встречающихся типов записей (Type-1, Type-2, Type-14)
+*/
+template<class R, const nistFieldSchema<R>* Schema, unsigned N>
+static unsigned schemaDecode(R* rec, const char* name)
+{
+   static_assert(N<=nist_schema_max_fields,"schema is too large");
+   bool seen[N] = {};
+   unsigned errors = 0;
+   for(unsigned tag_no=0;tag_no<rec->tags_.size();tag_no++)
+   {
+      const nistTag& tag = rec->tags_[tag_no];
+      bool ok = true;
+      int field_no = schemaSwitch<R,Schema,0,N>::decode(rec,tag,ok);
+      if(field_no<0)
       {
-         return true;
+         continue;
       }
-      else
+      seen[field_no] = true;
+      if(!ok)
       {
-         dbg0( (char*)"type1Record::load error can't get transaction type or nom\n");
+         dbg0( (char*)"%s::load error invalid %s tag data\n",name,Schema[field_no].mnemonic_);
+         errors++;
       }
+      dbg7( (char*)"%s::load %s size %d\n",name,Schema[field_no].mnemonic_,tag.data_size());
+   }
+   return errors + reportMissing(Schema,N,seen,name);
+}
 
+/*!Значение члена записи совпадает с данными тега, из которого оно разобрано. Тег с несколькими значениями
+   (RS/US) член хранит только первым значением, поэтому такой тег тоже считается неизмененным
+*/
+template<class R>
+static bool tagUnchanged(const R* rec, const nistFieldSchema<R>& field, const nistTag& tag)
+{
+   const unsigned char* p = tag.data();
+   const unsigned char* end = p + tag.data_size();
+   if(!p)
+   {
+      return false;
    }
-   return false;
+   if(std::find(p,end,nistParser::RS())!=end || std::find(p,end,nistParser::US())!=end)
+   {
+      return true;
+   }
+   switch(field.kind_)
+   {
+      case nistFieldUInt:
+         return rec->*(field.uint_)==parseDigits(p,end,field.width_);
+      case nistFieldByte:
+         return rec->*(field.byte_)==(unsigned char)parseDigits(p,end,field.width_);
+      case nistFieldHex:
+         return rec->*(field.uint_)==parseHex(p,end);
+      case nistFieldString:
+         return (rec->*(field.string_)).compare(0,std::string::npos,(const char*)p,end - p)==0;
+      case nistFieldImage:
+         return rec->image_data_==tag.data() && rec->image_data_size_==tag.data_size();
+      case nistFieldCustom:
+         break;
+   }
+   return true;
 }
 
-int type1Record::write(FILE* out, unsigned len)
+/*!Записывает теги записи в порядке их следования в исходном файле. 
+   Поля, не измененные с момента загрузки, и поля с несколькими значениями копируются без изменений,
+   как и теги вне схемы; значения измененных полей из схемы берутся из членов класса
+*/
+template<class R>
+static int schemaWrite(R* rec, const nistFieldSchema<R>* schema, unsigned schema_size, FILE* out, unsigned len)
 {
-    int stpos = ftell(out);
     unsigned char gs;
     gs = nistParser::GS();
-    unsigned char us;
-    us = nistParser::US();
-    unsigned char rs;
-    rs = nistParser::RS();
     unsigned char fs;
     fs = nistParser::FS();
-    std::string st;
-    if (len)
-    {
-        st = "1.001:" + itos(len);
-    }
-    else
-    {
-        st = "1.001:";
-    }
-    fwrite(st.c_str(), 1, st.length(), out);
-    fwrite(&gs, 1, 1, out);
-
-    std::string ss;
-    
-    const nistTag* tag = getTagById(2);
-    if (tag)
+    //Поле 1.001 LEN первое в записи, его значение добавляет writeTagged
+    std::string body;
+    for (unsigned i = 0; i < rec->tags_.size(); i++)
     {
-        ss = "1.002:";
-        ss += fmtz(4,std::to_string(ver_));
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
-    }
+        unsigned tag_no = rec->tags_[i].tag_no();
+        const nistFieldSchema<R>* field = findField(schema, schema_size, tag_no);
+        if (tag_no == 1)
+        {
+        }
+        else if (!field || tagUnchanged(rec, *field, rec->tags_[i]))
+        {
+            body += std::to_string(rec->type_) + "." + fmtz(3, std::to_string(tag_no)) + ":";
+            body.append((const char*)rec->tags_[i].data(), rec->tags_[i].data_size());
+        }
+        else
+        {
+            body += std::to_string(rec->type_) + "." + fmtz(3, std::to_string(tag_no)) + ":";
+            switch (field->kind_)
+            {
+            case nistFieldUInt:
+                body += std::to_string(rec->*(field->uint_));
+                break;
+            case nistFieldByte:
+                body += std::to_string((unsigned)(rec->*(field->byte_)));
+                break;
+            case nistFieldHex:
+            {
+                char x[16];
+                snprintf(x, sizeof(x), "%04X", rec->*(field->uint_));
+                body += x;
+                break;
+            }
+            case nistFieldString:
+                body += rec->*(field->string_);
+                break;
+            case nistFieldImage:
+                if (rec->image_data_)
+                {
+                    body.append((const char*)rec->image_data_, rec->image_data_size_);
+                }
+                break;
+            case nistFieldCustom:
+                body.append((const char*)rec->tags_[i].data(), rec->tags_[i].data_size());
+                break;
+            }
+        }
+
+        if (i + 1 == rec->tags_.size())
+        {
+            body += fs;
+        }
+        else
+        {
+            body += gs;
+        }
+    }
+    return writeTagged(out, rec->type_, body, len);
+}
+
+type1Record::type1Record()
+   :nistRecord()
+{
+   ver_ = 0;
+   priority_ = 0;
+   scanning_res_ = 0.0;
+   transmitting_res_ = 0.0;
+}
+
+type1Record::~type1Record()
+{
+
+}
+
+void type1Record::clear()
+{
+   ver_ = 0;
+   file_content_.clear();
+   transaction_.clear();
+   transaction_date_.clear();
+   priority_ = 0;
+   destination_.clear();
+   originating_.clear();
+   control_number_.clear();
+   responce_control_number_.clear();
+   scanning_res_ = 0.0;
+   transmitting_res_ = 0.0;
+   domain_.clear();
+   g_mean_time_.clear();
+   char_sets_.clear();
+   nistRecord::clear();
+}
+
+constexpr nistFieldSchema<type1Record> type1Record::schema_[] =
+{
+   {  2, "VER",  nistFieldUInt,   false, &type1Record::ver_, 0, 0, 4, 0},
+   {  3, "CNT",  nistFieldCustom, true,  0, 0, 0, 0, &type1Record::decodeCNT},
+   {  4, "TOT",  nistFieldString, true,  0, 0, &type1Record::transaction_, 0, 0},
+   {  5, "DAT",  nistFieldString, true,  0, 0, &type1Record::transaction_date_, 0, 0},
+   {  6, "PRY",  nistFieldUInt,   false, &type1Record::priority_, 0, 0, 1, 0},
+   {  7, "DAI",  nistFieldString, true,  0, 0, &type1Record::destination_, 0, 0},
+   {  8, "ORI",  nistFieldString, true,  0, 0, &type1Record::originating_, 0, 0},
+   {  9, "TCN",  nistFieldString, true,  0, 0, &type1Record::control_number_, 0, 0},
+   { 10, "TCR",  nistFieldString, false, 0, 0, &type1Record::responce_control_number_, 0, 0},
+   { 11, "NSR",  nistFieldCustom, true,  0, 0, 0, 0, &type1Record::decodeNSR},
+   { 12, "NTR",  nistFieldCustom, true,  0, 0, 0, 0, &type1Record::decodeNTR},
+   { 13, "DOM",  nistFieldString, false, 0, 0, &type1Record::domain_, 0, 0},
+   { 14, "GMT",  nistFieldString, false, 0, 0, &type1Record::g_mean_time_, 0, 0},
+   { 15, "DCS",  nistFieldString, false, 0, 0, &type1Record::char_sets_, 0, 0}
+};
+
+const unsigned type1Record::schema_size_ = sizeof(type1Record::schema_)/sizeof(type1Record::schema_[0]);
+
+//!Разбирает число с фиксированной точкой вида 19.68
+static double parseDecimal(const unsigned char* p, const unsigned char* end)
+{
+   double res = parseUInt(p,end);
+   if(p<end && *p=='.')
+   {
+      p++;
+      double scale = 0.1;
+      for(;p<end && *p>='0' && *p<='9';p++,scale/=10)
+      {
+         res += (*p - '0')*scale;
+      }
+   }
+   return res;
+}
+
+bool type1Record::decodeCNT(type1Record& rec, const unsigned char* data, const unsigned char* end)
+{
+   //1.003 CNT <1> US <количество записей> RS <тип записи> US <IDC> RS ...
+   rec.file_content_.clear();
+   const unsigned char* p = data;
+   const unsigned char* item_begin[2];
+   const unsigned char* item_end[2];
+   bool first = true;
+   while(p<end)
+   {
+      if(splitItems(p,end,item_begin,item_end,2)<2)
+      {
+         dbg0("type1Record::load error invalid 1.003 tag data\n");
+         rec.file_content_.clear();
+         return false;
+      }
+      unsigned rec_type = parseUInt(item_begin[0],item_end[0]);
+      unsigned idc = parseUInt(item_begin[1],item_end[1]);
+      if(!first || rec_type!=1)
+      {
+         rec.file_content_.push_back(std::pair<unsigned,unsigned>(rec_type,idc));
+      }
+      first = false;
+   }
+   return true;
+}
+
+bool type1Record::decodeNSR(type1Record& rec, const unsigned char* data, const unsigned char* end)
+{
+   rec.scanning_res_ = parseDecimal(data,end);
+   return true;
+}
+
+bool type1Record::decodeNTR(type1Record& rec, const unsigned char* data, const unsigned char* end)
+{
+   rec.transmitting_res_ = parseDecimal(data,end);
+   return true;
+}
+
+unsigned type1Record::decodeFields()
+{
+   return schemaDecode<type1Record,type1Record::schema_,type1Record::schema_size_>(this,"type1Record");
+}
+
+bool type1Record::load(const nistSpan& data, unsigned& offset,bool force)
+{
+   if(nistRecord::load(data, offset,1,force))
+   {
+      //Как и для Type-2: без обязательных полей запись не загружается, с force загружается то, что разобрано
+      if(decodeFields() && !force)
+      {
+         dbg0( (char*)"type1Record::load error mandatory field missing or invalid\n");
+         return false;
+      }
+      if(ver_>0)
+      {
+         dbg7( (char*)"type1Record::load ver %d\n",ver_);
+      }
+      else
+      {
+         dbg3( (char*)"type1Record::load warning invalid ver value\n");
+      }
+
+      if(file_content_.size() > 0 && transaction_.length() && control_number_.length()) //Анализ первой записи
+      {
+         return true;
+      }
+      else
+      {
+         dbg0( (char*)"type1Record::load error can't get transaction type or nom\n");
+      }
+
+   }
+   return false;
+}
+
+int type1Record::write(FILE* out, unsigned len)
+{
+    unsigned char gs;
+    gs = nistParser::GS();
+    unsigned char us;
+    us = nistParser::US();
+    unsigned char rs;
+    rs = nistParser::RS();
+    unsigned char fs;
+    fs = nistParser::FS();
+    //Каждое поле пишется с предшествующим GS, запись завершается FS
+    std::string body;
+    std::string ss;
+    
+    const nistTag* tag = getTagById(2);
+    if (tag)
+    {
+        ss = "1.002:";
+        ss += fmtz(4,std::to_string(ver_));
+        body += gs;
+        body += ss;
+    }
     tag = getTagById(3);
     if (tag)
     {
-        ss = "1.003:1";
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&us, 1, 1, out);
-        ss =  std::to_string(file_content_.size());
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&rs, 1, 1, out);
+        body += gs;
+        body += "1.003:1";
+        body += us;
+        body += std::to_string(file_content_.size());
 
         for (int i = 0; i < file_content_.size(); i++) 
         {
-            ss = std::to_string(file_content_[i].first);
-            fwrite(ss.c_str(), 1, ss.length(), out);
-            fwrite(&us, 1, 1, out);
-            ss = fmtz(2,std::to_string(file_content_[i].second));
-            fwrite(ss.c_str(), 1, ss.length(), out);
-            if (i + 1 == file_content_.size()) 
-            {
-                fwrite(&gs, 1, 1, out);
-            }
-            else 
-            {
-                fwrite(&rs, 1, 1, out);
-            }
+            body += rs;
+            body += std::to_string(file_content_[i].first);
+            body += us;
+            body += fmtz(2,std::to_string(file_content_[i].second));
         }
 
     }
@@ -645,56 +1135,56 @@ int type1Record::write(FILE* out, unsigned len)
     {
         ss = "1.004:";
         ss += transaction_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(5);
     if (tag)
     {
         ss = "1.005:";
         ss += transaction_date_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(6);
     if (tag)
     {
         ss = "1.006:";
         ss += std::to_string(priority_);
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(7);
     if (tag)
     {
         ss = "1.007:";
         ss += destination_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(8);
     if (tag)
     {
         ss = "1.008:";
         ss += originating_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(9);
     if (tag)
     {
         ss = "1.009:";
         ss += control_number_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(10);
     if (tag)
     {
         ss = "1.010:";
         ss += responce_control_number_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(11);
     if (tag)
@@ -703,8 +1193,8 @@ int type1Record::write(FILE* out, unsigned len)
         ss = "1.011:";
         ss += std::to_string(scanning_res_);
         ss.resize(11);
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(12);
     if (tag)
@@ -712,39 +1202,38 @@ int type1Record::write(FILE* out, unsigned len)
         ss = "1.012:";
         ss += std::to_string(transmitting_res_);
         ss.resize(11);
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(13);
     if (tag)
     {
         ss = "1.013:";
         ss += domain_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
     tag = getTagById(14);
     if (tag)
     {
         ss = "1.014:";
         ss += g_mean_time_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }          
     tag = getTagById(15);
     if (tag)
     {
         ss = "1.015:";
         ss += char_sets_;
-        fwrite(ss.c_str(), 1, ss.length(), out);
-        fwrite(&gs, 1, 1, out);
+        body += gs;
+        body += ss;
     }
-    fseek(out, -1, SEEK_CUR);
-    fwrite(&fs, 1, 1, out);
-    return ftell(out) - stpos;
+    body += fs;
+    return writeTagged(out, 1, body, len);
 }
 
-unsigned type1Record::getRecordType(unsigned rec_no)
+unsigned type1Record::getRecordType(unsigned rec_no) const
 {
    /*
    for(unsigned no = 0 ; no<file_content_.size();no++ )
@@ -762,6 +1251,15 @@ unsigned type1Record::getRecordType(unsigned rec_no)
    return 0;
 }
 
+unsigned type1Record::getRecordIDC(unsigned rec_no) const
+{
+   if(rec_no<file_content_.size())
+   {
+      return file_content_[rec_no].second;
+   }
+   return 0;
+}
+
 type2Record::type2Record()
    :nistRecord()
 {
@@ -774,40 +1272,29 @@ type2Record::~type2Record()
    idc_ = 0;
 }
 
-bool type2Record::load(const std::vector<unsigned char>& data, unsigned& offset, bool force)
+constexpr nistFieldSchema<type2Record> type2Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type2Record::idc_, 0, 2, 0},
+   {  3, "SYS",  nistFieldString, false, 0, 0, &type2Record::sys_, 0, 0}
+};
+
+const unsigned type2Record::schema_size_ = sizeof(type2Record::schema_)/sizeof(type2Record::schema_[0]);
+
+unsigned type2Record::decodeFields()
+{
+   return schemaDecode<type2Record,type2Record::schema_,type2Record::schema_size_>(this,"type2Record");
+}
+
+bool type2Record::load(const nistSpan& data, unsigned& offset, bool force)
 {
    if(nistRecord::load(data, offset,2,force))
    {
-      std::vector<unsigned char> tag_data;
-      const nistTag* tag = getTagById(2);
-      if(tag)
-      {
-         //2.002 IDC 
-         tag_data = tag->dataCopy();
-         idc_ = (unsigned char)atoi((char*)&tag_data.front());
-         dbg7( (char*)"type2Record::load idc %d\n",idc_);
-      }
-      else
+      if(decodeFields() && !force)
       {
-         dbg0( (char*)"type2Record::load error IDC tag missing\n");
+         dbg0( (char*)"type2Record::load error\n");
          return false;
       }
-
-      tag = getTagById(3);
-      if(tag)
-      {
-         //2.003 SYS
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            sys_ = (char*)&tag_data.front();
-            dbg7( (char*)"type2Record::load sys %s\n",sys_.c_str());
-         }
-      }
-      else
-      {
-         dbg7( (char*)"type2Record::load SYS tag missing\n");
-      }
+      dbg7( (char*)"type2Record::load idc %d sys %s\n",idc_,sys_.c_str());
       return true;
    }
    dbg0( (char*)"type2Record::load error\n");
@@ -899,19 +1386,13 @@ void type4Record::clear()
    nistRecord::clear();
 }
 
-bool type4Record::load(const std::vector<unsigned char>& data, unsigned& offset)
+bool type4Record::load(const nistSpan& data, unsigned& offset)
 {
-   if(data.size() && ((offset+sizeof(Type4Header)) <= data.size()))
+   nistCursor cursor(data,offset);
+   Type4Header hdr;
+   if(cursor.binaryHeader(hdr))
    {
-      unsigned curr_offset = offset;
-      const unsigned char* p_data_ = &data.front() + curr_offset;
-      Type4Header hdr;
-      memset(&hdr,0,sizeof(Type4Header));
-      memcpy(&hdr,p_data_,sizeof(Type4Header));
-      hdr.len_ = ntohl(hdr.len_);
-      hdr.hll_ = ntohs(hdr.hll_);
-      hdr.vll_ = ntohs(hdr.vll_);
-      curr_offset+=sizeof(Type4Header);
+      const unsigned char* p_data_ = cursor.pos();
       record_size_ = hdr.len_;
       idc_ = hdr.idc_;
       imp_ = hdr.imp_;
@@ -942,9 +1423,6 @@ bool type4Record::load(const std::vector<unsigned char>& data, unsigned& offset)
 
 int type4Record::write(FILE* out, unsigned len)
 {
-    int stpos = ftell(out);
-    unsigned char fs;
-    fs = nistParser::FS();
     Type4Header hdr;
     unsigned recordsize = record_size_;
     if (len)
@@ -962,12 +1440,12 @@ int type4Record::write(FILE* out, unsigned len)
 
     hdr.vll_ = htons(vll_);
     hdr.cga_ = cga_;
-    fwrite(&hdr, sizeof(Type4Header), 1, out);
+    size_t written = fwrite(&hdr, 1, sizeof(Type4Header), out);
     if (image_data_)
     {
-        fwrite(image_data_, 1, image_data_size_, out);
+        written += fwrite(image_data_, 1, image_data_size_, out);
     }
-    return ftell(out) - stpos;
+    return written==sizeof(Type4Header) + (image_data_ ? image_data_size_ : 0) ? (int)written : -1;
 }
 
 type7Record::type7Record()
@@ -984,26 +1462,19 @@ type7Record::~type7Record()
 {
 }
 
-bool type7Record::load(const std::vector<unsigned char>& data, unsigned& offset)
+bool type7Record::load(const nistSpan& data, unsigned& offset)
 {
    //return type4Record::load(data,offset);
-   if(data.size() && ((offset+sizeof(Type7Header)) <= data.size()))
+   nistCursor cursor(data,offset);
+   Type7Header hdr;
+   if(cursor.binaryHeader(hdr))
    {
-      unsigned curr_offset = offset;
-      const unsigned char* p_data_ = &data.front() + curr_offset;
-      Type7Header hdr;
-      memset(&hdr,0,sizeof(Type7Header));
-      memcpy(&hdr,p_data_,sizeof(Type7Header));
-      hdr.len_ = ntohl(hdr.len_);
-      hdr.hll_ = ntohs(hdr.hll_);
-      hdr.vll_ = ntohs(hdr.vll_);
-      curr_offset+=sizeof(Type7Header);
-
+      const unsigned char* p_data_ = cursor.pos();
       record_size_ = hdr.len_;
       idc_ = hdr.idc_;
       imt_ = hdr.imt_;
       memcpy(pcn_,hdr.pcn_,sizeof(pcn_));
-      memcpy(imr_,hdr.imr_,sizeof(pcn_));
+      memcpy(imr_,hdr.imr_,sizeof(imr_));
       hll_ = hdr.hll_;
       vll_ = hdr.vll_;
       cga_ = hdr.cga_;
@@ -1029,7 +1500,6 @@ bool type7Record::load(const std::vector<unsigned char>& data, unsigned& offset)
 
 int type7Record::write(FILE* out, unsigned len)
 {
-    int stpos = ftell(out);
     Type7Header hdr;
 
     unsigned recordsize = record_size_;
@@ -1047,12 +1517,12 @@ int type7Record::write(FILE* out, unsigned len)
     memcpy(hdr.pcn_, pcn_, sizeof(pcn_));
     memcpy(hdr.imr_, imr_, sizeof(imr_));
     hdr.cga_ = cga_;
-    fwrite(&hdr, sizeof(Type7Header), 1, out);
+    size_t written = fwrite(&hdr, 1, sizeof(Type7Header), out);
     if (image_data_)
     {
-        fwrite(image_data_, 1, image_data_size_, out);
+        written += fwrite(image_data_, 1, image_data_size_, out);
     }
-    return ftell(out) - stpos;
+    return written==sizeof(Type7Header) + (image_data_ ? image_data_size_ : 0) ? (int)written : -1;
 }
 
 type8Record::type8Record()
@@ -1067,20 +1537,13 @@ type8Record::~type8Record()
 {
 }
 
-bool type8Record::load(const std::vector<unsigned char>& data, unsigned& offset)
+bool type8Record::load(const nistSpan& data, unsigned& offset)
 {
-   if(data.size() && ((offset+sizeof(Type8Header)) <= data.size()))
+   nistCursor cursor(data,offset);
+   Type8Header hdr;
+   if(cursor.binaryHeader(hdr))
    {
-      unsigned curr_offset = offset;
-      const unsigned char* p_data_ = &data.front() + curr_offset;
-      Type8Header hdr;
-      memset(&hdr,0,sizeof(Type8Header));
-      memcpy(&hdr,p_data_,sizeof(Type8Header));
-      hdr.len_ = ntohl(hdr.len_);
-      hdr.hll_ = ntohs(hdr.hll_);
-      hdr.vll_ = ntohs(hdr.vll_);
-      curr_offset+=sizeof(Type8Header);
-
+      const unsigned char* p_data_ = cursor.pos();
       record_size_ = hdr.len_;
       idc_ = hdr.idc_;
       sig_ = hdr.sig_;
@@ -1088,7 +1551,7 @@ bool type8Record::load(const std::vector<unsigned char>& data, unsigned& offset)
       vll_ = hdr.vll_;
       srt_ = hdr.srt_;
       cga_ = 0; //Сжатие указывается типом подписи  srt_
-      if(hdr.len_>sizeof(Type7Header))
+      if(hdr.len_>sizeof(Type8Header))
       {
          image_data_ = p_data_+sizeof(Type8Header);
          image_data_size_ = hdr.len_ - sizeof(Type8Header);
@@ -1110,9 +1573,6 @@ bool type8Record::load(const std::vector<unsigned char>& data, unsigned& offset)
 
 int type8Record::write(FILE* out, unsigned len)
 {
-    int stpos = ftell(out);
-    unsigned char fs;
-    fs = nistParser::FS();
     Type8Header hdr;
     unsigned recordsize = record_size_;
     if (len)
@@ -1126,474 +1586,372 @@ int type8Record::write(FILE* out, unsigned len)
     hdr.idc_ = idc_;
     hdr.sig_ = sig_;
     hdr.srt_ = srt_;
-    fwrite(&hdr, sizeof(Type8Header), 1, out);
+    size_t written = fwrite(&hdr, 1, sizeof(Type8Header), out);
     if (image_data_)
     {
-        fwrite(image_data_, 1, image_data_size_, out);
+        written += fwrite(image_data_, 1, image_data_size_, out);
     }
-    return ftell(out) - stpos;
+    return written==sizeof(Type8Header) + (image_data_ ? image_data_size_ : 0) ? (int)written : -1;
 }
 
 
-type9Record::type9Record() 
+type9Record::type9Record(nistArena* arena) 
    : nistRecord()
 {   
    type_ = 9;
+   arena_ = arena;
+   idc_ = 0;
+   imp_ = 0;
+   fmt_ = 0;
+   fgp_ = 0;
+   minutiae_tag_ = 0;
+   minutiae_format_ = nistMinutiaeNone;
+   memset(&local_.minutiae_,0,sizeof(local_.minutiae_));
+   published_.store(0,std::memory_order_relaxed);
 }
 
 type9Record::~type9Record()
 {
+   dropMinutiae();
+}
+
+type9Record::type9Record(const type9Record& other)
+   : nistRecord(other)
+{
+   published_.store(0,std::memory_order_relaxed);
+   assignFields(other);
 }
 
-bool type9Record::load(const std::vector<unsigned char>& data, unsigned& offset)
+type9Record& type9Record::operator=(const type9Record& other)
 {
-   nistTag new_tag;
-   unsigned start_offset = offset;
-   if(new_tag.load(data,offset,0))
+   if(this!=&other)
    {
-      if(new_tag.rec()==9 && new_tag.tag_no()==1)
-      {
-         std::vector<unsigned char> tag_data;
-         tag_data = new_tag.dataCopy();
-         unsigned rec_size = atoi((char*)&tag_data.front());
-         if(rec_size)
-         {            
-            type_ = 9;
-            offset_ = start_offset;
-            record_size_ = rec_size;
-            offset = offset_+record_size_;
-            return true;
-         }
-      }
+      dropMinutiae();
+      nistRecord::operator=(other);
+      assignFields(other);
    }
-   clear();
-   return false;
+   return *this;
 }
 
+void type9Record::assignFields(const type9Record& other)
+{
+   idc_ = other.idc_;
+   imp_ = other.imp_;
+   fmt_ = other.fmt_;
+   fgp_ = other.fgp_;
+   //Тег минуций указывает в tags_ исходной записи, переносится по номеру
+   minutiae_tag_ = other.minutiae_tag_ ? &tags_[other.minutiae_tag_ - &other.tags_.front()] : 0;
+   minutiae_format_ = other.minutiae_format_;
+   arena_ = other.arena_;
+   memset(&local_.minutiae_,0,sizeof(local_.minutiae_));
+}
 
-
-type10Record::type10Record()
-   :type4Record()
+void type9Record::dropMinutiae()
 {
-   type_ = 10;
-   slc_ = 0;
-   hps_ = 0;
-   vps_ = 0;
-   cga_ = "";
-   imt_ = "";
-   ori_ = "";
-   photo_date_ = "";
-   hll_ = 0;
-   vll_ = 0;
-   csp_ = "";
-   pos_ = "";
-   poa_ = "";
-   pxs_ = "";
+   const nistMinutiaeBlock* block = published_.exchange(0,std::memory_order_acq_rel);
+   if(block && block!=&local_)
+   {
+      delete block;
+   }
 }
 
-type10Record::~type10Record()
+void type9Record::clear()
 {
    idc_ = 0;
+   imp_ = 0;
+   fmt_ = 0;
+   fgp_ = 0;
+   minutiae_tag_ = 0;
+   minutiae_format_ = nistMinutiaeNone;
+   dropMinutiae();
+   memset(&local_.minutiae_,0,sizeof(local_.minutiae_));
+   nistRecord::clear();
 }
 
-bool type10Record::load(const std::vector<unsigned char>& data, unsigned& offset)
+bool type9Record::load(const nistSpan& data, unsigned& offset)
 {
-   if(nistRecord::load(data, offset,type_))
+   if(nistRecord::load(data, offset,9))
    {
-      std::vector<unsigned char> tag_data;
-      const nistTag* tag = getTagById(2);
-      if(tag)
+      for(unsigned tag_no=0;tag_no<tags_.size();tag_no++)
       {
-         //10.002 IDC 
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
+         const nistTag& tag = tags_[tag_no];
+         const unsigned char* p = tag.data();
+         const unsigned char* end = p + tag.data_size();
+         switch(tag.tag_no())
          {
-            idc_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"Type10Record::load idc %d\n",idc_);
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load error IDC tag empty\n");
+            case 2:
+               idc_ = (unsigned char)parseUInt(p,end);
+               break;
+            case 3:
+               imp_ = (unsigned char)parseUInt(p,end);
+               break;
+            case 4:
+               fmt_ = p<end ? *p : 0;
+               break;
+            case 6:
+               fgp_ = (unsigned char)parseUInt(p,end);
+               break;
+            case 12:
+               //9.012 MRC - используется, если нет данных в форматах INCITS и EFS
+               if(minutiae_format_==nistMinutiaeNone)
+               {
+                  minutiae_tag_ = &tag;
+                  minutiae_format_ = nistMinutiaeFBI;
+               }
+               break;
+            case 134:
+               fgp_ = (unsigned char)parseUInt(p,end);
+               break;
+            case 137:
+               if(minutiae_format_!=nistMinutiaeEFS)
+               {
+                  minutiae_tag_ = &tag;
+                  minutiae_format_ = nistMinutiaeINCITS;
+               }
+               break;
+            case 331:
+               minutiae_tag_ = &tag;
+               minutiae_format_ = nistMinutiaeEFS;
+               break;
          }
       }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error IDC tag missing\n");
-      }
+      dbg7( (char*)"type9Record::load idc %d fmt %c minutiae format %d\n",idc_,fmt_?fmt_:' ',minutiae_format_);
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type9Record::load error\n");
+   return false;
+}
 
-      tag = getTagById(3);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            imt_ = (const char*)&tag_data.front();
-            dbg7( (char*)"Type10Record::load imp %s\n",imp_);
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load error IMP tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error IMP tag missing\n");
-      }
+//!Приводит код типа минуции в любом из форматов Type-9 к nistMinutiaType
+static int minutiaType(nistMinutiaeFormat format, const unsigned char* p, const unsigned char* end)
+{
+   if(p>=end)
+   {
+      return nistMinutiaOther;
+   }
+   if(format==nistMinutiaeINCITS)
+   {
+      unsigned type = parseUInt(p,end);
+      return type<=2 ? (int)type : (int)nistMinutiaOther;
+   }
+   switch(*p)
+   {
+      case 'A':
+      case 'E':
+         return nistMinutiaRidgeEnding;
+      case 'B':
+         return nistMinutiaBifurcation;
+      case 'C':
+         return format==nistMinutiaeFBI ? nistMinutiaCompound : nistMinutiaOther;
+   }
+   return nistMinutiaOther;
+}
 
-      tag = getTagById(4);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            ori_ = (const char*) &tag_data.front();
-            dbg7( (char*)"Type10Record::load ORI %s\n",ori_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load ORI tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error ORI tag missing\n");
-      }
-
-      tag = getTagById(5);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            photo_date_ = (const char*) &tag_data.front();
-            dbg7( (char*)"Type10Record::load PHD %s\n",photo_date_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load PHD tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error PHD tag missing\n");
-      }
-
-      tag = getTagById(6);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            hll_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"Type10Record::load HLL %d\n",hll_);
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load error HLL tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error HLL tag missing\n");
-      }
+bool type9Record::decodeMinutiae()
+{
+   if(published_.load(std::memory_order_acquire))
+   {
+      return true;
+   }
+   bool res = decodeTo(local_,arena_);
+   const nistMinutiaeBlock* expected = 0;
+   published_.compare_exchange_strong(expected,&local_,std::memory_order_acq_rel);
+   return res;
+}
 
-      tag = getTagById(7);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            vll_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"Type10Record::load VLL %d\n",vll_);
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load error VLL tag empty\n");
-         }
-      }
-      else
+bool type9Record::decodeTo(nistMinutiaeBlock& out, nistArena* arena) const
+{
+   nistMinutiae& minutiae = out.minutiae_;
+   memset(&minutiae,0,sizeof(minutiae));
+   minutiae.format_ = minutiae_format_;
+   if(!minutiae_tag_ || !minutiae_tag_->data_size())
+   {
+      return minutiae_format_==nistMinutiaeNone;
+   }
+   const unsigned char* p = minutiae_tag_->data();
+   const unsigned char* end = p + minutiae_tag_->data_size();
+   unsigned count = std::count(p,end,nistParser::RS()) + 1;
+   unsigned stride = (count + 7) & ~7u;
+   int* block = 0;
+   size_t block_size = 5*stride*sizeof(int);
+   if(arena)
+   {
+      block = (int*)arena->alloc(block_size,32);
+   }
+   else
+   {
+      out.data_.resize(5*stride + 8);
+      block = (int*)((reinterpret_cast<size_t>(&out.data_.front()) + 31) & ~size_t(31));
+   }
+   if(!block)
+   {
+      dbg0( (char*)"type9Record::decodeMinutiae error can't allocate %d minutiae\n",count);
+      return false;
+   }
+   memset(block,0,block_size);
+   int* x = block;
+   int* y = x + stride;
+   int* theta = y + stride;
+   int* type = theta + stride;
+   int* quality = type + stride;
+
+   const unsigned char* item_begin[6];
+   const unsigned char* item_end[6];
+   unsigned decoded = 0;
+   while(p<end && decoded<count)
+   {
+      unsigned items = splitItems(p,end,item_begin,item_end,6);
+      const unsigned char* it = 0;
+      switch(minutiae_format_)
       {
-         dbg0( (char*)"Type10Record::load error VLL tag missing\n");
+         case nistMinutiaeFBI:
+            //<индекс> US <XXXXYYYYTTT> US <качество> US <тип> [US <счетчики гребней>]
+            if(items<2)
+            {
+               continue;
+            }
+            it = item_begin[1];
+            x[decoded] = parseFixed(it,item_end[1],4);
+            y[decoded] = parseFixed(it,item_end[1],4);
+            theta[decoded] = parseFixed(it,item_end[1],3);
+            if(items>2)
+            {
+               it = item_begin[2];
+               quality[decoded] = parseUInt(it,item_end[2]);
+            }
+            type[decoded] = items>3 ? minutiaType(minutiae_format_,item_begin[3],item_end[3]) : nistMinutiaOther;
+            break;
+         case nistMinutiaeINCITS:
+            //<MIN индекс> US <MXC> US <MYC> US <MAV угол в единицах 2 градуса> US <M1M тип> US <MQV качество>
+            if(items<4)
+            {
+               continue;
+            }
+            it = item_begin[1];
+            x[decoded] = parseUInt(it,item_end[1]);
+            it = item_begin[2];
+            y[decoded] = parseUInt(it,item_end[2]);
+            it = item_begin[3];
+            theta[decoded] = 2*parseUInt(it,item_end[3]);
+            type[decoded] = items>4 ? minutiaType(minutiae_format_,item_begin[4],item_end[4]) : nistMinutiaOther;
+            if(items>5)
+            {
+               it = item_begin[5];
+               quality[decoded] = parseUInt(it,item_end[5]);
+            }
+            break;
+         case nistMinutiaeEFS:
+            //<X> US <Y> US <угол> US <тип> [US ...]
+            if(items<3)
+            {
+               continue;
+            }
+            it = item_begin[0];
+            x[decoded] = parseUInt(it,item_end[0]);
+            it = item_begin[1];
+            y[decoded] = parseUInt(it,item_end[1]);
+            it = item_begin[2];
+            theta[decoded] = parseUInt(it,item_end[2]);
+            type[decoded] = items>3 ? minutiaType(minutiae_format_,item_begin[3],item_end[3]) : nistMinutiaOther;
+            break;
+         default:
+            break;
       }
+      decoded++;
+   }
+   minutiae.count_ = decoded;
+   minutiae.stride_ = stride;
+   minutiae.x_ = x;
+   minutiae.y_ = y;
+   minutiae.theta_ = theta;
+   minutiae.type_ = type;
+   minutiae.quality_ = quality;
+   dbg7( (char*)"type9Record::decodeMinutiae idc %d %d minutiae\n",idc_,decoded);
+   return true;
+}
 
-      tag = getTagById(8);
-      if(tag)
+const nistMinutiae& type9Record::getMinutiae() const
+{
+   const nistMinutiaeBlock* block = published_.load(std::memory_order_acquire);
+   if(!block)
+   {
+      nistMinutiaeBlock* fresh = new nistMinutiaeBlock();
+      decodeTo(*fresh,0);
+      if(published_.compare_exchange_strong(block,fresh,std::memory_order_acq_rel,std::memory_order_acquire))
       {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            slc_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"Type10Record::load SLC %d\n",slc_);
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load SLC tag empty\n");
-         }
+         block = fresh;
       }
       else
       {
-         dbg0( (char*)"Type10Record::load error SLC tag missing\n");
+         delete fresh;
       }
+   }
+   return block->minutiae_;
+}
 
-      tag = getTagById(9);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            hps_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"Type10Record::load HPS %d\n",hps_);
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load HPS tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error HPS tag missing\n");
-      }
 
-      tag = getTagById(10);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            vps_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"Type10Record::load VPS %d\n",vps_);
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load VPS tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error VPS tag missing\n");
-      }
 
-      tag = getTagById(11);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            cga_ = (const char*)&tag_data.front();
-            dbg7( (char*)"Type10Record::load CGA %s\n",cga_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load CGA tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error CGA tag missing\n");
-      }
+type10Record::type10Record()
+   :type4Record()
+{
+   type_ = 10;
+   slc_ = 0;
+   hps_ = 0;
+   vps_ = 0;
+   cga_ = "";
+   imt_ = "";
+   ori_ = "";
+   photo_date_ = "";
+   hll_ = 0;
+   vll_ = 0;
+   csp_ = "";
+   pos_ = "";
+   poa_ = "";
+   pxs_ = "";
+}
 
-      tag = getTagById(12);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            csp_ = (const char*)&tag_data.front();
-            dbg7( (char*)"Type10Record::load CSP %s\n",csp_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"Type10Record::load CSP tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"Type10Record::load error CSP tag missing\n");
-      }
+type10Record::~type10Record()
+{
+   idc_ = 0;
+}
 
-      tag = getTagById(20);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            pos_ = (const char*)&tag_data.front();
-            dbg7( (char*)"Type10Record::load POS %s\n",pos_.c_str());
-         }
-      }
+constexpr nistFieldSchema<type10Record> type10Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type10Record::idc_, 0, 0, 0},
+   {  3, "IMT",  nistFieldString, true,  0, 0, &type10Record::imt_, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type10Record::ori_, 0, 0},
+   {  5, "PHD",  nistFieldString, true,  0, 0, &type10Record::photo_date_, 0, 0},
+   {  6, "HLL",  nistFieldUInt,   true,  &type10Record::hll_, 0, 0, 0, 0},
+   {  7, "VLL",  nistFieldUInt,   true,  &type10Record::vll_, 0, 0, 0, 0},
+   {  8, "SLC",  nistFieldByte,   true,  0, &type10Record::slc_, 0, 0, 0},
+   {  9, "HPS",  nistFieldUInt,   true,  &type10Record::hps_, 0, 0, 0, 0},
+   { 10, "VPS",  nistFieldUInt,   true,  &type10Record::vps_, 0, 0, 0, 0},
+   { 11, "CGA",  nistFieldString, true,  0, 0, &type10Record::cga_, 0, 0},
+   { 12, "CSP",  nistFieldString, true,  0, 0, &type10Record::csp_, 0, 0},
+   { 20, "POS",  nistFieldString, false, 0, 0, &type10Record::pos_, 0, 0},
+   { 21, "POA",  nistFieldString, false, 0, 0, &type10Record::poa_, 0, 0},
+   { 22, "PXS",  nistFieldString, false, 0, 0, &type10Record::pxs_, 0, 0},
+   {999, "DAT",  nistFieldImage,  true,  0, 0, 0, 0, 0}
+};
 
-      tag = getTagById(21);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            poa_ = (const char*)&tag_data.front();
-            dbg7( (char*)"Type10Record::load POA %s\n",poa_.c_str());
-         }
-      }
-      tag = getTagById(22);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            pxs_ = (const char*)&tag_data.front();
-            dbg7( (char*)"Type10Record::load PXS %s\n",pxs_.c_str());
-         }
-      }
+const unsigned type10Record::schema_size_ = sizeof(type10Record::schema_)/sizeof(type10Record::schema_[0]);
 
-      tag = getTagById(999);
-      if(tag)
-      {
-         //Field 10.999: Image data (DAT)
-         image_data_ = tag->data();
-         image_data_size_ = tag->data_size();
-         dbg7( (char*)"Type10Record::load image data size %d\n",image_data_size_);
-      }
-      else
-      {
-         image_data_ = 0;
-         image_data_size_ = 0;
-         dbg0( (char*)"Type10Record::load error image data tag missing\n");
-      }
+bool type10Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,10))
+   {
+      schemaLoad(this,schema_,schema_size_,"type10Record");
       return true;
    }
    clear();
-   dbg0( (char*)"Type10Record::load error\n");
+   dbg0( (char*)"type10Record::load error\n");
    return false;
 }
 
-
 int type10Record::write(FILE* out, unsigned len)
 {
-    int stpos = ftell(out);
-    unsigned char gs;
-    gs = nistParser::GS();
-    unsigned char fs;
-    fs = nistParser::FS();
-    for (int i = 0; i < tags_.size(); i++)
-    {
-        std::string number = fmtz(3, std::to_string(tags_[i].tag_no()));
-        std::string str = std::to_string(type_) + "." + number + ":";
-        fwrite(str.c_str(), 1, str.length(), out);
-
-        switch (tags_[i].tag_no())
-        {
-        case 1:
-        {
-            if (len)
-            {
-                std::string x = itos(len);
-                fwrite(x.c_str(), 1, x.length(), out);
-            }
-            break;
-        }
-        case 2:
-        {
-            std::string x = std::to_string(idc_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-        case 3:
-        {
-            fwrite(imt_.c_str(), 1, ori_.length(), out);
-            break;
-        }
-        case 4:
-        {
-            fwrite(ori_.c_str(), 1, ori_.length(), out);
-            break;
-        }
-        case 5:
-        {
-            fwrite(photo_date_.c_str(), 1, photo_date_.length(), out);
-            break;
-        }
-        case 6:
-        {
-            std::string x = std::to_string(hll_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-
-        case 7:
-        {
-            std::string x = std::to_string(vll_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-
-        case 8:
-        {
-            fwrite(&slc_, 1, 1, out);
-            break;
-        }
-
-        case 9:
-        {
-            std::string x = std::to_string(hps_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-
-        case 10:
-        {
-            std::string x = std::to_string(vps_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-
-        case 11:
-        {
-            fwrite(cga_.c_str(), 1, cga_.length(), out);
-            break;
-        }
-        case 12:
-        {
-            fwrite(csp_.c_str(), 1, csp_.length(), out);
-            break;
-        }
-
-        case 20:
-        {
-            fwrite(pos_.c_str(), 1, pos_.length(), out);
-            break;
-        }
-
-        case 21:
-        {
-            fwrite(poa_.c_str(), 1, poa_.length(), out);
-            break;
-        }
-        case 22:
-        {
-            fwrite(pxs_.c_str(), 1, pxs_.length(), out);
-            break;
-        }
-        case 999:
-            if (image_data_)
-            {
-                fwrite(image_data_, 1, image_data_size_, out);
-            }
-            break;
-        default:
-            fwrite(tags_[i].data(), 1, tags_[i].data_size(), out);
-            break;
-        }
-
-
-        if (i + 1 == tags_.size())
-        {
-            fwrite(&fs, 1, 1, out);
-        }
-        else
-        {
-            fwrite(&gs, 1, 1, out);
-        }
-
-    }
-    return ftell(out) - stpos;
+   return schemaWrite(this,schema_,schema_size_,out,len);
 }
 
 type13Record::type13Record()
@@ -1612,1541 +1970,1722 @@ type13Record::~type13Record()
    idc_ = 0;
 }
 
-bool type13Record::load(const std::vector<unsigned char>& data, unsigned& offset)
+constexpr nistFieldSchema<type13Record> type13Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type13Record::idc_, 0, 0, 0},
+   {  3, "IMP",  nistFieldByte,   true,  0, &type13Record::imp_, 0, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type13Record::ori_, 0, 0},
+   {  5, "LCD",  nistFieldString, true,  0, 0, &type13Record::lcd_, 0, 0},
+   {  6, "HLL",  nistFieldUInt,   true,  &type13Record::hll_, 0, 0, 0, 0},
+   {  7, "VLL",  nistFieldUInt,   true,  &type13Record::vll_, 0, 0, 0, 0},
+   {  8, "SLC",  nistFieldByte,   true,  0, &type13Record::slc_, 0, 0, 0},
+   {  9, "HPS",  nistFieldUInt,   true,  &type13Record::hps_, 0, 0, 0, 0},
+   { 10, "VPS",  nistFieldUInt,   true,  &type13Record::vps_, 0, 0, 0, 0},
+   { 11, "CGA",  nistFieldString, true,  0, 0, &type13Record::cga_, 0, 0},
+   { 12, "BPX",  nistFieldByte,   true,  0, &type13Record::bpx_, 0, 0, 0},
+   { 13, "FGP",  nistFieldString, true,  0, 0, &type13Record::fgp_, 0, 0},
+   { 20, "COM",  nistFieldString, false, 0, 0, &type13Record::com_, 0, 0},
+   {999, "DAT",  nistFieldImage,  true,  0, 0, 0, 0, 0}
+};
+
+const unsigned type13Record::schema_size_ = sizeof(type13Record::schema_)/sizeof(type13Record::schema_[0]);
+
+bool type13Record::load(const nistSpan& data, unsigned& offset)
 {
-   if(nistRecord::load(data, offset,type_))
+   if(nistRecord::load(data, offset,13))
    {
-      std::vector<unsigned char> tag_data;
-      const nistTag* tag = getTagById(2);
-      if(tag)
-      {
-         //13.002 IDC 
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            idc_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type13Record::load idc %d\n",idc_);
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load error IDC tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error IDC tag missing\n");
-      }
+      schemaLoad(this,schema_,schema_size_,"type13Record");
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type13Record::load error\n");
+   return false;
+}
 
-      tag = getTagById(3);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            imp_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type13Record::load imp %d\n",imp_);
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load error IMP tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error IMP tag missing\n");
-      }
+int type13Record::write(FILE* out, unsigned len)
+{
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
 
-      tag = getTagById(4);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            ori_ = (const char*) &tag_data.front();
-            dbg7( (char*)"type13Record::load ORI %s\n",ori_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load ORI tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error ORI tag missing\n");
-      }
+unsigned char type13Record::getFGP() const
+{
+   return atoi(fgp_.c_str());
+}
 
-      tag = getTagById(5);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            lcd_ = (const char*) &tag_data.front();
-            dbg7( (char*)"type13Record::load PCD %s\n",lcd_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load PCD tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error PCD tag missing\n");
-      }
+type14Record::type14Record()
+   :type4Record()
+{
+   type_ = 14;
+   slc_ = 0;
+   hps_ = 0;
+   vps_ = 0;
+   cga_ = "";
+   pbx_ = 0;
+}
 
-      tag = getTagById(6);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            hll_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type13Record::load HLL %d\n",hll_);
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load error HLL tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error HLL tag missing\n");
-      }
+type14Record::~type14Record()
+{
+   idc_ = 0;
+}
 
-      tag = getTagById(7);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            vll_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type13Record::load VLL %d\n",vll_);
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load error VLL tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error VLL tag missing\n");
-      }
+constexpr nistFieldSchema<type14Record> type14Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type14Record::idc_, 0, 2, 0},
+   {  3, "IMP",  nistFieldByte,   true,  0, &type14Record::imp_, 0, 2, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type14Record::ori_, 0, 0},
+   {  5, "TCD",  nistFieldString, true,  0, 0, &type14Record::tcd_, 0, 0},
+   {  6, "HLL",  nistFieldUInt,   true,  &type14Record::hll_, 0, 0, 5, 0},
+   {  7, "VLL",  nistFieldUInt,   true,  &type14Record::vll_, 0, 0, 5, 0},
+   {  8, "SLC",  nistFieldByte,   true,  0, &type14Record::slc_, 0, 1, 0},
+   {  9, "HPS",  nistFieldUInt,   true,  &type14Record::hps_, 0, 0, 5, 0},
+   { 10, "VPS",  nistFieldUInt,   true,  &type14Record::vps_, 0, 0, 5, 0},
+   { 11, "CGA",  nistFieldString, true,  0, 0, &type14Record::cga_, 0, 0},
+   { 12, "BPX",  nistFieldByte,   true,  0, &type14Record::pbx_, 0, 2, 0},
+   { 13, "FGP",  nistFieldByte,   true,  0, &type14Record::fgp_, 0, 2, 0},
+   { 20, "COM",  nistFieldString, false, 0, 0, &type14Record::com_, 0, 0},
+   {999, "DAT",  nistFieldImage,  true,  0, 0, 0, 0, 0}
+};
 
-      tag = getTagById(8);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            slc_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type13Record::load SLC %d\n",slc_);
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load SLC tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error SLC tag missing\n");
-      }
+const unsigned type14Record::schema_size_ = sizeof(type14Record::schema_)/sizeof(type14Record::schema_[0]);
 
-      tag = getTagById(9);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            hps_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type13Record::load HPS %d\n",hps_);
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load HPS tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error HPS tag missing\n");
-      }
+unsigned type14Record::decodeFields()
+{
+   return schemaDecode<type14Record,type14Record::schema_,type14Record::schema_size_>(this,"type14Record");
+}
 
-      tag = getTagById(10);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            vps_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type13Record::load VPS %d\n",vps_);
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load VPS tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error VPS tag missing\n");
-      }
+bool type14Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,14))
+   {
+      decodeFields();
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type14Record::load error\n");
+   return false;
+}
 
-      tag = getTagById(11);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            cga_ = (const char*)&tag_data.front();
-            dbg7( (char*)"type13Record::load CGA %s\n",cga_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load CGA tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error CGA tag missing\n");
-      }
+int type14Record::write(FILE* out, unsigned len)
+{
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
 
-      tag = getTagById(12);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            bpx_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type13Record::load PBX %d\n",bpx_);
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load PBX tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error PBX tag missing\n");
-      }
+type15Record::type15Record()
+   :type4Record()
+{
+   type_ = 15;
+   slc_ = 0;
+   hps_ = 0;
+   vps_ = 0;
+   cga_ = "";
+   pbx_ = 0;
+   plp_ = 0;
+}
 
-      tag = getTagById(13);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            fgp_ = (char*)&tag_data.front();
-            dbg7( (char*)"type13Record::load FGP %d\n",fgp_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type13Record::load FGP tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type13Record::load error PLP tag missing\n");
-      }
+type15Record::~type15Record()
+{
+   idc_ = 0;
+}
 
-      tag = getTagById(20);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            com_ = (char*)&tag_data.front();
-            dbg7( (char*)"type13Record::load COM %s\n",com_.c_str());
-         }
-      }
+constexpr nistFieldSchema<type15Record> type15Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type15Record::idc_, 0, 0, 0},
+   {  3, "IMP",  nistFieldByte,   true,  0, &type15Record::imp_, 0, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type15Record::ori_, 0, 0},
+   {  5, "PCD",  nistFieldString, true,  0, 0, &type15Record::pcd_, 0, 0},
+   {  6, "HLL",  nistFieldUInt,   true,  &type15Record::hll_, 0, 0, 0, 0},
+   {  7, "VLL",  nistFieldUInt,   true,  &type15Record::vll_, 0, 0, 0, 0},
+   {  8, "SLC",  nistFieldByte,   true,  0, &type15Record::slc_, 0, 0, 0},
+   {  9, "HPS",  nistFieldUInt,   true,  &type15Record::hps_, 0, 0, 0, 0},
+   { 10, "VPS",  nistFieldUInt,   true,  &type15Record::vps_, 0, 0, 0, 0},
+   { 11, "CGA",  nistFieldString, true,  0, 0, &type15Record::cga_, 0, 0},
+   { 12, "BPX",  nistFieldByte,   true,  0, &type15Record::pbx_, 0, 0, 0},
+   { 13, "PLP",  nistFieldByte,   true,  0, &type15Record::plp_, 0, 0, 0},
+   { 20, "COM",  nistFieldString, false, 0, 0, &type15Record::com_, 0, 0},
+   {999, "DAT",  nistFieldImage,  true,  0, 0, 0, 0, 0}
+};
 
+const unsigned type15Record::schema_size_ = sizeof(type15Record::schema_)/sizeof(type15Record::schema_[0]);
 
-      tag = getTagById(999);
-      if(tag)
-      {
-         //Field 15.999: Image data (DAT)
-         image_data_ = tag->data();
-         image_data_size_ = tag->data_size();
-         dbg7( (char*)"type13Record::load image data size %d\n",image_data_size_);
-      }
-      else
-      {
-         image_data_ = 0;
-         image_data_size_ = 0;
-         dbg0( (char*)"type13Record::load error image data tag missing\n");
-      }
+bool type15Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,15))
+   {
+      schemaLoad(this,schema_,schema_size_,"type15Record");
       return true;
    }
    clear();
-   dbg0( (char*)"type13Record::load error\n");
+   dbg0( (char*)"type15Record::load error\n");
    return false;
 }
 
-int type13Record::write(FILE* out, unsigned len)
+int type15Record::write(FILE* out, unsigned len)
 {
-    int stpos = ftell(out);
-    unsigned char gs;
-    gs = nistParser::GS();
-    unsigned char fs;
-    fs = nistParser::FS();
-    for (int i = 0; i < tags_.size(); i++)
-    {
-        std::string number = fmtz(3, std::to_string(tags_[i].tag_no()));
-        std::string str = std::to_string(type_) + "." + number + ":";
-        fwrite(str.c_str(), 1, str.length(), out);
-        switch (tags_[i].tag_no())
-        {
-        case 1:
-        {
-            if (len)
-            {
-                std::string x = itos(len);
-                fwrite(x.c_str(), 1, x.length(), out);
-            }
-            break;
-        }
-        case 2:
-        {
-            std::string x = std::to_string(idc_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-        case 3:
-        {
-            std::string x = std::to_string(imp_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-        case 4:
-        {
-            fwrite(ori_.c_str(), 1, ori_.length(), out);
-            break;
-        }
-        case 5:
-        {
-            fwrite(lcd_.c_str(), 1, lcd_.length(), out);
-            break;
-        }
-        case 6:
-        {
-            std::string x = std::to_string(hll_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-
-        case 7:
-        {
-            std::string x = std::to_string(vll_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-
-        case 8:
-        {
-            fwrite(&slc_, 1, 1, out);
-            break;
-        }
-
-        case 9:
-        {
-            std::string x = std::to_string(hps_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-
-        case 10:
-        {
-            std::string x = std::to_string(vps_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
 
-        case 11:
-        {
-            fwrite(cga_.c_str(), 1, cga_.length(), out);
-            break;
-        }
-        case 12:
-        {
-            fwrite(&bpx_, 1, 1, out);
-            break;
-        }
+type16Record::type16Record()
+   :type4Record()
+{
+   type_ = 16;
+   slc_ = 0;
+   hps_ = 0;
+   vps_ = 0;
+   bpx_ = 0;
+}
 
-        case 13:
-        {
-            fwrite(fgp_.c_str(), 1, fgp_.length(), out);
-            break;
-        }
+type16Record::~type16Record()
+{
+}
 
-        case 20:
-        {
-            fwrite(com_.c_str(), 1, com_.length(), out);
-            break;
-        }
-        case 999:
-            if (image_data_)
-            {
-                fwrite(image_data_, 1, image_data_size_, out);
-            }
-            break;
-        default:
-            fwrite(tags_[i].data(), 1, tags_[i].data_size(), out);
-            break;
-        }
+constexpr nistFieldSchema<type16Record> type16Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type16Record::idc_, 0, 0, 0},
+   {  3, "UDI",  nistFieldString, true,  0, 0, &type16Record::udi_, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type16Record::ori_, 0, 0},
+   {  5, "UTD",  nistFieldString, true,  0, 0, &type16Record::utd_, 0, 0},
+   {  6, "HLL",  nistFieldUInt,   true,  &type16Record::hll_, 0, 0, 0, 0},
+   {  7, "VLL",  nistFieldUInt,   true,  &type16Record::vll_, 0, 0, 0, 0},
+   {  8, "SLC",  nistFieldByte,   true,  0, &type16Record::slc_, 0, 0, 0},
+   {  9, "THPS", nistFieldUInt,   true,  &type16Record::hps_, 0, 0, 0, 0},
+   { 10, "TVPS", nistFieldUInt,   true,  &type16Record::vps_, 0, 0, 0, 0},
+   { 11, "CGA",  nistFieldString, true,  0, 0, &type16Record::cga_, 0, 0},
+   { 12, "BPX",  nistFieldByte,   true,  0, &type16Record::bpx_, 0, 0, 0},
+   { 13, "CSP",  nistFieldString, true,  0, 0, &type16Record::csp_, 0, 0},
+   {999, "DAT",  nistFieldImage,  true,  0, 0, 0, 0, 0}
+};
 
-        if (i + 1 == tags_.size())
-        {
-            fwrite(&fs, 1, 1, out);
-        }
-        else
-        {
-            fwrite(&gs, 1, 1, out);
-        }
+const unsigned type16Record::schema_size_ = sizeof(type16Record::schema_)/sizeof(type16Record::schema_[0]);
 
-    }
-    return ftell(out) - stpos;
+bool type16Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,16))
+   {
+      schemaLoad(this,schema_,schema_size_,"type16Record");
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type16Record::load error\n");
+   return false;
 }
 
-unsigned char type13Record::getFGP()
+int type16Record::write(FILE* out, unsigned len)
 {
-   return atoi(fgp_.c_str());
+   return schemaWrite(this,schema_,schema_size_,out,len);
 }
 
-type14Record::type14Record()
+type17Record::type17Record()
    :type4Record()
 {
-   type_ = 14;
+   type_ = 17;
+   elr_ = 0;
    slc_ = 0;
    hps_ = 0;
    vps_ = 0;
-   cga_ = "";
-   pbx_ = 0;
+   bpx_ = 0;
 }
 
-type14Record::~type14Record()
+type17Record::~type17Record()
 {
-   idc_ = 0;
 }
 
-bool type14Record::load(const std::vector<unsigned char>& data, unsigned& offset)
+constexpr nistFieldSchema<type17Record> type17Record::schema_[] =
 {
-   if(nistRecord::load(data, offset,type_))
+   {  2, "IDC",  nistFieldByte,   true,  0, &type17Record::idc_, 0, 0, 0},
+   {  3, "ELR",  nistFieldByte,   true,  0, &type17Record::elr_, 0, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type17Record::ori_, 0, 0},
+   {  5, "ICD",  nistFieldString, true,  0, 0, &type17Record::icd_, 0, 0},
+   {  6, "HLL",  nistFieldUInt,   true,  &type17Record::hll_, 0, 0, 0, 0},
+   {  7, "VLL",  nistFieldUInt,   true,  &type17Record::vll_, 0, 0, 0, 0},
+   {  8, "SLC",  nistFieldByte,   true,  0, &type17Record::slc_, 0, 0, 0},
+   {  9, "THPS", nistFieldUInt,   true,  &type17Record::hps_, 0, 0, 0, 0},
+   { 10, "TVPS", nistFieldUInt,   true,  &type17Record::vps_, 0, 0, 0, 0},
+   { 11, "CGA",  nistFieldString, true,  0, 0, &type17Record::cga_, 0, 0},
+   { 12, "BPX",  nistFieldByte,   true,  0, &type17Record::bpx_, 0, 0, 0},
+   { 13, "CSP",  nistFieldString, true,  0, 0, &type17Record::csp_, 0, 0},
+   { 14, "RAE",  nistFieldString, false, 0, 0, &type17Record::rae_, 0, 0},
+   { 15, "RAU",  nistFieldString, false, 0, 0, &type17Record::rau_, 0, 0},
+   { 17, "DUI",  nistFieldString, false, 0, 0, &type17Record::dui_, 0, 0},
+   {999, "DAT",  nistFieldImage,  true,  0, 0, 0, 0, 0}
+};
+
+const unsigned type17Record::schema_size_ = sizeof(type17Record::schema_)/sizeof(type17Record::schema_[0]);
+
+bool type17Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,17))
    {
-      std::vector<unsigned char> tag_data;
-      const nistTag* tag = getTagById(2);
-      if(tag)
-      {
-         //14.002 IDC 
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            idc_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load idc %d\n",idc_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load error IDC tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error IDC tag missing\n");
-      }
+      schemaLoad(this,schema_,schema_size_,"type17Record");
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type17Record::load error\n");
+   return false;
+}
 
-      tag = getTagById(3);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            imp_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load imp %d\n",imp_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load error IMP tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error IMP tag missing\n");
-      }
+int type17Record::write(FILE* out, unsigned len)
+{
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
 
-      tag = getTagById(4);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            ori_ = (const char*) &tag_data.front();
-            dbg7( (char*)"type14Record::load ORI %s\n",ori_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load ORI tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error ORI tag missing\n");
-      }
+type18Record::type18Record()
+   :nistRecord()
+{
+   type_ = 18;
+   idc_ = 0;
+   nal_ = 0;
+}
 
-      tag = getTagById(5);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            tcd_ = (const char*) &tag_data.front();
-            dbg7( (char*)"type14Record::load TCD %s\n",tcd_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load TCD tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error TCD tag missing\n");
-      }
+type18Record::~type18Record()
+{
+}
 
-      tag = getTagById(6);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            hll_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load HLL %d\n",hll_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load error HLL tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error HLL tag missing\n");
-      }
+constexpr nistFieldSchema<type18Record> type18Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type18Record::idc_, 0, 0, 0},
+   {  3, "DLS",  nistFieldString, true,  0, 0, &type18Record::dls_, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type18Record::ori_, 0, 0},
+   {  5, "NAL",  nistFieldUInt,   true,  &type18Record::nal_, 0, 0, 0, 0},
+   {  6, "SDI",  nistFieldString, true,  0, 0, &type18Record::sdi_, 0, 0},
+   {  7, "COPR", nistFieldString, false, 0, 0, &type18Record::copr_, 0, 0},
+   {  8, "VRS",  nistFieldString, false, 0, 0, &type18Record::vrs_, 0, 0}
+};
 
-      tag = getTagById(7);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            vll_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load VLL %d\n",vll_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load error VLL tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error VLL tag missing\n");
-      }
+const unsigned type18Record::schema_size_ = sizeof(type18Record::schema_)/sizeof(type18Record::schema_[0]);
 
-      tag = getTagById(8);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            slc_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load SLC %d\n",slc_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load SLC tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error SLC tag missing\n");
-      }
+bool type18Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,18))
+   {
+      schemaLoad(this,schema_,schema_size_,"type18Record");
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type18Record::load error\n");
+   return false;
+}
 
-      tag = getTagById(9);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            hps_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load HPS %d\n",hps_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load HPS tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error HPS tag missing\n");
-      }
+int type18Record::write(FILE* out, unsigned len)
+{
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
 
-      tag = getTagById(10);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            vps_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load VPS %d\n",vps_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load VPS tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error VPS tag missing\n");
-      }
+type19Record::type19Record()
+   :type4Record()
+{
+   type_ = 19;
+   slc_ = 0;
+   hps_ = 0;
+   vps_ = 0;
+   bpx_ = 0;
+   fgp_ = 0;
+}
 
-      tag = getTagById(11);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            cga_ = (const char*)&tag_data.front();
-            dbg7( (char*)"type14Record::load CGA %s\n",cga_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load CGA tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error CGA tag missing\n");
-      }
+type19Record::~type19Record()
+{
+}
 
-      tag = getTagById(12);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            pbx_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load PBX %d\n",pbx_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load PBX tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error PBX tag missing\n");
-      }
+constexpr nistFieldSchema<type19Record> type19Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type19Record::idc_, 0, 0, 0},
+   {  3, "IMP",  nistFieldByte,   true,  0, &type19Record::imp_, 0, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type19Record::ori_, 0, 0},
+   {  5, "PCD",  nistFieldString, true,  0, 0, &type19Record::pcd_, 0, 0},
+   {  6, "HLL",  nistFieldUInt,   true,  &type19Record::hll_, 0, 0, 0, 0},
+   {  7, "VLL",  nistFieldUInt,   true,  &type19Record::vll_, 0, 0, 0, 0},
+   {  8, "SLC",  nistFieldByte,   true,  0, &type19Record::slc_, 0, 0, 0},
+   {  9, "THPS", nistFieldUInt,   true,  &type19Record::hps_, 0, 0, 0, 0},
+   { 10, "TVPS", nistFieldUInt,   true,  &type19Record::vps_, 0, 0, 0, 0},
+   { 11, "CGA",  nistFieldString, true,  0, 0, &type19Record::cga_, 0, 0},
+   { 12, "BPX",  nistFieldByte,   true,  0, &type19Record::bpx_, 0, 0, 0},
+   { 13, "FGP",  nistFieldByte,   true,  0, &type19Record::fgp_, 0, 0, 0},
+   { 20, "COM",  nistFieldString, false, 0, 0, &type19Record::com_, 0, 0},
+   {999, "DAT",  nistFieldImage,  true,  0, 0, 0, 0, 0}
+};
 
-      tag = getTagById(13);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            fgp_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type14Record::load PLP %d\n",fgp_);
-         }
-         else
-         {
-            dbg0( (char*)"type14Record::load PLP tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type14Record::load error PLP tag missing\n");
-      }
+const unsigned type19Record::schema_size_ = sizeof(type19Record::schema_)/sizeof(type19Record::schema_[0]);
 
-      tag = getTagById(20);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            com_ = (char*)&tag_data.front();
-            dbg7( (char*)"type14Record::load COM %s\n",com_.c_str());
-         }
-      }
+bool type19Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,19))
+   {
+      schemaLoad(this,schema_,schema_size_,"type19Record");
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type19Record::load error\n");
+   return false;
+}
 
-      tag = getTagById(999);
-      if(tag)
-      {
-         //Field 14.999: Image data (DAT)
-         image_data_ = tag->data();
-         image_data_size_ = tag->data_size();
-         dbg7( (char*)"type14Record::load image data size %d\n",image_data_size_);
-      }
-      else
-      {
-         image_data_ = 0;
-         image_data_size_ = 0;
-         dbg0( (char*)"type14Record::load error image data tag missing\n");
-      }
+int type19Record::write(FILE* out, unsigned len)
+{
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
+
+type20Record::type20Record()
+   :type4Record()
+{
+   type_ = 20;
+   slc_ = 0;
+   hps_ = 0;
+   vps_ = 0;
+   bpx_ = 0;
+   srn_ = 0;
+}
+
+type20Record::~type20Record()
+{
+}
+
+constexpr nistFieldSchema<type20Record> type20Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type20Record::idc_, 0, 0, 0},
+   {  3, "CAR",  nistFieldString, true,  0, 0, &type20Record::car_, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type20Record::ori_, 0, 0},
+   {  5, "SRD",  nistFieldString, false, 0, 0, &type20Record::srd_, 0, 0},
+   {  6, "HLL",  nistFieldUInt,   false, &type20Record::hll_, 0, 0, 0, 0},
+   {  7, "VLL",  nistFieldUInt,   false, &type20Record::vll_, 0, 0, 0, 0},
+   {  8, "SLC",  nistFieldByte,   false, 0, &type20Record::slc_, 0, 0, 0},
+   {  9, "THPS", nistFieldUInt,   false, &type20Record::hps_, 0, 0, 0, 0},
+   { 10, "TVPS", nistFieldUInt,   false, &type20Record::vps_, 0, 0, 0, 0},
+   { 11, "CGA",  nistFieldString, false, 0, 0, &type20Record::cga_, 0, 0},
+   { 12, "BPX",  nistFieldByte,   false, 0, &type20Record::bpx_, 0, 0, 0},
+   { 13, "CSP",  nistFieldString, false, 0, 0, &type20Record::csp_, 0, 0},
+   { 14, "AQS",  nistFieldString, false, 0, 0, &type20Record::aqs_, 0, 0},
+   { 15, "SFT",  nistFieldString, true,  0, 0, &type20Record::sft_, 0, 0},
+   { 20, "COM",  nistFieldString, false, 0, 0, &type20Record::com_, 0, 0},
+   { 21, "SRN",  nistFieldUInt,   true,  &type20Record::srn_, 0, 0, 0, 0},
+   {999, "DAT",  nistFieldImage,  false, 0, 0, 0, 0, 0}
+};
+
+const unsigned type20Record::schema_size_ = sizeof(type20Record::schema_)/sizeof(type20Record::schema_[0]);
+
+bool type20Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,20))
+   {
+      schemaLoad(this,schema_,schema_size_,"type20Record");
       return true;
    }
    clear();
-   dbg0( (char*)"type14Record::load error\n");
+   dbg0( (char*)"type20Record::load error\n");
    return false;
 }
 
-int type14Record::write(FILE* out, unsigned len)
+int type20Record::write(FILE* out, unsigned len)
 {
-    int stpos = ftell(out);
-    unsigned char gs;
-    gs = nistParser::GS();
-    unsigned char fs;
-    fs = nistParser::FS();
-    for (int i = 0; i < tags_.size(); i++)
-    {
-        std::string number = fmtz(3, std::to_string(tags_[i].tag_no()));
-        std::string str = std::to_string(type_) + "." + number + ":";
-        fwrite(str.c_str(), 1, str.length(), out);
-        switch (tags_[i].tag_no())
-        {
-        case 1:
-        {
-            if (len)
-            {
-                std::string x = itos(len);
-                fwrite(x.c_str(), 1, x.length(), out);
-            }
-            break;
-        }
-        case 2:
-        {
-            std::string x = std::to_string(idc_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-        case 3:
-        {
-            std::string x = std::to_string(imp_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
-        case 4:
-        {
-            fwrite(ori_.c_str(), 1, ori_.length(), out);
-            break;
-        }
-        case 5:
-        {
-            fwrite(tcd_.c_str(), 1, tcd_.length(), out);
-            break;
-        }
-        case 6:
-        {
-            std::string x = std::to_string(hll_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
+
+type21Record::type21Record()
+   :type4Record()
+{
+   type_ = 21;
+   acn_ = 0;
+}
+
+type21Record::~type21Record()
+{
+}
+
+constexpr nistFieldSchema<type21Record> type21Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type21Record::idc_, 0, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type21Record::ori_, 0, 0},
+   {  5, "ACD",  nistFieldString, false, 0, 0, &type21Record::acd_, 0, 0},
+   { 15, "AFT",  nistFieldString, false, 0, 0, &type21Record::aft_, 0, 0},
+   { 20, "COM",  nistFieldString, false, 0, 0, &type21Record::com_, 0, 0},
+   { 21, "ACN",  nistFieldUInt,   true,  &type21Record::acn_, 0, 0, 0, 0},
+   {999, "DAT",  nistFieldImage,  false, 0, 0, 0, 0, 0}
+};
+
+const unsigned type21Record::schema_size_ = sizeof(type21Record::schema_)/sizeof(type21Record::schema_[0]);
 
-        case 7:
-        {
-            std::string x = std::to_string(vll_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
+bool type21Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,21))
+   {
+      schemaLoad(this,schema_,schema_size_,"type21Record");
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type21Record::load error\n");
+   return false;
+}
 
-        case 8:
-        {
-            fwrite(&slc_, 1, 1, out);
-            break;
-        }
+int type21Record::write(FILE* out, unsigned len)
+{
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
 
-        case 9:
-        {
-            std::string x = std::to_string(hps_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
+type98Record::type98Record()
+   :nistRecord()
+{
+   type_ = 98;
+   idc_ = 0;
+   dfo_ = 0;
+   dft_ = 0;
+}
 
-        case 10:
-        {
-            std::string x = std::to_string(vps_);
-            fwrite(x.c_str(), 1, x.length(), out);
-            break;
-        }
+type98Record::~type98Record()
+{
+}
 
-        case 11:
-        {
-            fwrite(cga_.c_str(), 1, cga_.length(), out);
-            break;
-        }
-        case 12:
-        {
-            fwrite(&pbx_, 1, 1, out);
-            break;
-        }
+constexpr nistFieldSchema<type98Record> type98Record::schema_[] =
+{
+   {  2, "IDC",  nistFieldByte,   true,  0, &type98Record::idc_, 0, 0, 0},
+   {  3, "DFO",  nistFieldHex,    true,  &type98Record::dfo_, 0, 0, 0, 0},
+   {  4, "SRC",  nistFieldString, true,  0, 0, &type98Record::ori_, 0, 0},
+   {  5, "DFT",  nistFieldHex,    true,  &type98Record::dft_, 0, 0, 0, 0},
+   {  6, "DCD",  nistFieldString, true,  0, 0, &type98Record::dcd_, 0, 0}
+};
 
-        case 13:
-        {
-            fwrite(&fgp_, 1, 1, out);
-            break;
-        }
+const unsigned type98Record::schema_size_ = sizeof(type98Record::schema_)/sizeof(type98Record::schema_[0]);
 
-        case 20:
-        {
-            fwrite(com_.c_str(), 1, com_.length(), out);
-            break;
-        }
-        case 999:
-            if (image_data_)
-            {
-                fwrite(image_data_, 1, image_data_size_, out);
-            }
-            break;
-        default:
-            fwrite(tags_[i].data(), 1, tags_[i].data_size(), out);
-            break;
-        }
+bool type98Record::load(const nistSpan& data, unsigned& offset)
+{
+   if(nistRecord::load(data, offset,98))
+   {
+      schemaLoad(this,schema_,schema_size_,"type98Record");
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type98Record::load error\n");
+   return false;
+}
 
-        if (i + 1 == tags_.size())
-        {
-            fwrite(&fs, 1, 1, out);
-        }
-        else
-        {
-            fwrite(&gs, 1, 1, out);
-        }
+int type98Record::write(FILE* out, unsigned len)
+{
+   return schemaWrite(this,schema_,schema_size_,out,len);
+}
 
-    }
-    return ftell(out) - stpos;
+type99Record::type99Record() 
+   : nistRecord()
+{   
+   type_ = 99;
+   idc_ = 0;
+   bty_ = 0;
+   bdq_ = 0;
+   bdq_vendor_ = 0;
+   bdq_algorithm_ = 0;
+   bfo_ = 0;
+   bft_ = 0;
 }
 
-type15Record::type15Record()
-   :type4Record()
+type99Record::~type99Record()
 {
-   type_ = 15;
-   slc_ = 0;
-   hps_ = 0;
-   vps_ = 0;
-   cga_ = "";
-   pbx_ = 0;
-   plp_ = 0;
 }
 
-type15Record::~type15Record()
+void type99Record::clear()
 {
    idc_ = 0;
+   ori_.clear();
+   bcd_.clear();
+   hdv_.clear();
+   bty_ = 0;
+   bdq_ = 0;
+   bdq_vendor_ = 0;
+   bdq_algorithm_ = 0;
+   bfo_ = 0;
+   bft_ = 0;
+   nistRecord::clear();
 }
 
-bool type15Record::load(const std::vector<unsigned char>& data, unsigned& offset)
+bool type99Record::load(const nistSpan& data, unsigned& offset)
 {
-   if(nistRecord::load(data, offset,type_))
+   if(nistRecord::load(data, offset,99))
    {
-      std::vector<unsigned char> tag_data;
-      const nistTag* tag = getTagById(2);
-      if(tag)
+      for(unsigned tag_no=0;tag_no<tags_.size();tag_no++)
       {
-         //15.002 IDC 
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            idc_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load idc %d\n",idc_);
-         }
-         else
+         const nistTag& tag = tags_[tag_no];
+         const unsigned char* p = tag.data();
+         const unsigned char* end = p + tag.data_size();
+         switch(tag.tag_no())
          {
-            dbg0( (char*)"type15Record::load error IDC tag empty\n");
+            case 2:
+               idc_ = (unsigned char)parseUInt(p,end);
+               break;
+            case 4:
+               ori_.assign((const char*)p,end-p);
+               break;
+            case 5:
+               bcd_.assign((const char*)p,end-p);
+               break;
+            case 100:
+               hdv_.assign((const char*)p,end-p);
+               break;
+            case 101:
+               bty_ = parseHex(p,end);
+               break;
+            case 102:
+               {
+                  const unsigned char* item_begin[3];
+                  const unsigned char* item_end[3];
+                  unsigned items = splitItems(p,end,item_begin,item_end,3);
+                  bdq_ = parseUInt(item_begin[0],item_end[0]);
+                  if(items>1)
+                  {
+                     bdq_vendor_ = parseHex(item_begin[1],item_end[1]);
+                  }
+                  if(items>2)
+                  {
+                     bdq_algorithm_ = parseHex(item_begin[2],item_end[2]);
+                  }
+               }
+               break;
+            case 103:
+               bfo_ = parseHex(p,end);
+               break;
+            case 104:
+               bft_ = parseHex(p,end);
+               break;
+            case 999:
+               image_data_ = tag.data();
+               image_data_size_ = tag.data_size();
+               break;
          }
       }
-      else
+      dbg7( (char*)"type99Record::load idc %d BFO %04X BFT %04X BDB size %d\n",idc_,bfo_,bft_,image_data_size_);
+      if(!image_data_)
       {
-         dbg0( (char*)"type15Record::load error IDC tag missing\n");
+         dbg0( (char*)"type99Record::load error BDB tag missing\n");
       }
+      return true;
+   }
+   clear();
+   dbg0( (char*)"type99Record::load error\n");
+   return false;
+}
 
-      tag = getTagById(3);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            imp_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load imp %d\n",imp_);
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load error IMP tag empty\n");
-         }
-      }
-      else
+//!Номера обязательных полей схемы
+template<class R>
+static unsigned schemaMandatory(const nistFieldSchema<R>* schema, unsigned size, unsigned* tags, unsigned max_tags)
+{
+   unsigned cnt = 0;
+   for(unsigned no=0;no<size && cnt<max_tags;no++)
+   {
+      if(schema[no].mandatory_)
       {
-         dbg0( (char*)"type15Record::load error IMP tag missing\n");
+         tags[cnt++] = schema[no].tag_;
       }
+   }
+   return cnt;
+}
 
-      tag = getTagById(4);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            ori_ = (const char*) &tag_data.front();
-            dbg7( (char*)"type15Record::load ORI %s\n",ori_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load ORI tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type15Record::load error ORI tag missing\n");
-      }
+unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags)
+{
+   switch(type)
+   {
+      case 1:
+         return schemaMandatory(type1Record::schema_,type1Record::schema_size_,tags,max_tags);
+      case 2:
+         return schemaMandatory(type2Record::schema_,type2Record::schema_size_,tags,max_tags);
+      case 10:
+         return schemaMandatory(type10Record::schema_,type10Record::schema_size_,tags,max_tags);
+      case 13:
+         return schemaMandatory(type13Record::schema_,type13Record::schema_size_,tags,max_tags);
+      case 14:
+         return schemaMandatory(type14Record::schema_,type14Record::schema_size_,tags,max_tags);
+      case 15:
+         return schemaMandatory(type15Record::schema_,type15Record::schema_size_,tags,max_tags);
+      case 16:
+         return schemaMandatory(type16Record::schema_,type16Record::schema_size_,tags,max_tags);
+      case 17:
+         return schemaMandatory(type17Record::schema_,type17Record::schema_size_,tags,max_tags);
+      case 18:
+         return schemaMandatory(type18Record::schema_,type18Record::schema_size_,tags,max_tags);
+      case 19:
+         return schemaMandatory(type19Record::schema_,type19Record::schema_size_,tags,max_tags);
+      case 20:
+         return schemaMandatory(type20Record::schema_,type20Record::schema_size_,tags,max_tags);
+      case 21:
+         return schemaMandatory(type21Record::schema_,type21Record::schema_size_,tags,max_tags);
+      case 98:
+         return schemaMandatory(type98Record::schema_,type98Record::schema_size_,tags,max_tags);
+   }
+   return 0;
+}
 
-      tag = getTagById(5);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            pcd_ = (const char*) &tag_data.front();
-            dbg7( (char*)"type15Record::load PCD %s\n",pcd_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load PCD tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type15Record::load error PCD tag missing\n");
-      }
+nistParser::nistParser()
+{
+   dbg7( (char*)"nistParser::nistParser\n");
+   lazy_minutiae_ = false;
+   memset(type_begin_,0,sizeof(type_begin_));
+}
 
-      tag = getTagById(6);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            hll_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load HLL %d\n",hll_);
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load error HLL tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type15Record::load error HLL tag missing\n");
-      }
+nistParser::~nistParser()
+{
+   dbg7( (char*)"nistParser::~nistParser\n");
+   release();
+}
 
-      tag = getTagById(7);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            vll_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load VLL %d\n",vll_);
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load error VLL tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type15Record::load error VLL tag missing\n");
-      }
+nistParser::nistParser(nistParser&& other)
+   : err_msg_(std::move(other.err_msg_)), file_data_(std::move(other.file_data_)), header_(std::move(other.header_)),
+     records_(std::move(other.records_)), arena_(std::move(other.arena_)), lazy_minutiae_(other.lazy_minutiae_),
+     header_data_(std::move(other.header_data_)), owned_(std::move(other.owned_))
+{
+   for(unsigned type=0;type<pool_types_;type++)
+   {
+      pool_[type].swap(other.pool_[type]);
+   }
+   takeIndex(other);
+   other.records_.clear();
+   other.header_.clear();
+   other.header_data_.clear();
+   other.owned_.clear();
+   attachArena();
+}
 
-      tag = getTagById(8);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            slc_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load SLC %d\n",slc_);
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load SLC tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type15Record::load error SLC tag missing\n");
-      }
+nistParser& nistParser::operator=(nistParser&& other)
+{
+   if(this!=&other)
+   {
+      release();
+      err_msg_ = std::move(other.err_msg_);
+      file_data_ = std::move(other.file_data_);
+      header_ = std::move(other.header_);
+      records_ = std::move(other.records_);
+      arena_ = std::move(other.arena_);
+      lazy_minutiae_ = other.lazy_minutiae_;
+      header_data_ = std::move(other.header_data_);
+      owned_ = std::move(other.owned_);
+      for(unsigned type=0;type<pool_types_;type++)
+      {
+         pool_[type].swap(other.pool_[type]);
+      }
+      takeIndex(other);
+      other.records_.clear();
+      other.header_.clear();
+      other.header_data_.clear();
+      other.owned_.clear();
+      attachArena();
+   }
+   return *this;
+}
 
-      tag = getTagById(9);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            hps_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load HPS %d\n",hps_);
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load HPS tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type15Record::load error HPS tag missing\n");
-      }
+void nistParser::takeIndex(nistParser& other)
+{
+   by_type_.swap(other.by_type_);
+   memcpy(type_begin_,other.type_begin_,sizeof(type_begin_));
+   memset(other.type_begin_,0,sizeof(other.type_begin_));
+   records_idc_.swap(other.records_idc_);
+   idc_entries_.swap(other.idc_entries_);
+   idc_keys_.swap(other.idc_keys_);
+   by_idc_.swap(other.by_idc_);
+   idc_groups_.swap(other.idc_groups_);
+   other.idc_groups_.clear();
+   other.by_type_.clear();
+   other.records_idc_.clear();
+   other.idc_entries_.clear();
+   other.idc_keys_.clear();
+   other.by_idc_.clear();
+}
 
-      tag = getTagById(10);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            vps_ = atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load VPS %d\n",vps_);
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load VPS tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type15Record::load error VPS tag missing\n");
-      }
+/*!Ключ записи в индексе по IDC. Внутри одного IDC записи упорядочены по группам: 
+   0 - Type-2, 1 - Type-9, 2 - изображения, 3 - остальные, чтобы каждая группа была непрерывным диапазоном
+*/
+static unsigned idcKey(unsigned idc, unsigned type)
+{
+   unsigned group = 3;
+   switch(type)
+   {
+      case 2:
+         group = 0;
+         break;
+      case 9:
+         group = 1;
+         break;
+      case 3: case 4: case 5: case 6: case 7: case 8:
+      case 10: case 13: case 14: case 15: case 16: case 17: case 19: case 20:
+         group = 2;
+         break;
+   }
+   return idc<<10 | group<<8 | (type & 0xFF);
+}
 
-      tag = getTagById(11);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            cga_ = (const char*)&tag_data.front();
-            dbg7( (char*)"type15Record::load CGA %s\n",cga_.c_str());
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load CGA tag empty\n");
-         }
-      }
-      else
-      {
-         dbg0( (char*)"type15Record::load error CGA tag missing\n");
-      }
+void nistParser::buildIndex()
+{
+   //Подсчет записей по типам и размещение их группами с сохранением порядка в файле
+   memset(type_begin_,0,sizeof(type_begin_));
+   for(unsigned rec_no=0;rec_no<records_.size();rec_no++)
+   {
+      type_begin_[records_[rec_no]->type() + 1]++;
+   }
+   for(unsigned type=0;type<pool_types_;type++)
+   {
+      type_begin_[type + 1] += type_begin_[type];
+   }
+   by_type_.resize(records_.size());
+   unsigned fill[pool_types_];
+   memcpy(fill,type_begin_,sizeof(fill));
+   for(unsigned rec_no=0;rec_no<records_.size();rec_no++)
+   {
+      by_type_[fill[records_[rec_no]->type()]++] = records_[rec_no];
+   }
 
-      tag = getTagById(12);
-      if(tag)
-      {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            pbx_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load PBX %d\n",pbx_);
-         }
-         else
-         {
-            dbg0( (char*)"type15Record::load PBX tag empty\n");
-         }
-      }
-      else
+   idc_entries_.clear();
+   for(unsigned rec_no=0;rec_no<records_.size();rec_no++)
+   {
+      idc_entries_.push_back(std::make_pair(idcKey(records_idc_[rec_no],records_[rec_no]->type()),records_[rec_no]));
+   }
+   //Устойчивая сортировка вставками: записей в транзакции немного и они обычно уже упорядочены по IDC
+   for(unsigned entry_no=1;entry_no<idc_entries_.size();entry_no++)
+   {
+      std::pair<unsigned,nistRecord*> entry = idc_entries_[entry_no];
+      unsigned pos = entry_no;
+      while(pos>0 && idc_entries_[pos - 1].first>entry.first)
       {
-         dbg0( (char*)"type15Record::load error PBX tag missing\n");
+         idc_entries_[pos] = idc_entries_[pos - 1];
+         pos--;
       }
+      idc_entries_[pos] = entry;
+   }
+   idc_keys_.resize(idc_entries_.size());
+   by_idc_.resize(idc_entries_.size());
+   for(unsigned entry_no=0;entry_no<idc_entries_.size();entry_no++)
+   {
+      idc_keys_[entry_no] = idc_entries_[entry_no].first;
+      by_idc_[entry_no] = idc_entries_[entry_no].second;
+   }
 
-      tag = getTagById(13);
-      if(tag)
+   //Перекрестные ссылки: границы IDC и групп типов внутри него
+   idc_groups_.clear();
+   unsigned pos = 0;
+   while(pos<by_idc_.size())
+   {
+      nistIdcGroup group;
+      memset(&group,0,sizeof(group));
+      group.idc_ = idc_keys_[pos]>>10;
+      group.records_.begin_ = &by_idc_.front() + pos;
+      while(pos<by_idc_.size() && (idc_keys_[pos]>>10)==group.idc_)
       {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
+         nistConstRecordRange* range = 0;
+         switch((idc_keys_[pos]>>8) & 3)
          {
-            plp_ = (unsigned char)atoi((char*)&tag_data.front());
-            dbg7( (char*)"type15Record::load PLP %d\n",plp_);
+            case 0:
+               range = &group.type2_;
+               break;
+            case 1:
+               range = &group.minutiae_;
+               break;
+            case 2:
+               range = &group.images_;
+               break;
          }
-         else
+         if(range)
          {
-            dbg0( (char*)"type15Record::load PLP tag empty\n");
+            if(!range->begin_)
+            {
+               range->begin_ = &by_idc_.front() + pos;
+            }
+            range->end_ = &by_idc_.front() + pos + 1;
          }
+         pos++;
       }
-      else
+      group.records_.end_ = &by_idc_.front() + pos;
+      idc_groups_.push_back(group);
+   }
+}
+
+void nistParser::release()
+{
+   for(unsigned record_no=0;record_no<records_.size();record_no++)
+   {
+      delete records_[record_no];
+   }
+   records_.clear();
+   for(unsigned type=0;type<pool_types_;type++)
+   {
+      for(unsigned record_no=0;record_no<pool_[type].size();record_no++)
       {
-         dbg0( (char*)"type15Record::load error PLP tag missing\n");
+         delete pool_[type][record_no];
       }
+      pool_[type].clear();
+   }
+}
 
-      tag = getTagById(20);
-      if(tag)
+void nistParser::attachArena()
+{
+   for(unsigned record_no=0;record_no<records_.size();record_no++)
+   {
+      if(records_[record_no]->type()==9)
       {
-         tag_data = tag->dataCopy();
-         if(tag_data.size())
-         {
-            com_ = (char*)&tag_data.front();
-            dbg7( (char*)"type15Record::load COM %s\n",com_.c_str());
-         }
+         static_cast<type9Record*>(records_[record_no])->setArena(&arena_);
       }
+   }
+   for(unsigned record_no=0;record_no<pool_[9].size();record_no++)
+   {
+      static_cast<type9Record*>(pool_[9][record_no])->setArena(&arena_);
+   }
+}
 
-
-      tag = getTagById(999);
-      if(tag)
+void nistParser::reset()
+{
+   for(unsigned record_no=0;record_no<records_.size();record_no++)
+   {
+      nistRecord* rec = records_[record_no];
+      if(rec->type()<pool_types_)
       {
-         //Field 15.999: Image data (DAT)
-         image_data_ = tag->data();
-         image_data_size_ = tag->data_size();
-         dbg7( (char*)"type15Record::load image data size %d\n",image_data_size_);
+         pool_[rec->type()].push_back(rec);
       }
       else
       {
-         image_data_ = 0;
-         image_data_size_ = 0;
-         dbg0( (char*)"type15Record::load error image data tag missing\n");
+         delete rec;
       }
-      return true;
    }
-   clear();
-   dbg0( (char*)"type15Record::load error\n");
-   return false;
+   records_.clear();
+   header_.clear();
+   arena_.reset();
+   err_msg_.clear();
+   by_type_.clear();
+   memset(type_begin_,0,sizeof(type_begin_));
+   records_idc_.clear();
+   idc_entries_.clear();
+   idc_keys_.clear();
+   by_idc_.clear();
+   idc_groups_.clear();
+   header_data_.clear();
+   owned_.clear();
 }
 
-int type15Record::write(FILE* out, unsigned len)
+bool nistParser::load(const std::string& file,bool force)
 {
-    int stpos = ftell(out);
-    unsigned char gs;
-    gs = nistParser::GS();
-    unsigned char fs;
-    fs = nistParser::FS();
-    for (int i = 0; i < tags_.size(); i++)
-    {
-        
-        std::string number = fmtz(3, std::to_string(tags_[i].tag_no()));
-        std::string str = std::to_string(type_) + "." + number + ":";
-        fwrite(str.c_str(), 1, str.length(), out);
+   dbg7( (char*)"nistParser::load %s\n",file.c_str());
+   bool res = false;
+   if(readFile(file,file_data_))
+   {
+      dbg7( (char*)"nistParser::load file read Ok\n");
+      return load(file_data_,force);
+   }
+   else
+   {
+      dbg0("nistParser::load file read error\n");
+   }
 
-        switch (tags_[i].tag_no()) 
-        {
-            case 1:
-            {
-                if (len) 
-                {
-                    std::string x = itos(len);
-                    fwrite(x.c_str(), 1, x.length(), out);
-                }
-                break;
-            }
-            case 2: 
-            {
-                std::string x = std::to_string(idc_);
-                fwrite(x.c_str(), 1, x.length(), out);
-                break;
-            }
-            case 3:
+   return res;
+}
+
+bool nistParser::loadSwap(std::vector<unsigned char>& data, bool force)
+{
+   file_data_.swap(data);
+   return load(file_data_,force);
+}
+
+/*!Берет запись типа R из списка свободных и приводит ее к состоянию blank. 
+   Копирующее присваивание сохраняет емкость строк и векторов записи. Если список пуст, создает новую запись
+*/
+template<class R>
+static R* takeRecord(std::vector<nistRecord*>& pool, const R& blank)
+{
+   if(pool.empty())
+   {
+      return new R(blank);
+   }
+   R* rec = static_cast<R*>(pool.back());
+   pool.pop_back();
+   *rec = blank;
+   return rec;
+}
+
+//!Загружает запись типа R из буфера. При ошибке запись возвращается в список свободных
+template<class R>
+static bool addRecord(std::vector<nistRecord*>& records, std::vector<nistRecord*>& pool, const nistSpan& file_data, unsigned& offset)
+{
+   R* new_rec = takeRecord(pool,R());
+   if(!new_rec->load(file_data,offset))
+   {
+      pool.push_back(new_rec);
+      return false;
+   }
+   records.push_back(new_rec);
+   return true;
+}
+
+bool nistParser::loadRecord(unsigned rec_type, const nistSpan& file_data, unsigned& offset, bool force)
+{
+   bool rec_res = false;
+   switch(rec_type)
+   {
+      case 2:
+         {
+            type2Record* new_rec = takeRecord(pool_[2],type2Record());
+            rec_res = new_rec->load(file_data,offset,force);
+            if(!rec_res)
             {
-                std::string x = std::to_string(imp_);
-                fwrite(x.c_str(), 1, x.length(), out);
-                break;
+               pool_[2].push_back(new_rec);
             }
-            case 4:
+            else
             {
-                fwrite(ori_.c_str(), 1, ori_.length(), out);
-                break;
+               records_.push_back(new_rec);
             }
-            case 5:
+         }
+         break;
+      case 4:
+         rec_res = addRecord<type4Record>(records_,pool_[4],file_data,offset);
+         break;
+      case 7:
+         rec_res = addRecord<type7Record>(records_,pool_[7],file_data,offset);
+         break;
+      case 8:
+         rec_res = addRecord<type8Record>(records_,pool_[8],file_data,offset);
+         break;
+      case 9:
+         {
+            type9Record* new_rec = takeRecord(pool_[9],type9Record(&arena_));
+            rec_res = new_rec->load(file_data,offset) && (lazy_minutiae_ || new_rec->decodeMinutiae());
+            if(!rec_res)
             {
-                fwrite(pcd_.c_str(), 1, pcd_.length(), out);
-                break;
+               pool_[9].push_back(new_rec);
             }
-            case 6:
+            else
             {
-                std::string x = std::to_string(hll_);
-                fwrite(x.c_str(), 1, x.length(), out);
-                break;
+               records_.push_back(new_rec);
             }
+         }
+         break;
+      case 10:
+         rec_res = addRecord<type10Record>(records_,pool_[10],file_data,offset);
+         break;
+      case 13:
+         rec_res = addRecord<type13Record>(records_,pool_[13],file_data,offset);
+         break;
+      case 14:
+         rec_res = addRecord<type14Record>(records_,pool_[14],file_data,offset);
+         break;
+      case 15:
+         rec_res = addRecord<type15Record>(records_,pool_[15],file_data,offset);
+         break;
+      case 16:
+         rec_res = addRecord<type16Record>(records_,pool_[16],file_data,offset);
+         break;
+      case 17:
+         rec_res = addRecord<type17Record>(records_,pool_[17],file_data,offset);
+         break;
+      case 18:
+         rec_res = addRecord<type18Record>(records_,pool_[18],file_data,offset);
+         break;
+      case 19:
+         rec_res = addRecord<type19Record>(records_,pool_[19],file_data,offset);
+         break;
+      case 20:
+         rec_res = addRecord<type20Record>(records_,pool_[20],file_data,offset);
+         break;
+      case 21:
+         rec_res = addRecord<type21Record>(records_,pool_[21],file_data,offset);
+         break;
+      case 98:
+         rec_res = addRecord<type98Record>(records_,pool_[98],file_data,offset);
+         break;
+      case 99:
+         rec_res = addRecord<type99Record>(records_,pool_[99],file_data,offset);
+         break;
+      default:
+         dbg0("nistParser::load from memory error: unknown record type %d\n",rec_type);
+         break;
+   };
+   return rec_res;
+}
 
-            case 7:
-            {
-                std::string x = std::to_string(vll_);
-                fwrite(x.c_str(), 1, x.length(), out);
-                break;
-            }
+bool nistParser::load(const std::vector<unsigned char>& file_data, bool force)
+{
+   return load(file_data.empty() ? 0 : &file_data.front(),file_data.size(),force);
+}
 
-            case 8:
-            {
-                fwrite(&slc_, 1, 1, out);
-                break;
-            }
+bool nistParser::load(const unsigned char* data, size_t size, bool force)
+{
+   dbg7( (char*)"nistParser::load from memory data size %d\n",(int)size);
+   bool res = false;
+   unsigned offset = 0;
+   err_msg_ = "";
 
-            case 9:
-            {
-                std::string x = std::to_string(hps_);
-                fwrite(x.c_str(), 1, x.length(), out);
-                break;
-            }
+   reset();
+   nistMetrics::count(nistCounterFilesLoaded);
 
-            case 10:
-            {
-                std::string x = std::to_string(vps_);
-                fwrite(x.c_str(), 1, x.length(), out);
-                break;
-            }
+   //Смещения записей и тегов 32-битные
+   if(size>0xFFFFFFFFu)
+   {
+      dbg0("nistParser::load from memory error: data size %zu too large\n",size);
+      err_msg_ = "Transaction too large ";
+      nistMetrics::count(nistCounterLoadErrors);
+      return false;
+   }
+   nistSpan file_data(data,size);
 
-            case 11:
-            {
-                fwrite(cga_.c_str(), 1, cga_.length(), out);
-                break;
-            }
-            case 12:
-            {
-                fwrite(&pbx_, 1, 1, out);
-                break;
-            }
+   {
+      nistPhaseTimer timer(nistPhaseType1);
+      res = header_.load(file_data,offset,force);
+   }
 
-            case 13:
-            {
-                std::string x = std::to_string(plp_);
-                fwrite(x.c_str(), 1, x.length(), out);
-                break;
-            }
- 
-            case 20:
+   if(!res)
+   {
+      dbg0("nistParser::load from memory parse error\n");
+      nistMetrics::error(1);
+      nistMetrics::count(nistCounterLoadErrors);
+      return false;
+   }
+   else
+   {
+      nistMetrics::record(1,header_.record_size_);
+      nistMetrics::count(nistCounterTagsTokenized,header_.tagsCnt());
+      unsigned recs = header_.getRecordsCnt();
+      for(unsigned rec_no=0; rec_no<recs;rec_no++)
+      {
+         
+         unsigned rec_type  = header_.getRecordType(rec_no);
+         unsigned rec_offset = offset;
+         bool rec_res = false;
+     
+         dbg7("nistParser::load from record type %d\n",rec_type);
+         nistPhaseTimer timer(nistPhaseDecode,rec_type);
+         if(rec_type==1)
+         {
+            continue;
+         }
+         rec_res = loadRecord(rec_type,file_data,offset,force);
+         if(rec_res)
+         {
+            records_.back()->offset_ = rec_offset;
+            records_idc_.push_back(header_.getRecordIDC(rec_no));
+            nistMetrics::record(rec_type,offset - rec_offset);
+            nistMetrics::count(nistCounterTagsTokenized,records_.back()->tagsCnt());
+         }
+         else
+         {
+            err_msg_ += "Invalid Type" + std::to_string(rec_type) + " record ";
+            nistMetrics::error(rec_type);
+            res = false;
+            if(!force)
             {
-                fwrite(com_.c_str(), 1, com_.length(), out);
-                break;
+               break;
             }
+         }
+      }
+   }
+   buildIndex();
+   if(!res)
+   {
+      nistMetrics::count(nistCounterLoadErrors);
+   }
+   return force? true:res;
+}
 
-            case 999:
-                if (image_data_)
-                {
-                    fwrite(image_data_, 1, image_data_size_, out);
-                }
-                break;
-            default:
-                fwrite(tags_[i].data(), 1, tags_[i].data_size(), out);
-            break;
-        }
-             
-        
-        if (i + 1 == tags_.size())
-        {
-            fwrite(&fs, 1, 1, out);
-        }
-        else
-        {
-            fwrite(&gs, 1, 1, out);
-        }
+//!Поле собираемой записи: номер и данные без идентификатора и разделителя
+struct nistFieldData
+{
+   unsigned tag_;
+   const unsigned char* data_;
+   unsigned size_;
+};
 
-    }
-    return ftell(out) - stpos;
+//!Поля записи, кроме LEN, в порядке записи
+static void recordFields(const nistRecord& rec, std::vector<nistFieldData>& fields)
+{
+   fields.clear();
+   for(unsigned tag_no=0;tag_no<rec.tagsCnt();tag_no++)
+   {
+      const nistTag* tag = rec.getTag(tag_no);
+      if(tag->tag_no()!=1)
+      {
+         nistFieldData field = {tag->tag_no(),tag->data(),tag->data_size()};
+         fields.push_back(field);
+      }
+   }
 }
 
-type99Record::type99Record() 
-   : nistRecord()
-{   
-   type_ = 99;
+//!Заменяет поле tag или вставляет его по порядку номеров
+static void setFieldData(std::vector<nistFieldData>& fields, unsigned tag, const unsigned char* data, unsigned size)
+{
+   nistFieldData field = {tag,data,size};
+   for(size_t no=0;no<fields.size();no++)
+   {
+      if(fields[no].tag_==tag)
+      {
+         fields[no] = field;
+         return;
+      }
+      if(fields[no].tag_>tag)
+      {
+         fields.insert(fields.begin() + no,field);
+         return;
+      }
+   }
+   fields.push_back(field);
 }
 
-type99Record::~type99Record()
+size_t nistUtf8Length(const unsigned char* p, const unsigned char* end)
+{
+   size_t len;
+   unsigned code;
+   if(*p>=0xC2 && *p<=0xDF)
+   {
+      len = 2;
+      code = *p & 0x1F;
+   }
+   else if(*p>=0xE0 && *p<=0xEF)
+   {
+      len = 3;
+      code = *p & 0x0F;
+   }
+   else if(*p>=0xF0 && *p<=0xF4)
+   {
+      len = 4;
+      code = *p & 0x07;
+   }
+   else
+   {
+      return 0;
+   }
+   if((size_t)(end - p)<len)
+   {
+      return 0;
+   }
+   for(size_t no=1;no<len;no++)
+   {
+      if((p[no] & 0xC0)!=0x80)
+      {
+         return 0;
+      }
+      code = (code<<6) | (p[no] & 0x3F);
+   }
+   //Избыточная запись, суррогаты и значения за пределами Unicode
+   if((len==3 && code<0x800) || (len==4 && (code<0x10000 || code>0x10FFFF)) || (code>=0xD800 && code<=0xDFFF))
+   {
+      return 0;
+   }
+   return len;
+}
+
+unsigned long long nistTaggedRecordLen(unsigned long long other, char* digits)
+{
+   unsigned long long len = other + 1;
+   for(;;)
+   {
+      unsigned long long new_len = other + snprintf(digits,24,"%llu",len);
+      if(new_len==len)
+      {
+         return len;
+      }
+      len = new_len;
+   }
+}
+
+/*!Собирает текстовую запись type из полей в out. Длина известна заранее, 
+   LEN вычисляется вместе с собственными цифрами без повторной сборки
+*/
+static bool encodeRecord(unsigned type, const std::vector<nistFieldData>& fields, std::vector<unsigned char>& out)
+{
+   char prefix[32];
+   unsigned long long size = 0;
+   for(size_t no=0;no<fields.size();no++)
+   {
+      size += snprintf(prefix,sizeof(prefix),"%u.%03u:",type,fields[no].tag_) + (unsigned long long)fields[no].size_ + 1;
+   }
+   unsigned head = snprintf(prefix,sizeof(prefix),"%u.001:",type);
+   char digits[32];
+   unsigned long long len = nistTaggedRecordLen(head + 1 + size,digits);
+   if(len>0xFFFFFFFFull)
+   {
+      dbg0("nistParser: record type %u is too large\n",type);
+      return false;
+   }
+   out.clear();
+   out.reserve(len);
+   out.insert(out.end(),prefix,prefix + head);
+   out.insert(out.end(),digits,digits + strlen(digits));
+   out.push_back(nistParser::GS());
+   for(size_t no=0;no<fields.size();no++)
+   {
+      unsigned id_size = snprintf(prefix,sizeof(prefix),"%u.%03u:",type,fields[no].tag_);
+      out.insert(out.end(),prefix,prefix + id_size);
+      out.insert(out.end(),fields[no].data_,fields[no].data_ + fields[no].size_);
+      out.push_back(nistParser::GS());
+   }
+   out.back() = nistParser::FS();
+   return true;
+}
+
+bool nistParser::reloadRecord(unsigned rec_no, std::vector<unsigned char>& data)
+{
+   unsigned offset = 0;
+   nistRecord* old_rec = records_[rec_no];
+   if(!loadRecord(old_rec->type(),data,offset,false))
+   {
+      dbg0("nistParser::reloadRecord can't load rebuilt record type %u\n",old_rec->type());
+      return false;
+   }
+   //Перемещение вектора сохраняет его буфер, указатели загруженной записи остаются действительными
+   nistRecord* new_rec = records_.back();
+   records_.pop_back();
+   records_[rec_no] = new_rec;
+   owned_.erase(old_rec);
+   owned_[new_rec].swap(data);
+   pool_[old_rec->type()].push_back(old_rec);
+   return true;
+}
+
+bool nistParser::rebuildHeader(unsigned tag, const std::string& value)
+{
+   std::string cnt = "1";
+   cnt += US();
+   cnt += std::to_string(records_.size());
+   char item[32];
+   for(unsigned rec_no=0;rec_no<records_.size();rec_no++)
+   {
+      snprintf(item,sizeof(item),"%c%u%c%02u",RS(),records_[rec_no]->type(),US(),records_idc_[rec_no]);
+      cnt += item;
+   }
+   std::vector<nistFieldData> fields;
+   recordFields(header_,fields);
+   setFieldData(fields,3,(const unsigned char*)cnt.data(),cnt.size());
+   if(tag)
+   {
+      setFieldData(fields,tag,(const unsigned char*)value.data(),value.size());
+   }
+   std::vector<unsigned char> data;
+   type1Record header;
+   unsigned offset = 0;
+   if(!encodeRecord(1,fields,data) || !header.load(data,offset))
+   {
+      dbg0("nistParser::rebuildHeader can't load rebuilt Type-1\n");
+      return false;
+   }
+   header_ = std::move(header);
+   header_data_.swap(data);
+   return true;
+}
+
+void nistParser::updateLayout()
 {
+   unsigned offset = header_.recordSize();
+   for(unsigned rec_no=0;rec_no<records_.size();rec_no++)
+   {
+      records_[rec_no]->offset_ = offset;
+      offset += records_[rec_no]->recordSize();
+   }
+   buildIndex();
 }
 
-bool type99Record::load(const std::vector<unsigned char>& data, unsigned& offset)
-{
-   nistTag new_tag;
-   unsigned start_offset = offset;
-   if(new_tag.load(data,offset,0))
+int nistParser::appendRecord(unsigned type, const std::vector<std::pair<unsigned,std::string> >& fields,
+                             const unsigned char* image, unsigned image_size)
+{
+   if(type<2 || type>=pool_types_ || (nistIsBinaryRecord(type) && type!=4))
+   {
+      dbg0("nistParser::appendRecord record type %u can't be created\n",type);
+      return -1;
+   }
+   unsigned idc = 0;
+   bool has_idc = false;
+   for(size_t no=0;no<fields.size();no++)
+   {
+      if(fields[no].first==2)
+      {
+         idc = strtoul(fields[no].second.c_str(),0,10);
+         has_idc = true;
+      }
+   }
+   if(!has_idc)
+   {
+      for(unsigned rec_no=0;rec_no<records_idc_.size();rec_no++)
+      {
+         idc = records_idc_[rec_no] + 1>idc ? records_idc_[rec_no] + 1 : idc;
+      }
+   }
+
+   std::vector<unsigned char> data;
+   if(type==4)
    {
-      if(new_tag.rec()==99 && new_tag.tag_no()==1)
+      //Поля 4.002-4.008 задаются десятичными значениями, 4.004 - первая позиция пальца
+      Type4Header hdr;
+      memset(&hdr,0,sizeof(hdr));
+      memset(hdr.fgp_,255,sizeof(hdr.fgp_));
+      hdr.idc_ = idc;
+      for(size_t no=0;no<fields.size();no++)
       {
-         std::vector<unsigned char> tag_data;
-         tag_data = new_tag.dataCopy();
-         unsigned rec_size = atoi((char*)&tag_data.front());
-         if(rec_size)
-         {            
-            type_ = 99;
-            offset_ = start_offset;
-            record_size_ = rec_size;
-            offset = offset_+record_size_;
-            return true;
+         unsigned long value = strtoul(fields[no].second.c_str(),0,10);
+         switch(fields[no].first)
+         {
+            case 3: hdr.imp_ = value; break;
+            case 4: hdr.fgp_[0] = value; break;
+            case 5: hdr.isr_ = value; break;
+            case 6: hdr.hll_ = htons(value); break;
+            case 7: hdr.vll_ = htons(value); break;
+            case 8: hdr.cga_ = value; break;
          }
       }
+      hdr.len_ = htonl(sizeof(hdr) + image_size);
+      data.resize(sizeof(hdr));
+      memcpy(&data.front(),&hdr,sizeof(hdr));
+      if(image_size)
+      {
+         data.insert(data.end(),image,image + image_size);
+      }
+   }
+   else
+   {
+      std::vector<nistFieldData> record;
+      for(size_t no=0;no<fields.size();no++)
+      {
+         if(fields[no].first!=1)
+         {
+            setFieldData(record,fields[no].first,(const unsigned char*)fields[no].second.data(),fields[no].second.size());
+         }
+      }
+      char idc_value[16];
+      snprintf(idc_value,sizeof(idc_value),"%02u",idc);
+      if(!has_idc)
+      {
+         setFieldData(record,2,(const unsigned char*)idc_value,strlen(idc_value));
+      }
+      if(image_size)
+      {
+         setFieldData(record,999,image,image_size);
+      }
+      if(!encodeRecord(type,record,data))
+      {
+         return -1;
+      }
    }
-   clear();
-   return false;
-}
 
-nistParser::nistParser()
-{
-   dbg7( (char*)"nistParser::nistParser\n");
+   unsigned offset = 0;
+   if(!loadRecord(type,data,offset,false))
+   {
+      dbg0("nistParser::appendRecord can't load new record type %u\n",type);
+      return -1;
+   }
+   records_idc_.push_back(idc);
+   if(!rebuildHeader())
+   {
+      pool_[type].push_back(records_.back());
+      records_.pop_back();
+      records_idc_.pop_back();
+      return -1;
+   }
+   owned_[records_.back()].swap(data);
+   updateLayout();
+   return records_.size() - 1;
 }
 
-nistParser::~nistParser()
+bool nistParser::removeRecord(unsigned rec_no)
 {
-   dbg7( (char*)"nistParser::~nistParser\n");
-   for(unsigned record_no=0;record_no<records_.size();record_no++)
+   if(rec_no>=records_.size())
    {
-      delete records_[record_no];
+      return false;
    }
-   records_.clear();
+   nistRecord* rec = records_[rec_no];
+   records_.erase(records_.begin() + rec_no);
+   unsigned idc = records_idc_[rec_no];
+   records_idc_.erase(records_idc_.begin() + rec_no);
+   if(!rebuildHeader())
+   {
+      records_.insert(records_.begin() + rec_no,rec);
+      records_idc_.insert(records_idc_.begin() + rec_no,idc);
+      return false;
+   }
+   owned_.erase(rec);
+   pool_[rec->type()].push_back(rec);
+   updateLayout();
+   return true;
 }
 
-bool nistParser::load(const std::string& file,bool force)
+bool nistParser::replaceImage(unsigned rec_no, const unsigned char* image, unsigned image_size)
 {
-   dbg7( (char*)"nistParser::load %s\n",file.c_str());
-   bool res = false;
-   if(readFile(file,file_data_))
+   if(rec_no>=records_.size())
    {
-      dbg7( (char*)"nistParser::load file read Ok\n");
-      return load(file_data_,force);
+      return false;
+   }
+   const nistRecord* rec = records_[rec_no];
+   std::vector<unsigned char> data;
+   if(nistIsBinaryRecord(rec->type()))
+   {
+      //Заголовок бинарной записи предшествует изображению, копируется как есть с новой длиной
+      unsigned header_size = rec->recordSize() - rec->getImgDataSize();
+      if(!rec->getImgData() || header_size<4)
+      {
+         dbg0("nistParser::replaceImage binary record %u has no image to locate its header\n",rec_no);
+         return false;
+      }
+      const unsigned char* header = rec->getImgData() - header_size;
+      unsigned len = htonl(header_size + image_size);
+      data.assign(header,header + header_size);
+      memcpy(&data.front(),&len,sizeof(len));
+      data.insert(data.end(),image,image + image_size);
    }
    else
    {
-      dbg0("nistParser::load file read error\n");
+      std::vector<nistFieldData> fields;
+      recordFields(*rec,fields);
+      setFieldData(fields,999,image,image_size);
+      if(!encodeRecord(rec->type(),fields,data))
+      {
+         return false;
+      }
    }
-
-   return res;
+   if(!reloadRecord(rec_no,data))
+   {
+      return false;
+   }
+   updateLayout();
+   return true;
 }
 
-bool nistParser::load(const std::vector<unsigned char>& file_data, bool force)
+bool nistParser::setField(unsigned rec_no, unsigned tag, const std::string& value)
 {
-   dbg7( (char*)"nistParser::load from memory data size %d\n",file_data.size());
-   bool res = false;
-   unsigned offset = 0;
-   err_msg_ = "";
-
-   header_.clear();
-   records_.clear();
-
-   if(header_.load(file_data,offset,force))
+   if(rec_no>=records_.size() || tag<2 || tag==999 || nistIsBinaryRecord(records_[rec_no]->type()))
    {
-      res = true;
+      dbg0("nistParser::setField field %u of record %u can't be set\n",tag,rec_no);
+      return false;
    }
-
-   if(!res)
+   //IDC записи входит в 1.003 CNT: сначала пересобирается заголовок, при ошибке запись не меняется
+   unsigned idc = records_idc_[rec_no];
+   if(tag==2)
    {
-      dbg0("nistParser::load from memory parse error\n");
-      return false;
+      records_idc_[rec_no] = strtoul(value.c_str(),0,10);
+      if(!rebuildHeader())
+      {
+         records_idc_[rec_no] = idc;
+         return false;
+      }
    }
-   else
+   std::vector<nistFieldData> fields;
+   recordFields(*records_[rec_no],fields);
+   setFieldData(fields,tag,(const unsigned char*)value.data(),value.size());
+   std::vector<unsigned char> data;
+   if(!encodeRecord(records_[rec_no]->type(),fields,data) || !reloadRecord(rec_no,data))
    {
-      unsigned recs = header_.getRecordsCnt();
-      for(unsigned rec_no=0; rec_no<recs;rec_no++)
+      if(tag==2)
       {
-         
-         unsigned rec_type  = header_.getRecordType(rec_no);
-     
-         dbg7("nistParser::load from record type %d\n",rec_type);
-         switch(rec_type)
-         {
-            case 1:
-               break;
-            case 2:
-               {
-                  type2Record* new_rec = new type2Record();
-                  if(!new_rec->load(file_data,offset,force))
-                  {
-                     delete new_rec;
-                     err_msg_ += "Invalid Type2 record ";
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-               }
-               break;
-            case 4:
-               {
-                  type4Record* new_rec = new type4Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type4 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-               }
-               break;
-            case 7:
-               {
-                  type7Record* new_rec = new type7Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type7 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-                  break;
-               }
-            case 8:
-               {
-                  type8Record* new_rec = new type8Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type8 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-                  break;
-               }
-            case 9:
-               {
-                  type9Record* new_rec = new type9Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type9 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-                  break;
-               }
-            case 10:
-               {
-                  type10Record* new_rec = new type10Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type10 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-               }
-               break;
-            case 13:
-               {
-                  type13Record* new_rec = new type13Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type13 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-               }
-               break;
-            case 14:
-               {
-                  type14Record* new_rec = new type14Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type14 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-               }
-               break;
-            case 15:
-               {
-                  type15Record* new_rec = new type15Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type15 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-               }
-               break;
-            case 99:
-               {
-                  type99Record* new_rec = new type99Record();
-                  if(!new_rec->load(file_data,offset))
-                  {
-                     err_msg_ += "Invalid Type99 record ";
-                     delete new_rec;
-                     res = false;
-                  }
-                  else
-                  {
-                     records_.push_back(new_rec);
-                  }
-                  break;
-               }
-            default:
-               dbg0("nistParser::load from memory error: unknown record type %d\n",rec_type);
-               res = false;
-               break;
-         };
-         if(!res && !force)
-         {
-            break;
-         }
-         records_.back()->offset_ = offset;
+         records_idc_[rec_no] = idc;
+         rebuildHeader();
       }
+      return false;
    }
-   return force? true:res;
+   updateLayout();
+   return true;
+}
+
+bool nistParser::setHeaderField(unsigned tag, const std::string& value)
+{
+   if(tag<2 || tag==3)
+   {
+      dbg0("nistParser::setHeaderField field 1.%03u is maintained by the parser\n",tag);
+      return false;
+   }
+   if(!rebuildHeader(tag,value))
+   {
+      return false;
+   }
+   updateLayout();
+   return true;
 }
 
-std::string nistParser::getDOM()
+std::string nistParser::getDOM() const
 {
    return header_.getDOM();
 }
 
-std::string nistParser::getTOT()
+std::string nistParser::getTOT() const
 {
    return header_.getTOT();
 }
 
-std::string nistParser::getTCN()
+std::string nistParser::getTCN() const
 {
    return header_.getTCN();
 }
 
-std::string nistParser::getTCR()
+std::string nistParser::getTCR() const
 {
    return header_.getTCR();
 }
 
-std::string nistParser::getORI()
+std::string nistParser::getORI() const
 {
    return header_.getORI();
 }
 
-std::string nistParser::getDAI()
+std::string nistParser::getDAI() const
 {
    return header_.getDAI();
 }
 
-double nistParser::getISR()
+double nistParser::getISR() const
 {
    return header_.getISR();
 }
 
-std::vector<nistRecord*> nistParser::getRecords(unsigned type)
+nistRecordRange nistParser::getRecords(unsigned type)
 {
-   std::vector<nistRecord*> res;
-   for(unsigned rec_no=0;rec_no<records_.size();rec_no++)
+   nistRecordRange res = {0,0};
+   if(type<pool_types_ && type_begin_[type]<type_begin_[type + 1])
+   {
+      res.begin_ = &by_type_.front() + type_begin_[type];
+      res.end_ = &by_type_.front() + type_begin_[type + 1];
+   }
+   return res;
+}
+
+nistConstRecordRange nistParser::getRecords(unsigned type) const
+{
+   nistRecordRange range = const_cast<nistParser*>(this)->getRecords(type);
+   nistConstRecordRange res = {range.begin_,range.end_};
+   return res;
+}
+
+nistRecordRange nistParser::getRecords(unsigned type, unsigned idc)
+{
+   nistRecordRange res = {0,0};
+   unsigned key = idcKey(idc,type);
+   std::vector<unsigned>::const_iterator first = std::lower_bound(idc_keys_.begin(),idc_keys_.end(),key);
+   std::vector<unsigned>::const_iterator last = std::upper_bound(first,idc_keys_.cend(),key);
+   if(first!=last)
+   {
+      res.begin_ = &by_idc_.front() + (first - idc_keys_.begin());
+      res.end_ = &by_idc_.front() + (last - idc_keys_.begin());
+   }
+   return res;
+}
+
+nistConstRecordRange nistParser::getRecords(unsigned type, unsigned idc) const
+{
+   nistRecordRange range = const_cast<nistParser*>(this)->getRecords(type,idc);
+   nistConstRecordRange res = {range.begin_,range.end_};
+   return res;
+}
+
+const nistIdcGroup* nistParser::getIDC(unsigned idc) const
+{
+   unsigned low = 0;
+   unsigned high = idc_groups_.size();
+   while(low<high)
    {
-      if(records_[rec_no]->type()==type)
+      unsigned mid = (low + high)/2;
+      if(idc_groups_[mid].idc_<idc)
+      {
+         low = mid + 1;
+      }
+      else
       {
-         res.push_back(records_[rec_no]);
+         high = mid;
       }
    }
-   return res;
+   if(low<idc_groups_.size() && idc_groups_[low].idc_==idc)
+   {
+      return &idc_groups_[low];
+   }
+   return 0;
+}
+
+/*!Возвращает длину записи, начинающейся со смещения offset, по полю LEN 
+   (первые 4 байта для бинарных записей, N.001 для текстовых). 0 - если длину определить не удалось
+*/
+static unsigned recordLength(const nistSpan& data, unsigned offset, unsigned type)
+{
+   if(offset>=data.size())
+   {
+      return 0;
+   }
+   const unsigned char* p = &data.front() + offset;
+   const unsigned char* end = &data.front() + data.size();
+   if(nistIsBinaryRecord(type))
+   {
+      if(end - p < 4)
+      {
+         return 0;
+      }
+      return (unsigned(p[0])<<24) | (unsigned(p[1])<<16) | (unsigned(p[2])<<8) | unsigned(p[3]);
+   }
+   if(parseUInt(p,end)!=type || p>=end || *p++!='.')
+   {
+      return 0;
+   }
+   if(parseUInt(p,end)!=1 || p>=end || *p++!=':')
+   {
+      return 0;
+   }
+   return parseUInt(p,end);
+}
+
+unsigned nistParser::findCbeff(const nistSpan& file_data, unsigned format_owner, unsigned format_type,
+                               std::vector<nistCbeffRef>& found)
+{
+   unsigned offset = 0;
+   unsigned found_cnt = 0;
+   type1Record header;
+   if(!header.load(file_data,offset))
+   {
+      dbg0("nistParser::findCbeff error invalid Type1 record\n");
+      return 0;
+   }
+   for(unsigned rec_no=0;rec_no<header.getRecordsCnt();rec_no++)
+   {
+      unsigned rec_type = header.getRecordType(rec_no);
+      unsigned rec_size = recordLength(file_data,offset,rec_type);
+      //LEN около UINT_MAX не должен переполнить сумму
+      if(!rec_size || offset>file_data.size() || rec_size>file_data.size() - offset)
+      {
+         dbg0("nistParser::findCbeff error invalid record %d length at offset %d\n",rec_type,offset);
+         break;
+      }
+      if(rec_type==99)
+      {
+         //Разбираем только заголовок CBEFF, блок данных не просматривается
+         nistCbeffRef ref = nistCbeffRef();
+         ref.offset_ = offset;
+         ref.size_ = rec_size;
+         const unsigned char* p = &file_data.front() + offset;
+         const unsigned char* end = p + rec_size - 1;
+         while(p<end)
+         {
+            parseUInt(p,end);
+            if(p<end && *p=='.')
+            {
+               p++;
+            }
+            unsigned tag_no = parseUInt(p,end);
+            if(p>=end || *p!=':')
+            {
+               break;
+            }
+            p++;
+            if(tag_no==999)
+            {
+               ref.bdb_.data_ = p;
+               ref.bdb_.size_ = end - p;
+               break;
+            }
+            const unsigned char* value = p;
+            const unsigned char* value_end = std::find(p,end,nistParser::GS());
+            switch(tag_no)
+            {
+               case 2:
+                  ref.idc_ = parseUInt(value,value_end);
+                  break;
+               case 103:
+                  ref.format_owner_ = parseHex(value,value_end);
+                  break;
+               case 104:
+                  ref.format_type_ = parseHex(value,value_end);
+                  break;
+            }
+            p = value_end<end ? value_end + 1 : end;
+         }
+         if((format_owner==0xFFFFFFFF || ref.format_owner_==format_owner) && 
+            (format_type==0xFFFFFFFF || ref.format_type_==format_type))
+         {
+            found.push_back(ref);
+            found_cnt++;
+         }
+      }
+      offset += rec_size;
+   }
+   return found_cnt;
 }
 
 bool nistParser::readFile(const std::string& file_name,std::vector<unsigned char>& content)
 {
+   nistPhaseTimer timer(nistPhaseRead);
    FILE *in = fopen(file_name.c_str(), "rb");
-   if(in>0)
+   if(in)
    {
       unsigned long length;
       fseek(in, 0L, SEEK_END);
@@ -3173,21 +3712,102 @@ bool nistParser::readFile(const std::string& file_name,std::vector<unsigned char
    return false;
 }
 
-void nistParser::write(const std::string& output_file_name) 
+bool nistParser::write(const std::string& output_file_name) 
 {
+    nistPhaseTimer timer(nistPhaseWrite);
     FILE *out = fopen(output_file_name.c_str(), "wb");
+    if (!out)
+    {
+        dbg0("nistParser::write file %s open error\n", output_file_name.c_str());
+        return false;
+    }
 
-    int len = header_.write(out, 0);
-    fseek(out, -len, SEEK_CUR);
-    header_.write(out, len);
+    //Записи сами вычисляют LEN (двоичные берут сохраненную длину), каждая пишется один раз
+    bool res = header_.write(out) > 0;
+    for (unsigned rec_no = 0; res && rec_no < records_.size(); rec_no++) 
+    {
+        res = records_[rec_no]->write(out) > 0;
+    }
 
-    for (int rec_no = 0; rec_no < records_.size(); rec_no++) 
+    if (fclose(out) != 0 || !res)
     {
-        len = (records_[rec_no])->write(out, 0);
-        fseek(out, -len, SEEK_CUR);
-        (records_[rec_no])->write(out, len);
-        int pos = ftell(out);
+        dbg0("nistParser::write file %s write error\n", output_file_name.c_str());
+        return false;
     }
+    return true;
+}
 
-    fclose(out);
+bool nistGetImageInfo(const nistRecord& rec, nistImageInfo& info)
+{
+   static const std::string empty;
+   const type4Record& image = static_cast<const type4Record&>(rec);
+   info.fgp_ = info.slc_ = info.hps_ = info.vps_ = info.bpx_ = 0;
+   info.date_ = info.imt_ = &empty;
+   switch(rec.type())
+   {
+      case 4:
+      {
+         char code[4];
+         snprintf(code,sizeof(code),"%u",image.getCGA());
+         info.cga_ = code;
+         info.fgp_ = image.getFGP();
+         info.hps_ = image.getISR();
+         break;
+      }
+      case 10:
+      {
+         const type10Record& face = static_cast<const type10Record&>(rec);
+         info.cga_ = face.getCGA();
+         info.date_ = &face.getPHD();
+         info.imt_ = &face.getIMT();
+         info.slc_ = face.getSLC();
+         info.hps_ = face.getHPS();
+         info.vps_ = face.getVPS();
+         break;
+      }
+      case 13:
+      {
+         const type13Record& latent = static_cast<const type13Record&>(rec);
+         info.cga_ = latent.getCGA();
+         info.date_ = &latent.getLCD();
+         info.fgp_ = latent.getFGP();
+         info.slc_ = latent.getSLC();
+         info.hps_ = latent.getHPS();
+         info.vps_ = latent.getVPS();
+         info.bpx_ = latent.getBPX();
+         break;
+      }
+      case 14:
+      {
+         const type14Record& finger = static_cast<const type14Record&>(rec);
+         info.cga_ = finger.getCGA();
+         info.date_ = &finger.getTCD();
+         info.fgp_ = finger.getFGP();
+         info.slc_ = finger.getSLC();
+         info.hps_ = finger.getHPS();
+         info.vps_ = finger.getVPS();
+         info.bpx_ = finger.getBPX();
+         break;
+      }
+      case 15:
+      {
+         const type15Record& palm = static_cast<const type15Record&>(rec);
+         info.cga_ = palm.getCGA();
+         info.date_ = &palm.getPCD();
+         info.fgp_ = palm.getFGP();
+         info.slc_ = palm.getSLC();
+         info.hps_ = palm.getHPS();
+         info.vps_ = palm.getVPS();
+         info.bpx_ = palm.getBPX();
+         break;
+      }
+      default:
+         info.imp_ = info.hll_ = info.vll_ = 0;
+         info.cga_.clear();
+         return false;
+   }
+   info.imp_ = image.getIMP();
+   info.hll_ = image.getHLL();
+   info.vll_ = image.getVLL();
+   return true;
 }
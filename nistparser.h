@@ -1,12 +1,90 @@
 #ifndef NIST_PARSER_H
 #define NIST_PARSER_H
 
+#include <atomic>
+#include <cstddef>
+#include <map>
 #include <string>
 #include <vector>
 #include <utility>
 
 
 
+///! Непрерывный участок памяти, не владеющий данными: вектор, отображенный файл, разделяемая память, сетевой буфер
+struct nistSpan
+{
+   nistSpan() : data_(0), size_(0) {}
+   nistSpan(const unsigned char* data, size_t size) : data_(size ? data : 0), size_(data ? size : 0) {}
+   nistSpan(const std::vector<unsigned char>& data) : data_(data.empty() ? 0 : &data.front()), size_(data.size()) {}
+   const unsigned char* data() const{return data_;}
+   size_t size() const{return size_;}
+   bool empty() const{return !size_;}
+   const unsigned char& front() const{return data_[0];}
+   const unsigned char& operator[](size_t pos) const{return data_[pos];}
+   const unsigned char* data_;
+   size_t size_;
+};
+
+//!Запись с бинарным заголовком (Type-3..8): LEN - первые 4 байта big-endian, затем IDC
+inline bool nistIsBinaryRecord(unsigned type){return type>=3 && type<=8;}
+//!Размер заголовка бинарной записи, он же ее минимальный размер: Type-7 - 33, Type-8 - 12, остальные как Type-4 - 18
+inline unsigned nistBinaryHeaderSize(unsigned type){return type==7 ? 33 : type==8 ? 12 : 18;}
+/*!Значение LEN текстовой записи, LEN учитывает собственные цифры. other - размер всех остальных байтов записи
+   (идентификатор "T.001:", разделитель после LEN, прочие поля и FS). В digits (не меньше 24 символов)
+   записываются цифры значения
+*/
+unsigned long long nistTaggedRecordLen(unsigned long long other, char* digits);
+//!Длина правильной последовательности UTF-8, начинающейся с p (байт >= 0x80), или 0
+size_t nistUtf8Length(const unsigned char* p, const unsigned char* end);
+
+///! Непрерывный диапазон указателей на записи, не владеющий ими
+template<class T>
+struct nistRange
+{
+   T* const* begin_;
+   T* const* end_;
+   T* const* begin() const{return begin_;}
+   T* const* end() const{return end_;}
+   size_t size() const{return end_ - begin_;}
+   bool empty() const{return begin_==end_;}
+   T* operator[](size_t no) const{return begin_[no];}
+};
+
+class nistRecord;
+typedef nistRange<nistRecord> nistRecordRange;
+typedef nistRange<const nistRecord> nistConstRecordRange;
+
+///! Арена транзакции: память под разобранные данные выделяется блоками и освобождается целиком
+class nistArena
+{
+public:
+   nistArena(size_t chunk_size = 64*1024);
+   ~nistArena();
+   //!Забирает блоки other, выделенная из них память остается действительной
+   nistArena(nistArena&& other);
+   nistArena& operator=(nistArena&& other);
+   //!Выделяет size байт с выравниванием align (степень двойки). Память не инициализируется
+   void* alloc(size_t size, size_t align = 32);
+   //!Делает всю выделенную память снова доступной, блоки не освобождаются
+   void reset();
+   //!Объем памяти, выделенной из арены с последнего reset()
+   size_t used()const{return used_;}
+private:
+   nistArena(const nistArena&);
+   nistArena& operator=(const nistArena&);
+   struct chunk
+   {
+      unsigned char* data_;
+      size_t size_;
+   };
+   std::vector<chunk> chunks_;
+   size_t chunk_size_;
+   //!Номер текущего блока
+   size_t cur_;
+   //!Смещение свободного места в текущем блоке
+   size_t pos_;
+   size_t used_;
+};
 
 ///! Базовый класс тега ANSI-NIST файла
 class nistTag
@@ -14,7 +92,7 @@ class nistTag
 public:
    nistTag();
    virtual ~nistTag();
-   virtual bool load(const std::vector<unsigned char>&, unsigned& offset,unsigned offset_to_record_end = 0);
+   virtual bool load(const nistSpan&, unsigned& offset,unsigned offset_to_record_end = 0);
    //!Номер записи тега
    unsigned rec()const{return rec_;}
    //!Номер тега
@@ -46,16 +124,23 @@ class nistRecord
 public:
    nistRecord();
    virtual ~nistRecord();
-   virtual bool load(const std::vector<unsigned char>&, unsigned& offset,unsigned type,bool force=false);
+   nistRecord(const nistRecord&) = default;
+   nistRecord(nistRecord&&) = default;
+   nistRecord& operator=(const nistRecord&) = default;
+   nistRecord& operator=(nistRecord&&) = default;
+   virtual bool load(const nistSpan&, unsigned& offset,unsigned type,bool force=false);
+   /*!Записывает запись в out одним проходом и возвращает число записанных байт или -1.
+      len - длина записи без цифр LEN, 0 - LEN вычисляется по записываемым данным
+   */
    virtual int write(FILE* out, unsigned len = 0);
 
-   unsigned recordSize();
-   unsigned type(){return type_;}
-   unsigned tagsCnt(){return tags_.size();}
-   const nistTag* getTag(unsigned no);
-   const nistTag* getTagById(unsigned id);
-   const unsigned char* getImgData(){return image_data_;}
-   const unsigned getImgDataSize(){return image_data_size_;}
+   unsigned recordSize() const;
+   unsigned type() const{return type_;}
+   unsigned tagsCnt() const{return tags_.size();}
+   const nistTag* getTag(unsigned no) const;
+   const nistTag* getTagById(unsigned id) const;
+   const unsigned char* getImgData() const{return image_data_;}
+   const unsigned getImgDataSize() const{return image_data_size_;}
 public:
    //virtual bool writeTag(nistTag& tag, FILE* out);
    virtual void clear();
@@ -73,25 +158,79 @@ public:
    unsigned image_data_size_;
 };
 
+///! Тип значения поля в схеме записи
+enum nistFieldKind
+{
+   nistFieldUInt,    ///<Десятичное число, член типа unsigned
+   nistFieldByte,    ///<Десятичное число, член типа unsigned char
+   nistFieldHex,     ///<Шестнадцатеричное число, член типа unsigned
+   nistFieldString,  ///<Строка ASCII, член типа std::string
+   nistFieldImage,   ///<Данные изображения N.999, хранятся в image_data_/image_data_size_
+   nistFieldCustom   ///<Поле со сложной структурой, разбирается функцией decode_
+};
+
+/*! Описание поля в таблице схемы записи типа R.
+   Поле класса задается указателем на член, заполняется только указатель, соответствующий kind_.
+   Таблица должна быть упорядочена по номеру тега и объявляется constexpr, 
+   чтобы для часто встречающихся типов записей разбор разворачивался на этапе компиляции.
+*/
+template<class R>
+struct nistFieldSchema
+{
+   unsigned tag_;
+   const char* mnemonic_;
+   nistFieldKind kind_;
+   bool mandatory_;
+   unsigned R::* uint_;
+   unsigned char R::* byte_;
+   std::string R::* string_;
+   //!Максимальное количество цифр числового поля фиксированной ширины, 0 - не ограничено
+   unsigned width_;
+   //!Функция разбора поля nistFieldCustom, возвращает false при ошибке в данных
+   bool (*decode_)(R& rec, const unsigned char* data, const unsigned char* end);
+};
+
+/*! Номера обязательных полей записи типа type по ее схеме разбора (LEN не включается) по возрастанию.
+    Записывает не более max_tags номеров и возвращает их число, для типов без схемы - 0
+*/
+unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+
 ///! Запись Type-1 - заголовок файла
 class type1Record : public nistRecord
 {   
 public:
    type1Record();
    ~type1Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset,bool force=false);
+   type1Record(const type1Record&) = default;
+   type1Record(type1Record&&) = default;
+   type1Record& operator=(const type1Record&) = default;
+   type1Record& operator=(type1Record&&) = default;
+   bool load(const nistSpan&, unsigned& offset,bool force=false);
+   //!Заполняет поля записи по уже разобранным тегам (вторая половина load), возвращает число отсутствующих
+   //!обязательных и ошибочных полей
+   unsigned decodeFields();
    int write(FILE* out, unsigned len = 0);
-   std::string getDOM(){return domain_;}
-   std::string getTOT(){return transaction_;}
-   std::string getTCN(){return control_number_;}
-   std::string getTCR(){return responce_control_number_;}
-   std::string getORI(){return originating_;}
-   std::string getDAI(){return destination_;}
-   std::string getDCS(){return char_sets_;}
-   double getISR(){return scanning_res_;}
-   unsigned getRecordsCnt(){return file_content_.size();}
-   unsigned getRecordType(unsigned rec_no);
+   std::string getDOM() const{return domain_;}
+   std::string getTOT() const{return transaction_;}
+   std::string getTCN() const{return control_number_;}
+   std::string getTCR() const{return responce_control_number_;}
+   std::string getORI() const{return originating_;}
+   std::string getDAI() const{return destination_;}
+   std::string getDCS() const{return char_sets_;}
+   const std::string& getDAT() const{return transaction_date_;}
+   double getISR() const{return scanning_res_;}
+   unsigned getRecordsCnt() const{return file_content_.size();}
+   unsigned getRecordType(unsigned rec_no) const;
+   //!IDC записи rec_no из 1.003 CNT
+   unsigned getRecordIDC(unsigned rec_no) const;
+   virtual void clear();
 protected:
+   static const nistFieldSchema<type1Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+   static bool decodeCNT(type1Record& rec, const unsigned char* data, const unsigned char* end);
+   static bool decodeNSR(type1Record& rec, const unsigned char* data, const unsigned char* end);
+   static bool decodeNTR(type1Record& rec, const unsigned char* data, const unsigned char* end);
    
    unsigned ver_;                                              ///1.002 VER 
    std::vector<std::pair<unsigned,unsigned> > file_content_;   ///1.003 CNT
@@ -115,9 +254,15 @@ class type2Record : public nistRecord
 public:
    type2Record();
    ~type2Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset,bool force=false);
+   bool load(const nistSpan&, unsigned& offset,bool force=false);
+   //!Заполняет поля записи по уже разобранным тегам (вторая половина load), возвращает число отсутствующих
+   //!обязательных и ошибочных полей
+   unsigned decodeFields();
    //int write(FILE* out, unsigned len = 0);
 protected:
+   static const nistFieldSchema<type2Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
    // bool writeTag(nistTag& tag, FILE* out);
    /*
       Field 2.002: Image Designation Character (IDC)  
@@ -148,15 +293,15 @@ class type4Record : public nistRecord
 public:
    type4Record();
    virtual ~type4Record();
-   virtual bool load(const std::vector<unsigned char>&, unsigned& offset);
+   virtual bool load(const nistSpan&, unsigned& offset);
    virtual int write(FILE* out, unsigned len = 0);
-   unsigned getHLL(){return hll_;}
-   unsigned getVLL(){return vll_;}
-   unsigned char getCGA(){return cga_;}
-   virtual unsigned getISR(){return isr_;}
-   unsigned char getIMP(){return imp_;}
-   virtual unsigned char getFGP(){return fgp_[0];}
-   unsigned char getIDC(){return idc_;}
+   unsigned getHLL() const{return hll_;}
+   unsigned getVLL() const{return vll_;}
+   unsigned char getCGA() const{return cga_;}
+   virtual unsigned getISR() const{return isr_;}
+   unsigned char getIMP() const{return imp_;}
+   virtual unsigned char getFGP() const{return fgp_[0];}
+   unsigned char getIDC() const{return idc_;}
 protected:
    virtual void clear();
    /*!Field 4.002: Image Designation Character (IDC) 
@@ -252,7 +397,7 @@ class type7Record : public type4Record
 public:
    type7Record();
    ~type7Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset);
+   bool load(const nistSpan&, unsigned& offset);
    int write(FILE* out, unsigned len = 0);
 protected:
    /*
@@ -304,7 +449,7 @@ class type8Record : public type4Record
 public:
    type8Record();
    ~type8Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset);
+   bool load(const nistSpan&, unsigned& offset);
    int write(FILE* out, unsigned len = 0);
 protected:
    /*The sixth byte contains the signature type field. The permissible values of this field are:  
@@ -322,13 +467,104 @@ protected:
 };
 
 
-///! Запись Type-9 - Мелкие особенности. Пока просто читаем как текстовую запись
+///! Тип минуции, приведенный к общему виду для всех форматов Type-9
+enum nistMinutiaType
+{
+   nistMinutiaOther = 0,         ///<Другой или неопределенный тип (FBI D, INCITS 0, EFS X)
+   nistMinutiaRidgeEnding = 1,   ///<Окончание гребня (FBI A, INCITS 1, EFS E)
+   nistMinutiaBifurcation = 2,   ///<Раздвоение гребня (FBI B, INCITS 2, EFS B)
+   nistMinutiaCompound = 3       ///<Составная минуция (FBI C)
+};
+
+///! Формат, из которого были прочитаны минуции
+enum nistMinutiaeFormat
+{
+   nistMinutiaeNone = 0,   ///<Минуции в записи отсутствуют
+   nistMinutiaeFBI,        ///<9.012 MRC, стандартный формат FBI/IAFIS, координаты в 0.01 мм
+   nistMinutiaeINCITS,     ///<9.137 FMD, INCITS 378, координаты в пикселях
+   nistMinutiaeEFS         ///<9.331 EMD, Extended Feature Set, координаты в 0.01 мм
+};
+
+/*! Минуции одного отпечатка в виде структуры массивов.
+   Все массивы лежат в одном блоке арены транзакции, каждый выровнен на 32 байта
+   и дополнен нулями до stride_ элементов (кратно 8), поэтому матчер может 
+   обрабатывать их векторно без отдельной обработки хвоста.
+*/
+struct nistMinutiae
+{
+   nistMinutiaeFormat format_;
+   //!Количество минуций
+   unsigned count_;
+   //!Количество элементов в каждом массиве с учетом дополнения
+   unsigned stride_;
+   const int* x_;
+   const int* y_;
+   //!Направление в градусах 0-359
+   const int* theta_;
+   //!Значения nistMinutiaType
+   const int* type_;
+   //!Качество 0-100 (FBI 0-63), 0 если формат его не содержит
+   const int* quality_;
+};
+
+///! Разобранные минуции вместе с памятью под массивы (если они не размещены в арене)
+struct nistMinutiaeBlock
+{
+   nistMinutiae minutiae_;
+   std::vector<int> data_;
+};
+
+///! Запись Type-9 - Мелкие особенности (минуции)
 class type9Record : public nistRecord
 {   
 public:
-   type9Record();
+   //!arena - арена транзакции, в которой размещаются массивы минуций. Без арены используется собственный буфер
+   type9Record(nistArena* arena = 0);
    virtual ~type9Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset);
+   //!Разобранные минуции не копируются и будут разобраны копией заново при обращении
+   type9Record(const type9Record& other);
+   type9Record& operator=(const type9Record& other);
+   //!Меняет арену записи, используется при перемещении парсера
+   void setArena(nistArena* arena){arena_ = arena;}
+   bool load(const nistSpan&, unsigned& offset);
+   /*!Разбирает минуции сразу, массивы размещаются в арене. Без вызова разбор выполняется при первом обращении к getMinutiae().
+      Вызывается потоком, загружающим транзакцию, до передачи ее читателям
+   */
+   bool decodeMinutiae();
+   /*!Возвращает минуции отпечатка, при необходимости разбирая их. Безопасно при одновременном вызове из нескольких потоков:
+      каждый поток, не заставший результат, разбирает минуции в собственный блок и публикует его compare_exchange,
+      проигравшие удаляют свой блок и возвращают опубликованный
+   */
+   const nistMinutiae& getMinutiae() const;
+   unsigned char getIDC() const{return idc_;}
+   unsigned char getIMP() const{return imp_;}
+   unsigned char getFGP() const{return fgp_;}
+   //!9.004 FMT: 'S' - стандартный формат, 'U' - пользовательский
+   unsigned char getFMT() const{return fmt_;}
+protected:
+   virtual void clear();
+   //!Разбирает минуции в out, массивы выделяются в arena или, если арены нет, в out.data_
+   bool decodeTo(nistMinutiaeBlock& out, nistArena* arena) const;
+   //!Снимает публикацию минуций и удаляет блок, созданный getMinutiae()
+   void dropMinutiae();
+   //!Копирует поля записи, кроме базовой части и разобранных минуций
+   void assignFields(const type9Record& other);
+   /*9.002 IDC*/
+   unsigned char idc_;
+   /*9.003 IMP*/
+   unsigned char imp_;
+   /*9.004 Minutiae format (FMT)*/
+   unsigned char fmt_;
+   /*9.006 FGP (FBI) или первый элемент 9.134 FGP (INCITS 378)*/
+   unsigned char fgp_;
+   //!Тег с данными минуций, из которого выполняется разбор
+   const nistTag* minutiae_tag_;
+   nistMinutiaeFormat minutiae_format_;
+   nistArena* arena_;
+   //!Минуции, разобранные decodeMinutiae()
+   nistMinutiaeBlock local_;
+   //!Опубликованные минуции: &local_, блок из getMinutiae() или 0, если разбор не выполнялся
+   mutable std::atomic<const nistMinutiaeBlock*> published_;
 };
 
 
@@ -338,17 +574,20 @@ class type10Record : public type4Record
 public:
    type10Record();
    ~type10Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset);
+   bool load(const nistSpan&, unsigned& offset);
    int write(FILE* out, unsigned len = 0);
-   const std::string& getCGA(){return cga_;}
-   const std::string& getIMT(){return imt_;}
-   const std::string& getPHD(){return photo_date_;}
-   const std::string& getPOS(){return pos_;}
-   const std::string& getCSP(){return csp_;}
-   unsigned getVPS(){return vps_;}
-   unsigned getHPS(){return hps_;}
-   unsigned char getSLC(){return slc_;}
+   const std::string& getCGA() const{return cga_;}
+   const std::string& getIMT() const{return imt_;}
+   const std::string& getPHD() const{return photo_date_;}
+   const std::string& getPOS() const{return pos_;}
+   const std::string& getCSP() const{return csp_;}
+   unsigned getVPS() const{return vps_;}
+   unsigned getHPS() const{return hps_;}
+   unsigned char getSLC() const{return slc_;}
 protected:
+   static const nistFieldSchema<type10Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
    /*
    10.1.3  Field 10.003: Image Type (IMT)  
    This mandatory ASCII field is used to indicate the type of image contained in this record. It shall 
@@ -441,18 +680,21 @@ class type13Record : public type4Record
 public:
    type13Record();
    ~type13Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset);
+   bool load(const nistSpan&, unsigned& offset);
    int write(FILE* out, unsigned len = 0);
-   const char* getCGA(){return cga_.c_str();}
-   unsigned char getFGP();
-   const std::string& getLCD(){return lcd_;}
-   unsigned char getSLC(){return slc_;}
-   unsigned getISR(){return vps_;}
-   unsigned getVPS(){return vps_;}
-   unsigned getHPS(){return hps_;}
-   unsigned getBPX(){return bpx_;}
-   const char* getCOM(){return com_.c_str();}
+   const char* getCGA() const{return cga_.c_str();}
+   unsigned char getFGP() const;
+   const std::string& getLCD() const{return lcd_;}
+   unsigned char getSLC() const{return slc_;}
+   unsigned getISR() const{return vps_;}
+   unsigned getVPS() const{return vps_;}
+   unsigned getHPS() const{return hps_;}
+   unsigned getBPX() const{return bpx_;}
+   const char* getCOM() const{return com_.c_str();}
 protected:
+   static const nistFieldSchema<type13Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
    /*
       11.1.3  Field 13.003: Impression type (IMP)  
       This mandatory one- or two-byte ASCII field shall indicate the manner by which the latent 
@@ -572,15 +814,23 @@ class type14Record : public type4Record
 public:
    type14Record();
    ~type14Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset);
+   bool load(const nistSpan&, unsigned& offset);
+   //!Заполняет поля записи по уже разобранным тегам (вторая половина load), возвращает число отсутствующих
+   //!обязательных и ошибочных полей
+   unsigned decodeFields();
    int write(FILE* out, unsigned len = 0);
-   const char* getCGA(){return cga_.c_str();}
-   unsigned char getSLC(){return slc_;}
-   unsigned getISR(){return vps_;}
-   unsigned getVPS(){return vps_;}
-   unsigned getHPS(){return hps_;}
-   unsigned char getFGP() {return fgp_;}
+   const char* getCGA() const{return cga_.c_str();}
+   unsigned char getSLC() const{return slc_;}
+   unsigned getISR() const{return vps_;}
+   unsigned getVPS() const{return vps_;}
+   unsigned getHPS() const{return hps_;}
+   unsigned char getFGP() const{return fgp_;}
+   unsigned char getBPX() const{return pbx_;}
+   const std::string& getTCD() const{return tcd_;}
 protected:
+   static const nistFieldSchema<type14Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
    /*
    Field 14.003: Impression type (IMP)  
    This mandatory one-byte ASCII field shall indicate the manner by which the tenprint image 
@@ -678,16 +928,21 @@ class type15Record : public type4Record
 public:
    type15Record();
    ~type15Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset);
+   bool load(const nistSpan&, unsigned& offset);
    int write(FILE* out, unsigned len = 0);
-   const char* getCGA(){return cga_.c_str();}
-   unsigned char getPLP(){return plp_;}
-   unsigned char getFGP(){return getPLP();}
-   unsigned char getSLC(){return slc_;}
-   unsigned getISR(){return vps_;}
-   unsigned getVPS(){return vps_;}
-   unsigned getHPS(){return hps_;}
+   const char* getCGA() const{return cga_.c_str();}
+   unsigned char getPLP() const{return plp_;}
+   unsigned char getFGP() const{return getPLP();}
+   unsigned char getSLC() const{return slc_;}
+   unsigned getISR() const{return vps_;}
+   unsigned getVPS() const{return vps_;}
+   unsigned getHPS() const{return hps_;}
+   unsigned char getBPX() const{return pbx_;}
+   const std::string& getPCD() const{return pcd_;}
 protected:
+   static const nistFieldSchema<type15Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
    /*
    13.1.3  Field 15.003: Impression type (IMP) 
       Live-scan palm          10 
@@ -796,29 +1051,403 @@ protected:
    std::string com_;
 };
 
-///! Запись Type-99 - CBEFF. Пока просто читаем как текстовую запись
+///! Запись Type-16 - Пользовательские изображения для тестирования
+class type16Record : public type4Record
+{   
+public:
+   type16Record();
+   ~type16Record();
+   bool load(const nistSpan&, unsigned& offset);
+   int write(FILE* out, unsigned len = 0);
+   const std::string& getUDI() const{return udi_;}
+   const std::string& getCGA() const{return cga_;}
+   const std::string& getCSP() const{return csp_;}
+   unsigned char getSLC() const{return slc_;}
+   unsigned getHPS() const{return hps_;}
+   unsigned getVPS() const{return vps_;}
+   unsigned char getBPX() const{return bpx_;}
+protected:
+   static const nistFieldSchema<type16Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+   /*16.003 User-defined image (UDI)*/
+   std::string udi_;
+   /*16.004 Source agency / ORI (SRC)*/
+   std::string ori_;
+   /*16.005 User-defined testing date (UTD)*/
+   std::string utd_;
+   /*16.008 Scale units (SLC)*/
+   unsigned char slc_;
+   /*16.009 Transmitted horizontal pixel scale (THPS)*/
+   unsigned hps_;
+   /*16.010 Transmitted vertical pixel scale (TVPS)*/
+   unsigned vps_;
+   /*16.011 Compression algorithm (CGA)*/
+   std::string cga_;
+   /*16.012 Bits per pixel (BPX)*/
+   unsigned char bpx_;
+   /*16.013 Color space (CSP)*/
+   std::string csp_;
+};
+
+///! Запись Type-17 - Радужная оболочка глаза
+class type17Record : public type4Record
+{   
+public:
+   type17Record();
+   ~type17Record();
+   bool load(const nistSpan&, unsigned& offset);
+   int write(FILE* out, unsigned len = 0);
+   //!17.003 Eye label (ELR): 0 - не определен, 1 - правый, 2 - левый
+   unsigned char getELR() const{return elr_;}
+   const std::string& getICD() const{return icd_;}
+   const std::string& getCGA() const{return cga_;}
+   const std::string& getCSP() const{return csp_;}
+   unsigned char getSLC() const{return slc_;}
+   unsigned getHPS() const{return hps_;}
+   unsigned getVPS() const{return vps_;}
+   unsigned char getBPX() const{return bpx_;}
+protected:
+   static const nistFieldSchema<type17Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+   /*17.003 Eye label (ELR)*/
+   unsigned char elr_;
+   /*17.004 Source agency / ORI (SRC)*/
+   std::string ori_;
+   /*17.005 Iris capture date (ICD)*/
+   std::string icd_;
+   /*17.008 Scale units (SLC)*/
+   unsigned char slc_;
+   /*17.009 Transmitted horizontal pixel scale (THPS)*/
+   unsigned hps_;
+   /*17.010 Transmitted vertical pixel scale (TVPS)*/
+   unsigned vps_;
+   /*17.011 Compression algorithm (CGA)*/
+   std::string cga_;
+   /*17.012 Bits per pixel (BPX)*/
+   unsigned char bpx_;
+   /*17.013 Color space (CSP)*/
+   std::string csp_;
+   /*17.014 Rotation angle of eye (RAE)*/
+   std::string rae_;
+   /*17.015 Rotation uncertainty (RAU)*/
+   std::string rau_;
+   /*17.017 Device unique identifier (DUI)*/
+   std::string dui_;
+};
+
+///! Запись Type-18 - Данные ДНК
+class type18Record : public nistRecord
+{   
+public:
+   type18Record();
+   ~type18Record();
+   bool load(const nistSpan&, unsigned& offset);
+   int write(FILE* out, unsigned len = 0);
+   unsigned char getIDC() const{return idc_;}
+   const std::string& getDLS() const{return dls_;}
+   unsigned getNAL() const{return nal_;}
+protected:
+   static const nistFieldSchema<type18Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+   /*18.002 IDC*/
+   unsigned char idc_;
+   /*18.003 DNA laboratory setting (DLS)*/
+   std::string dls_;
+   /*18.004 Source agency / ORI (SRC)*/
+   std::string ori_;
+   /*18.005 Number of analyses flag (NAL)*/
+   unsigned nal_;
+   /*18.006 Sample donor information (SDI)*/
+   std::string sdi_;
+   /*18.007 Claimed or purported relationship (COPR)*/
+   std::string copr_;
+   /*18.008 Sample cellular type (VRS)*/
+   std::string vrs_;
+};
+
+///! Запись Type-19 - Отпечатки стоп и пальцев ног
+class type19Record : public type4Record
+{   
+public:
+   type19Record();
+   ~type19Record();
+   bool load(const nistSpan&, unsigned& offset);
+   int write(FILE* out, unsigned len = 0);
+   const std::string& getCGA() const{return cga_;}
+   unsigned char getFGP() const{return fgp_;}
+   unsigned char getSLC() const{return slc_;}
+   unsigned getISR() const{return vps_;}
+   unsigned getHPS() const{return hps_;}
+   unsigned getVPS() const{return vps_;}
+   unsigned char getBPX() const{return bpx_;}
+protected:
+   static const nistFieldSchema<type19Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+   /*19.004 Source agency / ORI (SRC)*/
+   std::string ori_;
+   /*19.005 Plantar capture date (PCD)*/
+   std::string pcd_;
+   /*19.008 Scale units (SLC)*/
+   unsigned char slc_;
+   /*19.009 Transmitted horizontal pixel scale (THPS)*/
+   unsigned hps_;
+   /*19.010 Transmitted vertical pixel scale (TVPS)*/
+   unsigned vps_;
+   /*19.011 Compression algorithm (CGA)*/
+   std::string cga_;
+   /*19.012 Bits per pixel (BPX)*/
+   unsigned char bpx_;
+   /*19.013 Friction ridge generalized position (FGP), коды 60-79*/
+   unsigned char fgp_;
+   /*19.020 Comment (COM)*/
+   std::string com_;
+};
+
+///! Запись Type-20 - Исходное представление
+class type20Record : public type4Record
+{   
+public:
+   type20Record();
+   ~type20Record();
+   bool load(const nistSpan&, unsigned& offset);
+   int write(FILE* out, unsigned len = 0);
+   //!20.003 Source representation cardinality (CAR): S, D или M
+   const std::string& getCAR() const{return car_;}
+   const std::string& getCGA() const{return cga_;}
+   const std::string& getSFT() const{return sft_;}
+   unsigned char getSLC() const{return slc_;}
+   unsigned getHPS() const{return hps_;}
+   unsigned getVPS() const{return vps_;}
+   unsigned char getBPX() const{return bpx_;}
+protected:
+   static const nistFieldSchema<type20Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+   /*20.003 Cardinality (CAR)*/
+   std::string car_;
+   /*20.004 Source agency / ORI (SRC)*/
+   std::string ori_;
+   /*20.005 Source representation date (SRD)*/
+   std::string srd_;
+   /*20.008 Scale units (SLC)*/
+   unsigned char slc_;
+   /*20.009 Transmitted horizontal pixel scale (THPS)*/
+   unsigned hps_;
+   /*20.010 Transmitted vertical pixel scale (TVPS)*/
+   unsigned vps_;
+   /*20.011 Compression algorithm (CGA)*/
+   std::string cga_;
+   /*20.012 Bits per pixel (BPX)*/
+   unsigned char bpx_;
+   /*20.013 Color space (CSP)*/
+   std::string csp_;
+   /*20.014 Acquisition source (AQS)*/
+   std::string aqs_;
+   /*20.015 Source representation format (SFT)*/
+   std::string sft_;
+   /*20.020 Comment (COM)*/
+   std::string com_;
+   /*20.021 Source representation number (SRN)*/
+   unsigned srn_;
+};
+
+///! Запись Type-21 - Сопутствующие данные
+class type21Record : public type4Record
+{   
+public:
+   type21Record();
+   ~type21Record();
+   bool load(const nistSpan&, unsigned& offset);
+   int write(FILE* out, unsigned len = 0);
+   const std::string& getACD() const{return acd_;}
+   const std::string& getAFT() const{return aft_;}
+   unsigned getACN() const{return acn_;}
+protected:
+   static const nistFieldSchema<type21Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+   /*21.004 Source agency / ORI (SRC)*/
+   std::string ori_;
+   /*21.005 Associated context date (ACD)*/
+   std::string acd_;
+   /*21.015 Associated context format (AFT)*/
+   std::string aft_;
+   /*21.020 Comment (COM)*/
+   std::string com_;
+   /*21.021 Associated context number (ACN)*/
+   unsigned acn_;
+};
+
+///! Запись Type-98 - Обеспечение достоверности информации
+class type98Record : public nistRecord
+{   
+public:
+   type98Record();
+   ~type98Record();
+   bool load(const nistSpan&, unsigned& offset);
+   int write(FILE* out, unsigned len = 0);
+   unsigned char getIDC() const{return idc_;}
+   unsigned getDFO() const{return dfo_;}
+   unsigned getDFT() const{return dft_;}
+   const std::string& getDCD() const{return dcd_;}
+protected:
+   static const nistFieldSchema<type98Record> schema_[];
+   static const unsigned schema_size_;
+   friend unsigned nistMandatoryFields(unsigned type, unsigned* tags, unsigned max_tags);
+   /*98.002 IDC*/
+   unsigned char idc_;
+   /*98.003 IA data format owner (DFO), шестнадцатеричное значение*/
+   unsigned dfo_;
+   /*98.004 Source agency / ORI (SRC)*/
+   std::string ori_;
+   /*98.005 IA data format type (DFT), шестнадцатеричное значение*/
+   unsigned dft_;
+   /*98.006 IA data creation date (DCD) CCYYMMDDhhmmssZ*/
+   std::string dcd_;
+};
+
+///! Запись Type-99 - биометрические данные в формате CBEFF
 class type99Record : public nistRecord
 {   
 public:
    type99Record();
    virtual ~type99Record();
-   bool load(const std::vector<unsigned char>&, unsigned& offset);
+   bool load(const nistSpan&, unsigned& offset);
+   unsigned char getIDC() const{return idc_;}
+   const std::string& getSRC() const{return ori_;}
+   const std::string& getBCD() const{return bcd_;}
+   const std::string& getHDV() const{return hdv_;}
+   unsigned getBTY() const{return bty_;}
+   unsigned getBDQ() const{return bdq_;}
+   unsigned getBDQVendor() const{return bdq_vendor_;}
+   unsigned getBDQAlgorithm() const{return bdq_algorithm_;}
+   unsigned getBFO() const{return bfo_;}
+   unsigned getBFT() const{return bft_;}
+   //!Блок биометрических данных (99.999 BDB), указывает в исходный буфер без копирования
+   nistSpan getBDB() const{nistSpan bdb = {image_data_, image_data_size_}; return bdb;}
+protected:
+   virtual void clear();
+   /*99.002 IDC*/
+   unsigned char idc_;
+   /*99.004 Source agency / ORI (SRC)*/
+   std::string ori_;
+   /*99.005 Biometric capture date (BCD)*/
+   std::string bcd_;
+   /*99.100 CBEFF header version (HDV), "0101" для CBEFF 1.1*/
+   std::string hdv_;
+   /*99.101 Biometric type (BTY), шестнадцатеричное значение*/
+   unsigned bty_;
+   /*
+   99.102 Biometric data quality (BDQ)
+   Первое подполе: <качество 0-100, 254, 255> US <идентификатор производителя алгоритма> US <идентификатор алгоритма>
+   */
+   unsigned bdq_;
+   unsigned bdq_vendor_;
+   unsigned bdq_algorithm_;
+   /*99.103 BDB format owner (BFO), шестнадцатеричный идентификатор, регистрируемый IBIA*/
+   unsigned bfo_;
+   /*99.104 BDB format type (BFT), шестнадцатеричное значение, назначаемое владельцем формата*/
+   unsigned bft_;
+};
+
+///! Ссылка на запись Type-99, найденную без полной загрузки файла
+struct nistCbeffRef
+{
+   //!Смещение записи относительно начала файла
+   unsigned offset_;
+   unsigned size_;
+   unsigned idc_;
+   unsigned format_owner_;
+   unsigned format_type_;
+   //!Блок биометрических данных в исходном буфере
+   nistSpan bdb_;
+};
+
+/*! Записи транзакции с одним IDC: текстовые данные, минуции и изображения одного объекта.
+    Диапазоны указывают во внутренний индекс парсера и действительны до следующей загрузки
+*/
+struct nistIdcGroup
+{
+   unsigned idc_;
+   //!Все записи с этим IDC: Type-2, затем Type-9, затем изображения, затем остальные
+   nistConstRecordRange records_;
+   nistConstRecordRange type2_;
+   nistConstRecordRange minutiae_;
+   //!Записи изображений: Type-3..8, 10, 13..17, 19, 20
+   nistConstRecordRange images_;
+};
+
+///! Описательные поля записи изображения Type-4/10/13/14/15 для выгрузок метаданных; поля, которых нет в типе, - 0
+struct nistImageInfo
+{
+   unsigned imp_;
+   //!FGP, для Type-15 - PLP
+   unsigned fgp_;
+   unsigned hll_;
+   unsigned vll_;
+   unsigned slc_;
+   //!HPS, для Type-4 - ISR
+   unsigned hps_;
+   unsigned vps_;
+   unsigned bpx_;
+   //!CGA, для Type-4 - код десятичным числом
+   std::string cga_;
+   //!Дата съемки PHD, LCD, TCD, PCD и 10.003 IMT; указывают в запись или на пустую строку
+   const std::string* date_;
+   const std::string* imt_;
 };
 
+//!Заполняет info по записи изображения; false, если тип записи не Type-4/10/13/14/15
+bool nistGetImageInfo(const nistRecord& rec, nistImageInfo& info);
+
 ///! Класс парсера ANSI-NIST файлов
 class nistParser
 {
 public:
    nistParser();
    ~nistParser();
+   /*! Moves loaded transaction, record pools and buffers. Records and views obtained from other stay valid
+       and now belong to this parser. Parsers are not copyable.
+   */
+   nistParser(nistParser&& other);
+   nistParser& operator=(nistParser&& other);
+   nistParser(const nistParser&) = delete;
+   nistParser& operator=(const nistParser&) = delete;
+   /*! Releases the loaded transaction. Records go to per-type free lists, file buffer, arena and strings 
+       keep their capacity, so a parser reused for similar transactions stops allocating memory.
+       Records and views obtained before reset() are invalid after it. Called by load().
+   */
+   void reset();
    /// Reads file in to internal buffer, then call load from this buffer
    bool load(const std::string&,bool force=false);
-   /// Loads ANSI-NIS file data from memory buffer. Buffer should be valid until obect destruction.
+   /*! Loads ANSI-NIST transaction from any contiguous memory: vector, mmap region, shared memory segment,
+       network buffer. The bytes are not copied: tags, images and records point into them, so the memory must
+       stay valid and unchanged until the next load(), reset() or parser destruction (or destruction of a
+       nistTransaction that took the records). The parser never writes to or frees it; editing copies the
+       changed records into buffers owned by the parser.
+   */
+   bool load(const unsigned char* data, size_t size, bool force=false);
+   /// Same as load(data.data(), data.size()); the vector is the caller's buffer under the same contract
    bool load(const std::vector<unsigned char>&,bool force=false);
+   /*! Swaps data with the internal file buffer and loads it. data receives the previous buffer, so a producer 
+       that builds transactions in memory (e.g. nistXmlReader) hands them over without copying and reuses capacity.
+   */
+   bool loadSwap(std::vector<unsigned char>& data,bool force=false);
 
+   /*! Finds Type-99 records with the given CBEFF format owner/type (0xFFFFFFFF matches any) 
+       without loading other records: only Type-1 is parsed, other records are skipped by their LEN.
+       Returns the number of records found.
+   */
+   static unsigned findCbeff(const nistSpan& file_data, unsigned format_owner, unsigned format_type,
+                             std::vector<nistCbeffRef>& found);
    /// Service function for reading file in to memory
    static bool readFile(const std::string& file_name,std::vector<unsigned char>& content);
-   void write(const std::string& output_file_name);
+   /// Writes transaction to output_file_name. Every record is written once, LEN is computed by the record writer
+   bool write(const std::string& output_file_name);
    /// Unit Separator  Separates information items 
    static unsigned char US() {return 0x1F;}
    /// Record Separator  Separates subfields
@@ -827,22 +1456,120 @@ public:
    static unsigned char GS() {return 0x1D;}
    /// File Separator  Separates logical records 
    static unsigned char FS() {return 0x1C;}
-   std::string getTOT();
-   std::string getORI();
-   std::string getDAI();
-   std::string getTCN();
-   std::string getTCR();
-   std::string getDOM();
-   double getISR();
+   std::string getTOT() const;
+   std::string getORI() const;
+   std::string getDAI() const;
+   std::string getTCN() const;
+   std::string getTCR() const;
+   std::string getDOM() const;
+   double getISR() const;
    type1Record* getFileHeader(){return &header_;}
-   std::vector<nistRecord*> getRecords(unsigned type);
+   const type1Record* getFileHeader() const{return &header_;}
+   /*! Records of the type in file order. The index is built during load, so the lookup is O(1) and 
+       does not allocate. The range is valid until the next load() or reset().
+   */
+   nistRecordRange getRecords(unsigned type);
+   nistConstRecordRange getRecords(unsigned type) const;
+   /// Records of the type with the IDC given for them in Type-1 CNT, usually one record
+   nistRecordRange getRecords(unsigned type, unsigned idc);
+   nistConstRecordRange getRecords(unsigned type, unsigned idc) const;
+   /// Records linked by the IDC (Type-2, Type-9 and images), 0 if there are none. Binary search, no allocations
+   const nistIdcGroup* getIDC(unsigned idc) const;
+   /// All IDC groups in ascending IDC order
+   const std::vector<nistIdcGroup>& getIdcGroups() const{return idc_groups_;}
+   /// Number of loaded records except Type-1 and the record by its position in the file
+   unsigned getRecordsCnt() const{return records_.size();}
+   const nistRecord* getRecord(unsigned no) const{return no<records_.size() ? records_[no] : 0;}
+   /// Minutiae of Type-9 records are decoded on first access instead of during load
+   void setLazyMinutiae(bool lazy){lazy_minutiae_ = lazy;}
+
+   /*! Transaction editing. Only the changed record is serialized again (with its LEN) into a buffer owned by
+       the parser and reloaded, Type-1 CNT is regenerated from the record list, offsets and indexes are updated.
+       So every call leaves sizes, IDC and CNT consistent and building a transaction record by record
+       costs one record serialization per call. Record numbers are positions in getRecord().
+       Records, tags and views obtained before a call are invalid after it.
+   */
+   /// Appends a record built from (tag, value) fields, image becomes field 999 (Type-4: the binary image data,
+   /// header fields 4.002-4.008 are given as decimal values). Without field 2 the next unused IDC is assigned.
+   /// Returns the number of the new record or -1
+   int appendRecord(unsigned type, const std::vector<std::pair<unsigned,std::string> >& fields,
+                    const unsigned char* image = 0, unsigned image_size = 0);
+   bool removeRecord(unsigned rec_no);
+   /// Replaces field 999 of a tagged record or the image data of a binary record, binary header is kept
+   bool replaceImage(unsigned rec_no, const unsigned char* image, unsigned image_size);
+   /// Sets or adds field tag of a tagged record. Changing field 2 (IDC) updates CNT
+   bool setField(unsigned rec_no, unsigned tag, const std::string& value);
+   /// Sets or adds field tag of Type-1. LEN and CNT are maintained by the parser and can't be set
+   bool setHeaderField(unsigned tag, const std::string& value);
+   /// True if the transaction was edited and records no longer point into the loaded buffer
+   bool isModified() const{return !header_data_.empty() || !owned_.empty();}
 protected:
    std::string err_msg_;
    std::vector<unsigned char> file_data_;
    type1Record header_;
    std::vector<nistRecord*> records_;
+   //!Арена для разобранных данных текущей транзакции
+   nistArena arena_;
+   bool lazy_minutiae_;
+   //!Число типов записей, для которых ведутся списки свободных записей
+   static const unsigned pool_types_ = 100;
+   //!Свободные записи по типам, используются повторно при следующей загрузке
+   std::vector<nistRecord*> pool_[pool_types_];
+   //!Записи, сгруппированные по типам; записи типа t занимают [type_begin_[t], type_begin_[t+1])
+   std::vector<nistRecord*> by_type_;
+   unsigned type_begin_[pool_types_ + 1];
+   //!IDC из CNT для каждой записи records_
+   std::vector<unsigned> records_idc_;
+   //!Записи, упорядоченные по ключу idcKey() (IDC, группа типа, тип), и сами ключи
+   std::vector<std::pair<unsigned,nistRecord*> > idc_entries_;
+   std::vector<unsigned> idc_keys_;
+   std::vector<nistRecord*> by_idc_;
+   //!Перекрестные ссылки по IDC, диапазоны указывают в by_idc_
+   std::vector<nistIdcGroup> idc_groups_;
+   //!Данные Type-1 и записей, собранных заново при редактировании; буфер записи живет, пока запись в транзакции
+   std::vector<unsigned char> header_data_;
+   std::map<const nistRecord*,std::vector<unsigned char> > owned_;
+private:
+   //!Удаляет все записи, включая свободные
+   void release();
+   //!Переназначает арену записям Type-9 после перемещения
+   void attachArena();
+   //!Строит индексы по типам и IDC после загрузки записей
+   void buildIndex();
+   //!Переносит индексы из other
+   void takeIndex(nistParser& other);
+   //!Загружает запись типа rec_type из data и добавляет ее в records_
+   bool loadRecord(unsigned rec_type, const nistSpan& data, unsigned& offset, bool force);
+   //!Заменяет запись rec_no записью, загруженной из data; data переходит во владение парсера
+   bool reloadRecord(unsigned rec_no, std::vector<unsigned char>& data);
+   //!Собирает Type-1 заново с CNT по текущему списку записей и, если tag!=0, новым значением поля tag
+   bool rebuildHeader(unsigned tag = 0, const std::string& value = std::string());
+   //!Пересчитывает смещения записей по их длинам и строит индексы после редактирования
+   void updateLayout();
+};
+
+/*! Неизменяемое представление загруженной транзакции для одновременного чтения из нескольких потоков.
+    Забирает у парсера записи, буфер файла и арену без копирования и открывает только const-доступ к ним.
+    Отложенный разбор (минуции Type-9) выполняется однократно без блокировок, см. type9Record::getMinutiae().
+    Если парсер загружался из внешнего буфера, буфер должен существовать дольше представления.
+*/
+class nistTransaction
+{
+public:
+   explicit nistTransaction(nistParser&& parser) : parser_(std::move(parser)) {}
+   nistTransaction(nistTransaction&&) = default;
+   const type1Record& header() const{return *parser_.getFileHeader();}
+   unsigned recordsCnt() const{return parser_.getRecordsCnt();}
+   const nistRecord* record(unsigned no) const{return parser_.getRecord(no);}
+   nistConstRecordRange getRecords(unsigned type) const{return parser_.getRecords(type);}
+   nistConstRecordRange getRecords(unsigned type, unsigned idc) const{return parser_.getRecords(type,idc);}
+   const nistIdcGroup* getIDC(unsigned idc) const{return parser_.getIDC(idc);}
+   const std::vector<nistIdcGroup>& getIdcGroups() const{return parser_.getIdcGroups();}
+private:
+   nistParser parser_;
 };
 
 
 
+
 #endif // NIST_PARSER_H
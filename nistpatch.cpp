@@ -0,0 +1,437 @@
+/*
+  \file   nistpatch.cpp
+  \brief  Правка отдельных полей ANSI-NIST файла без разбора и перезаписи всей транзакции
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "nistcopy.h"
+#include "nistpatch.h"
+#include "nistparser.h"
+
+//!Размер блока при копировании без copy_file_range
+static const size_t copy_chunk = 256*1024;
+
+static bool seekTo(FILE* file, unsigned long long offset)
+{
+#ifdef WIN32
+   return _fseeki64(file,offset,SEEK_SET)==0;
+#else
+   return fseeko(file,offset,SEEK_SET)==0;
+#endif
+}
+
+static bool readAt(FILE* file, unsigned long long offset, unsigned char* data, size_t size)
+{
+   return seekTo(file,offset) && fread(data,1,size,file)==size;
+}
+
+/*!Читает длину записи по ее началу: LEN первого поля текстовой записи
+   или первые 4 байта (big-endian) бинарной
+*/
+static bool recordLength(FILE* file, unsigned long long offset, unsigned type, unsigned long long& len)
+{
+   unsigned char head[32];
+   size_t got = seekTo(file,offset) ? fread(head,1,sizeof(head),file) : 0;
+   if(nistIsBinaryRecord(type))
+   {
+      len = got>=4 ? (unsigned long long)head[0]<<24 | head[1]<<16 | head[2]<<8 | head[3] : 0;
+      return len>=4;
+   }
+   const unsigned char* colon = (const unsigned char*)memchr(head,':',got);
+   if(!colon)
+   {
+      return false;
+   }
+   len = 0;
+   const unsigned char* p = colon + 1;
+   for(;p<head + got && *p>='0' && *p<='9';p++)
+   {
+      len = len*10 + (*p - '0');
+   }
+   return p<head + got && *p==nistParser::GS() && len>0;
+}
+
+nistPatch::nistPatch()
+{
+}
+
+void nistPatch::setField(unsigned rec_no, unsigned tag, const std::string& value)
+{
+   edit e = {rec_no,tag,false,value};
+   edits_.push_back(e);
+}
+
+void nistPatch::removeField(unsigned rec_no, unsigned tag)
+{
+   edit e = {rec_no,tag,true,std::string()};
+   edits_.push_back(e);
+}
+
+///! Поле текстовой записи: номер и границы в исходном буфере
+struct patchField
+{
+   unsigned tag_;
+   //!Идентификатор поля с двоеточием и значение
+   const unsigned char* begin_;
+   const unsigned char* value_;
+   const unsigned char* end_;
+};
+
+bool nistPatch::rebuild(unsigned type, record& rec)
+{
+   //Разбор полей записи: значение до GS/FS, поле 999 - до конца записи
+   std::vector<patchField> fields;
+   const unsigned char* p = &rec.data_[0];
+   const unsigned char* end = p + rec.data_.size();
+   while(p<end)
+   {
+      const unsigned char* colon = (const unsigned char*)memchr(p,':',end - p);
+      const unsigned char* dot = colon ? (const unsigned char*)memchr(p,'.',colon - p) : 0;
+      if(!dot)
+      {
+         err_msg_ = "invalid field identifier";
+         return false;
+      }
+      patchField field;
+      field.tag_ = atoi(std::string(dot + 1,colon).c_str());
+      field.begin_ = p;
+      field.value_ = colon + 1;
+      field.end_ = end - 1;
+      if(field.tag_!=999)
+      {
+         for(const unsigned char* sep=field.value_;sep<end;sep++)
+         {
+            if(*sep==nistParser::GS() || *sep==nistParser::FS())
+            {
+               field.end_ = sep;
+               break;
+            }
+         }
+      }
+      fields.push_back(field);
+      p = field.end_ + 1;
+   }
+
+   //Правки этой записи; более поздняя правка поля заменяет раннюю
+   std::vector<const edit*> edits;
+   for(size_t no=0;no<edits_.size();no++)
+   {
+      const edit& e = edits_[no];
+      if(e.rec_no_!=rec.rec_no_)
+      {
+         continue;
+      }
+      if(e.tag_==1 || e.tag_==999 || !e.tag_)
+      {
+         err_msg_ = "fields LEN and 999 can't be patched";
+         return false;
+      }
+      edits.erase(std::remove_if(edits.begin(),edits.end(),[&e](const edit* other){return other->tag_==e.tag_;}),edits.end());
+      edits.push_back(&e);
+   }
+   std::sort(edits.begin(),edits.end(),[](const edit* a, const edit* b){return a->tag_<b->tag_;});
+
+   //Все поля, кроме LEN: исходные и новые по порядку номеров
+   std::vector<unsigned char> rest;
+   size_t next_edit = 0;
+   char prefix[32];
+   for(size_t no=0;no<=fields.size();no++)
+   {
+      unsigned tag = no<fields.size() ? fields[no].tag_ : 0xFFFFFFFF;
+      while(next_edit<edits.size() && edits[next_edit]->tag_<tag)
+      {
+         const edit& e = *edits[next_edit++];
+         if(!e.remove_)
+         {
+            snprintf(prefix,sizeof(prefix),"%u.%03u:",type,e.tag_);
+            rest.insert(rest.end(),prefix,prefix + strlen(prefix));
+            rest.insert(rest.end(),e.value_.begin(),e.value_.end());
+            rest.push_back(nistParser::GS());
+         }
+      }
+      if(no==fields.size() || tag==1)
+      {
+         continue;
+      }
+      const patchField& field = fields[no];
+      if(next_edit<edits.size() && edits[next_edit]->tag_==tag)
+      {
+         const edit& e = *edits[next_edit++];
+         if(!e.remove_)
+         {
+            rest.insert(rest.end(),field.begin_,field.value_);
+            rest.insert(rest.end(),e.value_.begin(),e.value_.end());
+            rest.push_back(nistParser::GS());
+         }
+         continue;
+      }
+      rest.insert(rest.end(),field.begin_,field.end_ + 1);
+   }
+   if(rest.empty())
+   {
+      err_msg_ = "record has no fields left";
+      return false;
+   }
+   rest.back() = nistParser::FS();
+
+   //Идентификатор LEN сохраняется в исходном виде, длина пересчитывается вместе с ее собственными цифрами
+   const patchField& len_field = fields[0];
+   std::string head(len_field.begin_,len_field.value_);
+   nistTaggedRecordLen(head.size() + 1 + rest.size(),prefix);
+   std::vector<unsigned char> data(head.begin(),head.end());
+   data.insert(data.end(),prefix,prefix + strlen(prefix));
+   data.push_back(nistParser::GS());
+   data.insert(data.end(),rest.begin(),rest.end());
+   rec.data_.swap(data);
+   return true;
+}
+
+bool nistPatch::prepare(FILE* in, std::vector<record>& records)
+{
+   std::vector<unsigned> rec_nos;
+   for(size_t no=0;no<edits_.size();no++)
+   {
+      rec_nos.push_back(edits_[no].rec_no_);
+   }
+   std::sort(rec_nos.begin(),rec_nos.end());
+   rec_nos.erase(std::unique(rec_nos.begin(),rec_nos.end()),rec_nos.end());
+
+   unsigned long long header_size = 0;
+   if(!recordLength(in,0,1,header_size))
+   {
+      err_msg_ = "can't read Type-1 LEN";
+      return false;
+   }
+   std::vector<unsigned char> header_data(header_size);
+   if(!readAt(in,0,&header_data[0],header_data.size()))
+   {
+      err_msg_ = "can't read Type-1";
+      return false;
+   }
+   type1Record header;
+   unsigned header_offset = 0;
+   if(!header.load(header_data,header_offset,true))
+   {
+      err_msg_ = "invalid Type-1";
+      return false;
+   }
+
+   //Смещения записей по их LEN, читаются только начала записей
+   unsigned long long offset = header_size;
+   unsigned cur = 1;
+   for(size_t no=0;no<rec_nos.size();no++)
+   {
+      record rec;
+      rec.rec_no_ = rec_nos[no];
+      unsigned type = 1;
+      if(!rec.rec_no_)
+      {
+         rec.offset_ = 0;
+         rec.old_size_ = header_size;
+         rec.data_.swap(header_data);
+      }
+      else
+      {
+         if(rec.rec_no_>header.getRecordsCnt())
+         {
+            err_msg_ = "record number is out of CNT";
+            return false;
+         }
+         unsigned long long len = 0;
+         for(;;cur++)
+         {
+            if(!recordLength(in,offset,header.getRecordType(cur - 1),len))
+            {
+               err_msg_ = "can't read record LEN";
+               return false;
+            }
+            if(cur==rec.rec_no_)
+            {
+               break;
+            }
+            offset += len;
+         }
+         type = header.getRecordType(cur - 1);
+         if(nistIsBinaryRecord(type))
+         {
+            err_msg_ = "binary records can't be patched";
+            return false;
+         }
+         rec.offset_ = offset;
+         rec.old_size_ = len;
+         rec.data_.resize(len);
+         if(!readAt(in,offset,&rec.data_[0],len))
+         {
+            err_msg_ = "can't read record";
+            return false;
+         }
+      }
+      if(!rebuild(type,rec))
+      {
+         return false;
+      }
+      records.push_back(rec);
+   }
+   return true;
+}
+
+//!Копирует size байт из in (с offset) в текущую позицию out
+static bool copyRange(FILE* in, FILE* out, unsigned long long offset, unsigned long long size)
+{
+#ifndef WIN32
+   if(size && fflush(out)==0)
+   {
+      unsigned long long copied = nistKernelCopy(fileno(in),offset,fileno(out),size);
+      offset += copied;
+      size -= copied;
+      //Позиция потока out должна учесть данные, записанные в обход него
+      if(copied && fseeko(out,0,SEEK_END)!=0)
+      {
+         return false;
+      }
+   }
+#endif
+   std::vector<unsigned char> buffer(size ? copy_chunk : 0);
+   while(size)
+   {
+      size_t chunk = size<copy_chunk ? (size_t)size : copy_chunk;
+      if(!readAt(in,offset,&buffer[0],chunk) || fwrite(&buffer[0],1,chunk,out)!=chunk)
+      {
+         return false;
+      }
+      offset += chunk;
+      size -= chunk;
+   }
+   return true;
+}
+
+bool nistPatch::splice(FILE* in, FILE* out, const std::vector<record>& records)
+{
+   if(!seekTo(in,0) || fseek(in,0,SEEK_END)!=0)
+   {
+      return false;
+   }
+#ifdef WIN32
+   unsigned long long file_size = _ftelli64(in);
+#else
+   unsigned long long file_size = ftello(in);
+#endif
+   unsigned long long pos = 0;
+   for(size_t no=0;no<records.size();no++)
+   {
+      const record& rec = records[no];
+      if(!copyRange(in,out,pos,rec.offset_ - pos) ||
+         fwrite(&rec.data_[0],1,rec.data_.size(),out)!=rec.data_.size())
+      {
+         return false;
+      }
+      pos = rec.offset_ + rec.old_size_;
+   }
+   return copyRange(in,out,pos,file_size - pos);
+}
+
+bool nistPatch::write(const std::string& in_file, const std::string& out_file)
+{
+   err_msg_.clear();
+   FILE* in = fopen(in_file.c_str(),"rb");
+   if(!in)
+   {
+      err_msg_ = "can't open " + in_file;
+      return false;
+   }
+   std::vector<record> records;
+   bool res = prepare(in,records);
+   FILE* out = res ? fopen(out_file.c_str(),"wb") : 0;
+   if(res && !out)
+   {
+      err_msg_ = "can't create " + out_file;
+      res = false;
+   }
+   if(out)
+   {
+      if(!splice(in,out,records))
+      {
+         err_msg_ = "write error " + out_file;
+         res = false;
+      }
+      if(fclose(out)!=0)
+      {
+         res = false;
+      }
+   }
+   fclose(in);
+   if(!res)
+   {
+      dbg0("nistPatch::write error: %s\n",err_msg_.c_str());
+   }
+   return res;
+}
+
+bool nistPatch::apply(const std::string& file_name)
+{
+   err_msg_.clear();
+   FILE* file = fopen(file_name.c_str(),"r+b");
+   if(!file)
+   {
+      err_msg_ = "can't open " + file_name;
+      return false;
+   }
+   std::vector<record> records;
+   bool res = prepare(file,records);
+   bool same_size = true;
+   for(size_t no=0;no<records.size();no++)
+   {
+      same_size = same_size && records[no].data_.size()==records[no].old_size_;
+   }
+   if(res && same_size)
+   {
+      //Смещения остальных записей не меняются, переписываются только измененные
+      for(size_t no=0;res && no<records.size();no++)
+      {
+         res = seekTo(file,records[no].offset_) &&
+               fwrite(&records[no].data_[0],1,records[no].data_.size(),file)==records[no].data_.size();
+      }
+      if(!res)
+      {
+         err_msg_ = "write error " + file_name;
+      }
+      res = fclose(file)==0 && res;
+      return res;
+   }
+   fclose(file);
+   if(!res)
+   {
+      dbg0("nistPatch::apply error: %s\n",err_msg_.c_str());
+      return false;
+   }
+   //Размер изменился - файл собирается заново рядом и заменяет исходный
+   std::string tmp_file = file_name + ".patch";
+   if(!write(file_name,tmp_file))
+   {
+      remove(tmp_file.c_str());
+      return false;
+   }
+#ifdef WIN32
+   remove(file_name.c_str());
+#endif
+   if(rename(tmp_file.c_str(),file_name.c_str())!=0)
+   {
+      err_msg_ = "can't replace " + file_name;
+      remove(tmp_file.c_str());
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,64 @@
+/*
+  \file   nistpatch.h
+  \brief  Правка отдельных полей ANSI-NIST файла без разбора и перезаписи всей транзакции
+*/
+
+#ifndef NIST_PATCH_H
+#define NIST_PATCH_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*! Набор правок текстовых полей. Из файла читаются только Type-1 (для CNT), начала предшествующих
+    записей (их LEN) и сами изменяемые записи; изменяемая запись собирается заново с новым значением
+    поля и пересчитанным LEN.
+
+    apply() правит файл на месте: если размер записей не изменился, перезаписываются только они,
+    и стоимость правки не зависит от размера файла. Иначе файл собирается заново во временном файле
+    рядом (неизменные участки копируются copy_file_range, на файловых системах с reflink - без
+    копирования данных) и заменяет исходный.
+*/
+class nistPatch
+{
+public:
+   nistPatch();
+   /*! Новое значение поля tag записи rec_no: 0 - Type-1, далее записи в порядке CNT.
+       Если поля нет, оно добавляется по порядку номеров. Поле 999 и бинарные записи не изменяются
+   */
+   void setField(unsigned rec_no, unsigned tag, const std::string& value);
+   //!Удаляет поле tag записи rec_no
+   void removeField(unsigned rec_no, unsigned tag);
+   void clear(){edits_.clear();}
+   //!Правит файл на месте
+   bool apply(const std::string& file_name);
+   //!Пишет исправленную копию in_file в out_file, in_file не меняется
+   bool write(const std::string& in_file, const std::string& out_file);
+   const std::string& getError() const{return err_msg_;}
+private:
+   struct edit
+   {
+      unsigned rec_no_;
+      unsigned tag_;
+      bool remove_;
+      std::string value_;
+   };
+   //!Новое содержимое записи и ее место в исходном файле
+   struct record
+   {
+      unsigned rec_no_;
+      unsigned long long offset_;
+      unsigned long long old_size_;
+      std::vector<unsigned char> data_;
+   };
+   //!Находит изменяемые записи в in и собирает их новое содержимое, записи упорядочены по смещению
+   bool prepare(FILE* in, std::vector<record>& records);
+   //!Собирает запись rec.data_ с учетом правок
+   bool rebuild(unsigned type, record& rec);
+   bool splice(FILE* in, FILE* out, const std::vector<record>& records);
+
+   std::vector<edit> edits_;
+   std::string err_msg_;
+};
+
+#endif // NIST_PATCH_H
@@ -0,0 +1,476 @@
+/*
+  \file   nistprofile.cpp
+  \brief  Проверка транзакций на соответствие профилю (INT-I, EBTS, версии ANSI/NIST-ITL)
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "nistprofile.h"
+
+const char* nistRuleText(nistRuleOp op)
+{
+   switch(op)
+   {
+      case nistRuleMandatory: return "mandatory field is missing";
+      case nistRuleRange: return "value out of range";
+      case nistRuleLength: return "length out of range";
+      case nistRuleValues: return "value not allowed";
+      case nistRuleRecords: return "record count out of range";
+   }
+   return "unknown";
+}
+
+//!Ссылка на поле "T.NNN"
+static bool parseFieldRef(const std::string& word, unsigned& type, unsigned& tag)
+{
+   char* end = 0;
+   unsigned long value = strtoul(word.c_str(),&end,10);
+   if(end==word.c_str() || *end!='.' || value>99)
+   {
+      return false;
+   }
+   type = value;
+   const char* tag_str = end + 1;
+   value = strtoul(tag_str,&end,10);
+   if(end==tag_str || *end || value<1 || value>999)
+   {
+      return false;
+   }
+   tag = value;
+   return true;
+}
+
+static bool parseUnsigned(const std::string& word, unsigned& value)
+{
+   char* end = 0;
+   unsigned long long parsed = strtoull(word.c_str(),&end,10);
+   if(end==word.c_str() || *end || parsed>0xFFFFFFFFull)
+   {
+      return false;
+   }
+   value = parsed;
+   return true;
+}
+
+//!Совпадает ли значение поля со строкой value
+static bool fieldEquals(const unsigned char* data, unsigned size, const char* value, unsigned value_size)
+{
+   return size==value_size && !memcmp(data,value,size);
+}
+
+nistProfile::nistProfile()
+{
+   memset(type_begin_,0,sizeof(type_begin_));
+}
+
+bool nistProfile::compileFile(const std::string& file_name)
+{
+   std::vector<unsigned char> content;
+   if(!nistParser::readFile(file_name,content))
+   {
+      err_msg_ = "can't read " + file_name;
+      return false;
+   }
+   return compile(std::string(content.begin(),content.end()));
+}
+
+bool nistProfile::compileLine(const std::vector<std::string>& words, unsigned line, unsigned short tot)
+{
+   const std::string& op = words[0];
+   nistRule rule = {0,0,0,tot,(unsigned short)line,0,0};
+   unsigned type = 0;
+   unsigned tag = 0;
+   if(op=="mandatory")
+   {
+      for(size_t no=1;no<words.size();no++)
+      {
+         if(!parseFieldRef(words[no],type,tag))
+         {
+            return false;
+         }
+         rule.op_ = nistRuleMandatory;
+         rule.type_ = type;
+         rule.tag_ = tag;
+         rules_.push_back(rule);
+      }
+      return words.size()>1;
+   }
+   if(op=="range" || op=="length")
+   {
+      if(words.size()!=4 || !parseFieldRef(words[1],type,tag) || !parseUnsigned(words[2],rule.a_) ||
+         !parseUnsigned(words[3],rule.b_))
+      {
+         return false;
+      }
+      rule.op_ = op=="range" ? nistRuleRange : nistRuleLength;
+      rule.type_ = type;
+      rule.tag_ = tag;
+      rules_.push_back(rule);
+      return true;
+   }
+   if(op=="values")
+   {
+      if(words.size()<3 || !parseFieldRef(words[1],type,tag))
+      {
+         return false;
+      }
+      rule.op_ = nistRuleValues;
+      rule.type_ = type;
+      rule.tag_ = tag;
+      rule.a_ = pool_.size();
+      rule.b_ = words.size() - 2;
+      for(size_t no=2;no<words.size();no++)
+      {
+         if(words[no].size()>255)
+         {
+            return false;
+         }
+         pool_ += (char)words[no].size();
+         pool_ += words[no];
+      }
+      rules_.push_back(rule);
+      return true;
+   }
+   if(op=="records")
+   {
+      if(words.size()!=4 || !parseUnsigned(words[1],type) || type<2 || type>99 || !parseUnsigned(words[2],rule.a_) ||
+         !parseUnsigned(words[3],rule.b_))
+      {
+         return false;
+      }
+      rule.op_ = nistRuleRecords;
+      rule.type_ = type;
+      count_rules_.push_back(rule);
+      return true;
+   }
+   return false;
+}
+
+bool nistProfile::compile(const std::string& text)
+{
+   name_.clear();
+   domain_.clear();
+   domain_version_.clear();
+   versions_.clear();
+   rules_.clear();
+   count_rules_.clear();
+   pool_.clear();
+   tot_groups_.clear();
+   err_msg_.clear();
+
+   std::istringstream in(text);
+   std::string line_text;
+   unsigned line = 0;
+   unsigned short tot = 0;
+   std::vector<std::string> words;
+   while(std::getline(in,line_text))
+   {
+      line++;
+      size_t comment = line_text.find('#');
+      if(comment!=std::string::npos)
+      {
+         line_text.erase(comment);
+      }
+      std::istringstream line_in(line_text);
+      words.clear();
+      std::string word;
+      while(line_in>>word)
+      {
+         words.push_back(word);
+      }
+      if(words.empty())
+      {
+         continue;
+      }
+      bool res = true;
+      if(words[0]=="profile")
+      {
+         res = words.size()==2;
+         name_ = res ? words[1] : name_;
+      }
+      else if(words[0]=="domain")
+      {
+         res = words.size()==2 || words.size()==3;
+         domain_ = res ? words[1] : domain_;
+         domain_version_ = words.size()==3 ? words[2] : std::string();
+      }
+      else if(words[0]=="version")
+      {
+         versions_.insert(versions_.end(),words.begin() + 1,words.end());
+         res = words.size()>1;
+      }
+      else if(words[0]=="tot")
+      {
+         if(words.size()==2 && words[1]=="*")
+         {
+            tot = 0;
+         }
+         else if(words.size()<2 || tot_groups_.size()>=64)
+         {
+            res = false;
+         }
+         else
+         {
+            tot_groups_.push_back(std::make_pair((unsigned)pool_.size(),(unsigned)words.size() - 1));
+            for(size_t no=1;no<words.size() && res;no++)
+            {
+               res = words[no].size()<=255;
+               pool_ += (char)words[no].size();
+               pool_ += words[no];
+            }
+            tot = tot_groups_.size();
+         }
+      }
+      else
+      {
+         res = compileLine(words,line,tot);
+      }
+      if(!res)
+      {
+         err_msg_ = "profile line " + std::to_string(line) + ": invalid rule";
+         dbg0("nistProfile::compile %s\n",err_msg_.c_str());
+         return false;
+      }
+   }
+   //Правила по порядку полей записи: при проверке поля и правила сливаются за один проход
+   std::stable_sort(rules_.begin(),rules_.end(),[](const nistRule& a, const nistRule& b)
+   {
+      return a.type_<b.type_ || (a.type_==b.type_ && a.tag_<b.tag_);
+   });
+   memset(type_begin_,0,sizeof(type_begin_));
+   for(size_t no=0;no<rules_.size();no++)
+   {
+      type_begin_[rules_[no].type_ + 1]++;
+   }
+   for(unsigned type=0;type<100;type++)
+   {
+      type_begin_[type + 1] += type_begin_[type];
+   }
+   return true;
+}
+
+bool nistProfile::matches(const nistParser& parser) const
+{
+   const type1Record* header = parser.getFileHeader();
+   if(!domain_.empty())
+   {
+      //1.013 DOM: имя<US>версия
+      const nistTag* dom = header->getTagById(13);
+      if(!dom || !dom->data())
+      {
+         return false;
+      }
+      const unsigned char* data = dom->data();
+      const unsigned char* us = (const unsigned char*)memchr(data,nistParser::US(),dom->data_size());
+      unsigned name_size = us ? us - data : dom->data_size();
+      if(!fieldEquals(data,name_size,domain_.data(),domain_.size()))
+      {
+         return false;
+      }
+      if(!domain_version_.empty() &&
+         (!us || !fieldEquals(us + 1,dom->data_size() - name_size - 1,domain_version_.data(),domain_version_.size())))
+      {
+         return false;
+      }
+   }
+   if(!versions_.empty())
+   {
+      const nistTag* ver = header->getTagById(2);
+      bool found = false;
+      for(size_t no=0;ver && ver->data() && no<versions_.size() && !found;no++)
+      {
+         found = fieldEquals(ver->data(),ver->data_size(),versions_[no].data(),versions_[no].size());
+      }
+      return found;
+   }
+   return true;
+}
+
+unsigned long long nistProfile::totMask(const nistRecord& header) const
+{
+   unsigned long long mask = 0;
+   const nistTag* tot = header.getTagById(4);
+   if(!tot || !tot->data())
+   {
+      return 0;
+   }
+   for(size_t group=0;group<tot_groups_.size();group++)
+   {
+      unsigned pos = tot_groups_[group].first;
+      for(unsigned no=0;no<tot_groups_[group].second;no++)
+      {
+         unsigned size = (unsigned char)pool_[pos];
+         if(fieldEquals(tot->data(),tot->data_size(),pool_.data() + pos + 1,size))
+         {
+            mask |= 1ull<<group;
+         }
+         pos += 1 + size;
+      }
+   }
+   return mask;
+}
+
+bool nistProfile::checkValue(const nistRule& rule, const unsigned char* data, unsigned size) const
+{
+   switch(rule.op_)
+   {
+      case nistRuleRange:
+         {
+            if(!size || size>10)
+            {
+               return false;
+            }
+            unsigned long long value = 0;
+            for(unsigned pos=0;pos<size;pos++)
+            {
+               if(data[pos]<'0' || data[pos]>'9')
+               {
+                  return false;
+               }
+               value = value*10 + (data[pos] - '0');
+            }
+            return value>=rule.a_ && value<=rule.b_;
+         }
+      case nistRuleLength:
+         return size>=rule.a_ && size<=rule.b_;
+      case nistRuleValues:
+         {
+            unsigned pos = rule.a_;
+            for(unsigned no=0;no<rule.b_;no++)
+            {
+               unsigned value_size = (unsigned char)pool_[pos];
+               if(fieldEquals(data,size,pool_.data() + pos + 1,value_size))
+               {
+                  return true;
+               }
+               pos += 1 + value_size;
+            }
+            return false;
+         }
+      default:
+         return true;
+   }
+}
+
+//!Значение поля заголовка Type-4 (4.002-4.008) в десятичном виде
+static unsigned type4Field(const type4Record& rec, unsigned tag, char* buffer, size_t buffer_size)
+{
+   unsigned value = 0;
+   switch(tag)
+   {
+      case 2: value = rec.getIDC(); break;
+      case 3: value = rec.getIMP(); break;
+      case 4: value = rec.getFGP(); break;
+      case 5: value = rec.getISR(); break;
+      case 6: value = rec.getHLL(); break;
+      case 7: value = rec.getVLL(); break;
+      case 8: value = rec.getCGA(); break;
+      default: return 0;
+   }
+   return snprintf(buffer,buffer_size,"%u",value);
+}
+
+void nistProfile::checkRecord(const nistRecord& rec, unsigned record, unsigned long long tots,
+                              std::vector<nistProfileViolation>& violations) const
+{
+   unsigned type = rec.type();
+   if(type>=100)
+   {
+      return;
+   }
+   unsigned tag_no = 0;
+   unsigned tags_cnt = rec.tagsCnt();
+   char buffer[16];
+   for(unsigned rule_no=type_begin_[type];rule_no<type_begin_[type + 1];rule_no++)
+   {
+      const nistRule& rule = rules_[rule_no];
+      if(rule.tot_ && !(tots>>(rule.tot_ - 1) & 1))
+      {
+         continue;
+      }
+      //Поля и правила упорядочены по номеру, указатель поля только продвигается вперед
+      while(tag_no<tags_cnt && rec.getTag(tag_no)->tag_no()<rule.tag_)
+      {
+         tag_no++;
+      }
+      const unsigned char* data = 0;
+      unsigned size = 0;
+      if(tag_no<tags_cnt && rec.getTag(tag_no)->tag_no()==rule.tag_)
+      {
+         data = rec.getTag(tag_no)->data();
+         size = rec.getTag(tag_no)->data_size();
+      }
+      else if(type==4)
+      {
+         size = type4Field(static_cast<const type4Record&>(rec),rule.tag_,buffer,sizeof(buffer));
+         data = size ? (const unsigned char*)buffer : 0;
+      }
+      else if(const nistTag* tag = rec.getTagById(rule.tag_))
+      {
+         //Поля записи не по порядку
+         data = tag->data();
+         size = tag->data_size();
+      }
+      bool ok = rule.op_==nistRuleMandatory ? data!=0 : !data || checkValue(rule,data,size);
+      if(!ok)
+      {
+         nistProfileViolation violation = {(nistRuleOp)rule.op_,record,type,rule.tag_,rule.line_};
+         violations.push_back(violation);
+      }
+   }
+}
+
+bool nistProfile::check(const nistParser& parser, std::vector<nistProfileViolation>& violations) const
+{
+   size_t first = violations.size();
+   const type1Record* header = parser.getFileHeader();
+   unsigned long long tots = totMask(*header);
+   unsigned counts[100];
+   memset(counts,0,sizeof(counts));
+   checkRecord(*header,0,tots,violations);
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      if(rec->type()<100)
+      {
+         counts[rec->type()]++;
+      }
+      checkRecord(*rec,rec_no + 1,tots,violations);
+   }
+   for(size_t no=0;no<count_rules_.size();no++)
+   {
+      const nistRule& rule = count_rules_[no];
+      if(rule.tot_ && !(tots>>(rule.tot_ - 1) & 1))
+      {
+         continue;
+      }
+      if(counts[rule.type_]<rule.a_ || counts[rule.type_]>rule.b_)
+      {
+         nistProfileViolation violation = {nistRuleRecords,0,rule.type_,0,rule.line_};
+         violations.push_back(violation);
+      }
+   }
+   return violations.size()==first;
+}
+
+const nistProfile* nistProfileSet::select(const nistParser& parser) const
+{
+   for(size_t no=0;no<profiles_.size();no++)
+   {
+      if(profiles_[no].matches(parser))
+      {
+         return &profiles_[no];
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,116 @@
+/*
+  \file   nistprofile.h
+  \brief  Проверка транзакций на соответствие профилю (INT-I, EBTS, версии ANSI/NIST-ITL)
+*/
+
+#ifndef NIST_PROFILE_H
+#define NIST_PROFILE_H
+
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+
+///! Вид правила профиля
+enum nistRuleOp
+{
+   nistRuleMandatory,   ///<Поле обязательно
+   nistRuleRange,       ///<Десятичное значение поля в диапазоне [a, b]
+   nistRuleLength,      ///<Длина поля в диапазоне [a, b]
+   nistRuleValues,      ///<Значение поля из списка (CGA, IMT и т.п.)
+   nistRuleRecords      ///<Число записей типа в диапазоне [a, b]
+};
+
+//!Описание нарушения правила
+const char* nistRuleText(nistRuleOp op);
+
+/*! Правило скомпилированного профиля, 16 байт. Для nistRuleValues a_ - смещение списка значений в пуле
+    профиля, b_ - их число
+*/
+struct nistRule
+{
+   unsigned char op_;
+   unsigned char type_;
+   unsigned short tag_;
+   //!0 - правило для всех TOT, иначе номер группы TOT профиля + 1
+   unsigned short tot_;
+   //!Строка текста профиля
+   unsigned short line_;
+   unsigned a_;
+   unsigned b_;
+};
+
+///! Нарушение профиля
+struct nistProfileViolation
+{
+   nistRuleOp op_;
+   //!Номер записи: 0 - Type-1, далее в порядке nistParser::getRecord() + 1
+   unsigned record_;
+   unsigned type_;
+   unsigned tag_;
+   //!Строка правила в тексте профиля
+   unsigned line_;
+};
+
+/*! Профиль, скомпилированный в программу правил. Текст профиля - строки вида
+       # комментарий
+       profile INT-I-4.22          имя профиля
+       domain INT-I 4.22           выбор по 1.013 DOM: имя и, необязательно, версия
+       version 0400 0500           выбор по 1.002 VER, любое из значений
+       tot CAR MAP                 следующие правила только для этих TOT (до 64 групп); "tot *" - снова для всех
+       mandatory 1.004 2.002       обязательные поля
+       range 10.006 10 99999       диапазон десятичного значения
+       length 1.009 1 40           диапазон длины значения
+       values 10.011 NONE JPEGB    допустимые значения
+       records 14 1 14             число записей типа
+    Правила упорядочиваются по типу записи и номеру поля, поэтому проверка - один проход по записям
+    со слиянием их полей с правилами их типа, без поиска полей и выделения памяти.
+    Поля бинарных записей Type-4 (4.002-4.008) проверяются по значениям заголовка.
+*/
+class nistProfile
+{
+public:
+   nistProfile();
+   bool compile(const std::string& text);
+   bool compileFile(const std::string& file_name);
+   const std::string& name() const{return name_;}
+   unsigned rulesCnt() const{return rules_.size() + count_rules_.size();}
+   //!Подходит ли профиль транзакции по 1.013 DOM и 1.002 VER; профиль без domain и version подходит любой
+   bool matches(const nistParser& parser) const;
+   //!Дописывает нарушения в violations, возвращает true, если их нет
+   bool check(const nistParser& parser, std::vector<nistProfileViolation>& violations) const;
+   const std::string& getError() const{return err_msg_;}
+private:
+   bool compileLine(const std::vector<std::string>& words, unsigned line, unsigned short tot);
+   //!Группы TOT, в которые входит TOT транзакции, битовая маска
+   unsigned long long totMask(const nistRecord& header) const;
+   void checkRecord(const nistRecord& rec, unsigned record, unsigned long long tots, std::vector<nistProfileViolation>& violations) const;
+   bool checkValue(const nistRule& rule, const unsigned char* data, unsigned size) const;
+
+   std::string name_;
+   std::string domain_;
+   std::string domain_version_;
+   std::vector<std::string> versions_;
+   //!Правила полей, упорядоченные по (тип, поле); правила типа t занимают [type_begin_[t], type_begin_[t+1])
+   std::vector<nistRule> rules_;
+   unsigned type_begin_[101];
+   std::vector<nistRule> count_rules_;
+   //!Списки значений и TOT: байт длины, затем значение
+   std::string pool_;
+   //!Группы TOT: смещение списка в пуле и число значений
+   std::vector<std::pair<unsigned,unsigned> > tot_groups_;
+   std::string err_msg_;
+};
+
+///! Набор профилей с выбором по домену транзакции
+class nistProfileSet
+{
+public:
+   void add(const nistProfile& profile){profiles_.push_back(profile);}
+   //!Первый подходящий профиль или 0
+   const nistProfile* select(const nistParser& parser) const;
+private:
+   std::vector<nistProfile> profiles_;
+};
+
+#endif // NIST_PROFILE_H
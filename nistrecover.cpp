@@ -0,0 +1,485 @@
+/*
+  \file   nistrecover.cpp
+  \brief  Восстановление поврежденных ANSI-NIST транзакций
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "nistrecover.h"
+
+const char* nistDamageText(nistDamageKind kind)
+{
+   switch(kind)
+   {
+      case nistDamageLen: return "LEN corrected";
+      case nistDamageGarbage: return "bytes outside records skipped";
+      case nistDamageMissing: return "record listed in CNT not found";
+      case nistDamageTruncated: return "record truncated";
+      case nistDamageCnt: return "CNT unreadable, tagged records found by search";
+   }
+   return "unknown";
+}
+
+static bool isDigit(unsigned char c)
+{
+   return c>='0' && c<='9';
+}
+
+/*!Идентификатор поля LEN "T.001:" (число нулей любое) и первая цифра значения за ним.
+   type == 0 - любой тип, найденный тип записывается в found. Возвращает длину идентификатора или 0
+*/
+static size_t lenFieldId(const unsigned char* p, const unsigned char* end, unsigned type, unsigned* found = 0)
+{
+   const unsigned char* q = p;
+   unsigned value = 0;
+   while(q<end && isDigit(*q) && q - p<2)
+   {
+      value = value*10 + (*q++ - '0');
+   }
+   if(q==p || (type && value!=type) || !value || q==end || *q++!='.')
+   {
+      return 0;
+   }
+   while(q<end && *q=='0')
+   {
+      q++;
+   }
+   if(q==end || *q++!='1' || q==end || *q++!=':' || q==end || !isDigit(*q))
+   {
+      return 0;
+   }
+   if(found)
+   {
+      *found = value;
+   }
+   return q - p;
+}
+
+//!Десятичное значение после идентификатора; end_digits - первый байт после цифр
+static unsigned long long readDigits(const unsigned char* p, const unsigned char* end, const unsigned char*& end_digits)
+{
+   unsigned long long value = 0;
+   while(p<end && isDigit(*p) && value<0xFFFFFFFFFFull)
+   {
+      value = value*10 + (*p++ - '0');
+   }
+   end_digits = p;
+   return value;
+}
+
+static unsigned binaryLen(const unsigned char* p)
+{
+   return (unsigned)p[0]<<24 | p[1]<<16 | p[2]<<8 | p[3];
+}
+
+void nistRecovery::report(nistDamageKind kind, size_t offset, size_t size, unsigned record, unsigned type)
+{
+   nistDamage damage = {kind,offset,size,record,type};
+   damage_->push_back(damage);
+   dbg0("nistRecovery: %s at %zu, record %u type %u\n",nistDamageText(kind),offset,record,type);
+}
+
+bool nistRecovery::startsAt(size_t pos, size_t entry_no) const
+{
+   if(entry_no>=entries_.size())
+   {
+      return pos==size_;
+   }
+   const entry& rec = entries_[entry_no];
+   if(nistIsBinaryRecord(rec.type_))
+   {
+      if(size_ - pos<5 || data_[pos + 4]!=rec.idc_)
+      {
+         return false;
+      }
+      unsigned len = binaryLen(data_ + pos);
+      return len>=nistBinaryHeaderSize(rec.type_) && len<=size_ - pos;
+   }
+   return pos<size_ && lenFieldId(data_ + pos,data_ + size_,rec.type_)>0;
+}
+
+size_t nistRecovery::findStart(size_t from, size_t entry_no) const
+{
+   const entry& rec = entries_[entry_no];
+   if(nistIsBinaryRecord(rec.type_))
+   {
+      //Кандидаты - байты со значением IDC, заголовок начинается за 4 байта до него
+      size_t pos = from + 4;
+      while(pos<size_)
+      {
+         const unsigned char* hit = (const unsigned char*)memchr(data_ + pos,rec.idc_,size_ - pos);
+         if(!hit)
+         {
+            break;
+         }
+         size_t start = hit - data_ - 4;
+         if(startsAt(start,entry_no))
+         {
+            return start;
+         }
+         pos = hit - data_ + 1;
+      }
+      return size_;
+   }
+   char needle[8];
+   int needle_size = snprintf(needle,sizeof(needle),"%u.",rec.type_);
+   size_t pos = from;
+   while(pos<size_)
+   {
+      const unsigned char* hit = (const unsigned char*)memmem(data_ + pos,size_ - pos,needle,needle_size);
+      if(!hit)
+      {
+         break;
+      }
+      size_t start = hit - data_;
+      //Перед идентификатором - FS предыдущей записи или конец бинарной, но не цифра номера другого типа
+      if((start==from || !isDigit(hit[-1])) && lenFieldId(hit,data_ + size_,rec.type_))
+      {
+         return start;
+      }
+      pos = start + 1;
+   }
+   return size_;
+}
+
+bool nistRecovery::parseCnt(const unsigned char* cnt, const unsigned char* cnt_end)
+{
+   //1<US>число записей, затем <RS>тип<US>IDC
+   const unsigned char* p = cnt;
+   const unsigned char* q = 0;
+   if(readDigits(p,cnt_end,q)!=1 || q==p || q==cnt_end || *q!=nistParser::US())
+   {
+      return false;
+   }
+   p = q + 1;
+   readDigits(p,cnt_end,q);
+   if(q==p)
+   {
+      return false;
+   }
+   p = q;
+   while(p<cnt_end)
+   {
+      if(*p!=nistParser::RS())
+      {
+         return false;
+      }
+      entry rec;
+      rec.type_ = readDigits(p + 1,cnt_end,q);
+      if(q==p + 1 || q==cnt_end || *q!=nistParser::US() || rec.type_<2 || rec.type_>99)
+      {
+         return false;
+      }
+      p = q + 1;
+      rec.idc_ = readDigits(p,cnt_end,q);
+      if(q==p)
+      {
+         return false;
+      }
+      p = q;
+      entries_.push_back(rec);
+   }
+   return true;
+}
+
+void nistRecovery::discover(size_t pos)
+{
+   while(pos<size_)
+   {
+      entry rec;
+      size_t id = lenFieldId(data_ + pos,data_ + size_,0,&rec.type_);
+      if(id)
+      {
+         //IDC - значение поля T.002, если оно следует за LEN
+         const unsigned char* q = 0;
+         readDigits(data_ + pos + id,data_ + size_,q);
+         char idc_id[16];
+         int idc_id_size = snprintf(idc_id,sizeof(idc_id),"%u.002:",rec.type_);
+         rec.idc_ = 0;
+         if(q<data_ + size_ && *q==nistParser::GS() && data_ + size_ - q>idc_id_size &&
+            !memcmp(q + 1,idc_id,idc_id_size))
+         {
+            rec.idc_ = readDigits(q + 1 + idc_id_size,data_ + size_,q);
+         }
+         entries_.push_back(rec);
+      }
+      //Следующая запись начинается после FS
+      const unsigned char* fs = (const unsigned char*)memchr(data_ + pos,nistParser::FS(),size_ - pos);
+      if(!fs)
+      {
+         break;
+      }
+      pos = fs - data_ + 1;
+      while(pos<size_ && !lenFieldId(data_ + pos,data_ + size_,0))
+      {
+         fs = (const unsigned char*)memchr(data_ + pos,nistParser::FS(),size_ - pos);
+         pos = fs ? fs - data_ + 1 : size_;
+      }
+   }
+}
+
+bool nistRecovery::appendRecord(size_t start, size_t end, unsigned record, unsigned type, std::vector<unsigned char>& out)
+{
+   if(nistIsBinaryRecord(type))
+   {
+      if(end - start<nistBinaryHeaderSize(type))
+      {
+         return false;
+      }
+      size_t first = out.size();
+      unsigned len = end - start;
+      out.insert(out.end(),data_ + start,data_ + end);
+      out[first] = len>>24;
+      out[first + 1] = len>>16;
+      out[first + 2] = len>>8;
+      out[first + 3] = len;
+      return true;
+   }
+   size_t id = lenFieldId(data_ + start,data_ + end,type);
+   const unsigned char* rest = 0;
+   readDigits(data_ + start + id,data_ + end,rest);
+   bool add_fs = rest==data_ + end || data_[end - 1]!=nistParser::FS();
+   if(add_fs)
+   {
+      report(nistDamageTruncated,start,end - start,record,type);
+   }
+   //LEN пересчитывается вместе с собственными цифрами
+   unsigned long long rest_size = data_ + end - rest + (add_fs ? 1 : 0);
+   char digits[32];
+   nistTaggedRecordLen(id + rest_size,digits);
+   out.insert(out.end(),data_ + start,data_ + start + id);
+   out.insert(out.end(),digits,digits + strlen(digits));
+   out.insert(out.end(),rest,data_ + end);
+   if(add_fs)
+   {
+      out.push_back(nistParser::FS());
+   }
+   return true;
+}
+
+int nistRecovery::repair(const unsigned char* data, size_t size, std::vector<unsigned char>& repaired, std::vector<nistDamage>& damage)
+{
+   data_ = data;
+   size_ = size;
+   damage_ = &damage;
+   entries_.clear();
+   saved_.clear();
+   records_.clear();
+   repaired.clear();
+
+   //Type-1: текстовая запись без изображений, заканчивается первым FS
+   size_t header = 0;
+   if(!size_ || !lenFieldId(data_,data_ + size_,1))
+   {
+      entries_.push_back(entry());
+      entries_[0].type_ = 1;
+      header = findStart(0,0);
+      entries_.clear();
+      if(header==size_)
+      {
+         dbg0("nistRecovery::repair Type-1 not found\n");
+         return -1;
+      }
+      report(nistDamageGarbage,0,header,0,1);
+   }
+   const unsigned char* header_end = (const unsigned char*)memchr(data_ + header,nistParser::FS(),size_ - header);
+   if(!header_end)
+   {
+      dbg0("nistRecovery::repair Type-1 has no FS\n");
+      return -1;
+   }
+   size_t header_size = header_end - data_ - header + 1;
+   const unsigned char* value = 0;
+   if(readDigits(data_ + header + lenFieldId(data_ + header,header_end,1),header_end,value)!=header_size)
+   {
+      report(nistDamageLen,header,header_size,0,1);
+   }
+
+   //Поля Type-1: номер и границы значения
+   struct field
+   {
+      unsigned tag_;
+      const unsigned char* begin_;
+      const unsigned char* end_;
+   };
+   std::vector<field> fields;
+   const unsigned char* p = value;
+   while(p<header_end)
+   {
+      const unsigned char* id_end = 0;
+      field cur;
+      readDigits(p + 1,header_end,id_end);
+      if(id_end<header_end && *id_end=='.')
+      {
+         cur.tag_ = readDigits(id_end + 1,header_end,id_end);
+      }
+      else
+      {
+         cur.tag_ = 0;
+      }
+      cur.begin_ = id_end<header_end && *id_end==':' ? id_end + 1 : 0;
+      p++;
+      while(p<header_end && *p!=nistParser::GS())
+      {
+         p++;
+      }
+      cur.end_ = p;
+      if(cur.begin_ && cur.tag_>1)
+      {
+         fields.push_back(cur);
+      }
+   }
+   bool has_cnt = false;
+   for(size_t no=0;no<fields.size() && !has_cnt;no++)
+   {
+      has_cnt = fields[no].tag_==3 && parseCnt(fields[no].begin_,fields[no].end_);
+   }
+   size_t pos = header + header_size;
+   if(!has_cnt)
+   {
+      entries_.clear();
+      report(nistDamageCnt,header,header_size,0,1);
+      discover(pos);
+   }
+
+   for(size_t entry_no=0;entry_no<entries_.size();entry_no++)
+   {
+      unsigned type = entries_[entry_no].type_;
+      unsigned record = entry_no + 1;
+      size_t start = pos;
+      //На ожидаемом месте бинарная запись узнается по IDC, даже если ее LEN испорчен
+      bool expected = nistIsBinaryRecord(type) ? size_ - pos>=5 && data_[pos + 4]==entries_[entry_no].idc_ : startsAt(pos,entry_no);
+      if(!expected)
+      {
+         start = findStart(pos,entry_no);
+         if(start==size_)
+         {
+            report(nistDamageMissing,pos,0,record,type);
+            continue;
+         }
+         report(nistDamageGarbage,pos,start - pos,record,type);
+      }
+      unsigned long long len = 0;
+      if(nistIsBinaryRecord(type))
+      {
+         len = binaryLen(data_ + start);
+      }
+      else
+      {
+         const unsigned char* digits_end = 0;
+         len = readDigits(data_ + start + lenFieldId(data_ + start,data_ + size_,type),data_ + size_,digits_end);
+      }
+      size_t end = start + len;
+      //Текстовая запись проверяется по FS в конце, бинарная - по началу следующей записи
+      bool len_ok = len && len<=size_ - start &&
+                    (nistIsBinaryRecord(type) ? startsAt(end,entry_no + 1) || entry_no + 1==entries_.size() :
+                                            data_[end - 1]==nistParser::FS());
+      if(!len_ok)
+      {
+         //Конец записи - ближайшее найденное начало одной из следующих записей
+         end = size_;
+         for(size_t next=entry_no + 1;next<entries_.size() && end==size_;next++)
+         {
+            end = findStart(start + 1,next);
+         }
+         report(nistDamageLen,start,end - start,record,type);
+      }
+      if(!appendRecord(start,end,record,type,records_))
+      {
+         report(nistDamageMissing,start,end - start,record,type);
+      }
+      else
+      {
+         saved_.push_back(entries_[entry_no]);
+      }
+      pos = end;
+   }
+   if(pos<size_)
+   {
+      report(nistDamageGarbage,pos,size_ - pos,entries_.size() + 1,0);
+   }
+
+   //Type-1 с CNT спасенных записей
+   std::string cnt = "1";
+   cnt += nistParser::US();
+   cnt += std::to_string(saved_.size());
+   char item[32];
+   for(size_t no=0;no<saved_.size();no++)
+   {
+      snprintf(item,sizeof(item),"%c%u%c%02u",nistParser::RS(),saved_[no].type_,nistParser::US(),saved_[no].idc_);
+      cnt += item;
+   }
+   std::vector<unsigned char> body;
+   bool cnt_written = false;
+   for(size_t no=0;no<=fields.size();no++)
+   {
+      if(!cnt_written && (no==fields.size() || fields[no].tag_>=3))
+      {
+         body.push_back(nistParser::GS());
+         const char id[] = "1.003:";
+         body.insert(body.end(),id,id + sizeof(id) - 1);
+         body.insert(body.end(),cnt.begin(),cnt.end());
+         cnt_written = true;
+      }
+      if(no==fields.size())
+      {
+         break;
+      }
+      if(fields[no].tag_!=3)
+      {
+         //Поле копируется с разделителем перед ним; поиск GS не выходит за начало Type-1
+         const unsigned char* record_start = data_ + header;
+         const unsigned char* field_start = fields[no].begin_;
+         while(field_start>record_start && *field_start!=nistParser::GS())
+         {
+            field_start--;
+         }
+         if(*field_start!=nistParser::GS())
+         {
+            //Перед полем нет разделителя, его начало не определить - поле не сохраняется
+            report(nistDamageGarbage,header,fields[no].end_ - record_start,0,1);
+            continue;
+         }
+         body.insert(body.end(),field_start,fields[no].end_);
+      }
+   }
+   body.push_back(nistParser::FS());
+   const char len_id[] = "1.001:";
+   char digits[32];
+   unsigned long long len = nistTaggedRecordLen(sizeof(len_id) - 1 + body.size(),digits);
+   repaired.reserve(len + records_.size());
+   repaired.insert(repaired.end(),len_id,len_id + sizeof(len_id) - 1);
+   repaired.insert(repaired.end(),digits,digits + strlen(digits));
+   repaired.insert(repaired.end(),body.begin(),body.end());
+   repaired.insert(repaired.end(),records_.begin(),records_.end());
+   return saved_.size();
+}
+
+bool nistRecovery::load(const std::vector<unsigned char>& data, nistParser& parser, std::vector<nistDamage>& damage)
+{
+   if(repair(data.empty() ? 0 : &data[0],data.size(),file_data_,damage)<0)
+   {
+      return false;
+   }
+   //Спасенная запись может быть повреждена внутри, такие записи пропускаются
+   return parser.loadSwap(file_data_,true);
+}
+
+bool nistRecovery::load(const std::string& file_name, nistParser& parser, std::vector<nistDamage>& damage)
+{
+   std::vector<unsigned char> data;
+   if(!nistParser::readFile(file_name,data))
+   {
+      dbg0("nistRecovery::load can't read %s\n",file_name.c_str());
+      return false;
+   }
+   return load(data,parser,damage);
+}
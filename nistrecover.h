@@ -0,0 +1,79 @@
+/*
+  \file   nistrecover.h
+  \brief  Восстановление поврежденных ANSI-NIST транзакций
+*/
+
+#ifndef NIST_RECOVER_H
+#define NIST_RECOVER_H
+
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+
+///! Вид повреждения
+enum nistDamageKind
+{
+   nistDamageLen,        ///<LEN записи не совпадал с ее границами и исправлен
+   nistDamageGarbage,    ///<Байты вне записей пропущены
+   nistDamageMissing,    ///<Запись из CNT не найдена
+   nistDamageTruncated,  ///<Запись обрезана, дополнена замыкающим FS
+   nistDamageCnt         ///<CNT не разбирается, текстовые записи найдены поиском, бинарные потеряны
+};
+
+//!Описание вида повреждения
+const char* nistDamageText(nistDamageKind kind);
+
+///! Повреждение и его место в исходных данных
+struct nistDamage
+{
+   nistDamageKind kind_;
+   unsigned long long offset_;
+   unsigned long long size_;
+   //!Номер записи в CNT (0 - Type-1)
+   unsigned record_;
+   unsigned type_;
+};
+
+/*! Восстановление транзакции с неверными LEN, мусором между записями и обрезанным концом.
+    Записи ищутся по CNT: текстовая - по идентификатору "T.001:" (поиск memmem/memchr), бинарная -
+    по длине и IDC из CNT в заголовке. Если LEN записи не приводит к началу следующей, запись
+    заканчивается перед ближайшим найденным началом одной из следующих записей CNT.
+    Результат - исправленная транзакция: спасенные записи с пересчитанными LEN и CNT, который
+    перечисляет только их. Ее можно записать в файл или загрузить обычным nistParser::load.
+*/
+class nistRecovery
+{
+public:
+   /*! Собирает исправленную транзакцию в repaired и дописывает повреждения в damage.
+       Возвращает число спасенных записей без Type-1 или -1, если Type-1 не найден
+   */
+   int repair(const unsigned char* data, size_t size, std::vector<unsigned char>& repaired, std::vector<nistDamage>& damage);
+   //!Восстанавливает data и загружает результат в parser; записи, которые не разбираются, пропускаются
+   bool load(const std::vector<unsigned char>& data, nistParser& parser, std::vector<nistDamage>& damage);
+   bool load(const std::string& file_name, nistParser& parser, std::vector<nistDamage>& damage);
+private:
+   struct entry
+   {
+      unsigned type_;
+      unsigned idc_;
+   };
+   bool startsAt(size_t pos, size_t entry_no) const;
+   //!Ближайшее начало записи entry_no не раньше from или size_ при неудаче
+   size_t findStart(size_t from, size_t entry_no) const;
+   void report(nistDamageKind kind, size_t offset, size_t size, unsigned record, unsigned type);
+   bool parseCnt(const unsigned char* cnt, const unsigned char* cnt_end);
+   //!Поиск текстовых записей без CNT
+   void discover(size_t pos);
+   bool appendRecord(size_t start, size_t end, unsigned record, unsigned type, std::vector<unsigned char>& out);
+
+   const unsigned char* data_;
+   size_t size_;
+   std::vector<entry> entries_;
+   std::vector<entry> saved_;
+   std::vector<nistDamage>* damage_;
+   std::vector<unsigned char> records_;
+   std::vector<unsigned char> file_data_;
+};
+
+#endif // NIST_RECOVER_H
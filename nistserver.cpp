@@ -0,0 +1,650 @@
+/*
+  \file   nistserver.cpp
+  \brief  Локальный сервис разбора ANSI-NIST транзакций через Unix domain socket
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "nistserver.h"
+
+//!Наибольший размер кадра запроса
+static const unsigned max_frame_size = 1u<<30;
+static const unsigned missing_field = 0xFFFFFFFFu;
+
+static void put32(std::string& out, unsigned value)
+{
+   char bytes[4] = {(char)value,(char)(value>>8),(char)(value>>16),(char)(value>>24)};
+   out.append(bytes,4);
+}
+
+static unsigned get32(const unsigned char* p)
+{
+   return p[0] | p[1]<<8 | p[2]<<16 | (unsigned)p[3]<<24;
+}
+
+//!Последовательное чтение кадра с проверкой границ
+struct nistFrameReader
+{
+   const unsigned char* p_;
+   const unsigned char* end_;
+   bool u32(unsigned& value)
+   {
+      if(end_ - p_<4)
+      {
+         return false;
+      }
+      value = get32(p_);
+      p_ += 4;
+      return true;
+   }
+   bool bytes(unsigned size, std::string& value)
+   {
+      if((size_t)(end_ - p_)<size)
+      {
+         return false;
+      }
+      value.assign((const char*)p_,size);
+      p_ += size;
+      return true;
+   }
+};
+
+#ifndef WIN32
+static bool readFull(int fd, void* data, size_t size)
+{
+   char* p = (char*)data;
+   while(size)
+   {
+      ssize_t got = ::read(fd,p,size);
+      if(got<=0)
+      {
+         return false;
+      }
+      p += got;
+      size -= got;
+   }
+   return true;
+}
+
+static bool writeFull(int fd, const void* data, size_t size)
+{
+   const char* p = (const char*)data;
+   while(size)
+   {
+      ssize_t sent = ::send(fd,p,size,MSG_NOSIGNAL);
+      if(sent<=0)
+      {
+         return false;
+      }
+      p += sent;
+      size -= sent;
+   }
+   return true;
+}
+
+//!Читает кадр после поля размера
+static bool readFrame(int fd, std::string& frame)
+{
+   unsigned char size_bytes[4];
+   if(!readFull(fd,size_bytes,sizeof(size_bytes)))
+   {
+      return false;
+   }
+   unsigned size = get32(size_bytes);
+   if(size>max_frame_size)
+   {
+      dbg0("nistServer: frame size %u too large\n",size);
+      return false;
+   }
+   frame.resize(size);
+   return !size || readFull(fd,&frame[0],size);
+}
+#endif
+
+struct nistServer::connection
+{
+   int fd_;
+   std::mutex write_mutex_;
+   explicit connection(int fd) : fd_(fd) {}
+   ~connection()
+   {
+#ifndef WIN32
+      ::close(fd_);
+#endif
+   }
+};
+
+struct nistServer::request
+{
+   std::shared_ptr<connection> conn_;
+   unsigned id_;
+   unsigned op_;
+   std::vector<std::pair<unsigned,unsigned> > fields_;
+   unsigned rec_no_;
+   std::vector<nistSource> sources_;
+   std::vector<nistResult> results_;
+   //!Число источников, результаты которых еще не готовы
+   std::atomic<unsigned> left_;
+};
+
+nistServer::nistServer()
+   :listen_fd_(-1),stopping_(false),requests_(0)
+{
+}
+
+nistServer::~nistServer()
+{
+   stop();
+}
+
+bool nistServer::start(const std::string& socket_path, unsigned threads)
+{
+#ifndef WIN32
+   stop();
+   struct sockaddr_un addr;
+   memset(&addr,0,sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if(socket_path.size()>=sizeof(addr.sun_path))
+   {
+      err_msg_ = "socket path too long";
+      return false;
+   }
+   memcpy(addr.sun_path,socket_path.c_str(),socket_path.size());
+   listen_fd_ = socket(AF_UNIX,SOCK_STREAM,0);
+   ::unlink(socket_path.c_str());
+   if(listen_fd_<0 || bind(listen_fd_,(struct sockaddr*)&addr,sizeof(addr))<0 || listen(listen_fd_,64)<0)
+   {
+      err_msg_ = "can't listen on " + socket_path;
+      if(listen_fd_>=0)
+      {
+         ::close(listen_fd_);
+         listen_fd_ = -1;
+      }
+      return false;
+   }
+   socket_path_ = socket_path;
+   stopping_ = false;
+   if(!threads)
+   {
+      threads = std::thread::hardware_concurrency();
+   }
+   if(!threads)
+   {
+      threads = 1;
+   }
+   for(unsigned no=0;no<threads;no++)
+   {
+      workers_.push_back(std::thread(&nistServer::workLoop,this));
+   }
+   acceptor_ = std::thread(&nistServer::acceptLoop,this);
+   return true;
+#else
+   err_msg_ = "Unix domain sockets are not supported";
+   return false;
+#endif
+}
+
+void nistServer::stop()
+{
+#ifndef WIN32
+   if(listen_fd_<0)
+   {
+      return;
+   }
+   stopping_ = true;
+   //Прерывает accept() и чтение соединений
+   shutdown(listen_fd_,SHUT_RDWR);
+   if(acceptor_.joinable())
+   {
+      acceptor_.join();
+   }
+   ::close(listen_fd_);
+   listen_fd_ = -1;
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for(size_t no=0;no<readers_.size();no++)
+      {
+         std::shared_ptr<connection> conn = readers_[no].conn_.lock();
+         if(conn)
+         {
+            shutdown(conn->fd_,SHUT_RDWR);
+         }
+      }
+   }
+   for(size_t no=0;no<readers_.size();no++)
+   {
+      readers_[no].thread_.join();
+   }
+   readers_.clear();
+   ready_.notify_all();
+   for(size_t no=0;no<workers_.size();no++)
+   {
+      workers_[no].join();
+   }
+   workers_.clear();
+   jobs_.clear();
+   ::unlink(socket_path_.c_str());
+#endif
+}
+
+void nistServer::acceptLoop()
+{
+#ifndef WIN32
+   while(!stopping_)
+   {
+      int fd = accept(listen_fd_,0,0);
+      if(fd<0)
+      {
+         if(stopping_ || (errno!=EINTR && errno!=ECONNABORTED))
+         {
+            break;
+         }
+         continue;
+      }
+      std::shared_ptr<connection> conn(new connection(fd));
+      std::lock_guard<std::mutex> lock(mutex_);
+      //Потоки закрытых соединений завершаются здесь, а не в stop()
+      for(size_t no=0;no<readers_.size();)
+      {
+         if(*readers_[no].done_)
+         {
+            readers_[no].thread_.join();
+            readers_.erase(readers_.begin() + no);
+         }
+         else
+         {
+            no++;
+         }
+      }
+      reader next;
+      next.conn_ = conn;
+      next.done_.reset(new std::atomic<bool>(false));
+      next.thread_ = std::thread(&nistServer::readLoop,this,conn,next.done_);
+      readers_.push_back(std::move(next));
+   }
+#endif
+}
+
+bool nistServer::parseRequest(const std::string& frame, request& req)
+{
+   nistFrameReader in = {(const unsigned char*)frame.data(),(const unsigned char*)frame.data() + frame.size()};
+   unsigned op = 0;
+   unsigned cnt = 0;
+   if(!in.u32(req.id_) || !in.u32(op))
+   {
+      return false;
+   }
+   req.op_ = op & 0xFF;
+   req.rec_no_ = 0;
+   switch(req.op_)
+   {
+      case nistRequestFields:
+         if(!in.u32(cnt) || cnt>(size_t)(in.end_ - in.p_)/8)
+         {
+            return false;
+         }
+         req.fields_.resize(cnt);
+         for(unsigned no=0;no<cnt;no++)
+         {
+            in.u32(req.fields_[no].first);
+            in.u32(req.fields_[no].second);
+         }
+         break;
+      case nistRequestRecords:
+         break;
+      case nistRequestImage:
+         if(!in.u32(req.rec_no_))
+         {
+            return false;
+         }
+         break;
+      default:
+         return false;
+   }
+   if(!in.u32(cnt) || cnt>(size_t)(in.end_ - in.p_)/5)
+   {
+      return false;
+   }
+   req.sources_.resize(cnt);
+   for(unsigned no=0;no<cnt;no++)
+   {
+      unsigned size = 0;
+      if(in.p_==in.end_)
+      {
+         return false;
+      }
+      unsigned kind = *in.p_++;
+      if((kind!=nistSourcePath && kind!=nistSourceInline) || !in.u32(size) || !in.bytes(size,req.sources_[no].data_))
+      {
+         return false;
+      }
+      req.sources_[no].kind_ = (nistSourceKind)kind;
+   }
+   return in.p_==in.end_;
+}
+
+void nistServer::readLoop(std::shared_ptr<connection> conn, std::shared_ptr<std::atomic<bool> > done)
+{
+#ifndef WIN32
+   std::string frame;
+   while(!stopping_ && readFrame(conn->fd_,frame))
+   {
+      std::shared_ptr<request> req(new request);
+      req->conn_ = conn;
+      req->id_ = frame.size()>=4 ? get32((const unsigned char*)frame.data()) : 0;
+      requests_++;
+      if(!parseRequest(frame,*req))
+      {
+         dbg0("nistServer: bad request %u\n",req->id_);
+         req->sources_.clear();
+         req->op_ = 0;
+         reply(*req);
+         continue;
+      }
+      req->results_.resize(req->sources_.size());
+      req->left_ = req->sources_.size();
+      if(req->sources_.empty())
+      {
+         reply(*req);
+         continue;
+      }
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         for(unsigned item=0;item<req->sources_.size();item++)
+         {
+            job next = {req,item};
+            jobs_.push_back(next);
+         }
+      }
+      ready_.notify_all();
+   }
+   *done = true;
+#endif
+}
+
+void nistServer::workLoop()
+{
+   //Парсер потока используется повторно для всех его транзакций
+   nistParser parser;
+   for(;;)
+   {
+      job next;
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         ready_.wait(lock,[this]{return stopping_ || !jobs_.empty();});
+         if(stopping_)
+         {
+            return;
+         }
+         next = jobs_.front();
+         jobs_.pop_front();
+      }
+      request& req = *next.request_;
+      process(parser,req,next.item_,req.results_[next.item_]);
+      if(--req.left_==0)
+      {
+         reply(req);
+      }
+   }
+}
+
+void nistServer::process(nistParser& parser, const request& req, unsigned item, nistResult& res)
+{
+   const nistSource& source = req.sources_[item];
+   res.data_.clear();
+   bool loaded = source.kind_==nistSourcePath ? parser.load(source.data_) :
+                 parser.load((const unsigned char*)source.data_.data(),source.data_.size());
+   if(!loaded)
+   {
+      res.status_ = nistReplyLoadError;
+      return;
+   }
+   res.status_ = nistReplyOk;
+   const type1Record* header = parser.getFileHeader();
+   switch(req.op_)
+   {
+      case nistRequestFields:
+         for(size_t no=0;no<req.fields_.size();no++)
+         {
+            //Поле первой записи типа; у бинарных записей полей-тегов нет
+            unsigned type = req.fields_[no].first;
+            const nistRecord* rec = header;
+            if(type!=1)
+            {
+               nistRecordRange range = parser.getRecords(type);
+               rec = range.empty() ? 0 : range[0];
+            }
+            const nistTag* tag = rec ? rec->getTagById(req.fields_[no].second) : 0;
+            if(!tag)
+            {
+               put32(res.data_,missing_field);
+               continue;
+            }
+            put32(res.data_,tag->data_size());
+            res.data_.append((const char*)tag->data(),tag->data_size());
+         }
+         break;
+      case nistRequestRecords:
+         put32(res.data_,parser.getRecordsCnt());
+         for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+         {
+            const nistRecord* rec = parser.getRecord(rec_no);
+            put32(res.data_,rec->type());
+            put32(res.data_,header->getRecordIDC(rec_no));
+            put32(res.data_,rec->record_size_);
+            put32(res.data_,rec->getImgDataSize());
+         }
+         break;
+      case nistRequestImage:
+      {
+         const nistRecord* rec = req.rec_no_ ? parser.getRecord(req.rec_no_ - 1) : 0;
+         if(!rec || !rec->getImgData())
+         {
+            res.status_ = nistReplyNoRecord;
+            break;
+         }
+         res.data_.assign((const char*)rec->getImgData(),rec->getImgDataSize());
+         break;
+      }
+   }
+}
+
+void nistServer::reply(request& req)
+{
+#ifndef WIN32
+   std::string frame;
+   put32(frame,0);
+   put32(frame,req.id_);
+   put32(frame,req.op_ ? nistReplyOk : nistReplyBadRequest);
+   put32(frame,req.results_.size());
+   for(size_t no=0;no<req.results_.size();no++)
+   {
+      frame += (char)req.results_[no].status_;
+      put32(frame,req.results_[no].data_.size());
+      frame += req.results_[no].data_;
+   }
+   std::string size;
+   put32(size,frame.size() - 4);
+   frame.replace(0,4,size);
+   std::lock_guard<std::mutex> lock(req.conn_->write_mutex_);
+   if(!writeFull(req.conn_->fd_,frame.data(),frame.size()))
+   {
+      dbg0("nistServer: can't send reply %u\n",req.id_);
+   }
+   //Результаты больше не нужны, пока запрос ждет освобождения
+   req.results_.clear();
+   req.sources_.clear();
+#endif
+}
+
+nistClient::nistClient()
+   :fd_(-1)
+{
+}
+
+nistClient::~nistClient()
+{
+   close();
+}
+
+bool nistClient::connect(const std::string& socket_path)
+{
+#ifndef WIN32
+   close();
+   struct sockaddr_un addr;
+   memset(&addr,0,sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if(socket_path.size()>=sizeof(addr.sun_path))
+   {
+      return false;
+   }
+   memcpy(addr.sun_path,socket_path.c_str(),socket_path.size());
+   fd_ = socket(AF_UNIX,SOCK_STREAM,0);
+   if(fd_<0 || ::connect(fd_,(struct sockaddr*)&addr,sizeof(addr))<0)
+   {
+      close();
+      return false;
+   }
+   return true;
+#else
+   return false;
+#endif
+}
+
+void nistClient::close()
+{
+#ifndef WIN32
+   if(fd_>=0)
+   {
+      ::close(fd_);
+   }
+#endif
+   fd_ = -1;
+}
+
+bool nistClient::send(unsigned id, nistRequestOp op, const std::string& params, const std::vector<nistSource>& sources)
+{
+#ifndef WIN32
+   std::string frame;
+   put32(frame,0);
+   put32(frame,id);
+   put32(frame,op);
+   frame += params;
+   put32(frame,sources.size());
+   for(size_t no=0;no<sources.size();no++)
+   {
+      frame += (char)sources[no].kind_;
+      put32(frame,sources[no].data_.size());
+      frame += sources[no].data_;
+   }
+   std::string size;
+   put32(size,frame.size() - 4);
+   frame.replace(0,4,size);
+   return fd_>=0 && writeFull(fd_,frame.data(),frame.size());
+#else
+   return false;
+#endif
+}
+
+bool nistClient::sendFields(unsigned id, const std::vector<std::pair<unsigned,unsigned> >& fields, const std::vector<nistSource>& sources)
+{
+   std::string params;
+   put32(params,fields.size());
+   for(size_t no=0;no<fields.size();no++)
+   {
+      put32(params,fields[no].first);
+      put32(params,fields[no].second);
+   }
+   return send(id,nistRequestFields,params,sources);
+}
+
+bool nistClient::sendRecords(unsigned id, const std::vector<nistSource>& sources)
+{
+   return send(id,nistRequestRecords,std::string(),sources);
+}
+
+bool nistClient::sendImage(unsigned id, unsigned rec_no, const std::vector<nistSource>& sources)
+{
+   std::string params;
+   put32(params,rec_no);
+   return send(id,nistRequestImage,params,sources);
+}
+
+bool nistClient::receive(unsigned& id, nistReplyStatus& status, std::vector<nistResult>& results)
+{
+#ifndef WIN32
+   std::string frame;
+   results.clear();
+   if(fd_<0 || !readFrame(fd_,frame))
+   {
+      return false;
+   }
+   nistFrameReader in = {(const unsigned char*)frame.data(),(const unsigned char*)frame.data() + frame.size()};
+   unsigned value = 0;
+   unsigned cnt = 0;
+   if(!in.u32(id) || !in.u32(value) || !in.u32(cnt) || cnt>(size_t)(in.end_ - in.p_)/5)
+   {
+      return false;
+   }
+   status = (nistReplyStatus)(value & 0xFF);
+   results.resize(cnt);
+   for(unsigned no=0;no<cnt;no++)
+   {
+      unsigned size = 0;
+      if(in.p_==in.end_)
+      {
+         return false;
+      }
+      results[no].status_ = (nistReplyStatus)*in.p_++;
+      if(!in.u32(size) || !in.bytes(size,results[no].data_))
+      {
+         return false;
+      }
+   }
+   return true;
+#else
+   return false;
+#endif
+}
+
+bool nistClient::fieldValues(const std::string& data, std::vector<std::string>& values, std::vector<bool>* missing)
+{
+   nistFrameReader in = {(const unsigned char*)data.data(),(const unsigned char*)data.data() + data.size()};
+   values.clear();
+   if(missing)
+   {
+      missing->clear();
+   }
+   while(in.p_<in.end_)
+   {
+      unsigned size = 0;
+      if(!in.u32(size))
+      {
+         return false;
+      }
+      values.push_back(std::string());
+      if(missing)
+      {
+         missing->push_back(size==missing_field);
+      }
+      if(size!=missing_field && !in.bytes(size,values.back()))
+      {
+         return false;
+      }
+   }
+   return true;
+}
@@ -0,0 +1,158 @@
+/*
+  \file   nistserver.h
+  \brief  Локальный сервис разбора ANSI-NIST транзакций через Unix domain socket
+
+  Протокол: кадры, все числа - u32 little-endian, если не указано иное.
+  Запрос:
+     u32 размер кадра без этого поля
+     u32 id          возвращается в ответе; ответы на запросы одного соединения приходят по мере готовности
+     u8  op          nistRequestOp
+     u8  reserved[3]
+     параметры op:   nistRequestFields - u32 n, n пар (u32 тип, u32 поле) ("1.004" - тип 1, поле 4)
+                     nistRequestRecords - нет
+                     nistRequestImage - u32 номер записи (1 - первая запись после Type-1)
+     u32 число источников, затем для каждого: u8 вид (nistSourcePath/nistSourceInline), u32 длина, байты
+  Ответ:
+     u32 размер кадра без этого поля
+     u32 id
+     u8  status      nistReplyOk или nistReplyBadRequest (тогда источников нет)
+     u8  reserved[3]
+     u32 число источников, затем для каждого в порядке запроса: u8 status, u32 длина, данные:
+                     nistRequestFields - для каждого поля u32 длина и значение, 0xFFFFFFFF - поля нет
+                     nistRequestRecords - u32 n, n записей (u32 тип, u32 IDC, u32 размер, u32 размер изображения)
+                     nistRequestImage - данные изображения
+  Клиент может отправлять запросы, не дожидаясь ответов. Источники всех запросов распределяются между
+  рабочими потоками, у каждого из которых свой nistParser, поэтому записи и буферы после первых
+  транзакций используются повторно.
+*/
+
+#ifndef NIST_SERVER_H
+#define NIST_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nistparser.h"
+
+///! Операция запроса
+enum nistRequestOp
+{
+   nistRequestFields = 1,    ///<Значения полей
+   nistRequestRecords = 2,   ///<Список записей
+   nistRequestImage = 3      ///<Данные изображения записи
+};
+
+///! Вид источника транзакции
+enum nistSourceKind
+{
+   nistSourcePath = 0,       ///<Путь к файлу на стороне сервиса
+   nistSourceInline = 1      ///<Байты транзакции в запросе
+};
+
+///! Состояние ответа и результата по источнику
+enum nistReplyStatus
+{
+   nistReplyOk = 0,
+   nistReplyBadRequest = 1,  ///<Кадр запроса не разбирается
+   nistReplyLoadError = 2,   ///<Транзакция не загружается
+   nistReplyNoRecord = 3     ///<Нет записи с изображением с таким номером
+};
+
+///! Источник транзакции в запросе
+struct nistSource
+{
+   nistSourceKind kind_;
+   //!Путь или байты транзакции
+   std::string data_;
+};
+
+///! Результат по одному источнику
+struct nistResult
+{
+   nistReplyStatus status_;
+   std::string data_;
+};
+
+/*! Сервис разбора. start() создает сокет и потоки: прием соединений, чтение запросов по потоку на
+    соединение и рабочие потоки. Ответ на запрос отправляется, когда готовы результаты всех его источников
+*/
+class nistServer
+{
+public:
+   nistServer();
+   ~nistServer();
+   //!Слушает socket_path (существующий файл сокета заменяется); threads == 0 - по числу ядер
+   bool start(const std::string& socket_path, unsigned threads = 0);
+   //!Закрывает сокет и соединения, дожидается потоков
+   void stop();
+   const std::string& getError() const{return err_msg_;}
+   unsigned long long requests() const{return requests_;}
+private:
+   nistServer(const nistServer&);
+   nistServer& operator=(const nistServer&);
+   struct connection;
+   struct request;
+   struct job
+   {
+      std::shared_ptr<request> request_;
+      unsigned item_;
+   };
+   void acceptLoop();
+   void readLoop(std::shared_ptr<connection> conn, std::shared_ptr<std::atomic<bool> > done);
+   void workLoop();
+   //!Разбирает кадр в запрос, false если кадр неверный
+   bool parseRequest(const std::string& frame, request& req);
+   void process(nistParser& parser, const request& req, unsigned item, nistResult& res);
+   void reply(request& req);
+
+   int listen_fd_;
+   std::string socket_path_;
+   std::atomic<bool> stopping_;
+   std::thread acceptor_;
+   std::vector<std::thread> workers_;
+   std::mutex mutex_;
+   std::condition_variable ready_;
+   std::deque<job> jobs_;
+   //!Потоки чтения соединений; соединение закрывается, когда на него не остается запросов
+   struct reader
+   {
+      std::weak_ptr<connection> conn_;
+      std::shared_ptr<std::atomic<bool> > done_;
+      std::thread thread_;
+   };
+   std::vector<reader> readers_;
+   std::atomic<unsigned long long> requests_;
+   std::string err_msg_;
+};
+
+///! Клиент сервиса разбора. Запросы можно отправлять подряд и затем читать ответы
+class nistClient
+{
+public:
+   nistClient();
+   ~nistClient();
+   bool connect(const std::string& socket_path);
+   void close();
+   //!Отправляет запрос полей (пары тип, поле) по источникам
+   bool sendFields(unsigned id, const std::vector<std::pair<unsigned,unsigned> >& fields, const std::vector<nistSource>& sources);
+   bool sendRecords(unsigned id, const std::vector<nistSource>& sources);
+   bool sendImage(unsigned id, unsigned rec_no, const std::vector<nistSource>& sources);
+   //!Читает следующий ответ
+   bool receive(unsigned& id, nistReplyStatus& status, std::vector<nistResult>& results);
+   //!Значения полей из данных результата nistRequestFields; отсутствующее поле - пустая строка, missing = true
+   static bool fieldValues(const std::string& data, std::vector<std::string>& values, std::vector<bool>* missing = 0);
+private:
+   nistClient(const nistClient&);
+   nistClient& operator=(const nistClient&);
+   bool send(unsigned id, nistRequestOp op, const std::string& params, const std::vector<nistSource>& sources);
+
+   int fd_;
+};
+
+#endif // NIST_SERVER_H
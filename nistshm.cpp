@@ -0,0 +1,466 @@
+/*
+  \file   nistshm.cpp
+  \brief  Передача загруженной транзакции между процессами через разделяемую память POSIX
+
+  Сборка: вместе с nistparser.cpp, на Linux со старой glibc добавить -lrt (shm_open)
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "nistshm.h"
+
+static const char shm_magic[8] = {'N','I','S','T','S','H','M','1'};
+static const unsigned byte_order_mark = 0x01020304;
+static const unsigned shm_types = 100;
+
+static unsigned long long aligned(unsigned long long size)
+{
+   return (size + 7) & ~7ull;
+}
+
+//!Строки сегмента до размещения: смещения считаются от начала раздела строк
+static nistShmString addString(std::vector<char>& strings, const std::string& value)
+{
+   nistShmString res = {(unsigned)strings.size(),(unsigned)value.size()};
+   strings.insert(strings.end(),value.begin(),value.end());
+   return res;
+}
+
+//!Поля изображения записи, те же, что и в колоночной выгрузке
+static void imageFields(const nistRecord& rec, nistShmRecord& out, std::vector<char>& strings)
+{
+   nistImageInfo info;
+   if(!nistGetImageInfo(rec,info))
+   {
+      return;
+   }
+   out.imp_ = info.imp_;
+   out.fgp_ = info.fgp_;
+   out.hll_ = info.hll_;
+   out.vll_ = info.vll_;
+   out.slc_ = info.slc_;
+   out.hps_ = info.hps_;
+   out.vps_ = info.vps_;
+   out.bpx_ = info.bpx_;
+   out.cga_ = addString(strings,info.cga_);
+   out.date_ = addString(strings,*info.date_);
+   out.imt_ = addString(strings,*info.imt_);
+}
+
+static bool addRecord(const nistRecord& rec, unsigned idc, const unsigned char* base, unsigned long long data_size,
+                      std::vector<nistShmRecord>& records, std::vector<nistShmTag>& tags, std::vector<char>& strings)
+{
+   nistShmRecord out;
+   memset(&out,0,sizeof(out));
+   out.type_ = rec.type();
+   out.idc_ = idc;
+   out.offset_ = rec.offset_;
+   out.size_ = rec.record_size_;
+   out.first_tag_ = tags.size();
+   out.tags_cnt_ = rec.tagsCnt();
+   if((unsigned long long)out.offset_ + out.size_>data_size)
+   {
+      return false;
+   }
+   for(unsigned tag_no=0;tag_no<rec.tagsCnt();tag_no++)
+   {
+      const nistTag* tag = rec.getTag(tag_no);
+      nistShmTag item = {tag->tag_no(),tag->data() ? (unsigned)(tag->data() - base) : 0,tag->data_size()};
+      if((unsigned long long)item.offset_ + item.size_>data_size)
+      {
+         return false;
+      }
+      tags.push_back(item);
+   }
+   if(rec.getImgData())
+   {
+      out.image_offset_ = rec.getImgData() - base;
+      out.image_size_ = rec.getImgDataSize();
+      if((unsigned long long)out.image_offset_ + out.image_size_>data_size)
+      {
+         return false;
+      }
+   }
+   imageFields(rec,out,strings);
+   records.push_back(out);
+   return true;
+}
+
+static void placeString(nistShmString& value, unsigned long long strings_offset)
+{
+   value.offset_ += strings_offset;
+}
+
+bool nistShmTransaction::publish(const nistParser& parser, const std::string& name, std::string& err)
+{
+   const type1Record* header = parser.getFileHeader();
+   if(parser.isModified())
+   {
+      err = "edited transaction has no single buffer, write and load it first";
+      return false;
+   }
+   if(!header->tagsCnt() || !header->getTag(0)->data())
+   {
+      err = "no transaction loaded";
+      return false;
+   }
+   //Теги указывают в буфер транзакции, смещение тега - от его начала
+   const nistTag* len = header->getTag(0);
+   const unsigned char* base = len->data() - len->offset_;
+   unsigned long long data_size = header->record_size_;
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      data_size = std::max(data_size,(unsigned long long)rec->offset_ + rec->record_size_);
+   }
+
+   std::vector<nistShmRecord> records;
+   std::vector<nistShmTag> tags;
+   std::vector<char> strings;
+   records.reserve(parser.getRecordsCnt() + 1);
+   bool res = addRecord(*header,0,base,data_size,records,tags,strings);
+   for(unsigned rec_no=0;res && rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      res = rec->type()<shm_types && addRecord(*rec,header->getRecordIDC(rec_no),base,data_size,records,tags,strings);
+   }
+   if(!res)
+   {
+      err = "record outside of transaction data";
+      return false;
+   }
+
+   nistShmHeader hdr;
+   memset(&hdr,0,sizeof(hdr));
+   memcpy(hdr.magic_,shm_magic,sizeof(shm_magic));
+   hdr.byte_order_ = byte_order_mark;
+   hdr.records_cnt_ = records.size();
+   hdr.tags_cnt_ = tags.size();
+   hdr.tot_ = addString(strings,header->getTOT());
+   hdr.ori_ = addString(strings,header->getORI());
+   hdr.dai_ = addString(strings,header->getDAI());
+   hdr.tcn_ = addString(strings,header->getTCN());
+   hdr.tcr_ = addString(strings,header->getTCR());
+   hdr.dat_ = addString(strings,header->getDAT());
+   hdr.dom_ = addString(strings,header->getDOM());
+
+   //Индекс по типам: подсчет и раскладка номеров записей
+   std::vector<unsigned> by_type(records.size());
+   for(size_t rec_no=0;rec_no<records.size();rec_no++)
+   {
+      hdr.type_begin_[records[rec_no].type_ + 1]++;
+   }
+   for(unsigned type=0;type<shm_types;type++)
+   {
+      hdr.type_begin_[type + 1] += hdr.type_begin_[type];
+   }
+   unsigned next[shm_types];
+   memcpy(next,hdr.type_begin_,sizeof(next));
+   for(size_t rec_no=0;rec_no<records.size();rec_no++)
+   {
+      by_type[next[records[rec_no].type_]++] = rec_no;
+   }
+   std::vector<nistShmIdc> by_idc;
+   by_idc.reserve(records.size());
+   for(size_t rec_no=1;rec_no<records.size();rec_no++)
+   {
+      nistShmIdc item = {records[rec_no].idc_,records[rec_no].type_,(unsigned)rec_no};
+      by_idc.push_back(item);
+   }
+   std::sort(by_idc.begin(),by_idc.end(),[](const nistShmIdc& a, const nistShmIdc& b)
+   {
+      return a.idc_!=b.idc_ ? a.idc_<b.idc_ : a.type_!=b.type_ ? a.type_<b.type_ : a.rec_<b.rec_;
+   });
+
+   hdr.records_offset_ = aligned(sizeof(hdr));
+   hdr.tags_offset_ = aligned(hdr.records_offset_ + records.size()*sizeof(nistShmRecord));
+   hdr.by_type_offset_ = aligned(hdr.tags_offset_ + tags.size()*sizeof(nistShmTag));
+   hdr.idc_offset_ = aligned(hdr.by_type_offset_ + by_type.size()*sizeof(unsigned));
+   unsigned long long strings_offset = aligned(hdr.idc_offset_ + by_idc.size()*sizeof(nistShmIdc));
+   hdr.data_offset_ = aligned(strings_offset + strings.size());
+   hdr.data_size_ = data_size;
+   hdr.size_ = hdr.data_offset_ + data_size;
+   if(strings_offset + strings.size()>0xFFFFFFFFull)
+   {
+      err = "transaction index too large";
+      return false;
+   }
+   placeString(hdr.tot_,strings_offset);
+   placeString(hdr.ori_,strings_offset);
+   placeString(hdr.dai_,strings_offset);
+   placeString(hdr.tcn_,strings_offset);
+   placeString(hdr.tcr_,strings_offset);
+   placeString(hdr.dat_,strings_offset);
+   placeString(hdr.dom_,strings_offset);
+   for(size_t rec_no=0;rec_no<records.size();rec_no++)
+   {
+      placeString(records[rec_no].cga_,strings_offset);
+      placeString(records[rec_no].date_,strings_offset);
+      placeString(records[rec_no].imt_,strings_offset);
+   }
+
+#ifndef WIN32
+   //Новый сегмент вместо существующего: подключенные читатели сохраняют прежний
+   shm_unlink(name.c_str());
+   int fd = shm_open(name.c_str(),O_RDWR | O_CREAT | O_EXCL,0600);
+   if(fd<0)
+   {
+      err = "can't create shared memory segment " + name;
+      return false;
+   }
+   void* map = ftruncate(fd,hdr.size_)==0 ? mmap(0,hdr.size_,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0) : MAP_FAILED;
+   close(fd);
+   if(map==MAP_FAILED)
+   {
+      err = "can't map shared memory segment " + name;
+      shm_unlink(name.c_str());
+      return false;
+   }
+   unsigned char* out = (unsigned char*)map;
+   memcpy(out,&hdr,sizeof(hdr));
+   memcpy(out + hdr.records_offset_,&records[0],records.size()*sizeof(nistShmRecord));
+   if(!tags.empty())
+   {
+      memcpy(out + hdr.tags_offset_,&tags[0],tags.size()*sizeof(nistShmTag));
+   }
+   memcpy(out + hdr.by_type_offset_,&by_type[0],by_type.size()*sizeof(unsigned));
+   if(!by_idc.empty())
+   {
+      memcpy(out + hdr.idc_offset_,&by_idc[0],by_idc.size()*sizeof(nistShmIdc));
+   }
+   if(!strings.empty())
+   {
+      memcpy(out + strings_offset,&strings[0],strings.size());
+   }
+   memcpy(out + hdr.data_offset_,base,data_size);
+   //Готовность публикуется после всех данных сегмента
+   __atomic_store_n(&((nistShmHeader*)out)->ready_,1u,__ATOMIC_RELEASE);
+   munmap(map,hdr.size_);
+   return true;
+#else
+   err = "shared memory is not supported";
+   return false;
+#endif
+}
+
+bool nistShmTransaction::unlink(const std::string& name)
+{
+#ifndef WIN32
+   return shm_unlink(name.c_str())==0;
+#else
+   return false;
+#endif
+}
+
+nistShmTransaction::nistShmTransaction()
+   :base_(0),size_(0),mapped_(false),header_(0),records_(0),tags_(0),by_type_(0),by_idc_(0),data_(0)
+{
+}
+
+nistShmTransaction::~nistShmTransaction()
+{
+   detach();
+}
+
+void nistShmTransaction::detach()
+{
+#ifndef WIN32
+   if(mapped_)
+   {
+      munmap((void*)base_,size_);
+   }
+#endif
+   base_ = 0;
+   size_ = 0;
+   mapped_ = false;
+   header_ = 0;
+   records_ = 0;
+   tags_ = 0;
+   by_type_ = 0;
+   by_idc_ = 0;
+   data_ = 0;
+}
+
+bool nistShmTransaction::attach(const std::string& name)
+{
+   detach();
+#ifndef WIN32
+   int fd = shm_open(name.c_str(),O_RDONLY,0);
+   if(fd<0)
+   {
+      err_msg_ = "can't open shared memory segment " + name;
+      return false;
+   }
+   struct stat st;
+   void* map = fstat(fd,&st)==0 && st.st_size>0 ? mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0) : MAP_FAILED;
+   close(fd);
+   if(map==MAP_FAILED)
+   {
+      err_msg_ = "can't map shared memory segment " + name;
+      return false;
+   }
+   base_ = (const unsigned char*)map;
+   size_ = st.st_size;
+   mapped_ = true;
+   if(!check())
+   {
+      detach();
+      return false;
+   }
+   return true;
+#else
+   err_msg_ = "shared memory is not supported";
+   return false;
+#endif
+}
+
+bool nistShmTransaction::attach(const void* base, size_t size)
+{
+   detach();
+   base_ = (const unsigned char*)base;
+   size_ = size;
+   if(!check())
+   {
+      detach();
+      return false;
+   }
+   return true;
+}
+
+//!Раздел из count элементов размера item по смещению offset помещается в size и выровнен
+static bool fits(unsigned long long offset, unsigned long long count, unsigned long long item, unsigned long long size)
+{
+   return offset%8==0 && offset<=size && count<=(size - offset)/item;
+}
+
+static bool fitsString(const nistShmString& value, unsigned long long size)
+{
+   return value.offset_<=size && value.size_<=size - value.offset_;
+}
+
+bool nistShmTransaction::check()
+{
+   const nistShmHeader* hdr = (const nistShmHeader*)base_;
+   if(size_<sizeof(nistShmHeader) || reinterpret_cast<size_t>(base_)%8 || memcmp(hdr->magic_,shm_magic,sizeof(shm_magic)))
+   {
+      err_msg_ = "not a transaction segment";
+      return false;
+   }
+   if(hdr->byte_order_!=byte_order_mark)
+   {
+      err_msg_ = "segment written with other byte order";
+      return false;
+   }
+   if(!__atomic_load_n(&hdr->ready_,__ATOMIC_ACQUIRE))
+   {
+      err_msg_ = "segment is not ready";
+      return false;
+   }
+   unsigned long long size = hdr->size_;
+   unsigned records_cnt = hdr->records_cnt_;
+   if(size>size_ || !records_cnt || !fits(hdr->records_offset_,records_cnt,sizeof(nistShmRecord),size) ||
+      !fits(hdr->tags_offset_,hdr->tags_cnt_,sizeof(nistShmTag),size) ||
+      !fits(hdr->by_type_offset_,records_cnt,sizeof(unsigned),size) ||
+      !fits(hdr->idc_offset_,records_cnt - 1,sizeof(nistShmIdc),size) ||
+      !fits(hdr->data_offset_,hdr->data_size_,1,size))
+   {
+      err_msg_ = "segment section out of bounds";
+      return false;
+   }
+   const nistShmRecord* records = (const nistShmRecord*)(base_ + hdr->records_offset_);
+   const nistShmTag* tags = (const nistShmTag*)(base_ + hdr->tags_offset_);
+   const unsigned* by_type = (const unsigned*)(base_ + hdr->by_type_offset_);
+   const nistShmIdc* by_idc = (const nistShmIdc*)(base_ + hdr->idc_offset_);
+   unsigned long long data_size = hdr->data_size_;
+   bool res = hdr->type_begin_[0]==0 && hdr->type_begin_[shm_types]==records_cnt;
+   for(unsigned type=0;res && type<shm_types;type++)
+   {
+      res = hdr->type_begin_[type]<=hdr->type_begin_[type + 1];
+   }
+   res = res && fitsString(hdr->tot_,size) && fitsString(hdr->ori_,size) && fitsString(hdr->dai_,size) &&
+         fitsString(hdr->tcn_,size) && fitsString(hdr->tcr_,size) && fitsString(hdr->dat_,size) && fitsString(hdr->dom_,size);
+   for(unsigned rec_no=0;res && rec_no<records_cnt;rec_no++)
+   {
+      const nistShmRecord& rec = records[rec_no];
+      res = (unsigned long long)rec.first_tag_ + rec.tags_cnt_<=hdr->tags_cnt_ &&
+            (unsigned long long)rec.offset_ + rec.size_<=data_size &&
+            (unsigned long long)rec.image_offset_ + rec.image_size_<=data_size &&
+            fitsString(rec.cga_,size) && fitsString(rec.date_,size) && fitsString(rec.imt_,size) &&
+            by_type[rec_no]<records_cnt && (rec_no==0 || by_idc[rec_no - 1].rec_<records_cnt);
+   }
+   for(unsigned tag_no=0;res && tag_no<hdr->tags_cnt_;tag_no++)
+   {
+      res = (unsigned long long)tags[tag_no].offset_ + tags[tag_no].size_<=data_size;
+   }
+   if(!res)
+   {
+      err_msg_ = "segment reference out of bounds";
+      return false;
+   }
+   header_ = hdr;
+   records_ = records;
+   tags_ = tags;
+   by_type_ = by_type;
+   by_idc_ = by_idc;
+   data_ = base_ + hdr->data_offset_;
+   return true;
+}
+
+const nistShmTag* nistShmTransaction::findTag(unsigned rec_no, unsigned tag) const
+{
+   const nistShmTag* begin = tags(rec_no);
+   const nistShmTag* end = begin + records_[rec_no].tags_cnt_;
+   for(const nistShmTag* item=begin;item<end;item++)
+   {
+      if(item->tag_==tag)
+      {
+         return item;
+      }
+   }
+   return 0;
+}
+
+const char* nistShmTransaction::str(const nistShmString& value, unsigned& size) const
+{
+   size = value.size_;
+   return (const char*)base_ + value.offset_;
+}
+
+unsigned nistShmTransaction::records(unsigned type, const unsigned*& rec_no) const
+{
+   if(type>=shm_types)
+   {
+      rec_no = by_type_;
+      return 0;
+   }
+   rec_no = by_type_ + header_->type_begin_[type];
+   return header_->type_begin_[type + 1] - header_->type_begin_[type];
+}
+
+int nistShmTransaction::findRecord(unsigned type, unsigned idc) const
+{
+   const nistShmIdc* begin = by_idc_;
+   const nistShmIdc* end = by_idc_ + header_->records_cnt_ - 1;
+   const nistShmIdc* found = std::lower_bound(begin,end,std::make_pair(idc,type),
+      [](const nistShmIdc& item, const std::pair<unsigned,unsigned>& key)
+      {
+         return item.idc_!=key.first ? item.idc_<key.first : item.type_<key.second;
+      });
+   return found<end && found->idc_==idc && found->type_==type ? (int)found->rec_ : -1;
+}
@@ -0,0 +1,169 @@
+/*
+  \file   nistshm.h
+  \brief  Передача загруженной транзакции между процессами через разделяемую память POSIX
+
+  Формат сегмента (порядок байт - как у записавшей машины, проверяется по маркеру в заголовке).
+  Ссылки внутри сегмента - смещения от его начала, поэтому сегмент отображается по любому адресу:
+     nistShmHeader
+     nistShmRecord[records_cnt_]     записи в порядке файла, [0] - Type-1
+     nistShmTag[tags_cnt_]           теги всех записей подряд, записи ссылаются на свой участок
+     u32[records_cnt_]               номера записей, упорядоченные по типу (type_begin_ в заголовке)
+     nistShmIdc[records_cnt_ - 1]    (IDC, тип, номер записи) по возрастанию для поиска по IDC
+     строки                          разобранные текстовые поля (TOT, CGA, IMT и т.п.)
+     данные                          исходные байты транзакции, на них ссылаются теги и изображения
+  Каждый раздел выровнен на 8 байт. Поле ready_ заголовка записывается последним, поэтому читатель,
+  подключившийся во время записи, получает отказ, а не частично заполненный сегмент.
+*/
+
+#ifndef NIST_SHM_H
+#define NIST_SHM_H
+
+#include <string>
+
+#include "nistparser.h"
+
+///! Строка в сегменте: смещение от начала сегмента и длина, без замыкающего нуля
+struct nistShmString
+{
+   unsigned offset_;
+   unsigned size_;
+};
+
+///! Тег записи: смещение данных тега от начала данных транзакции
+struct nistShmTag
+{
+   unsigned tag_;
+   unsigned offset_;
+   unsigned size_;
+};
+
+///! Запись с разобранными полями изображения (для записей без изображения поля нулевые)
+struct nistShmRecord
+{
+   unsigned type_;
+   //!IDC из CNT
+   unsigned idc_;
+   //!Смещение и размер записи в данных транзакции
+   unsigned offset_;
+   unsigned size_;
+   //!Участок массива тегов
+   unsigned first_tag_;
+   unsigned tags_cnt_;
+   //!Смещение данных изображения в данных транзакции
+   unsigned image_offset_;
+   unsigned image_size_;
+   unsigned hll_;
+   unsigned vll_;
+   //!HPS, для Type-4 - ISR
+   unsigned hps_;
+   unsigned vps_;
+   unsigned char imp_;
+   unsigned char fgp_;
+   unsigned char slc_;
+   unsigned char bpx_;
+   //!CGA, для Type-4 - код десятичным числом
+   nistShmString cga_;
+   //!Дата съемки: PHD, LCD, TCD, PCD
+   nistShmString date_;
+   nistShmString imt_;
+};
+
+///! Элемент индекса по IDC
+struct nistShmIdc
+{
+   unsigned idc_;
+   unsigned type_;
+   unsigned rec_;
+};
+
+///! Заголовок сегмента
+struct nistShmHeader
+{
+   char magic_[8];
+   unsigned byte_order_;
+   //!Не 0, когда сегмент записан полностью
+   unsigned ready_;
+   unsigned long long size_;
+   unsigned records_cnt_;
+   unsigned tags_cnt_;
+   unsigned long long records_offset_;
+   unsigned long long tags_offset_;
+   unsigned long long by_type_offset_;
+   unsigned long long idc_offset_;
+   unsigned long long data_offset_;
+   unsigned long long data_size_;
+   //!Записи типа t занимают [type_begin_[t], type_begin_[t+1]) индекса по типам
+   unsigned type_begin_[101];
+   unsigned reserved_;
+   nistShmString tot_;
+   nistShmString ori_;
+   nistShmString dai_;
+   nistShmString tcn_;
+   nistShmString tcr_;
+   nistShmString dat_;
+   nistShmString dom_;
+};
+
+/*! Транзакция в разделяемой памяти. Производитель размещает загруженную транзакцию вызовом publish(),
+    потребитель подключается attach() и читает записи, теги, изображения и разобранные поля прямо из
+    отображенного сегмента, без разбора ANSI/NIST и без копирования. При подключении проверяются только
+    границы ссылок сегмента, O(записей + тегов). Если потребителю нужен nistParser, его можно загрузить
+    из data() без копирования, nistParser::load(const unsigned char*, size_t).
+*/
+class nistShmTransaction
+{
+public:
+   nistShmTransaction();
+   ~nistShmTransaction();
+   /*! Размещает транзакцию в сегменте name (имя shm_open, например "/nist-42"); сегмент с тем же
+       именем заменяется. Транзакция, измененная после загрузки (nistParser::isModified), не размещается:
+       ее записи не лежат в одном буфере, сначала ее нужно записать и загрузить заново
+   */
+   static bool publish(const nistParser& parser, const std::string& name, std::string& err);
+   //!Удаляет имя сегмента; подключенные потребители читают его до detach()
+   static bool unlink(const std::string& name);
+   //!Подключается к сегменту только для чтения
+   bool attach(const std::string& name);
+   //!Подключается к сегменту, уже находящемуся в памяти; память не копируется и должна жить до detach()
+   bool attach(const void* base, size_t size);
+   void detach();
+   const std::string& getError() const{return err_msg_;}
+
+   const nistShmHeader& header() const{return *header_;}
+   //!Число записей вместе с Type-1
+   unsigned recordsCnt() const{return header_->records_cnt_;}
+   const nistShmRecord& record(unsigned rec_no) const{return records_[rec_no];}
+   const nistShmTag* tags(unsigned rec_no) const{return tags_ + records_[rec_no].first_tag_;}
+   //!Тег записи по номеру или 0
+   const nistShmTag* findTag(unsigned rec_no, unsigned tag) const;
+   //!Исходные байты транзакции
+   const unsigned char* data() const{return data_;}
+   size_t dataSize() const{return header_->data_size_;}
+   nistSpan tagData(const nistShmTag& tag) const{return nistSpan(data_ + tag.offset_,tag.size_);}
+   nistSpan image(unsigned rec_no) const{return nistSpan(data_ + records_[rec_no].image_offset_,records_[rec_no].image_size_);}
+   //!Строка сегмента, size - ее длина. Строка не завершается нулем
+   const char* str(const nistShmString& value, unsigned& size) const;
+   //!Номера записей типа type в порядке файла, возвращает их число
+   unsigned records(unsigned type, const unsigned*& rec_no) const;
+   //!Номер записи типа type с IDC или -1
+   int findRecord(unsigned type, unsigned idc) const;
+private:
+   nistShmTransaction(const nistShmTransaction&);
+   nistShmTransaction& operator=(const nistShmTransaction&);
+   //!Проверяет заголовок и границы всех ссылок сегмента
+   bool check();
+
+   const unsigned char* base_;
+   size_t size_;
+   //!Сегмент отображен attach(name) и снимается в detach()
+   bool mapped_;
+   const nistShmHeader* header_;
+   const nistShmRecord* records_;
+   const nistShmTag* tags_;
+   const unsigned* by_type_;
+   const nistShmIdc* by_idc_;
+   const unsigned char* data_;
+   std::string err_msg_;
+};
+
+#endif // NIST_SHM_H
@@ -0,0 +1,438 @@
+/*
+  \file   nistvalidate.cpp
+  \brief  Структурная проверка ANSI-NIST транзакций без разбора записей
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <atomic>
+#include <bitset>
+#include <cstring>
+#include <thread>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "nistvalidate.h"
+#include "nistparser.h"
+
+const char* nistViolationText(nistViolationCode code)
+{
+   switch(code)
+   {
+      case nistViolationTruncated: return "record exceeds the end of data";
+      case nistViolationBadLen: return "invalid LEN";
+      case nistViolationBadSeparator: return "FS before the end given by LEN";
+      case nistViolationBadTag: return "invalid field identifier";
+      case nistViolationTagOrder: return "field numbers are not ascending";
+      case nistViolationMissingField: return "mandatory field is missing";
+      case nistViolationCharset: return "invalid character";
+      case nistViolationBinaryLen: return "binary record is shorter than its header";
+      case nistViolationBadCnt: return "invalid CNT";
+      case nistViolationCntType: return "record type differs from CNT";
+      case nistViolationCntCount: return "record count differs from CNT";
+      case nistViolationTrailingData: return "data after the last record";
+      case nistViolationUnreadable: return "file can't be read";
+   }
+   return "unknown";
+}
+
+//!Класс байта текстового поля
+enum charClass
+{
+   charValid,
+   charSeparator,   ///<GS или FS - конец поля
+   charInvalid
+};
+
+//!Таблицы классов байтов: ASCII и ASCII с байтами >= 0x80 (задан DCS)
+struct charTables
+{
+   unsigned char ascii_[256];
+   unsigned char dcs_[256];
+   charTables()
+   {
+      for(unsigned c=0;c<256;c++)
+      {
+         bool printable = c>=0x20 && c<0x7F;
+         bool control = c==nistParser::US() || c==nistParser::RS() || c=='\t' || c=='\r' || c=='\n';
+         ascii_[c] = printable || control ? charValid : charInvalid;
+         dcs_[c] = printable || control || c>=0x80 ? charValid : charInvalid;
+      }
+      ascii_[nistParser::GS()] = dcs_[nistParser::GS()] = charSeparator;
+      ascii_[nistParser::FS()] = dcs_[nistParser::FS()] = charSeparator;
+   }
+};
+
+//!Десятичное число не длиннее 19 цифр
+static bool readNumber(const unsigned char*& p, const unsigned char* end, unsigned long long& value)
+{
+   const unsigned char* start = p;
+   value = 0;
+   while(p<end && *p>='0' && *p<='9' && p - start<19)
+   {
+      value = value*10 + (*p - '0');
+      p++;
+   }
+   return p>start;
+}
+
+/*!Состояние проверки одной транзакции. Размер фиксирован: обход CNT ведется по данным Type-1,
+   поля записи отмечаются в битовой маске
+*/
+class nistValidation
+{
+public:
+   nistValidation(const unsigned char* data, size_t size, std::vector<nistViolation>& violations, unsigned max_violations)
+      :data_(data),size_(size),violations_(violations),max_violations_(max_violations),reported_(0),
+       cnt_(0),cnt_end_(0),chars_(tables().ascii_)
+   {
+   }
+   bool run();
+private:
+   static const charTables& tables()
+   {
+      static const charTables tables;
+      return tables;
+   }
+   void report(nistViolationCode code, const unsigned char* at, unsigned record, unsigned type, unsigned tag)
+   {
+      if(reported_<max_violations_)
+      {
+         nistViolation violation = {code,(unsigned long long)(at - data_),record,type,tag};
+         violations_.push_back(violation);
+      }
+      reported_++;
+   }
+   //!Проверяет текстовую запись с начала data_ + pos, при успехе pos - начало следующей
+   bool taggedRecord(unsigned record, unsigned type, size_t& pos);
+   bool binaryRecord(unsigned record, unsigned type, size_t& pos);
+   //!Начинает обход CNT: первое подполе "1<US>число записей"
+   bool cntBegin(unsigned long long& count);
+   //!Следующий тип записи из CNT
+   bool cntNext(unsigned& type);
+
+   const unsigned char* data_;
+   size_t size_;
+   std::vector<nistViolation>& violations_;
+   unsigned max_violations_;
+   unsigned reported_;
+   //!Текущая позиция и конец значения CNT
+   const unsigned char* cnt_;
+   const unsigned char* cnt_end_;
+   const unsigned char* chars_;
+};
+
+bool nistValidation::taggedRecord(unsigned record, unsigned type, size_t& pos)
+{
+   const unsigned char* start = data_ + pos;
+   const unsigned char* end = data_ + size_;
+   const unsigned char* p = start;
+   unsigned long long rec_type = 0;
+   unsigned long long tag = 0;
+   if(!readNumber(p,end,rec_type) || p==end || *p++!='.' || !readNumber(p,end,tag) || p==end || *p++!=':')
+   {
+      report(nistViolationBadTag,start,record,type,0);
+      return false;
+   }
+   if(rec_type!=type)
+   {
+      report(nistViolationCntType,start,record,type,0);
+   }
+   unsigned long long len = 0;
+   if(tag!=1 || !readNumber(p,end,len) || p==end || (*p!=nistParser::GS() && *p!=nistParser::FS()))
+   {
+      report(nistViolationBadLen,start,record,type,1);
+      return false;
+   }
+   if(len>size_ - pos)
+   {
+      report(nistViolationTruncated,start,record,type,0);
+      return false;
+   }
+   const unsigned char* rec_end = start + len - 1;
+   if(len<(unsigned long long)(p - start) + 1 || *rec_end!=nistParser::FS())
+   {
+      report(nistViolationBadLen,start,record,type,1);
+      return false;
+   }
+
+   std::bitset<1000> seen;
+   seen.set(1);
+   unsigned long long prev_tag = 1;
+   //Type-1 всегда в ASCII, набор символов остальных записей задается DCS
+   const unsigned char* chars = type==1 ? tables().ascii_ : chars_;
+   while(p<rec_end)
+   {
+      if(*p==nistParser::FS())
+      {
+         report(nistViolationBadSeparator,p,record,type,(unsigned)prev_tag);
+      }
+      const unsigned char* field = ++p;
+      if(!readNumber(p,rec_end,rec_type) || p==rec_end || *p++!='.' || !readNumber(p,rec_end,tag) || p==rec_end || *p++!=':' ||
+         rec_type!=type)
+      {
+         report(nistViolationBadTag,field,record,type,0);
+         //Поле пропускается до следующего разделителя
+         while(p<rec_end && chars[*p]!=charSeparator)
+         {
+            p++;
+         }
+         continue;
+      }
+      if(tag<=prev_tag)
+      {
+         report(nistViolationTagOrder,field,record,type,(unsigned)tag);
+      }
+      prev_tag = tag;
+      if(tag<seen.size())
+      {
+         seen.set(tag);
+      }
+      if(tag==999)
+      {
+         //Данные изображения занимают запись до конца
+         p = rec_end;
+         break;
+      }
+      if(type==1 && tag==3)
+      {
+         cnt_ = p;
+      }
+      bool charset_ok = true;
+      while(p<rec_end)
+      {
+         unsigned char cls = chars[*p];
+         if(cls==charSeparator)
+         {
+            break;
+         }
+         if(cls==charInvalid && charset_ok)
+         {
+            report(nistViolationCharset,p,record,type,(unsigned)tag);
+            charset_ok = false;
+         }
+         p++;
+      }
+      if(type==1 && tag==3)
+      {
+         cnt_end_ = p;
+      }
+      if(type==1 && tag==15)
+      {
+         chars_ = tables().dcs_;
+      }
+   }
+
+   unsigned mandatory[64];
+   unsigned cnt = nistMandatoryFields(type,mandatory,sizeof(mandatory)/sizeof(mandatory[0]));
+   if(!cnt && type!=1)
+   {
+      //Запись без схемы разбора: IDC обязателен для всех записей, кроме Type-1
+      mandatory[cnt++] = 2;
+   }
+   for(unsigned no=0;no<cnt;no++)
+   {
+      if(!seen.test(mandatory[no]))
+      {
+         report(nistViolationMissingField,start,record,type,mandatory[no]);
+      }
+   }
+   pos += len;
+   return true;
+}
+
+bool nistValidation::binaryRecord(unsigned record, unsigned type, size_t& pos)
+{
+   const unsigned char* start = data_ + pos;
+   if(size_ - pos<4)
+   {
+      report(nistViolationTruncated,start,record,type,0);
+      return false;
+   }
+   unsigned long long len = (unsigned long long)start[0]<<24 | start[1]<<16 | start[2]<<8 | start[3];
+   if(len<nistBinaryHeaderSize(type))
+   {
+      report(nistViolationBinaryLen,start,record,type,0);
+      return false;
+   }
+   if(len>size_ - pos)
+   {
+      report(nistViolationTruncated,start,record,type,0);
+      return false;
+   }
+   pos += len;
+   return true;
+}
+
+bool nistValidation::cntBegin(unsigned long long& count)
+{
+   unsigned long long first = 0;
+   if(!cnt_ || !readNumber(cnt_,cnt_end_,first) || first!=1 || cnt_==cnt_end_ || *cnt_++!=nistParser::US() ||
+      !readNumber(cnt_,cnt_end_,count))
+   {
+      return false;
+   }
+   return true;
+}
+
+bool nistValidation::cntNext(unsigned& type)
+{
+   unsigned long long value = 0;
+   if(cnt_>=cnt_end_ || *cnt_++!=nistParser::RS() || !readNumber(cnt_,cnt_end_,value))
+   {
+      return false;
+   }
+   type = (unsigned)value;
+   //IDC не проверяется, пропускается до следующего подполя
+   while(cnt_<cnt_end_ && *cnt_!=nistParser::RS())
+   {
+      cnt_++;
+   }
+   return true;
+}
+
+bool nistValidation::run()
+{
+   size_t pos = 0;
+   if(!size_)
+   {
+      report(nistViolationUnreadable,data_,0,0,0);
+      return false;
+   }
+   if(!taggedRecord(0,1,pos))
+   {
+      return false;
+   }
+   unsigned long long count = 0;
+   const unsigned char* cnt_start = cnt_;
+   if(!cntBegin(count))
+   {
+      report(nistViolationBadCnt,cnt_start ? cnt_start : data_,0,1,3);
+      return false;
+   }
+   unsigned record = 1;
+   unsigned type = 0;
+   while(cntNext(type))
+   {
+      if(pos==size_)
+      {
+         report(nistViolationCntCount,data_ + pos,record,type,0);
+         return false;
+      }
+      bool res = nistIsBinaryRecord(type) ? binaryRecord(record,type,pos) : taggedRecord(record,type,pos);
+      if(!res)
+      {
+         return false;
+      }
+      record++;
+   }
+   if(cnt_<cnt_end_)
+   {
+      report(nistViolationBadCnt,cnt_,0,1,3);
+   }
+   if(count!=record - 1)
+   {
+      report(nistViolationCntCount,cnt_start,0,1,3);
+   }
+   if(pos<size_)
+   {
+      report(nistViolationTrailingData,data_ + pos,record,0,0);
+   }
+   return !reported_;
+}
+
+nistValidator::nistValidator(unsigned max_violations, unsigned threads)
+   :max_violations_(max_violations),threads_(threads)
+{
+   if(!threads_)
+   {
+      threads_ = std::thread::hardware_concurrency();
+   }
+   if(!threads_)
+   {
+      threads_ = 1;
+   }
+}
+
+bool nistValidator::validate(const unsigned char* data, size_t size, std::vector<nistViolation>& violations) const
+{
+   nistValidation validation(data,size,violations,max_violations_);
+   return validation.run();
+}
+
+bool nistValidator::validateFile(const std::string& file_name, std::vector<nistViolation>& violations) const
+{
+#ifndef WIN32
+   int fd = ::open(file_name.c_str(),O_RDONLY);
+   struct stat st;
+   void* map = MAP_FAILED;
+   if(fd>=0 && fstat(fd,&st)==0 && st.st_size>0)
+   {
+      map = mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+   }
+   if(fd>=0)
+   {
+      ::close(fd);
+   }
+   if(map==MAP_FAILED)
+   {
+      dbg0("nistValidator::validateFile can't map %s\n",file_name.c_str());
+      nistViolation violation = {nistViolationUnreadable,0,0,0,0};
+      violations.push_back(violation);
+      return false;
+   }
+   //Файл читается один раз по порядку
+   madvise(map,st.st_size,MADV_SEQUENTIAL);
+   bool res = validate((const unsigned char*)map,st.st_size,violations);
+   munmap(map,st.st_size);
+   return res;
+#else
+   std::vector<unsigned char> content;
+   if(!nistParser::readFile(file_name,content) || content.empty())
+   {
+      nistViolation violation = {nistViolationUnreadable,0,0,0,0};
+      violations.push_back(violation);
+      return false;
+   }
+   return validate(&content[0],content.size(),violations);
+#endif
+}
+
+unsigned nistValidator::validateFiles(const std::vector<std::string>& files, std::vector<std::vector<nistViolation> >& results) const
+{
+   results.resize(files.size());
+   std::atomic<size_t> next(0);
+   std::atomic<unsigned> valid(0);
+   auto worker = [&]()
+   {
+      for(size_t no=next++;no<files.size();no=next++)
+      {
+         results[no].clear();
+         if(validateFile(files[no],results[no]))
+         {
+            valid++;
+         }
+      }
+   };
+   std::vector<std::thread> workers;
+   unsigned cnt = files.size()<threads_ ? (unsigned)files.size() : threads_;
+   for(unsigned no=1;no<cnt;no++)
+   {
+      workers.push_back(std::thread(worker));
+   }
+   worker();
+   for(unsigned no=0;no<workers.size();no++)
+   {
+      workers[no].join();
+   }
+   return valid;
+}
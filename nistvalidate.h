@@ -0,0 +1,73 @@
+/*
+  \file   nistvalidate.h
+  \brief  Структурная проверка ANSI-NIST транзакций без разбора записей
+*/
+
+#ifndef NIST_VALIDATE_H
+#define NIST_VALIDATE_H
+
+#include <string>
+#include <vector>
+
+///! Вид нарушения структуры
+enum nistViolationCode
+{
+   nistViolationTruncated,     ///<Запись выходит за конец данных
+   nistViolationBadLen,        ///<LEN отсутствует, не число или не указывает на FS в конце записи
+   nistViolationBadSeparator,  ///<FS внутри записи до конца, заданного LEN
+   nistViolationBadTag,        ///<Неверный идентификатор поля или тип записи в нем
+   nistViolationTagOrder,      ///<Номера полей не возрастают
+   nistViolationMissingField,  ///<Нет обязательного поля
+   nistViolationCharset,       ///<Недопустимый символ в текстовом поле
+   nistViolationBinaryLen,     ///<Длина бинарной записи меньше ее заголовка
+   nistViolationBadCnt,        ///<Поле 1.003 CNT отсутствует или не разбирается
+   nistViolationCntType,       ///<Тип записи не совпадает с CNT
+   nistViolationCntCount,      ///<Число записей не совпадает с CNT
+   nistViolationTrailingData,  ///<Данные после последней записи
+   nistViolationUnreadable     ///<Файл не читается или пуст
+};
+
+//!Краткое описание нарушения
+const char* nistViolationText(nistViolationCode code);
+
+///! Нарушение и его место
+struct nistViolation
+{
+   nistViolationCode code_;
+   //!Смещение от начала транзакции
+   unsigned long long offset_;
+   //!Номер записи: 0 - Type-1, далее в порядке CNT
+   unsigned record_;
+   unsigned type_;
+   //!Номер поля, 0 - нарушение относится к записи
+   unsigned tag_;
+};
+
+/*! Проверка структуры транзакции за один проход по данным без загрузки записей:
+    CNT против фактических записей, LEN против разделителей, длины бинарных записей Type-3..8,
+    возрастание номеров полей, обязательные поля по схемам разбора nistParser, допустимые символы
+    текстовых полей (ASCII; если в Type-1 задан 1.015 DCS - также байты >= 0x80).
+    Данные изображений (поле 999, бинарные записи) пропускаются по длине без просмотра.
+
+    Память не зависит от размера файла: состояние проверки фиксированного размера, CNT читается
+    по мере прохода по записям, файлы отображаются в память. Сообщается не более max_violations нарушений.
+    После нарушения LEN границы следующих записей неизвестны, проверка транзакции прекращается.
+*/
+class nistValidator
+{
+public:
+   //!threads == 0 - по числу процессоров
+   nistValidator(unsigned max_violations = 64, unsigned threads = 0);
+   //!Дописывает нарушения в violations, возвращает true, если их нет
+   bool validate(const unsigned char* data, size_t size, std::vector<nistViolation>& violations) const;
+   bool validateFile(const std::string& file_name, std::vector<nistViolation>& violations) const;
+   /*! Проверяет пакет файлов в нескольких потоках, results[i] - нарушения files[i].
+       Возвращает число файлов без нарушений
+   */
+   unsigned validateFiles(const std::vector<std::string>& files, std::vector<std::vector<nistViolation> >& results) const;
+private:
+   unsigned max_violations_;
+   unsigned threads_;
+};
+
+#endif // NIST_VALIDATE_H
@@ -0,0 +1,1053 @@
+/*
+  \file   nistxml.cpp
+  \brief  Чтение и запись ANSI-NIST транзакций в XML-кодировке (ANSI/NIST-ITL 2011, NIEM)
+*/
+
+#ifndef NIST_NO_DEBUG_OUTPUT
+#define dbg0 printf
+#else
+#define dbg0(...)
+#endif
+
+#include <cstdlib>
+#include <cstring>
+
+#include "nistxml.h"
+
+//!Размер порции данных изображения при кодировании base64, кратен 3
+static const size_t base64_chunk = 3*1024;
+
+///! Элемент записи для каждого поддерживаемого типа
+struct xmlRecordElement
+{
+   unsigned type_;
+   const char* name_;
+};
+
+static const xmlRecordElement xml_records[] =
+{
+   {1,  "itl:PackageInformationRecord"},
+   {2,  "itl:PackageDescriptiveTextRecord"},
+   {10, "itl:PackageFacialAndSMTImageRecord"},
+   {14, "itl:PackageFingerprintImageRecord"},
+};
+
+static const unsigned xml_records_cnt = sizeof(xml_records)/sizeof(xml_records[0]);
+
+///! Строка таблицы соответствий по умолчанию, см. nistXmlField
+struct xmlDefaultField
+{
+   unsigned type_;
+   const char* path_;
+   unsigned tag_;
+   unsigned item_;
+   const char* group_;
+   nistXmlFormat format_;
+   unsigned first_char_;
+   unsigned chars_;
+};
+
+static const xmlDefaultField xml_default_fields[] =
+{
+   {1, "biom:TransactionMajorVersionValue", 2, 0, "", nistXmlText, 0, 2},
+   {1, "biom:TransactionMinorVersionValue", 2, 0, "", nistXmlText, 2, 2},
+   {1, "biom:TransactionContentSummary/biom:ContentFirstRecordCategoryCode", 3, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionContentSummary/biom:ContentRecordCount", 3, 1, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionContentSummary/biom:ContentRecordSummary/biom:ImageReferenceIdentification/nc:IdentificationID", 3, 1,
+       "biom:TransactionContentSummary/biom:ContentRecordSummary", nistXmlText, 0, 0},
+   {1, "biom:TransactionContentSummary/biom:ContentRecordSummary/biom:RecordCategoryCode", 3, 0,
+       "biom:TransactionContentSummary/biom:ContentRecordSummary", nistXmlText, 0, 0},
+   {1, "biom:TransactionCategoryCode", 4, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionDate/nc:Date", 5, 0, "", nistXmlDate, 0, 0},
+   {1, "biom:TransactionPriorityValue", 6, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionDestinationOrganization/nc:OrganizationIdentification/nc:IdentificationID", 7, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionOriginatingOrganization/nc:OrganizationIdentification/nc:IdentificationID", 8, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionControlIdentification/nc:IdentificationID", 9, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionControlReferenceIdentification/nc:IdentificationID", 10, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionImageResolutionDetails/biom:NativeScanningResolutionValue", 11, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionImageResolutionDetails/biom:NominalTransmittingResolutionValue", 12, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionDomain/biom:DomainVersionNumberIdentification/nc:IdentificationID", 13, 1, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionDomain/nc:OrganizationName", 13, 0, "", nistXmlText, 0, 0},
+   {1, "biom:TransactionUTCDate/nc:DateTime", 14, 0, "", nistXmlDateTime, 0, 0},
+
+   {2, "biom:ImageReferenceIdentification/nc:IdentificationID", 2, 0, "", nistXmlText, 0, 0},
+
+   {10, "biom:ImageReferenceIdentification/nc:IdentificationID", 2, 0, "", nistXmlText, 0, 0},
+   {10, "biom:ImageCategoryCode", 3, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/nc:BinaryBase64Object", 999, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/biom:ImageCaptureDetail/biom:CaptureDate/nc:Date", 5, 0, "", nistXmlDate, 0, 0},
+   {10, "biom:FaceImage/biom:ImageCaptureDetail/biom:CaptureOrganization/nc:OrganizationIdentification/nc:IdentificationID", 4, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/biom:ImageHorizontalLineLengthPixelQuantity", 6, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/biom:ImageVerticalLineLengthPixelQuantity", 7, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/biom:ImageScaleUnitsCode", 8, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/biom:ImageHorizontalPixelDensityValue", 9, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/biom:ImageVerticalPixelDensityValue", 10, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/biom:ImageCompressionAlgorithmText", 11, 0, "", nistXmlText, 0, 0},
+   {10, "biom:FaceImage/biom:ImageColorSpaceCode", 12, 0, "", nistXmlText, 0, 0},
+
+   {14, "biom:ImageReferenceIdentification/nc:IdentificationID", 2, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/nc:BinaryBase64Object", 999, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:FingerprintImageImpressionCaptureCategoryCode", 3, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageCaptureDetail/biom:CaptureDate/nc:Date", 5, 0, "", nistXmlDate, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageCaptureDetail/biom:CaptureOrganization/nc:OrganizationIdentification/nc:IdentificationID", 4, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageHorizontalLineLengthPixelQuantity", 6, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageVerticalLineLengthPixelQuantity", 7, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageScaleUnitsCode", 8, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageHorizontalPixelDensityValue", 9, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageVerticalPixelDensityValue", 10, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageCompressionAlgorithmText", 11, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:ImageBitsPerPixelQuantity", 12, 0, "", nistXmlText, 0, 0},
+   {14, "biom:FingerprintImage/biom:FingerprintImagePosition/biom:FingerPositionCode", 13, 0,
+        "biom:FingerprintImage/biom:FingerprintImagePosition", nistXmlText, 0, 0},
+};
+
+static const char xml_root[] = "itl:NISTBiometricInformationExchangePackage";
+
+static const char xml_namespaces[] =
+   " xmlns:itl=\"http://biometrics.nist.gov/standard/2011\""
+   " xmlns:biom=\"http://niem.gov/niem/biometrics/1.0\""
+   " xmlns:nc=\"http://niem.gov/niem/niem-core/2.0\""
+   " xmlns:ansi-nist=\"http://niem.gov/niem/ansi-nist/2.0\"";
+
+//!Имя элемента без префикса пространства имен
+static std::string localName(const char* name, size_t len)
+{
+   const char* colon = (const char*)memchr(name,':',len);
+   if(colon)
+   {
+      return std::string(colon + 1,name + len);
+   }
+   return std::string(name,len);
+}
+
+//!Разбивает путь на элементы; strip - отбрасывать префиксы пространств имен
+static std::vector<std::string> splitPath(const std::string& path, bool strip)
+{
+   std::vector<std::string> res;
+   size_t begin = 0;
+   while(begin<path.size())
+   {
+      size_t end = path.find('/',begin);
+      if(end==std::string::npos)
+      {
+         end = path.size();
+      }
+      res.push_back(strip ? localName(path.c_str() + begin,end - begin) : path.substr(begin,end - begin));
+      begin = end + 1;
+   }
+   return res;
+}
+
+static nistXmlField defaultField(const xmlDefaultField& def)
+{
+   nistXmlField field;
+   field.type_ = def.type_;
+   field.path_ = def.path_;
+   field.tag_ = def.tag_;
+   field.item_ = def.item_;
+   field.group_ = def.group_;
+   field.format_ = def.format_;
+   field.first_char_ = def.first_char_;
+   field.chars_ = def.chars_;
+   return field;
+}
+
+//!Дописывает символ code в UTF-8
+static void appendUtf8(std::string& out, unsigned long code)
+{
+   if(code<0x80)
+   {
+      out += (char)code;
+   }
+   else if(code<0x800)
+   {
+      out += (char)(0xC0 | code>>6);
+      out += (char)(0x80 | (code & 0x3F));
+   }
+   else if(code<0x10000)
+   {
+      out += (char)(0xE0 | code>>12);
+      out += (char)(0x80 | ((code>>6) & 0x3F));
+      out += (char)(0x80 | (code & 0x3F));
+   }
+   else
+   {
+      out += (char)(0xF0 | code>>18);
+      out += (char)(0x80 | ((code>>12) & 0x3F));
+      out += (char)(0x80 | ((code>>6) & 0x3F));
+      out += (char)(0x80 | (code & 0x3F));
+   }
+}
+
+//!Дописывает текст XML, заменяя ссылки на символы. Нераспознанная ссылка остается как есть
+static void appendText(std::string& out, const char* p, const char* end)
+{
+   while(p<end)
+   {
+      const char* amp = (const char*)memchr(p,'&',end - p);
+      if(!amp)
+      {
+         out.append(p,end);
+         return;
+      }
+      out.append(p,amp);
+      const char* semicolon = (const char*)memchr(amp,';',end - amp);
+      if(!semicolon)
+      {
+         out.append(amp,end);
+         return;
+      }
+      std::string ref(amp + 1,semicolon);
+      if(ref=="lt")
+      {
+         out += '<';
+      }
+      else if(ref=="gt")
+      {
+         out += '>';
+      }
+      else if(ref=="amp")
+      {
+         out += '&';
+      }
+      else if(ref=="quot")
+      {
+         out += '"';
+      }
+      else if(ref=="apos")
+      {
+         out += '\'';
+      }
+      else if(ref.size()>1 && ref[0]=='#')
+      {
+         bool hex = ref[1]=='x' || ref[1]=='X';
+         appendUtf8(out,strtoul(ref.c_str() + (hex ? 2 : 1),0,hex ? 16 : 10));
+      }
+      else
+      {
+         out.append(amp,semicolon + 1);
+      }
+      p = semicolon + 1;
+   }
+}
+
+//!Поиск строки str в [p, end), буфер XML не обязан заканчиваться нулем
+static const char* findString(const char* p, const char* end, const char* str)
+{
+   size_t len = strlen(str);
+   while(end - p>=(ptrdiff_t)len)
+   {
+      const char* first = (const char*)memchr(p,str[0],end - p - len + 1);
+      if(!first)
+      {
+         return 0;
+      }
+      if(!memcmp(first,str,len))
+      {
+         return first;
+      }
+      p = first + 1;
+   }
+   return 0;
+}
+
+static bool isSpace(char c)
+{
+   return c==' ' || c=='\t' || c=='\r' || c=='\n';
+}
+
+//!Преобразует значение элемента XML к виду поля NIST: из дат удаляются разделители
+static void fromXmlFormat(std::string& value, nistXmlFormat format)
+{
+   if(format==nistXmlText)
+   {
+      return;
+   }
+   size_t out = 0;
+   for(size_t pos=0;pos<value.size();pos++)
+   {
+      char c = value[pos];
+      if(c!='-' && c!=':' && c!='T')
+      {
+         value[out++] = c;
+      }
+   }
+   value.resize(out);
+}
+
+//!Обратное преобразование; значения неожиданной длины выводятся как есть
+static std::string toXmlFormat(const std::string& value, nistXmlFormat format)
+{
+   if(format==nistXmlDate && value.size()==8)
+   {
+      return value.substr(0,4) + "-" + value.substr(4,2) + "-" + value.substr(6,2);
+   }
+   if(format==nistXmlDateTime && value.size()==15)
+   {
+      return value.substr(0,4) + "-" + value.substr(4,2) + "-" + value.substr(6,2) + "T" +
+             value.substr(8,2) + ":" + value.substr(10,2) + ":" + value.substr(12);
+   }
+   return value;
+}
+
+nistXmlReader::nistXmlReader()
+   :depth_(0),record_depth_(0),record_type_(0),leaf_(false),image_first_(0),image_symbols_(0),image_ok_(true)
+{
+   for(unsigned no=0;no<sizeof(xml_default_fields)/sizeof(xml_default_fields[0]);no++)
+   {
+      addMapping(defaultField(xml_default_fields[no]));
+   }
+}
+
+void nistXmlReader::addMapping(const nistXmlField& field)
+{
+   fields_.push_back(field);
+   paths_.push_back(splitPath(field.path_,true));
+   groups_.push_back(splitPath(field.group_,true));
+}
+
+int nistXmlReader::findField(bool group) const
+{
+   size_t rel = depth_ - record_depth_;
+   for(unsigned no=0;no<fields_.size();no++)
+   {
+      if(fields_[no].type_!=record_type_)
+      {
+         continue;
+      }
+      const std::vector<std::string>& path = group ? groups_[no] : paths_[no];
+      if(path.size()!=rel)
+      {
+         continue;
+      }
+      size_t pos = 0;
+      while(pos<rel && path[pos]==stack_[record_depth_ + pos])
+      {
+         pos++;
+      }
+      if(pos==rel)
+      {
+         return no;
+      }
+   }
+   return -1;
+}
+
+void nistXmlReader::beginRecord(unsigned type)
+{
+   record_type_ = type;
+   record_depth_ = depth_;
+   values_.clear();
+   image_first_ = image_text_.size();
+   image_symbols_ = 0;
+   image_ok_ = true;
+}
+
+void nistXmlReader::startElement(const char* name, size_t len)
+{
+   if(depth_==stack_.size())
+   {
+      stack_.push_back(std::string());
+   }
+   const char* colon = (const char*)memchr(name,':',len);
+   if(colon)
+   {
+      len -= colon + 1 - name;
+      name = colon + 1;
+   }
+   stack_[depth_].assign(name,len);
+   depth_++;
+   leaf_ = true;
+
+   if(!record_depth_)
+   {
+      for(unsigned no=0;no<xml_records_cnt;no++)
+      {
+         if(stack_[depth_ - 1]==localName(xml_records[no].name_,strlen(xml_records[no].name_)))
+         {
+            beginRecord(xml_records[no].type_);
+            break;
+         }
+      }
+      return;
+   }
+   int group = findField(true);
+   if(group>=0)
+   {
+      values_[fields_[group].tag_].push_back(std::vector<std::string>());
+   }
+}
+
+void nistXmlReader::setValue(const nistXmlField& field, const char* text, const char* text_end)
+{
+   if(field.tag_==999)
+   {
+      //Текст остается в буфере XML до конца transcode, здесь только считается размер изображения
+      image_text_.push_back(std::make_pair(text,text_end));
+      image_symbols_ += nistBase64Decoder::symbols(text,text_end - text,image_ok_);
+      return;
+   }
+   if(field.tag_==1)
+   {
+      return;
+   }
+   while(text<text_end && isSpace(*text))
+   {
+      text++;
+   }
+   while(text_end>text && isSpace(text_end[-1]))
+   {
+      text_end--;
+   }
+   fieldValue& value = values_[field.tag_];
+   if(value.empty())
+   {
+      value.push_back(std::vector<std::string>());
+   }
+   std::vector<std::string>& subfield = field.group_.empty() ? value.front() : value.back();
+   if(subfield.size()<=field.item_)
+   {
+      subfield.resize(field.item_ + 1);
+   }
+   std::string item;
+   appendText(item,text,text_end);
+   fromXmlFormat(item,field.format_);
+   subfield[field.item_] += item;
+}
+
+void nistXmlReader::endElement(const char* text, const char* text_end)
+{
+   if(record_depth_ && depth_==record_depth_)
+   {
+      endRecord();
+      record_depth_ = 0;
+   }
+   else if(record_depth_ && leaf_)
+   {
+      int field = findField(false);
+      if(field>=0)
+      {
+         setValue(fields_[field],text,text_end);
+      }
+   }
+   depth_--;
+   leaf_ = false;
+}
+
+//!Длина значения поля в традиционной кодировке
+static size_t valueSize(const std::vector<std::vector<std::string> >& value)
+{
+   size_t size = 0;
+   for(unsigned sf=0;sf<value.size();sf++)
+   {
+      size += sf ? 1 : 0;
+      for(unsigned item=0;item<value[sf].size();item++)
+      {
+         size += value[sf][item].size() + (item ? 1 : 0);
+      }
+   }
+   return size;
+}
+
+static void appendString(std::vector<unsigned char>& out, const std::string& str)
+{
+   out.insert(out.end(),str.begin(),str.end());
+}
+
+void nistXmlReader::encodeRecord(unsigned type, std::vector<unsigned char>& out)
+{
+   char prefix[32];
+   //Размер записи без поля LEN
+   size_t rest = 0;
+   for(std::map<unsigned,fieldValue>::const_iterator it=values_.begin();it!=values_.end();++it)
+   {
+      rest += snprintf(prefix,sizeof(prefix),"%u.%03u:",type,it->first) + valueSize(it->second) + 1;
+   }
+   size_t image_size = image_symbols_*3/4;
+   if(image_size)
+   {
+      rest += snprintf(prefix,sizeof(prefix),"%u.999:",type) + image_size + 1;
+   }
+   size_t head = snprintf(prefix,sizeof(prefix),"%u.001:",type);
+   char digits[32];
+   nistTaggedRecordLen(head + 1 + rest,digits);
+
+   snprintf(prefix,sizeof(prefix),"%u.001:%s",type,digits);
+   appendString(out,prefix);
+   out.push_back(nistParser::GS());
+   for(std::map<unsigned,fieldValue>::const_iterator it=values_.begin();it!=values_.end();++it)
+   {
+      snprintf(prefix,sizeof(prefix),"%u.%03u:",type,it->first);
+      appendString(out,prefix);
+      const fieldValue& value = it->second;
+      for(unsigned sf=0;sf<value.size();sf++)
+      {
+         if(sf)
+         {
+            out.push_back(nistParser::RS());
+         }
+         for(unsigned item=0;item<value[sf].size();item++)
+         {
+            if(item)
+            {
+               out.push_back(nistParser::US());
+            }
+            appendString(out,value[sf][item]);
+         }
+      }
+      out.push_back(nistParser::GS());
+   }
+   if(image_size)
+   {
+      snprintf(prefix,sizeof(prefix),"%u.999:",type);
+      appendString(out,prefix);
+      imageRef image = {out.size(),image_size,image_first_,image_text_.size() - image_first_};
+      images_.push_back(image);
+   }
+   else
+   {
+      out.back() = nistParser::FS();
+   }
+}
+
+void nistXmlReader::endRecord()
+{
+   if(!image_ok_)
+   {
+      dbg0("nistXmlReader::endRecord invalid base64 image in record type %u\n",record_type_);
+   }
+   if(record_type_==1)
+   {
+      //Type-1 кодируется в конце документа, когда известен CNT
+      header_values_.swap(values_);
+      header_read_ = true;
+      return;
+   }
+   std::map<unsigned,fieldValue>::const_iterator idc = values_.find(2);
+   std::string idc_value = "00";
+   if(idc!=values_.end() && idc->second.size() && idc->second[0].size())
+   {
+      idc_value = idc->second[0][0];
+   }
+   content_.push_back(std::make_pair(record_type_,idc_value));
+   encodeRecord(record_type_,records_);
+}
+
+bool nistXmlReader::parse(const char* p, const char* end)
+{
+   const char* text = p;
+   const char* text_end = p;
+   //Текст элемента задан секцией CDATA, следующий тег его не ограничивает
+   bool cdata = false;
+   while(p<end)
+   {
+      const char* lt = (const char*)memchr(p,'<',end - p);
+      if(!lt)
+      {
+         break;
+      }
+      if(!cdata)
+      {
+         text_end = lt;
+      }
+      p = lt + 1;
+      if(p<end && *p=='?')
+      {
+         const char* close = findString(p,end,"?>");
+         p = close ? close + 2 : end;
+         continue;
+      }
+      if(end - p>=3 && !memcmp(p,"!--",3))
+      {
+         const char* close = findString(p,end,"-->");
+         p = close ? close + 3 : end;
+         continue;
+      }
+      if(end - p>=8 && !memcmp(p,"![CDATA[",8))
+      {
+         const char* close = findString(p,end,"]]>");
+         if(!close)
+         {
+            err_msg_ = "unterminated CDATA";
+            return false;
+         }
+         text = p + 8;
+         text_end = close;
+         cdata = true;
+         p = close + 3;
+         continue;
+      }
+      if(p<end && *p=='!')
+      {
+         const char* gt = (const char*)memchr(p,'>',end - p);
+         p = gt ? gt + 1 : end;
+         continue;
+      }
+      if(p<end && *p=='/')
+      {
+         const char* name = p + 1;
+         const char* gt = (const char*)memchr(name,'>',end - name);
+         if(!gt || !depth_)
+         {
+            err_msg_ = "unbalanced end tag";
+            return false;
+         }
+         const char* name_end = gt;
+         while(name_end>name && isSpace(name_end[-1]))
+         {
+            name_end--;
+         }
+         const char* colon = (const char*)memchr(name,':',name_end - name);
+         const char* local = colon ? colon + 1 : name;
+         if(stack_[depth_ - 1].compare(0,std::string::npos,local,name_end - local)!=0)
+         {
+            err_msg_ = "mismatched end tag " + std::string(name,name_end);
+            return false;
+         }
+         endElement(text,text_end);
+         p = gt + 1;
+         text = p;
+         cdata = false;
+         continue;
+      }
+      const char* name = p;
+      while(p<end && !isSpace(*p) && *p!='/' && *p!='>')
+      {
+         p++;
+      }
+      size_t name_len = p - name;
+      //Атрибуты не используются, значения в кавычках пропускаются целиком
+      while(p<end && *p!='>')
+      {
+         if(*p=='"' || *p=='\'')
+         {
+            const char* quote = (const char*)memchr(p + 1,*p,end - p - 1);
+            p = quote ? quote : end - 1;
+         }
+         p++;
+      }
+      if(p>=end || !name_len)
+      {
+         err_msg_ = "unterminated start tag";
+         return false;
+      }
+      startElement(name,name_len);
+      if(p[-1]=='/')
+      {
+         endElement(p,p);
+      }
+      p++;
+      text = p;
+      cdata = false;
+   }
+   if(depth_)
+   {
+      err_msg_ = "unexpected end of document";
+      return false;
+   }
+   return true;
+}
+
+bool nistXmlReader::transcode(const char* xml, size_t size, std::vector<unsigned char>& out)
+{
+   depth_ = 0;
+   record_depth_ = 0;
+   leaf_ = false;
+   header_read_ = false;
+   header_values_.clear();
+   records_.clear();
+   content_.clear();
+   image_text_.clear();
+   images_.clear();
+   err_msg_.clear();
+   out.clear();
+
+   if(!parse(xml,xml + size))
+   {
+      dbg0("nistXmlReader::transcode parse error: %s\n",err_msg_.c_str());
+      return false;
+   }
+   if(!header_read_)
+   {
+      err_msg_ = "no Type-1 record";
+      dbg0("nistXmlReader::transcode error: %s\n",err_msg_.c_str());
+      return false;
+   }
+
+   fieldValue cnt(1);
+   char buf[16];
+   cnt[0].push_back("1");
+   snprintf(buf,sizeof(buf),"%u",(unsigned)content_.size());
+   cnt[0].push_back(buf);
+   for(unsigned rec_no=0;rec_no<content_.size();rec_no++)
+   {
+      cnt.push_back(std::vector<std::string>(2));
+      snprintf(buf,sizeof(buf),"%u",content_[rec_no].first);
+      cnt.back()[0] = buf;
+      cnt.back()[1] = content_[rec_no].second;
+   }
+   values_.swap(header_values_);
+   values_[3].swap(cnt);
+   image_first_ = image_text_.size();
+   image_symbols_ = 0;
+   encodeRecord(1,out);
+   return assemble(out);
+}
+
+bool nistXmlReader::assemble(std::vector<unsigned char>& out)
+{
+   size_t size = out.size() + records_.size();
+   for(size_t no=0;no<images_.size();no++)
+   {
+      size += images_[no].size_ + 1;
+   }
+   unsigned char* dst = 0;
+   size_t from = 0;
+   if(size>out.size())
+   {
+      size_t header_size = out.size();
+      out.resize(size);
+      dst = &out[header_size];
+   }
+   for(size_t no=0;no<images_.size();no++)
+   {
+      const imageRef& image = images_[no];
+      memcpy(dst,&records_[from],image.end_ - from);
+      dst += image.end_ - from;
+      from = image.end_;
+      //Декодер пишет ровно image.size_ байт - столько, сколько насчитал symbols
+      decoder_.reset();
+      size_t done = 0;
+      for(size_t part=image.first_;part<image.first_ + image.parts_;part++)
+      {
+         done += decoder_.decode(image_text_[part].first,image_text_[part].second - image_text_[part].first,dst + done);
+      }
+      if(done!=image.size_)
+      {
+         err_msg_ = "base64 image size mismatch";
+         dbg0("nistXmlReader::assemble error: %s\n",err_msg_.c_str());
+         return false;
+      }
+      dst += done;
+      *dst++ = nistParser::FS();
+   }
+   if(from<records_.size())
+   {
+      memcpy(dst,&records_[from],records_.size() - from);
+   }
+   return true;
+}
+
+bool nistXmlReader::load(const char* xml, size_t size, nistParser& parser, bool force)
+{
+   if(!transcode(xml,size,transaction_))
+   {
+      return false;
+   }
+   return parser.loadSwap(transaction_,force);
+}
+
+bool nistXmlReader::load(const std::string& file_name, nistParser& parser, bool force)
+{
+   FILE* in = fopen(file_name.c_str(),"rb");
+   if(!in)
+   {
+      dbg0("nistXmlReader::load can't open %s\n",file_name.c_str());
+      return false;
+   }
+   fseek(in,0,SEEK_END);
+   long size = ftell(in);
+   fseek(in,0,SEEK_SET);
+   //Замыкающий ноль ограничивает поиск strstr
+   xml_.resize(size>0 ? size + 1 : 1);
+   bool res = size>=0 && fread(&xml_[0],1,size,in)==(size_t)size;
+   fclose(in);
+   if(!res)
+   {
+      dbg0("nistXmlReader::load read error %s\n",file_name.c_str());
+      return false;
+   }
+   xml_[size] = 0;
+   return load(&xml_[0],size,parser,force);
+}
+
+nistXmlWriter::nistXmlWriter(FILE* out)
+   :out_(out)
+{
+   for(unsigned no=0;no<sizeof(xml_default_fields)/sizeof(xml_default_fields[0]);no++)
+   {
+      addMapping(defaultField(xml_default_fields[no]));
+   }
+}
+
+void nistXmlWriter::addMapping(const nistXmlField& field)
+{
+   fields_.push_back(field);
+   paths_.push_back(splitPath(field.path_,false));
+}
+
+static const char* recordElement(unsigned type)
+{
+   for(unsigned no=0;no<xml_records_cnt;no++)
+   {
+      if(xml_records[no].type_==type)
+      {
+         return xml_records[no].name_;
+      }
+   }
+   return 0;
+}
+
+/*!Находит элемент item подполя sf в значении поля [data, data + size).
+   Возвращает false, если подполя или элемента нет
+*/
+static bool findItem(const unsigned char* data, size_t size, unsigned sf, unsigned item,
+                     const unsigned char*& begin, const unsigned char*& end)
+{
+   const unsigned char* p = data;
+   const unsigned char* data_end = data + size;
+   for(unsigned no=0;no<sf;no++)
+   {
+      p = (const unsigned char*)memchr(p,nistParser::RS(),data_end - p);
+      if(!p)
+      {
+         return false;
+      }
+      p++;
+   }
+   const unsigned char* sf_end = (const unsigned char*)memchr(p,nistParser::RS(),data_end - p);
+   if(!sf_end)
+   {
+      sf_end = data_end;
+   }
+   for(unsigned no=0;no<item;no++)
+   {
+      p = (const unsigned char*)memchr(p,nistParser::US(),sf_end - p);
+      if(!p)
+      {
+         return false;
+      }
+      p++;
+   }
+   end = (const unsigned char*)memchr(p,nistParser::US(),sf_end - p);
+   if(!end)
+   {
+      end = sf_end;
+   }
+   begin = p;
+   return true;
+}
+
+void nistXmlWriter::closeTo(size_t depth)
+{
+   while(open_.size()>depth)
+   {
+      fprintf(out_,"%*s</%s>\n",(int)(open_.size() + 1)*2,"",open_.back().c_str());
+      open_.pop_back();
+   }
+}
+
+void nistXmlWriter::openPath(const std::vector<std::string>& path)
+{
+   size_t parents = path.size() - 1;
+   size_t common = 0;
+   while(common<open_.size() && common<parents && open_[common]==path[common])
+   {
+      common++;
+   }
+   closeTo(common);
+   for(;common<parents;common++)
+   {
+      open_.push_back(path[common]);
+      fprintf(out_,"%*s<%s>\n",(int)(open_.size() + 1)*2,"",path[common].c_str());
+   }
+}
+
+void nistXmlWriter::putText(const unsigned char* data, size_t size)
+{
+   const unsigned char* end = data + size;
+   const unsigned char* p = data;
+   for(;p<end;p++)
+   {
+      const char* ref = 0;
+      char code[8];
+      switch(*p)
+      {
+         case '<': ref = "&lt;"; break;
+         case '>': ref = "&gt;"; break;
+         case '&': ref = "&amp;"; break;
+         default:
+            if(*p>=0x80)
+            {
+               //Правильный UTF-8 выводится как есть, остальные байты - ссылками на символы Latin-1
+               size_t len = nistUtf8Length(p,end);
+               if(len)
+               {
+                  p += len - 1;
+                  continue;
+               }
+            }
+            if(*p>=0x80 || (*p<0x20 && *p!='\t' && *p!='\n' && *p!='\r'))
+            {
+               snprintf(code,sizeof(code),"&#x%02X;",*p);
+               ref = code;
+            }
+      }
+      if(ref)
+      {
+         fwrite(data,1,p - data,out_);
+         fputs(ref,out_);
+         data = p + 1;
+      }
+   }
+   fwrite(data,1,end - data,out_);
+}
+
+void nistXmlWriter::putImage(const unsigned char* data, size_t size)
+{
+   char block[base64_chunk/3*4];
+   while(size)
+   {
+      size_t chunk = size<base64_chunk ? size : base64_chunk;
+      fwrite(block,1,nistBase64Encode(data,chunk,block),out_);
+      data += chunk;
+      size -= chunk;
+   }
+}
+
+bool nistXmlWriter::writeRecord(const nistRecord& rec, const std::string& cnt)
+{
+   const char* name = recordElement(rec.type());
+   fprintf(out_,"  <%s>\n    <ansi-nist:RecordCategoryCode>%02u</ansi-nist:RecordCategoryCode>\n",name,rec.type());
+   open_.clear();
+   size_t no = 0;
+   while(no<fields_.size())
+   {
+      if(fields_[no].type_!=rec.type())
+      {
+         no++;
+         continue;
+      }
+      //Поля одной группы идут подряд и выводятся для каждого подполя
+      size_t run_end = no + 1;
+      unsigned first_sf = 0;
+      if(!fields_[no].group_.empty())
+      {
+         while(run_end<fields_.size() && fields_[run_end].type_==rec.type() && fields_[run_end].group_==fields_[no].group_)
+         {
+            run_end++;
+         }
+         for(size_t other=0;other<fields_.size();other++)
+         {
+            if(fields_[other].type_==rec.type() && fields_[other].tag_==fields_[no].tag_ && fields_[other].group_.empty())
+            {
+               first_sf = 1;
+            }
+         }
+      }
+      const nistTag* tag = rec.getTagById(fields_[no].tag_);
+      const unsigned char* data = tag ? tag->data() : 0;
+      size_t size = tag ? tag->data_size() : 0;
+      if(rec.type()==1 && fields_[no].tag_==3)
+      {
+         data = (const unsigned char*)cnt.data();
+         size = cnt.size();
+      }
+      for(unsigned sf=first_sf;data;sf++)
+      {
+         bool found = false;
+         for(size_t field_no=no;field_no<run_end;field_no++)
+         {
+            const nistXmlField& field = fields_[field_no];
+            const unsigned char* begin = data;
+            const unsigned char* end = data + size;
+            if(field.tag_!=999 && !findItem(data,size,sf,field.item_,begin,end))
+            {
+               continue;
+            }
+            found = true;
+            if(field.chars_)
+            {
+               begin = begin + field.first_char_<end ? begin + field.first_char_ : end;
+               end = begin + field.chars_<end ? begin + field.chars_ : end;
+            }
+            openPath(paths_[field_no]);
+            const std::string& leaf = paths_[field_no].back();
+            fprintf(out_,"%*s<%s>",(int)(open_.size() + 2)*2,"",leaf.c_str());
+            if(field.tag_==999)
+            {
+               putImage(begin,end - begin);
+            }
+            else
+            {
+               std::string value = toXmlFormat(std::string(begin,end),field.format_);
+               putText((const unsigned char*)value.data(),value.size());
+            }
+            fprintf(out_,"</%s>\n",leaf.c_str());
+         }
+         if(fields_[no].group_.empty() || !found)
+         {
+            break;
+         }
+         //Следующее подполе открывает элемент группы заново
+         closeTo(splitPath(fields_[no].group_,false).size() - 1);
+      }
+      no = run_end;
+   }
+   closeTo(0);
+   fprintf(out_,"  </%s>\n",name);
+   return !ferror(out_);
+}
+
+bool nistXmlWriter::write(const nistParser& parser)
+{
+   const type1Record* header = parser.getFileHeader();
+   std::string cnt = "1";
+   unsigned written = 0;
+   std::string content;
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      if(!recordElement(rec->type()))
+      {
+         dbg0("nistXmlWriter::write record type %u is not supported, skipped\n",rec->type());
+         continue;
+      }
+      char sf[32];
+      snprintf(sf,sizeof(sf),"%c%u%c%02u",nistParser::RS(),rec->type(),nistParser::US(),header->getRecordIDC(rec_no));
+      content += sf;
+      written++;
+   }
+   char count[16];
+   snprintf(count,sizeof(count),"%c%u",nistParser::US(),written);
+   cnt += count + content;
+
+   fprintf(out_,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<%s%s>\n",xml_root,xml_namespaces);
+   bool res = writeRecord(*header,cnt);
+   for(unsigned rec_no=0;res && rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      const nistRecord* rec = parser.getRecord(rec_no);
+      if(recordElement(rec->type()))
+      {
+         res = writeRecord(*rec,cnt);
+      }
+   }
+   fprintf(out_,"</%s>\n",xml_root);
+   return res && !ferror(out_);
+}
+
+bool nistXmlWriter::writeFile(const nistParser& parser, const std::string& file_name)
+{
+   FILE* out = fopen(file_name.c_str(),"wb");
+   if(!out)
+   {
+      dbg0("nistXmlWriter::writeFile error can't open %s\n",file_name.c_str());
+      return false;
+   }
+   bool res = false;
+   {
+      nistXmlWriter writer(out);
+      res = writer.write(parser);
+   }
+   return fclose(out)==0 && res;
+}
@@ -0,0 +1,154 @@
+/*
+  \file   nistxml.h
+  \brief  Чтение и запись ANSI-NIST транзакций в XML-кодировке (ANSI/NIST-ITL 2011, NIEM)
+*/
+
+#ifndef NIST_XML_H
+#define NIST_XML_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+#include "nistbase64.h"
+
+///! Преобразование текста элемента XML в значение поля и обратно
+enum nistXmlFormat
+{
+   nistXmlText,      ///<Без изменений
+   nistXmlDate,      ///<YYYY-MM-DD <-> YYYYMMDD
+   nistXmlDateTime   ///<YYYY-MM-DDTHH:MM:SSZ <-> YYYYMMDDHHMMSSZ
+};
+
+/*! Соответствие элемента XML элементу поля записи.
+    Путь отсчитывается от элемента записи, части разделяются '/', префиксы пространств имен
+    при чтении не учитываются. Если задан group_, каждый экземпляр элемента group_ (он должен
+    быть началом path_) открывает новое подполе, иначе значение попадает в первое подполе.
+    Несколько элементов с одинаковыми tag_ и item_ дописываются друг к другу, при записи
+    каждому из них достается [first_char_, first_char_ + chars_) значения (chars_ == 0 - все значение)
+*/
+struct nistXmlField
+{
+   unsigned type_;
+   std::string path_;
+   unsigned tag_;
+   unsigned item_;
+   std::string group_;
+   nistXmlFormat format_;
+   unsigned first_char_;
+   unsigned chars_;
+};
+
+/*! Чтение XML без построения дерева. Текст разбирается за один проход по буферу, значения
+    элементов из таблицы соответствий собираются в поля, каждая запись сразу кодируется в
+    традиционном виде (разделители GS/RS/US, LEN вычисляется), после чего транзакция загружается
+    обычным nistParser::load - заполняются те же объекты записей, что и при чтении файлов NIST.
+    CNT строится по прочитанным записям. Изображения base64 декодируются один раз, при сборке
+    транзакции прямо на место поля 999 в ее буфере; буферы хранятся в объекте и используются повторно.
+
+    По умолчанию известны Type-1, Type-2 (только IDC, поля Type-2 определяются доменом
+    и добавляются через addMapping), Type-10 и Type-14. Записи других типов пропускаются.
+*/
+class nistXmlReader
+{
+public:
+   nistXmlReader();
+   //!Добавляет соответствие элемента XML полю; для Type-2 задает поля домена (например, EBTS)
+   void addMapping(const nistXmlField& field);
+   //!Формирует транзакцию в традиционной кодировке из XML в out
+   bool transcode(const char* xml, size_t size, std::vector<unsigned char>& out);
+   //!Читает XML из памяти и загружает транзакцию в parser. Буфер транзакции передается parser без копирования
+   bool load(const char* xml, size_t size, nistParser& parser, bool force = false);
+   //!Читает XML файл и загружает транзакцию в parser
+   bool load(const std::string& file_name, nistParser& parser, bool force = false);
+   const std::string& getError() const{return err_msg_;}
+private:
+   //!Поле собираемой записи: подполя из элементов
+   typedef std::vector<std::vector<std::string> > fieldValue;
+
+   bool parse(const char* p, const char* end);
+   void startElement(const char* name, size_t len);
+   void endElement(const char* text, const char* text_end);
+   //!Индекс соответствия для пути текущего элемента внутри записи, -1 если нет
+   int findField(bool group) const;
+   void beginRecord(unsigned type);
+   void endRecord();
+   void setValue(const nistXmlField& field, const char* text, const char* text_end);
+   /*!Кодирует запись в out: поля по возрастанию номеров, LEN, изображение последним. Место изображения
+      и FS за ним не заполняются, их добавляет assemble
+   */
+   void encodeRecord(unsigned type, std::vector<unsigned char>& out);
+   //!Дописывает к Type-1 в out записи records_, декодируя изображения прямо в out
+   bool assemble(std::vector<unsigned char>& out);
+
+   std::vector<nistXmlField> fields_;
+   //!Пути соответствий, разбитые на имена элементов без префиксов
+   std::vector<std::vector<std::string> > paths_;
+   std::vector<std::vector<std::string> > groups_;
+   //!Стек имен открытых элементов; строки сохраняют емкость между документами
+   std::vector<std::string> stack_;
+   size_t depth_;
+   //!Глубина элемента текущей записи, 0 - вне записи
+   size_t record_depth_;
+   unsigned record_type_;
+   //!У текущего элемента нет вложенных элементов
+   bool leaf_;
+   std::map<unsigned,fieldValue> values_;
+   //!Части текста base64 полей 999 документа, изображения декодируются при сборке транзакции
+   std::vector<std::pair<const char*,const char*> > image_text_;
+   //!Изображение в records_: перед ним end_ байт записей, его текст - части [first_, first_ + parts_)
+   struct imageRef
+   {
+      size_t end_;
+      size_t size_;
+      size_t first_;
+      size_t parts_;
+   };
+   std::vector<imageRef> images_;
+   //!Первая часть текста и число символов base64 изображения текущей записи
+   size_t image_first_;
+   size_t image_symbols_;
+   bool image_ok_;
+   nistBase64Decoder decoder_;
+   //!Поля Type-1: она кодируется последней, когда известен CNT, и ставится в начало транзакции
+   std::map<unsigned,fieldValue> header_values_;
+   bool header_read_;
+   std::vector<unsigned char> records_;
+   //!Тип и IDC прочитанных записей для CNT
+   std::vector<std::pair<unsigned,std::string> > content_;
+   std::vector<unsigned char> transaction_;
+   std::vector<char> xml_;
+   std::string err_msg_;
+};
+
+/*! Потоковая запись транзакции в XML по той же таблице соответствий. Вложенные элементы
+    открываются и закрываются по мере перехода от поля к полю, изображения кодируются base64
+    по частям. Записываются записи известных типов, CNT строится по записанным записям
+*/
+class nistXmlWriter
+{
+public:
+   nistXmlWriter(FILE* out);
+   void addMapping(const nistXmlField& field);
+   //!Выводит транзакцию. Возвращает false при ошибке записи
+   bool write(const nistParser& parser);
+   static bool writeFile(const nistParser& parser, const std::string& file_name);
+private:
+   nistXmlWriter(const nistXmlWriter&);
+   nistXmlWriter& operator=(const nistXmlWriter&);
+   bool writeRecord(const nistRecord& rec, const std::string& cnt);
+   //!Приводит стек открытых элементов записи к path без последнего элемента
+   void openPath(const std::vector<std::string>& path);
+   void closeTo(size_t depth);
+   void putText(const unsigned char* data, size_t size);
+   void putImage(const unsigned char* data, size_t size);
+
+   FILE* out_;
+   std::vector<nistXmlField> fields_;
+   std::vector<std::vector<std::string> > paths_;
+   std::vector<std::string> open_;
+};
+
+#endif // NIST_XML_H
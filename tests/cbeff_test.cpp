@@ -0,0 +1,57 @@
+/*
+  \file   cbeff_test.cpp
+  \brief  Поиск записей Type-99 без разбора транзакции, nistParser::findCbeff
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. cbeff_test.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o cbeff_test
+*/
+
+#include "nisttest.h"
+
+static nistTestRecord cbeffRecord(unsigned idc, const std::string& owner, const std::string& type)
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(4u,std::string("0")));
+   fields.push_back(std::make_pair(100u,std::string("0101")));
+   fields.push_back(std::make_pair(101u,std::string("8")));
+   fields.push_back(std::make_pair(102u,std::string("0")));
+   fields.push_back(std::make_pair(103u,owner));
+   fields.push_back(std::make_pair(104u,type));
+   return nistTestTagged(99,idc,fields,"BDB-DATA");
+}
+
+static void testFind()
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(cbeffRecord(1,"1B","0201"));
+   records.push_back(cbeffRecord(2,"1B","0301"));
+   std::vector<unsigned char> data = nistTestTransaction(records);
+   std::vector<nistCbeffRef> found;
+   NIST_CHECK(nistParser::findCbeff(nistSpan(data),0x1B,0x0301,found)==1);
+   NIST_CHECK(found.size()==1 && found[0].idc_==2 && found[0].bdb_.size()==8);
+}
+
+//!LEN около UINT_MAX: сумма смещения и длины переполняет 32 бита, запись должна быть отвергнута
+static void testHugeLen()
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(cbeffRecord(1,"1B","0201"));
+   nistTestRecord huge = cbeffRecord(2,"1B","0201");
+   size_t len_end = huge.data_.find((char)nistParser::GS());
+   huge.data_.replace(7,len_end - 7,"4294967290");
+   records.push_back(huge);
+   std::vector<unsigned char> data = nistTestTransaction(records);
+   //Точный размер буфера, чтобы санитайзер поймал чтение за его пределами
+   std::vector<unsigned char> exact(data.begin(),data.end());
+   exact.shrink_to_fit();
+   std::vector<nistCbeffRef> found;
+   NIST_CHECK(nistParser::findCbeff(nistSpan(exact),0xFFFFFFFF,0xFFFFFFFF,found)==1);
+   NIST_CHECK(found.size()==1 && found[0].idc_==1);
+}
+
+int main()
+{
+   testFind();
+   testHugeLen();
+   return nistTestResult("cbeff_test");
+}
@@ -0,0 +1,97 @@
+/*
+  \file   extract_test.cpp
+  \brief  Имена файлов при выгрузке изображений пакета транзакций
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. extract_test.cpp ../nistextract.cpp ../nistcopy.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o extract_test -lpthread
+*/
+
+#include <cstdlib>
+#include <set>
+
+#include "nisttest.h"
+#include "nistextract.h"
+
+static nistTestRecord type14(unsigned idc, const std::string& image)
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("1")));
+   fields.push_back(std::make_pair(4u,std::string("ORI000001")));
+   fields.push_back(std::make_pair(5u,std::string("20150419")));
+   fields.push_back(std::make_pair(6u,std::string("800")));
+   fields.push_back(std::make_pair(7u,std::string("750")));
+   fields.push_back(std::make_pair(8u,std::string("1")));
+   fields.push_back(std::make_pair(9u,std::string("500")));
+   fields.push_back(std::make_pair(10u,std::string("500")));
+   fields.push_back(std::make_pair(11u,std::string("NONE")));
+   fields.push_back(std::make_pair(12u,std::string("8")));
+   fields.push_back(std::make_pair(13u,std::string("13")));
+   return nistTestTagged(14,idc,fields,image);
+}
+
+static bool writeFile(const std::string& path, const std::vector<unsigned char>& data)
+{
+   FILE* out = fopen(path.c_str(),"wb");
+   bool res = out && fwrite(data.data(),1,data.size(),out)==data.size();
+   return out && fclose(out)==0 && res;
+}
+
+//!Две транзакции с одним TCN и одинаковыми IDC/FGP: все изображения должны оказаться в разных файлах
+static void testSameTcn(const std::string& dir)
+{
+   std::vector<std::string> transactions;
+   std::vector<std::string> images;
+   for(unsigned no=0;no<2;no++)
+   {
+      std::vector<nistTestRecord> records;
+      for(unsigned idc=1;idc<=2;idc++)
+      {
+         images.push_back("IMAGE-" + std::to_string(no) + "-" + std::to_string(idc));
+         records.push_back(type14(idc,images.back()));
+      }
+      std::string path = dir + "/t" + std::to_string(no) + ".an2";
+      NIST_CHECK(writeFile(path,nistTestTransaction(records,"SAME")));
+      transactions.push_back(path);
+   }
+
+   nistImageExtractor extractor(dir,2);
+   std::vector<nistImageFile> files;
+   NIST_CHECK(extractor.extractFiles(transactions,files));
+   NIST_CHECK(files.size()==4);
+   std::set<std::string> paths;
+   std::set<std::string> contents;
+   for(size_t no=0;no<files.size();no++)
+   {
+      paths.insert(files[no].path_);
+      std::vector<unsigned char> data;
+      NIST_CHECK(nistParser::readFile(files[no].path_,data));
+      contents.insert(std::string(data.begin(),data.end()));
+   }
+   NIST_CHECK(paths.size()==4);
+   NIST_CHECK(contents==std::set<std::string>(images.begin(),images.end()));
+
+   //Повторная выгрузка тем же объектом тоже не затирает уже выданные имена
+   std::vector<nistImageFile> again;
+   NIST_CHECK(extractor.extractFiles(std::vector<std::string>(1,transactions[0]),again));
+   for(size_t no=0;no<again.size();no++)
+   {
+      NIST_CHECK(paths.insert(again[no].path_).second);
+   }
+}
+
+int main()
+{
+   char dir[] = "/tmp/nist_extract_testXXXXXX";
+   if(!mkdtemp(dir))
+   {
+      printf("can't create temporary directory\n");
+      return 1;
+   }
+   testSameTcn(dir);
+   std::string cleanup = std::string("rm -rf ") + dir;
+   if(system(cleanup.c_str())!=0)
+   {
+      printf("can't remove %s\n",dir);
+   }
+   return nistTestResult("extract_test");
+}
@@ -0,0 +1,86 @@
+/*
+  \file   json_test.cpp
+  \brief  Экранирование значений полей при выгрузке в JSON
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. json_test.cpp ../nistjson.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o json_test
+*/
+
+#include "nisttest.h"
+#include "nistjson.h"
+
+static std::string toJson(const std::vector<unsigned char>& data)
+{
+   nistParser parser;
+   NIST_CHECK(parser.load(data));
+   FILE* out = tmpfile();
+   std::string res;
+   if(!out)
+   {
+      NIST_CHECK(out!=0);
+      return res;
+   }
+   nistJsonWriter writer(out);
+   NIST_CHECK(writer.write(parser));
+   writer.flush();
+   rewind(out);
+   char buf[4096];
+   size_t got;
+   while((got = fread(buf,1,sizeof(buf),out))>0)
+   {
+      res.append(buf,got);
+   }
+   fclose(out);
+   return res;
+}
+
+//!Все байты >= 0x80 образуют правильные последовательности UTF-8
+static bool validUtf8(const std::string& text)
+{
+   for(size_t pos=0;pos<text.size();)
+   {
+      unsigned char c = text[pos];
+      size_t len = c<0x80 ? 1 : (c>=0xC2 && c<=0xDF) ? 2 : (c>=0xE0 && c<=0xEF) ? 3 : (c>=0xF0 && c<=0xF4) ? 4 : 0;
+      if(!len || pos + len>text.size())
+      {
+         return false;
+      }
+      for(size_t no=1;no<len;no++)
+      {
+         if(((unsigned char)text[pos + no] & 0xC0)!=0x80)
+         {
+            return false;
+         }
+      }
+      pos += len;
+   }
+   return true;
+}
+
+static void testEscaping()
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("0422")));
+   //Пустое поле
+   fields.push_back(std::make_pair(4u,std::string()));
+   //Latin-1 "Gérard" и длинное значение, чтобы байты >= 0x80 попали в проверку по 16 байт
+   fields.push_back(std::make_pair(5u,std::string("G\xE9rard")));
+   fields.push_back(std::make_pair(6u,std::string("ABCDEFGHIJKLMNOPQRSTUVWXYZ M\xFCller \xFF")));
+   //Правильный UTF-8 "Gérard" выводится как есть
+   fields.push_back(std::make_pair(7u,std::string("G\xC3\xA9rard")));
+   std::vector<nistTestRecord> records;
+   records.push_back(nistTestTagged(2,0,fields));
+   std::string json = toJson(nistTestTransaction(records));
+
+   NIST_CHECK(validUtf8(json));
+   NIST_CHECK(json.find("{\"tag\":4,\"value\":\"\"}")!=std::string::npos);
+   NIST_CHECK(json.find("\"G\\u00e9rard\"")!=std::string::npos);
+   NIST_CHECK(json.find("M\\u00fcller \\u00ff\"")!=std::string::npos);
+   NIST_CHECK(json.find("\"G\xC3\xA9rard\"")!=std::string::npos);
+}
+
+int main()
+{
+   testEscaping();
+   return nistTestResult("json_test");
+}
@@ -0,0 +1,148 @@
+/*
+  \file   merge_test.cpp
+  \brief  Разделение транзакции по субъектам и обратное объединение
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. merge_test.cpp ../nistmerge.cpp ../nistcopy.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o merge_test -lpthread
+*/
+
+#include <cstdlib>
+
+#include "nisttest.h"
+#include "nistmerge.h"
+
+static nistTestRecord type2(unsigned idc, const std::string& name)
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(18u,name));
+   return nistTestTagged(2,idc,fields);
+}
+
+static nistTestRecord type14(unsigned idc, const std::string& image)
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("1")));
+   fields.push_back(std::make_pair(4u,std::string("ORI000001")));
+   fields.push_back(std::make_pair(5u,std::string("20150419")));
+   fields.push_back(std::make_pair(6u,std::string("800")));
+   fields.push_back(std::make_pair(7u,std::string("750")));
+   fields.push_back(std::make_pair(8u,std::string("1")));
+   fields.push_back(std::make_pair(9u,std::string("500")));
+   fields.push_back(std::make_pair(10u,std::string("500")));
+   fields.push_back(std::make_pair(11u,std::string("NONE")));
+   fields.push_back(std::make_pair(12u,std::string("8")));
+   fields.push_back(std::make_pair(13u,std::string("1")));
+   return nistTestTagged(14,idc,fields,image);
+}
+
+static bool writeFile(const std::string& path, const std::vector<unsigned char>& data)
+{
+   FILE* out = fopen(path.c_str(),"wb");
+   bool res = out && fwrite(data.data(),1,data.size(),out)==data.size();
+   return out && fclose(out)==0 && res;
+}
+
+static std::string imageOf(const nistRecord* rec)
+{
+   return rec && rec->getImgData() ? std::string((const char*)rec->getImgData(),rec->getImgDataSize()) : std::string();
+}
+
+//!Субъект транзакции part: одна Type-2 с именем name и одна Type-14 с изображением image
+static void checkSubject(const std::string& part, const std::string& name, const std::string& image)
+{
+   nistParser parser;
+   NIST_CHECK(parser.load(part));
+   NIST_CHECK(parser.getRecordsCnt()==2);
+   if(parser.getRecordsCnt()!=2)
+   {
+      return;
+   }
+   const type1Record* header = parser.getFileHeader();
+   const nistRecord* t2 = parser.getRecord(0);
+   const nistRecord* t14 = parser.getRecord(1);
+   NIST_CHECK(t2->type()==2 && t14->type()==14);
+   NIST_CHECK(header->getRecordIDC(0)==header->getRecordIDC(1));
+   const nistTag* tag = t2->getTagById(18);
+   NIST_CHECK(tag && tag->data() && std::string((const char*)tag->data(),tag->data_size())==name);
+   NIST_CHECK(imageOf(t14)==image);
+}
+
+//!Записи двух субъектов чередуются: T2(IDC1), T2(IDC2), T14(IDC1), T14(IDC2)
+static void testInterleaved(const std::string& dir)
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(type2(1,"FIRST"));
+   records.push_back(type2(2,"SECOND"));
+   records.push_back(type14(1,"IMAGE-1"));
+   records.push_back(type14(2,"IMAGE-2"));
+   std::string in_file = dir + "/two.an2";
+   NIST_CHECK(writeFile(in_file,nistTestTransaction(records)));
+
+   std::vector<std::string> parts;
+   std::string err_msg;
+   NIST_CHECK(nistSplitFile(in_file,dir + "/part",parts,err_msg));
+   NIST_CHECK(parts.size()==2);
+   if(parts.size()!=2)
+   {
+      return;
+   }
+   checkSubject(parts[0],"FIRST","IMAGE-1");
+   checkSubject(parts[1],"SECOND","IMAGE-2");
+
+   //Обратное объединение: IDC второго субъекта совпадает с первым и перенумеровывается
+   std::string merged = dir + "/merged.an2";
+   NIST_CHECK(nistMergeFiles(parts,merged,err_msg));
+   nistParser parser;
+   NIST_CHECK(parser.load(merged));
+   NIST_CHECK(parser.getRecordsCnt()==4);
+   const nistIdcGroup* first = parser.getIDC(1);
+   const nistIdcGroup* second = parser.getIDC(2);
+   NIST_CHECK(first && first->type2_.size()==1 && first->images_.size()==1);
+   NIST_CHECK(second && second->type2_.size()==1 && second->images_.size()==1);
+   if(first && second && first->images_.size()==1 && second->images_.size()==1)
+   {
+      NIST_CHECK(imageOf(first->images_[0])=="IMAGE-1");
+      NIST_CHECK(imageOf(second->images_[0])=="IMAGE-2");
+   }
+}
+
+//!Запись с IDC без Type-2 общая и входит в транзакцию каждого субъекта
+static void testShared(const std::string& dir)
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(type14(3,"SHARED"));
+   records.push_back(type2(1,"FIRST"));
+   records.push_back(type2(2,"SECOND"));
+   std::string in_file = dir + "/shared.an2";
+   NIST_CHECK(writeFile(in_file,nistTestTransaction(records)));
+
+   std::vector<std::string> parts;
+   std::string err_msg;
+   NIST_CHECK(nistSplitFile(in_file,dir + "/shared",parts,err_msg));
+   NIST_CHECK(parts.size()==2);
+   for(size_t no=0;no<parts.size();no++)
+   {
+      nistParser parser;
+      NIST_CHECK(parser.load(parts[no]));
+      NIST_CHECK(parser.getRecordsCnt()==2);
+      NIST_CHECK(imageOf(parser.getRecord(0))=="SHARED");
+   }
+}
+
+int main()
+{
+   char dir[] = "/tmp/nist_merge_testXXXXXX";
+   if(!mkdtemp(dir))
+   {
+      printf("can't create temporary directory\n");
+      return 1;
+   }
+   testInterleaved(dir);
+   testShared(dir);
+   std::string cleanup = std::string("rm -rf ") + dir;
+   if(system(cleanup.c_str())!=0)
+   {
+      printf("can't remove %s\n",dir);
+   }
+   return nistTestResult("merge_test");
+}
@@ -0,0 +1,54 @@
+/*
+  \file   minutiae_test.cpp
+  \brief  Разбор минуций Type-9
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. minutiae_test.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o minutiae_test
+*/
+
+#include "nisttest.h"
+
+//!9.137 FMD: MIN, MXC, MYC, MAV (единицы по 2 градуса), M1M (тип), MQV (качество)
+static void testIncitsOrder()
+{
+   std::string us(1,(char)nistParser::US());
+   std::string rs(1,(char)nistParser::RS());
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("1")));
+   fields.push_back(std::make_pair(4u,std::string("U")));
+   fields.push_back(std::make_pair(136u,std::string("2")));
+   fields.push_back(std::make_pair(137u,"1" + us + "120" + us + "340" + us + "45" + us + "2" + us + "77" + rs +
+                                        "2" + us + "10" + us + "20" + us + "179" + us + "1" + us + "5"));
+   std::vector<nistTestRecord> records;
+   records.push_back(nistTestTagged(9,1,fields));
+   std::vector<unsigned char> data = nistTestTransaction(records);
+
+   nistParser parser;
+   NIST_CHECK(parser.load(data));
+   NIST_CHECK(parser.getRecordsCnt()==1);
+   if(parser.getRecordsCnt()!=1)
+   {
+      return;
+   }
+   const type9Record* rec = static_cast<const type9Record*>(parser.getRecord(0));
+   const nistMinutiae& minutiae = rec->getMinutiae();
+   NIST_CHECK(minutiae.format_==nistMinutiaeINCITS);
+   NIST_CHECK(minutiae.count_==2);
+   if(minutiae.count_!=2)
+   {
+      return;
+   }
+   NIST_CHECK(minutiae.x_[0]==120 && minutiae.y_[0]==340);
+   NIST_CHECK(minutiae.theta_[0]==90);
+   NIST_CHECK(minutiae.type_[0]==nistMinutiaBifurcation);
+   NIST_CHECK(minutiae.quality_[0]==77);
+   NIST_CHECK(minutiae.theta_[1]==358);
+   NIST_CHECK(minutiae.type_[1]==nistMinutiaRidgeEnding);
+   NIST_CHECK(minutiae.quality_[1]==5);
+}
+
+int main()
+{
+   testIncitsOrder();
+   return nistTestResult("minutiae_test");
+}
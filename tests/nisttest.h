@@ -0,0 +1,86 @@
+/*
+  \file   nisttest.h
+  \brief  Общие средства регрессионных тестов: проверки и сборка небольших транзакций
+*/
+
+#ifndef NIST_TEST_H
+#define NIST_TEST_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "nistparser.h"
+#include "../bench/nistgen.h"
+
+static int nist_test_failures = 0;
+
+//!Печатает невыполненное условие и продолжает тест
+#define NIST_CHECK(cond) \
+   do \
+   { \
+      if(!(cond)) \
+      { \
+         printf("%s:%d: check failed: %s\n",__FILE__,__LINE__,#cond); \
+         nist_test_failures++; \
+      } \
+   } while(0)
+
+///! Запись транзакции для nistTestTransaction: тип, IDC и готовые байты записи
+struct nistTestRecord
+{
+   unsigned type_;
+   unsigned idc_;
+   std::string data_;
+};
+
+//!Текстовая запись с полем 2 (IDC)
+static nistTestRecord nistTestTagged(unsigned type, unsigned idc, std::vector<std::pair<unsigned,std::string> > fields,
+                                     const std::string& image = std::string())
+{
+   char buf[8];
+   snprintf(buf,sizeof(buf),"%02u",idc);
+   fields.insert(fields.begin(),std::make_pair(2u,std::string(buf)));
+   nistTestRecord rec = {type,idc,nistGenerator::taggedRecord(type,fields,image)};
+   return rec;
+}
+
+//!Транзакция из Type-1 с CNT по records и самих записей
+static std::vector<unsigned char> nistTestTransaction(const std::vector<nistTestRecord>& records,
+                                                      const std::string& tcn = "TCN00001")
+{
+   std::string us(1,(char)nistParser::US());
+   std::string rs(1,(char)nistParser::RS());
+   std::string cnt = "1" + us + std::to_string(records.size());
+   for(size_t no=0;no<records.size();no++)
+   {
+      char buf[8];
+      snprintf(buf,sizeof(buf),"%02u",records[no].idc_);
+      cnt += rs + std::to_string(records[no].type_) + us + buf;
+   }
+   std::vector<std::pair<unsigned,std::string> > t1;
+   t1.push_back(std::make_pair(2u,std::string("0400")));
+   t1.push_back(std::make_pair(3u,cnt));
+   t1.push_back(std::make_pair(4u,std::string("CAR")));
+   t1.push_back(std::make_pair(5u,std::string("20150419")));
+   t1.push_back(std::make_pair(7u,std::string("DEST00001")));
+   t1.push_back(std::make_pair(8u,std::string("ORI000001")));
+   t1.push_back(std::make_pair(9u,tcn));
+   t1.push_back(std::make_pair(11u,std::string("19.68")));
+   t1.push_back(std::make_pair(12u,std::string("19.68")));
+   std::string res = nistGenerator::taggedRecord(1,t1);
+   for(size_t no=0;no<records.size();no++)
+   {
+      res += records[no].data_;
+   }
+   return std::vector<unsigned char>(res.begin(),res.end());
+}
+
+//!Итог теста для main: 0, если все проверки выполнены
+static int nistTestResult(const char* name)
+{
+   printf("%s: %s\n",name,nist_test_failures ? "FAILED" : "ok");
+   return nist_test_failures ? 1 : 0;
+}
+
+#endif // NIST_TEST_H
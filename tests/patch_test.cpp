@@ -0,0 +1,147 @@
+/*
+  \file   patch_test.cpp
+  \brief  Правка полей файла на месте: без изменения размера записи и с пересчетом LEN
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. patch_test.cpp ../nistpatch.cpp ../nistcopy.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o patch_test -lpthread
+*/
+
+#include <cstdlib>
+
+#include "nisttest.h"
+#include "nistpatch.h"
+
+static std::vector<unsigned char> sample()
+{
+   std::vector<nistTestRecord> records;
+   std::vector<std::pair<unsigned,std::string> > t2(1,std::make_pair(18u,std::string("NAME")));
+   records.push_back(nistTestTagged(2,1,t2));
+   std::vector<std::pair<unsigned,std::string> > t14;
+   t14.push_back(std::make_pair(3u,std::string("1")));
+   t14.push_back(std::make_pair(4u,std::string("ORI000001")));
+   t14.push_back(std::make_pair(5u,std::string("20150419")));
+   t14.push_back(std::make_pair(6u,std::string("800")));
+   t14.push_back(std::make_pair(7u,std::string("750")));
+   t14.push_back(std::make_pair(8u,std::string("1")));
+   t14.push_back(std::make_pair(9u,std::string("500")));
+   t14.push_back(std::make_pair(10u,std::string("500")));
+   t14.push_back(std::make_pair(11u,std::string("NONE")));
+   t14.push_back(std::make_pair(12u,std::string("8")));
+   t14.push_back(std::make_pair(13u,std::string("1")));
+   records.push_back(nistTestTagged(14,1,t14,std::string(5000,'\x42')));
+   return nistTestTransaction(records);
+}
+
+static bool writeFile(const std::string& path, const std::vector<unsigned char>& data)
+{
+   FILE* out = fopen(path.c_str(),"wb");
+   bool res = out && fwrite(data.data(),1,data.size(),out)==data.size();
+   return out && fclose(out)==0 && res;
+}
+
+static std::string fieldOf(const nistRecord* rec, unsigned tag)
+{
+   const nistTag* field = rec ? rec->getTagById(tag) : 0;
+   return field && field->data() ? std::string((const char*)field->data(),field->data_size()) : std::string();
+}
+
+//!Загружает file и проверяет, что изображение Type-14 не изменилось
+static bool loadPatched(const std::string& file, nistParser& parser)
+{
+   if(!parser.load(file) || parser.getRecordsCnt()!=2)
+   {
+      return false;
+   }
+   const nistRecord* t14 = parser.getRecord(1);
+   return t14->getImgData() && std::string((const char*)t14->getImgData(),t14->getImgDataSize())==std::string(5000,'\x42');
+}
+
+//!Значение той же длины: размер файла не меняется, остальные записи остаются на месте
+static void testSameSize(const std::string& dir)
+{
+   std::vector<unsigned char> data = sample();
+   std::string file = dir + "/same.an2";
+   NIST_CHECK(writeFile(file,data));
+   nistPatch patch;
+   patch.setField(1,18,"EMAN");
+   NIST_CHECK(patch.apply(file));
+
+   std::vector<unsigned char> content;
+   NIST_CHECK(nistParser::readFile(file,content));
+   NIST_CHECK(content.size()==data.size());
+   nistParser parser;
+   NIST_CHECK(loadPatched(file,parser));
+   NIST_CHECK(fieldOf(parser.getRecord(0),18)=="EMAN");
+   //Отличаются только байты значения 2.018
+   size_t diff = 0;
+   for(size_t no=0;no<content.size() && no<data.size();no++)
+   {
+      diff += content[no]!=data[no] ? 1 : 0;
+   }
+   NIST_CHECK(diff==4);
+}
+
+//!Значения другой длины: LEN записей пересчитывается, в том числе с изменением числа цифр
+static void testResize(const std::string& dir)
+{
+   std::vector<unsigned char> data = sample();
+   std::string file = dir + "/resize.an2";
+   std::string copy = dir + "/copy.an2";
+   NIST_CHECK(writeFile(file,data));
+   nistPatch patch;
+   patch.setField(1,18,std::string(300,'N'));
+   patch.setField(0,9,"TCN0000000000002");
+   patch.removeField(1,18);
+   patch.setField(1,20,"ADDED");
+   NIST_CHECK(patch.write(file,copy));
+
+   //Исходный файл при write не меняется
+   std::vector<unsigned char> content;
+   NIST_CHECK(nistParser::readFile(file,content) && content==data);
+
+   nistParser parser;
+   NIST_CHECK(loadPatched(copy,parser));
+   NIST_CHECK(parser.getTCN()=="TCN0000000000002");
+   NIST_CHECK(fieldOf(parser.getRecord(0),20)=="ADDED");
+   NIST_CHECK(!parser.getRecord(0)->getTagById(18));
+
+   patch.clear();
+   patch.setField(1,18,std::string(300,'N'));
+   NIST_CHECK(patch.apply(file));
+   nistParser patched;
+   NIST_CHECK(loadPatched(file,patched));
+   NIST_CHECK(fieldOf(patched.getRecord(0),18)==std::string(300,'N'));
+   NIST_CHECK(patched.getRecord(0)->recordSize()>100);
+}
+
+//!Бинарные записи и поле 999 не правятся
+static void testRejected(const std::string& dir)
+{
+   std::vector<unsigned char> data = sample();
+   std::string file = dir + "/rejected.an2";
+   NIST_CHECK(writeFile(file,data));
+   nistPatch patch;
+   patch.setField(2,999,"IMAGE");
+   NIST_CHECK(!patch.apply(file));
+   std::vector<unsigned char> content;
+   NIST_CHECK(nistParser::readFile(file,content) && content==data);
+}
+
+int main()
+{
+   char dir[] = "/tmp/nist_patch_testXXXXXX";
+   if(!mkdtemp(dir))
+   {
+      printf("can't create temporary directory\n");
+      return 1;
+   }
+   testSameSize(dir);
+   testResize(dir);
+   testRejected(dir);
+   std::string cleanup = std::string("rm -rf ") + dir;
+   if(system(cleanup.c_str())!=0)
+   {
+      printf("can't remove %s\n",dir);
+   }
+   return nistTestResult("patch_test");
+}
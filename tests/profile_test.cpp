@@ -0,0 +1,145 @@
+/*
+  \file   profile_test.cpp
+  \brief  Правила профиля: обязательные поля, диапазоны, длины, списки значений, число записей, группы TOT
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. profile_test.cpp ../nistprofile.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o profile_test -lpthread
+*/
+
+#include "nisttest.h"
+#include "nistprofile.h"
+
+static std::vector<unsigned char> sample()
+{
+   std::vector<nistTestRecord> records;
+   std::vector<std::pair<unsigned,std::string> > t2(1,std::make_pair(18u,std::string("NAME")));
+   records.push_back(nistTestTagged(2,1,t2));
+   std::vector<std::pair<unsigned,std::string> > t14;
+   t14.push_back(std::make_pair(3u,std::string("1")));
+   t14.push_back(std::make_pair(4u,std::string("ORI000001")));
+   t14.push_back(std::make_pair(5u,std::string("20150419")));
+   t14.push_back(std::make_pair(6u,std::string("800")));
+   t14.push_back(std::make_pair(7u,std::string("750")));
+   t14.push_back(std::make_pair(8u,std::string("1")));
+   t14.push_back(std::make_pair(9u,std::string("500")));
+   t14.push_back(std::make_pair(10u,std::string("500")));
+   t14.push_back(std::make_pair(11u,std::string("NONE")));
+   t14.push_back(std::make_pair(12u,std::string("8")));
+   t14.push_back(std::make_pair(13u,std::string("1")));
+   records.push_back(nistTestTagged(14,1,t14,"IMAGE"));
+   return nistTestTransaction(records);
+}
+
+//!Нарушение правила op в записи record по строке line профиля
+static bool has(const std::vector<nistProfileViolation>& violations, nistRuleOp op, unsigned record, unsigned line)
+{
+   for(size_t no=0;no<violations.size();no++)
+   {
+      if(violations[no].op_==op && violations[no].record_==record && violations[no].line_==line)
+      {
+         return true;
+      }
+   }
+   return false;
+}
+
+//!Транзакция, удовлетворяющая всем правилам
+static void testConforming()
+{
+   std::vector<unsigned char> data = sample();
+   nistParser parser;
+   NIST_CHECK(parser.load(data));
+   nistProfile profile;
+   NIST_CHECK(profile.compile(
+      "profile TEST\n"
+      "version 0400 0500\n"
+      "mandatory 1.004 1.009 2.018\n"
+      "range 14.006 1 1000\n"
+      "length 1.009 1 40\n"
+      "values 14.011 NONE WSQ20\n"
+      "records 14 1 10\n"));
+   NIST_CHECK(profile.name()=="TEST");
+   NIST_CHECK(profile.rulesCnt()==7);
+   NIST_CHECK(profile.matches(parser));
+   std::vector<nistProfileViolation> violations;
+   NIST_CHECK(profile.check(parser,violations));
+   NIST_CHECK(violations.empty());
+}
+
+//!Каждое правило нарушено; правила группы TOT MAP к транзакции CAR не применяются
+static void testViolations()
+{
+   std::vector<unsigned char> data = sample();
+   nistParser parser;
+   NIST_CHECK(parser.load(data));
+   nistProfile profile;
+   NIST_CHECK(profile.compile(
+      "# строки считаются с 1\n"
+      "mandatory 2.019\n"
+      "range 14.006 1 500\n"
+      "length 1.009 1 4\n"
+      "values 14.011 WSQ20 JPEGB\n"
+      "records 14 2 4\n"
+      "tot MAP\n"
+      "mandatory 2.020\n"
+      "tot *\n"
+      "range 14.007 1 500\n"));
+   std::vector<nistProfileViolation> violations;
+   NIST_CHECK(!profile.check(parser,violations));
+   NIST_CHECK(has(violations,nistRuleMandatory,1,2));
+   NIST_CHECK(has(violations,nistRuleRange,2,3));
+   NIST_CHECK(has(violations,nistRuleLength,0,4));
+   NIST_CHECK(has(violations,nistRuleValues,2,5));
+   NIST_CHECK(has(violations,nistRuleRange,2,10));
+   bool records = false;
+   bool tot = false;
+   for(size_t no=0;no<violations.size();no++)
+   {
+      records = records || (violations[no].op_==nistRuleRecords && violations[no].line_==6);
+      tot = tot || violations[no].line_==8;
+   }
+   NIST_CHECK(records);
+   NIST_CHECK(!tot);
+   NIST_CHECK(violations.size()==6);
+}
+
+//!Выбор профиля по 1.002 VER и 1.013 DOM
+static void testSelect()
+{
+   std::vector<unsigned char> data = sample();
+   nistParser parser;
+   NIST_CHECK(parser.load(data));
+   nistProfile other_version;
+   NIST_CHECK(other_version.compile("profile V5\nversion 0500\n"));
+   nistProfile domain;
+   NIST_CHECK(domain.compile("profile DOM\ndomain INT-I 4.22\n"));
+   nistProfile any;
+   NIST_CHECK(any.compile("profile ANY\n"));
+   NIST_CHECK(!other_version.matches(parser));
+   NIST_CHECK(!domain.matches(parser));
+
+   nistProfileSet set;
+   set.add(other_version);
+   set.add(domain);
+   set.add(any);
+   const nistProfile* selected = set.select(parser);
+   NIST_CHECK(selected && selected->name()=="ANY");
+}
+
+//!Ошибка в тексте профиля указывает строку
+static void testInvalid()
+{
+   nistProfile profile;
+   NIST_CHECK(!profile.compile("profile BAD\nrange 14.006 1\n"));
+   NIST_CHECK(profile.getError().find("line 2")!=std::string::npos);
+   NIST_CHECK(!profile.compile("records 1 1 1\n"));
+}
+
+int main()
+{
+   testConforming();
+   testViolations();
+   testSelect();
+   testInvalid();
+   return nistTestResult("profile_test");
+}
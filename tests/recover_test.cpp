@@ -0,0 +1,66 @@
+/*
+  \file   recover_test.cpp
+  \brief  Восстановление поврежденных транзакций, nistRecovery
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. recover_test.cpp ../nistrecover.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o recover_test
+*/
+
+#include <algorithm>
+
+#include "nisttest.h"
+#include "nistrecover.h"
+
+static std::vector<unsigned char> sample()
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("0422")));
+   fields.push_back(std::make_pair(4u,std::string("VALUE")));
+   std::vector<nistTestRecord> records;
+   records.push_back(nistTestTagged(2,0,fields));
+   return nistTestTransaction(records);
+}
+
+//!Исходная транзакция без повреждений восстанавливается побайтно
+static void testClean()
+{
+   std::vector<unsigned char> data = sample();
+   std::vector<unsigned char> repaired;
+   std::vector<nistDamage> damage;
+   nistRecovery recovery;
+   NIST_CHECK(recovery.repair(data.data(),data.size(),repaired,damage)==1);
+   NIST_CHECK(damage.empty());
+   NIST_CHECK(repaired==data);
+}
+
+/*! Разделитель перед первым полем Type-1 (после LEN) заменен: перед полем 1.002 нет GS, и поиск
+    начала поля назад не должен выйти за начало данных
+*/
+static void testFirstField()
+{
+   std::vector<unsigned char> data = sample();
+   std::vector<unsigned char>::iterator gs = std::find(data.begin(),data.end(),nistParser::GS());
+   NIST_CHECK(gs!=data.end());
+   *gs = 'X';
+   //Буфер точного размера, чтобы санитайзер поймал чтение перед ним
+   unsigned char* exact = new unsigned char[data.size()];
+   std::copy(data.begin(),data.end(),exact);
+   std::vector<unsigned char> repaired;
+   std::vector<nistDamage> damage;
+   nistRecovery recovery;
+   NIST_CHECK(recovery.repair(exact,data.size(),repaired,damage)==1);
+   delete[] exact;
+   NIST_CHECK(!damage.empty());
+   //Поле без разделителя пропущено, остальные поля и запись Type-2 сохранены
+   nistParser parser;
+   NIST_CHECK(parser.load(repaired,true));
+   NIST_CHECK(parser.getRecordsCnt()==1);
+   NIST_CHECK(parser.getTCN()=="TCN00001");
+}
+
+int main()
+{
+   testClean();
+   testFirstField();
+   return nistTestResult("recover_test");
+}
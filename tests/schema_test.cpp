@@ -0,0 +1,172 @@
+/*
+  \file   schema_test.cpp
+  \brief  Запись полей по схеме: значения с несколькими подполями и неизмененные поля пишутся как в исходной записи
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. schema_test.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o schema_test -lpthread
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "nisttest.h"
+
+//!Type-14 с изменяемыми членами, как у наследников, заполняющих поля без тегов
+class editableType14 : public type14Record
+{
+public:
+   void setHLL(unsigned hll){hll_ = hll;}
+   void setCGA(const std::string& cga){cga_ = cga;}
+};
+
+static std::vector<std::pair<unsigned,std::string> > type14Fields()
+{
+   std::string rs(1,(char)nistParser::RS());
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("1")));
+   fields.push_back(std::make_pair(4u,std::string("ORI000001")));
+   fields.push_back(std::make_pair(5u,std::string("20150419")));
+   fields.push_back(std::make_pair(6u,std::string("0800")));
+   fields.push_back(std::make_pair(7u,std::string("750")));
+   fields.push_back(std::make_pair(8u,std::string("1")));
+   fields.push_back(std::make_pair(9u,std::string("500")));
+   fields.push_back(std::make_pair(10u,std::string("500")));
+   fields.push_back(std::make_pair(11u,std::string("NONE")));
+   fields.push_back(std::make_pair(12u,std::string("8")));
+   //14.013 FGP с несколькими значениями: член записи хранит только первое
+   fields.push_back(std::make_pair(13u,"2" + rs + "3" + rs + "4"));
+   return fields;
+}
+
+//!Записывает rec через write() и возвращает записанные байты после поля LEN
+static std::string written(nistRecord& rec)
+{
+   FILE* out = tmpfile();
+   if(!out)
+   {
+      return std::string();
+   }
+   int size = rec.write(out);
+   std::string res(size>0 ? size : 0,'\0');
+   rewind(out);
+   if(size<=0 || fread(&res[0],1,size,out)!=(size_t)size)
+   {
+      res.clear();
+   }
+   fclose(out);
+   return res.substr(std::min(res.find((char)nistParser::GS()),res.size()));
+}
+
+//!Данные поля tag записанной записи или пустая строка
+static std::string fieldData(const std::string& rec, unsigned type, unsigned tag)
+{
+   std::string id = std::to_string(type) + "." + (tag<10 ? "00" : tag<100 ? "0" : "") + std::to_string(tag) + ":";
+   size_t pos = rec.find(id);
+   if(pos==std::string::npos)
+   {
+      return std::string();
+   }
+   pos += id.size();
+   size_t end = rec.find_first_of(std::string(1,(char)nistParser::GS()) + (char)nistParser::FS(),pos);
+   return rec.substr(pos,end==std::string::npos ? std::string::npos : end - pos);
+}
+
+//!Запись без изменений: все поля, в том числе 14.013 с тремя значениями и 14.006 с ведущим нулем, пишутся как были
+static void testUnchanged()
+{
+   nistTestRecord src = nistTestTagged(14,5,type14Fields(),"IMAGE");
+   std::vector<unsigned char> data(src.data_.begin(),src.data_.end());
+   type14Record rec;
+   unsigned offset = 0;
+   NIST_CHECK(rec.load(data,offset));
+   NIST_CHECK(rec.getFGP()==2);
+   std::string out = written(rec);
+   NIST_CHECK(out==src.data_.substr(src.data_.find((char)nistParser::GS())));
+   NIST_CHECK(fieldData(out,14,13)==fieldData(src.data_,14,13));
+}
+
+//!Измененные члены пишутся из записи, остальные поля - как были
+static void testChanged()
+{
+   nistTestRecord src = nistTestTagged(14,5,type14Fields(),"IMAGE");
+   std::vector<unsigned char> data(src.data_.begin(),src.data_.end());
+   editableType14 rec;
+   unsigned offset = 0;
+   NIST_CHECK(rec.load(data,offset));
+   rec.setHLL(1600);
+   rec.setCGA("WSQ20");
+   std::string out = written(rec);
+   NIST_CHECK(fieldData(out,14,6)=="1600");
+   NIST_CHECK(fieldData(out,14,11)=="WSQ20");
+   NIST_CHECK(fieldData(out,14,13)==fieldData(src.data_,14,13));
+   NIST_CHECK(fieldData(out,14,2)=="05");
+   NIST_CHECK(fieldData(out,14,999)=="IMAGE");
+}
+
+//!Транзакция, сохраненная парсером, сохраняет все значения 14.013
+static void testTransaction()
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(nistTestTagged(14,1,type14Fields(),"IMAGE"));
+   std::vector<unsigned char> data = nistTestTransaction(records);
+   nistParser parser;
+   NIST_CHECK(parser.load(data.data(),data.size()));
+
+   char path[] = "/tmp/nist_schema_testXXXXXX";
+   int fd = mkstemp(path);
+   if(fd<0)
+   {
+      printf("can't create temporary file\n");
+      nist_test_failures++;
+      return;
+   }
+   close(fd);
+   parser.write(path);
+   nistParser saved;
+   NIST_CHECK(saved.load(std::string(path)));
+   remove(path);
+   const nistRecord* rec = saved.getRecord(0);
+   const nistTag* fgp = rec ? rec->getTagById(13) : 0;
+   std::string rs(1,(char)nistParser::RS());
+   NIST_CHECK(fgp && fgp->data() && std::string((const char*)fgp->data(),fgp->data_size())=="2" + rs + "3" + rs + "4");
+}
+
+//!Type-1 и Type-2 одинаково не загружаются без обязательных полей и загружаются с force
+static void testMandatory()
+{
+   //Type-2 без 2.002 IDC
+   std::vector<std::pair<unsigned,std::string> > t2(1,std::make_pair(3u,std::string("0422")));
+   std::string rec2 = nistGenerator::taggedRecord(2,t2);
+   std::vector<unsigned char> data2(rec2.begin(),rec2.end());
+   type2Record type2;
+   unsigned offset = 0;
+   NIST_CHECK(!type2.load(data2,offset));
+   offset = 0;
+   NIST_CHECK(type2.load(data2,offset,true));
+
+   std::string us(1,(char)nistParser::US());
+   std::string rs(1,(char)nistParser::RS());
+   //Type-1 без 1.005 DAT, 1.007 DAI, 1.008 ORI, 1.011 NSR и 1.012 NTR
+   std::vector<std::pair<unsigned,std::string> > t1;
+   t1.push_back(std::make_pair(2u,std::string("0400")));
+   t1.push_back(std::make_pair(3u,"1" + us + "1" + rs + "2" + us + "00"));
+   t1.push_back(std::make_pair(4u,std::string("CAR")));
+   t1.push_back(std::make_pair(9u,std::string("TCN00001")));
+   std::string rec1 = nistGenerator::taggedRecord(1,t1);
+   std::vector<unsigned char> data1(rec1.begin(),rec1.end());
+   type1Record type1;
+   offset = 0;
+   NIST_CHECK(!type1.load(data1,offset));
+   offset = 0;
+   NIST_CHECK(type1.load(data1,offset,true));
+}
+
+int main()
+{
+   testUnchanged();
+   testChanged();
+   testTransaction();
+   testMandatory();
+   return nistTestResult("schema_test");
+}
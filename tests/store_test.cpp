@@ -0,0 +1,127 @@
+/*
+  \file   store_test.cpp
+  \brief  Хранилище изображений с адресацией по содержимому, nistImageStore
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. store_test.cpp ../nistdedup.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o store_test -lpthread
+*/
+
+#include <cstdlib>
+
+#include "nisttest.h"
+#include "nistdedup.h"
+
+static nistTestRecord type14(unsigned idc, const std::string& image)
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("1")));
+   fields.push_back(std::make_pair(4u,std::string("ORI000001")));
+   fields.push_back(std::make_pair(5u,std::string("20150419")));
+   fields.push_back(std::make_pair(6u,std::string("800")));
+   fields.push_back(std::make_pair(7u,std::string("750")));
+   fields.push_back(std::make_pair(8u,std::string("1")));
+   fields.push_back(std::make_pair(9u,std::string("500")));
+   fields.push_back(std::make_pair(10u,std::string("500")));
+   fields.push_back(std::make_pair(11u,std::string("NONE")));
+   fields.push_back(std::make_pair(12u,std::string("8")));
+   fields.push_back(std::make_pair(13u,std::string("1")));
+   return nistTestTagged(14,idc,fields,image);
+}
+
+//!Изображение из 1000 байт, в том числе байтов разделителей
+static std::string image(unsigned seed)
+{
+   std::string res(1000,0);
+   for(size_t no=0;no<res.size();no++)
+   {
+      res[no] = (char)((no*31 + seed*17) ^ (no>>3));
+   }
+   return res;
+}
+
+static bool writeFile(const std::string& path, const std::string& data)
+{
+   FILE* out = fopen(path.c_str(),"wb");
+   bool res = out && fwrite(data.data(),1,data.size(),out)==data.size();
+   return out && fclose(out)==0 && res;
+}
+
+static std::string readFile(const std::string& path)
+{
+   std::vector<unsigned char> data;
+   nistParser::readFile(path,data);
+   return std::string(data.begin(),data.end());
+}
+
+static std::string transaction(const std::string& tcn, const std::string& first, const std::string& second)
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(type14(1,first));
+   records.push_back(type14(2,second));
+   std::vector<unsigned char> data = nistTestTransaction(records,tcn);
+   return std::string(data.begin(),data.end());
+}
+
+//!Одинаковые изображения записываются один раз, восстановленные байты совпадают с исходными файлами
+static void testDedup(const std::string& dir)
+{
+   std::vector<std::string> files;
+   files.push_back(dir + "/a.an2");
+   files.push_back(dir + "/b.an2");
+   NIST_CHECK(writeFile(files[0],transaction("A",image(1),image(2))));
+   NIST_CHECK(writeFile(files[1],transaction("B",image(1),image(3))));
+
+   nistImageStore store(dir + "/store",2);
+   NIST_CHECK(store.open());
+   NIST_CHECK(store.putFiles(files));
+   NIST_CHECK(store.stats().transactions_==2);
+   NIST_CHECK(store.stats().images_==4);
+   NIST_CHECK(store.stats().unique_==3);
+
+   for(size_t no=0;no<files.size();no++)
+   {
+      std::vector<unsigned char> data;
+      NIST_CHECK(store.get(files[no].substr(dir.size() + 1),data));
+      NIST_CHECK(std::string(data.begin(),data.end())==readFile(files[no]));
+   }
+}
+
+/*! Под хешем изображения уже лежат другие данные того же размера (коллизия): изображение
+    не заменяется ссылкой, транзакция восстанавливается без искажений, чужой файл не меняется
+*/
+static void testCollision(const std::string& dir)
+{
+   std::string path = dir + "/c.an2";
+   NIST_CHECK(writeFile(path,transaction("C",image(4),image(5))));
+   nistImageStore store(dir + "/store2");
+   NIST_CHECK(store.open());
+   std::string hex = nistHashImage((const unsigned char*)image(4).data(),image(4).size()).hex();
+   std::string object = dir + "/store2/objects/" + hex.substr(0,2) + "/" + hex.substr(2);
+   std::string other = image(6);
+   NIST_CHECK(writeFile(object,other));
+
+   NIST_CHECK(store.putFile(path));
+   NIST_CHECK(store.stats().images_==1);
+   NIST_CHECK(readFile(object)==other);
+   std::vector<unsigned char> data;
+   NIST_CHECK(store.get("c.an2",data));
+   NIST_CHECK(std::string(data.begin(),data.end())==readFile(path));
+}
+
+int main()
+{
+   char dir[] = "/tmp/nist_store_testXXXXXX";
+   if(!mkdtemp(dir))
+   {
+      printf("can't create temporary directory\n");
+      return 1;
+   }
+   testDedup(dir);
+   testCollision(dir);
+   std::string cleanup = std::string("rm -rf ") + dir;
+   if(system(cleanup.c_str())!=0)
+   {
+      printf("can't remove %s\n",dir);
+   }
+   return nistTestResult("store_test");
+}
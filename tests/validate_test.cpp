@@ -0,0 +1,111 @@
+/*
+  \file   validate_test.cpp
+  \brief  Структурная проверка: неверный LEN и расхождения с CNT
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. validate_test.cpp ../nistvalidate.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o validate_test -lpthread
+*/
+
+#include <cstdlib>
+
+#include "nisttest.h"
+#include "nistvalidate.h"
+
+static nistTestRecord type2(unsigned idc)
+{
+   std::vector<std::pair<unsigned,std::string> > fields(1,std::make_pair(18u,std::string("NAME")));
+   return nistTestTagged(2,idc,fields);
+}
+
+static std::vector<nistViolation> validate(const std::vector<unsigned char>& data)
+{
+   std::vector<nistViolation> violations;
+   nistValidator validator(64,1);
+   validator.validate(data.data(),data.size(),violations);
+   return violations;
+}
+
+static bool has(const std::vector<nistViolation>& violations, nistViolationCode code, unsigned record)
+{
+   for(size_t no=0;no<violations.size();no++)
+   {
+      if(violations[no].code_==code && violations[no].record_==record)
+      {
+         return true;
+      }
+   }
+   return false;
+}
+
+static void testValid()
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(type2(1));
+   records.push_back(type2(2));
+   NIST_CHECK(validate(nistTestTransaction(records)).empty());
+}
+
+//!LEN первой Type-2 на 1 меньше: он указывает не на FS
+static void testBadLen()
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(type2(1));
+   records.push_back(type2(2));
+   std::string& rec = records[0].data_;
+   size_t colon = rec.find(':');
+   size_t gs = rec.find((char)nistParser::GS());
+   unsigned len = strtoul(rec.substr(colon + 1,gs - colon - 1).c_str(),0,10);
+   rec.replace(colon + 1,gs - colon - 1,std::to_string(len - 1));
+   std::vector<nistViolation> violations = validate(nistTestTransaction(records));
+   NIST_CHECK(has(violations,nistViolationBadLen,1));
+   NIST_CHECK(!has(violations,nistViolationBadLen,0));
+}
+
+//!CNT называет три записи, в файле две, и тип второй записи не совпадает
+static void testBadCnt()
+{
+   std::vector<nistTestRecord> records;
+   records.push_back(type2(1));
+   records.push_back(type2(2));
+   std::vector<unsigned char> data = nistTestTransaction(records);
+
+   std::vector<nistTestRecord> listed = records;
+   listed.push_back(type2(3));
+   listed[1].type_ = 10;
+   std::vector<unsigned char> header = nistTestTransaction(listed);
+   //Type-1 из listed и записи из records
+   size_t header_size = std::string(header.begin(),header.end()).find((char)nistParser::FS()) + 1;
+   size_t old_size = std::string(data.begin(),data.end()).find((char)nistParser::FS()) + 1;
+   std::vector<unsigned char> mixed(header.begin(),header.begin() + header_size);
+   mixed.insert(mixed.end(),data.begin() + old_size,data.end());
+
+   std::vector<nistViolation> violations = validate(mixed);
+   NIST_CHECK(has(violations,nistViolationCntType,2));
+   bool count = false;
+   for(size_t no=0;no<violations.size();no++)
+   {
+      count = count || violations[no].code_==nistViolationCntCount;
+   }
+   NIST_CHECK(count);
+}
+
+//!1.003 CNT отсутствует
+static void testNoCnt()
+{
+   std::vector<std::pair<unsigned,std::string> > t1;
+   t1.push_back(std::make_pair(2u,std::string("0400")));
+   t1.push_back(std::make_pair(4u,std::string("CAR")));
+   std::string file = nistGenerator::taggedRecord(1,t1);
+   std::vector<unsigned char> data(file.begin(),file.end());
+   std::vector<nistViolation> violations = validate(data);
+   NIST_CHECK(has(violations,nistViolationBadCnt,0));
+}
+
+int main()
+{
+   testValid();
+   testBadLen();
+   testBadCnt();
+   testNoCnt();
+   return nistTestResult("validate_test");
+}
@@ -0,0 +1,134 @@
+/*
+  \file   write_test.cpp
+  \brief  Сохранение транзакции парсером: записи пишутся один раз с вычисленным LEN, правка IDC не ломает CNT
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. write_test.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o write_test -lpthread
+*/
+
+#include <unistd.h>
+
+#include "nisttest.h"
+
+static nistTestRecord type14(unsigned idc, const std::string& image)
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("1")));
+   fields.push_back(std::make_pair(4u,std::string("ORI000001")));
+   fields.push_back(std::make_pair(5u,std::string("20150419")));
+   fields.push_back(std::make_pair(6u,std::string("800")));
+   fields.push_back(std::make_pair(7u,std::string("750")));
+   fields.push_back(std::make_pair(8u,std::string("1")));
+   fields.push_back(std::make_pair(9u,std::string("500")));
+   fields.push_back(std::make_pair(10u,std::string("500")));
+   fields.push_back(std::make_pair(11u,std::string("NONE")));
+   fields.push_back(std::make_pair(12u,std::string("8")));
+   fields.push_back(std::make_pair(13u,std::string("1")));
+   return nistTestTagged(14,idc,fields,image);
+}
+
+static std::vector<unsigned char> sample()
+{
+   std::vector<nistTestRecord> records;
+   std::vector<std::pair<unsigned,std::string> > t2(1,std::make_pair(18u,std::string("NAME")));
+   records.push_back(nistTestTagged(2,1,t2));
+   records.push_back(type14(1,"IMAGE-1"));
+   return nistTestTransaction(records);
+}
+
+//!Сохраняет транзакцию во временный файл и возвращает его содержимое
+static bool saved(nistParser& parser, std::vector<unsigned char>& content)
+{
+   char path[] = "/tmp/nist_write_testXXXXXX";
+   int fd = mkstemp(path);
+   if(fd<0)
+   {
+      return false;
+   }
+   close(fd);
+   bool res = parser.write(path) && nistParser::readFile(path,content);
+   remove(path);
+   return res;
+}
+
+//!Транзакция без правок сохраняется байт в байт
+static void testUnchanged()
+{
+   std::vector<unsigned char> data = sample();
+   nistParser parser;
+   NIST_CHECK(parser.load(data));
+   std::vector<unsigned char> content;
+   NIST_CHECK(saved(parser,content));
+   NIST_CHECK(content==data);
+}
+
+//!После правок LEN каждой записи, в том числе двоичной Type-4, соответствует записанным данным
+static void testEdited()
+{
+   std::vector<unsigned char> data = sample();
+   nistParser parser;
+   NIST_CHECK(parser.load(data));
+   std::vector<std::pair<unsigned,std::string> > t4;
+   t4.push_back(std::make_pair(3u,std::string("0")));
+   t4.push_back(std::make_pair(4u,std::string("1")));
+   t4.push_back(std::make_pair(5u,std::string("0")));
+   t4.push_back(std::make_pair(6u,std::string("800")));
+   t4.push_back(std::make_pair(7u,std::string("750")));
+   t4.push_back(std::make_pair(8u,std::string("0")));
+   std::string image(1000,'\x5A');
+   NIST_CHECK(parser.appendRecord(4,t4,(const unsigned char*)image.data(),image.size())==2);
+   //Поле длиннее исходного меняет число цифр LEN записи Type-2
+   NIST_CHECK(parser.setField(0,18,std::string(200,'N')));
+   NIST_CHECK(parser.setHeaderField(9,"TCN0000000000002"));
+
+   std::vector<unsigned char> content;
+   NIST_CHECK(saved(parser,content));
+   unsigned long long size = parser.getFileHeader()->recordSize();
+   for(unsigned rec_no=0;rec_no<parser.getRecordsCnt();rec_no++)
+   {
+      size += parser.getRecord(rec_no)->recordSize();
+   }
+   NIST_CHECK(content.size()==size);
+
+   nistParser loaded;
+   NIST_CHECK(loaded.load(content));
+   NIST_CHECK(loaded.getRecordsCnt()==3);
+   NIST_CHECK(loaded.getTCN()=="TCN0000000000002");
+   const nistRecord* t4rec = loaded.getRecordsCnt()==3 ? loaded.getRecord(2) : 0;
+   NIST_CHECK(t4rec && t4rec->type()==4 && t4rec->getImgDataSize()==image.size());
+   const nistTag* name = loaded.getRecordsCnt()==3 ? loaded.getRecord(0)->getTagById(18) : 0;
+   NIST_CHECK(name && name->data_size()==200);
+}
+
+//!Если Type-1 нельзя пересобрать, правка IDC отклоняется и ничего не меняет
+static void testIdcRejected()
+{
+   std::vector<nistTestRecord> records;
+   std::vector<std::pair<unsigned,std::string> > t2(1,std::make_pair(18u,std::string("NAME")));
+   records.push_back(nistTestTagged(2,1,t2));
+   std::string us(1,(char)nistParser::US());
+   std::string rs(1,(char)nistParser::RS());
+   //Type-1 без обязательных полей загружается только с force
+   std::vector<std::pair<unsigned,std::string> > t1;
+   t1.push_back(std::make_pair(2u,std::string("0400")));
+   t1.push_back(std::make_pair(3u,"1" + us + "1" + rs + "2" + us + "01"));
+   t1.push_back(std::make_pair(4u,std::string("CAR")));
+   t1.push_back(std::make_pair(9u,std::string("TCN00001")));
+   std::string file = nistGenerator::taggedRecord(1,t1) + records[0].data_;
+   std::vector<unsigned char> data(file.begin(),file.end());
+
+   nistParser parser;
+   NIST_CHECK(parser.load(data,true));
+   NIST_CHECK(!parser.setField(0,2,"07"));
+   NIST_CHECK(parser.getFileHeader()->getRecordIDC(0)==1);
+   const nistTag* idc = parser.getRecordsCnt()==1 ? parser.getRecord(0)->getTagById(2) : 0;
+   NIST_CHECK(idc && std::string((const char*)idc->data(),idc->data_size())=="01");
+}
+
+int main()
+{
+   testUnchanged();
+   testEdited();
+   testIdcRejected();
+   return nistTestResult("write_test");
+}
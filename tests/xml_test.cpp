@@ -0,0 +1,136 @@
+/*
+  \file   xml_test.cpp
+  \brief  Запись транзакции в XML и обратное чтение: изображения base64 и текст, не являющийся UTF-8
+
+  Сборка:
+     g++ -g -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. xml_test.cpp ../nistxml.cpp ../bench/nistgen.cpp ../nistparser.cpp ../nistmetrics.cpp -o xml_test -lpthread
+*/
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "nisttest.h"
+#include "nistxml.h"
+
+static nistTestRecord type14(unsigned idc, const std::string& ori, const std::string& image)
+{
+   std::vector<std::pair<unsigned,std::string> > fields;
+   fields.push_back(std::make_pair(3u,std::string("1")));
+   fields.push_back(std::make_pair(4u,ori));
+   fields.push_back(std::make_pair(5u,std::string("20150419")));
+   fields.push_back(std::make_pair(6u,std::string("800")));
+   fields.push_back(std::make_pair(7u,std::string("750")));
+   fields.push_back(std::make_pair(8u,std::string("1")));
+   fields.push_back(std::make_pair(9u,std::string("500")));
+   fields.push_back(std::make_pair(10u,std::string("500")));
+   fields.push_back(std::make_pair(11u,std::string("NONE")));
+   fields.push_back(std::make_pair(12u,std::string("8")));
+   fields.push_back(std::make_pair(13u,std::string("1")));
+   return nistTestTagged(14,idc,fields,image);
+}
+
+//!Изображение из всех значений байта, размер не кратен 3
+static std::string image(size_t size, unsigned seed)
+{
+   std::string res(size,'\0');
+   for(size_t no=0;no<size;no++)
+   {
+      res[no] = (char)((no*seed + no/256) & 0xFF);
+   }
+   return res;
+}
+
+static std::string fieldOf(const nistRecord* rec, unsigned tag)
+{
+   const nistTag* field = rec ? rec->getTagById(tag) : 0;
+   return field && field->data() ? std::string((const char*)field->data(),field->data_size()) : std::string();
+}
+
+static std::string imageOf(const nistRecord* rec)
+{
+   return rec && rec->getImgData() ? std::string((const char*)rec->getImgData(),rec->getImgDataSize()) : std::string();
+}
+
+static bool readText(const std::string& path, std::string& text)
+{
+   std::vector<unsigned char> content;
+   if(!nistParser::readFile(path,content))
+   {
+      return false;
+   }
+   text.assign(content.begin(),content.end());
+   return true;
+}
+
+//!Все байты >= 0x80 образуют правильные последовательности UTF-8
+static bool validUtf8(const std::string& text)
+{
+   for(size_t pos=0;pos<text.size();)
+   {
+      size_t len = (unsigned char)text[pos]<0x80 ? 1 : nistUtf8Length((const unsigned char*)text.data() + pos,
+                                                                       (const unsigned char*)text.data() + text.size());
+      if(!len)
+      {
+         return false;
+      }
+      pos += len;
+   }
+   return true;
+}
+
+static void testRoundTrip(const std::string& dir)
+{
+   std::string first = image(1001,7);
+   std::string second = image(4097,13);
+   std::vector<nistTestRecord> records;
+   //Latin-1 "Gérard" и правильный UTF-8 "Gérard"
+   records.push_back(type14(1,"G\xE9rard",first));
+   records.push_back(type14(2,"G\xC3\xA9rard",second));
+   std::vector<unsigned char> data = nistTestTransaction(records);
+   nistParser parser;
+   NIST_CHECK(parser.load(data));
+
+   std::string xml_file = dir + "/transaction.xml";
+   NIST_CHECK(nistXmlWriter::writeFile(parser,xml_file));
+   std::string xml;
+   NIST_CHECK(readText(xml_file,xml));
+   NIST_CHECK(validUtf8(xml));
+   NIST_CHECK(xml.find("G&#xE9;rard")!=std::string::npos);
+   NIST_CHECK(xml.find("G\xC3\xA9rard")!=std::string::npos);
+
+   nistXmlReader reader;
+   nistParser loaded;
+   NIST_CHECK(reader.load(xml_file,loaded));
+   NIST_CHECK(loaded.getTCN()==parser.getTCN());
+   NIST_CHECK(loaded.getRecordsCnt()==2);
+   if(loaded.getRecordsCnt()!=2)
+   {
+      return;
+   }
+   const nistRecord* rec1 = loaded.getRecord(0);
+   const nistRecord* rec2 = loaded.getRecord(1);
+   NIST_CHECK(imageOf(rec1)==first);
+   NIST_CHECK(imageOf(rec2)==second);
+   NIST_CHECK(fieldOf(rec1,2)=="01" && fieldOf(rec2,2)=="02");
+   NIST_CHECK(fieldOf(rec1,6)=="800" && fieldOf(rec2,11)=="NONE");
+   //Байт Latin-1 читается обратно как тот же символ в UTF-8
+   NIST_CHECK(fieldOf(rec1,4)=="G\xC3\xA9rard");
+   NIST_CHECK(fieldOf(rec2,4)=="G\xC3\xA9rard");
+}
+
+int main()
+{
+   char dir[] = "/tmp/nist_xml_testXXXXXX";
+   if(!mkdtemp(dir))
+   {
+      printf("can't create temporary directory\n");
+      return 1;
+   }
+   testRoundTrip(dir);
+   std::string cleanup = std::string("rm -rf ") + dir;
+   if(system(cleanup.c_str())!=0)
+   {
+      printf("can't remove %s\n",dir);
+   }
+   return nistTestResult("xml_test");
+}
@@ -0,0 +1,76 @@
+/*
+  \file   nistd.cpp
+  \brief  Сервис разбора ANSI-NIST транзакций на Unix domain socket (протокол см. nistserver.h)
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. nistd.cpp ../nistserver.cpp ../nistparser.cpp ../nistmetrics.cpp -o nistd -lpthread
+  Запуск:
+     ./nistd [-j потоки] путь_сокета
+  Работает до SIGINT/SIGTERM, затем закрывает соединения и удаляет файл сокета.
+*/
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+
+#include "nistserver.h"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void onSignal(int)
+{
+   stop_requested = 1;
+}
+
+static void usage()
+{
+   printf("usage: nistd [-j threads] socket_path\n");
+}
+
+int main(int argc, char* argv[])
+{
+   unsigned threads = 0;
+   std::string socket_path;
+   for(int arg=1;arg<argc;arg++)
+   {
+      if(!strcmp(argv[arg],"-j") && arg + 1<argc)
+      {
+         threads = atoi(argv[++arg]);
+      }
+      else if(argv[arg][0]=='-' || !socket_path.empty())
+      {
+         usage();
+         return 2;
+      }
+      else
+      {
+         socket_path = argv[arg];
+      }
+   }
+   if(socket_path.empty())
+   {
+      usage();
+      return 2;
+   }
+   signal(SIGINT,onSignal);
+   signal(SIGTERM,onSignal);
+   signal(SIGPIPE,SIG_IGN);
+
+   nistServer server;
+   if(!server.start(socket_path,threads))
+   {
+      printf("%s\n",server.getError().c_str());
+      return 1;
+   }
+   while(!stop_requested)
+   {
+      pause();
+   }
+   server.stop();
+   printf("%llu requests served\n",server.requests());
+   return 0;
+}
@@ -0,0 +1,75 @@
+/*
+  \file   nistextract.cpp
+  \brief  Выгрузка изображений из ANSI-NIST файлов в каталог
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. nistextract.cpp ../nistextract.cpp ../nistcopy.cpp ../nistparser.cpp ../nistmetrics.cpp -o nistextract -lpthread
+  Запуск:
+     ./nistextract [-o каталог] [-j потоки] файл...
+  Для каждого изображения выводится строка: файл транзакции, тип записи, IDC, FGP, размер, путь.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nistextract.h"
+
+static void usage()
+{
+   printf("usage: nistextract [-o out_dir] [-j threads] file...\n");
+}
+
+int main(int argc, char* argv[])
+{
+   std::string out_dir = ".";
+   unsigned threads = 0;
+   std::vector<std::string> transactions;
+   for(int arg=1;arg<argc;arg++)
+   {
+      if(!strcmp(argv[arg],"-o") && arg + 1<argc)
+      {
+         out_dir = argv[++arg];
+      }
+      else if(!strcmp(argv[arg],"-j") && arg + 1<argc)
+      {
+         threads = atoi(argv[++arg]);
+      }
+      else if(argv[arg][0]=='-')
+      {
+         usage();
+         return 2;
+      }
+      else
+      {
+         transactions.push_back(argv[arg]);
+      }
+   }
+   if(transactions.empty())
+   {
+      usage();
+      return 2;
+   }
+
+   nistImageExtractor extractor(out_dir,threads);
+   std::vector<nistImageFile> files;
+   bool res;
+   if(transactions.size()==1)
+   {
+      //Одна транзакция - параллельно по изображениям
+      nistParser parser;
+      res = parser.load(transactions[0]) && extractor.extract(parser,files,transactions[0]);
+   }
+   else
+   {
+      res = extractor.extractFiles(transactions,files);
+   }
+   for(size_t no=0;no<files.size();no++)
+   {
+      printf("type %u idc %u fgp %u size %u %s%s\n",files[no].type_,files[no].idc_,files[no].fgp_,files[no].size_,
+             files[no].path_.c_str(),files[no].ok_ ? "" : " FAILED");
+   }
+   return res ? 0 : 1;
+}
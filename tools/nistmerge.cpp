@@ -0,0 +1,55 @@
+/*
+  \file   nistmerge.cpp
+  \brief  Объединение и разделение ANSI-NIST транзакций
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. nistmerge.cpp ../nistmerge.cpp ../nistcopy.cpp ../nistparser.cpp ../nistmetrics.cpp -o nistmerge
+  Запуск:
+     ./nistmerge merge результат файл...
+     ./nistmerge split файл префикс
+  При разделении выводятся имена созданных файлов.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nistmerge.h"
+
+static void usage()
+{
+   printf("usage: nistmerge merge out_file file...\n"
+          "       nistmerge split file out_prefix\n");
+}
+
+int main(int argc, char* argv[])
+{
+   std::string err_msg;
+   if(argc>=4 && !strcmp(argv[1],"merge"))
+   {
+      std::vector<std::string> transactions(argv + 3,argv + argc);
+      if(!nistMergeFiles(transactions,argv[2],err_msg))
+      {
+         printf("merge error: %s\n",err_msg.c_str());
+         return 1;
+      }
+      return 0;
+   }
+   if(argc==4 && !strcmp(argv[1],"split"))
+   {
+      std::vector<std::string> files;
+      if(!nistSplitFile(argv[2],argv[3],files,err_msg))
+      {
+         printf("split error: %s\n",err_msg.c_str());
+         return 1;
+      }
+      for(size_t no=0;no<files.size();no++)
+      {
+         printf("%s\n",files[no].c_str());
+      }
+      return 0;
+   }
+   usage();
+   return 2;
+}
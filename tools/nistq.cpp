@@ -0,0 +1,161 @@
+/*
+  \file   nistq.cpp
+  \brief  Клиент сервиса nistd: поля, список записей или изображение по пакету файлов
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. nistq.cpp ../nistserver.cpp ../nistparser.cpp ../nistmetrics.cpp -o nistq -lpthread
+  Запуск:
+     ./nistq путь_сокета fields 1.004,1.009,2.018 файл...
+     ./nistq путь_сокета records файл...
+     ./nistq путь_сокета image номер_записи выходной_файл файл
+  Пути передаются сервису как есть, поэтому они должны быть доступны ему (лучше абсолютные).
+  Файлы отправляются пакетами по 64, следующий пакет - не дожидаясь ответа на предыдущий.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "nistserver.h"
+
+static const size_t batch_size = 64;
+
+static void usage()
+{
+   printf("usage: nistq socket fields T.FFF[,T.FFF...] file...\n"
+          "       nistq socket records file...\n"
+          "       nistq socket image rec_no out_file file\n");
+}
+
+int main(int argc, char* argv[])
+{
+   if(argc<4)
+   {
+      usage();
+      return 2;
+   }
+   std::string op = argv[2];
+   int first_file = op=="fields" ? 4 : op=="records" ? 3 : op=="image" ? 5 : argc;
+   if(first_file>=argc)
+   {
+      usage();
+      return 2;
+   }
+   nistClient client;
+   if(!client.connect(argv[1]))
+   {
+      printf("can't connect to %s\n",argv[1]);
+      return 1;
+   }
+   std::vector<std::pair<unsigned,unsigned> > fields;
+   if(op=="fields")
+   {
+      for(const char* p=argv[3];*p;)
+      {
+         char* end = 0;
+         unsigned type = strtoul(p,&end,10);
+         unsigned tag = *end=='.' ? strtoul(end + 1,&end,10) : 0;
+         fields.push_back(std::make_pair(type,tag));
+         p = *end==',' ? end + 1 : end;
+         if(!tag)
+         {
+            usage();
+            return 2;
+         }
+      }
+   }
+
+   //Пакеты отправляются сразу, ответы читаются после
+   std::vector<std::string> files(argv + first_file,argv + argc);
+   unsigned batches = 0;
+   for(size_t first=0;first<files.size();first+=batch_size,batches++)
+   {
+      std::vector<nistSource> sources;
+      for(size_t no=first;no<files.size() && no<first + batch_size;no++)
+      {
+         nistSource source = {nistSourcePath,files[no]};
+         sources.push_back(source);
+      }
+      bool sent = op=="fields" ? client.sendFields(batches,fields,sources) :
+                  op=="records" ? client.sendRecords(batches,sources) :
+                  client.sendImage(batches,atoi(argv[3]),sources);
+      if(!sent)
+      {
+         printf("can't send request\n");
+         return 1;
+      }
+   }
+   int res = 0;
+   std::map<unsigned,std::vector<nistResult> > replies;
+   for(unsigned no=0;no<batches;no++)
+   {
+      unsigned id = 0;
+      nistReplyStatus status;
+      std::vector<nistResult> results;
+      if(!client.receive(id,status,results) || status!=nistReplyOk)
+      {
+         printf("bad reply\n");
+         return 1;
+      }
+      replies[id].swap(results);
+   }
+   //Вывод в порядке файлов
+   for(std::map<unsigned,std::vector<nistResult> >::iterator it=replies.begin();it!=replies.end();++it)
+   {
+      for(size_t no=0;no<it->second.size();no++)
+      {
+         const std::string& file = files[it->first*batch_size + no];
+         const nistResult& result = it->second[no];
+         if(result.status_!=nistReplyOk)
+         {
+            printf("%s: error %d\n",file.c_str(),result.status_);
+            res = 1;
+            continue;
+         }
+         if(op=="fields")
+         {
+            std::vector<std::string> values;
+            nistClient::fieldValues(result.data_,values);
+            printf("%s",file.c_str());
+            for(size_t value_no=0;value_no<values.size();value_no++)
+            {
+               printf("\t%s",values[value_no].c_str());
+            }
+            printf("\n");
+         }
+         else if(op=="records")
+         {
+            const unsigned char* p = (const unsigned char*)result.data_.data();
+            unsigned cnt = result.data_.size()>=4 ? p[0] | p[1]<<8 | p[2]<<16 | p[3]<<24 : 0;
+            for(unsigned rec_no=0;rec_no<cnt && 4 + (rec_no + 1)*16<=result.data_.size();rec_no++)
+            {
+               const unsigned char* item = p + 4 + rec_no*16;
+               unsigned values[4];
+               for(unsigned value_no=0;value_no<4;value_no++)
+               {
+                  const unsigned char* v = item + value_no*4;
+                  values[value_no] = v[0] | v[1]<<8 | v[2]<<16 | (unsigned)v[3]<<24;
+               }
+               printf("%s\t%u\ttype %u\tidc %u\tsize %u\timage %u\n",file.c_str(),rec_no + 1,values[0],values[1],values[2],values[3]);
+            }
+         }
+         else
+         {
+            FILE* out = fopen(argv[4],"wb");
+            if(!out || fwrite(result.data_.data(),1,result.data_.size(),out)!=result.data_.size())
+            {
+               printf("can't write %s\n",argv[4]);
+               res = 1;
+            }
+            if(out)
+            {
+               fclose(out);
+            }
+         }
+      }
+   }
+   return res;
+}
@@ -0,0 +1,59 @@
+/*
+  \file   nistrecover.cpp
+  \brief  Восстановление поврежденного ANSI-NIST файла
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. nistrecover.cpp ../nistrecover.cpp ../nistparser.cpp ../nistmetrics.cpp -o nistrecover
+  Запуск:
+     ./nistrecover входной_файл выходной_файл
+  Для каждого повреждения выводится строка: смещение, размер, номер записи в CNT, тип, описание.
+  Код возврата 0, если повреждений нет, 1 - файл восстановлен, 2 - Type-1 не найден или ошибка записи.
+*/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "nistrecover.h"
+
+int main(int argc, char* argv[])
+{
+   if(argc!=3)
+   {
+      printf("usage: nistrecover in_file out_file\n");
+      return 2;
+   }
+   std::vector<unsigned char> data;
+   if(!nistParser::readFile(argv[1],data))
+   {
+      printf("can't read %s\n",argv[1]);
+      return 2;
+   }
+   nistRecovery recovery;
+   std::vector<unsigned char> repaired;
+   std::vector<nistDamage> damage;
+   int saved = recovery.repair(data.empty() ? 0 : &data[0],data.size(),repaired,damage);
+   for(size_t no=0;no<damage.size();no++)
+   {
+      printf("offset %llu size %llu record %u type %u: %s\n",damage[no].offset_,damage[no].size_,
+             damage[no].record_,damage[no].type_,nistDamageText(damage[no].kind_));
+   }
+   if(saved<0)
+   {
+      printf("Type-1 record not found\n");
+      return 2;
+   }
+   FILE* out = fopen(argv[2],"wb");
+   if(!out || fwrite(&repaired[0],1,repaired.size(),out)!=repaired.size())
+   {
+      printf("can't write %s\n",argv[2]);
+      if(out)
+      {
+         fclose(out);
+      }
+      return 2;
+   }
+   fclose(out);
+   printf("%d records saved\n",saved);
+   return damage.empty() ? 0 : 1;
+}
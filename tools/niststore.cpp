@@ -0,0 +1,131 @@
+/*
+  \file   niststore.cpp
+  \brief  Хранилище ANSI-NIST транзакций без повторяющихся изображений
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. niststore.cpp ../nistdedup.cpp ../nistparser.cpp ../nistmetrics.cpp -o niststore -lpthread
+  Запуск:
+     ./niststore [-j потоки] [-m мин.размер] хранилище put файл...
+     ./niststore хранилище get имя выходной_файл
+     ./niststore хранилище hash файл...
+  put сохраняет транзакции под именами их файлов и выводит счетчики; get записывает восстановленные
+  байты транзакции, они совпадают с файлом, сохраненным put; hash выводит хеши изображений транзакций.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nistdedup.h"
+
+static void usage()
+{
+   printf("usage: niststore [-j threads] [-m min_size] store put file...\n"
+          "       niststore store get name out_file\n"
+          "       niststore store hash file...\n");
+}
+
+int main(int argc, char* argv[])
+{
+   unsigned threads = 0;
+   unsigned min_size = 0;
+   std::vector<std::string> args;
+   for(int arg=1;arg<argc;arg++)
+   {
+      if(!strcmp(argv[arg],"-j") && arg + 1<argc)
+      {
+         threads = atoi(argv[++arg]);
+      }
+      else if(!strcmp(argv[arg],"-m") && arg + 1<argc)
+      {
+         min_size = atoi(argv[++arg]);
+      }
+      else if(argv[arg][0]=='-')
+      {
+         usage();
+         return 2;
+      }
+      else
+      {
+         args.push_back(argv[arg]);
+      }
+   }
+   if(args.size()<3)
+   {
+      usage();
+      return 2;
+   }
+
+   nistImageStore store(args[0],threads);
+   if(min_size)
+   {
+      store.setMinSize(min_size);
+   }
+   const std::string& command = args[1];
+   if(command=="put")
+   {
+      std::vector<std::string> transactions(args.begin() + 2,args.end());
+      if(!store.open())
+      {
+         fprintf(stderr,"%s\n",store.getError().c_str());
+         return 1;
+      }
+      bool res = store.putFiles(transactions);
+      const nistStoreStats& stats = store.stats();
+      printf("transactions %u images %u unique %u bytes in %llu images %llu written %llu\n",stats.transactions_,
+             stats.images_,stats.unique_,stats.bytes_in_,stats.image_bytes_,stats.bytes_written_);
+      if(!res)
+      {
+         fprintf(stderr,"%s\n",store.getError().c_str());
+      }
+      return res ? 0 : 1;
+   }
+   if(command=="get" && args.size()==4)
+   {
+      std::vector<unsigned char> data;
+      if(!store.get(args[2],data))
+      {
+         fprintf(stderr,"%s\n",store.getError().c_str());
+         return 1;
+      }
+      //Байты пишутся как есть: повторная сборка парсером не обязана совпадать с исходным файлом
+      FILE* out = fopen(args[3].c_str(),"wb");
+      bool res = out && (data.empty() || fwrite(data.data(),1,data.size(),out)==data.size());
+      if(out && fclose(out)!=0)
+      {
+         res = false;
+      }
+      if(!res)
+      {
+         fprintf(stderr,"can't write %s\n",args[3].c_str());
+      }
+      return res ? 0 : 1;
+   }
+   if(command=="hash")
+   {
+      bool res = true;
+      nistParser parser;
+      std::vector<unsigned char> data;
+      std::vector<nistPayloadRef> refs;
+      for(size_t no=2;no<args.size();no++)
+      {
+         if(!nistParser::readFile(args[no],data) || !parser.load(data.data(),data.size()) ||
+            !store.hashImages(parser,data.data(),data.size(),refs))
+         {
+            fprintf(stderr,"can't load %s\n",args[no].c_str());
+            res = false;
+            continue;
+         }
+         for(size_t ref_no=0;ref_no<refs.size();ref_no++)
+         {
+            printf("%s offset %llu size %u %s\n",args[no].c_str(),refs[ref_no].offset_,refs[ref_no].size_,
+                   refs[ref_no].hash_.hex().c_str());
+         }
+      }
+      return res ? 0 : 1;
+   }
+   usage();
+   return 2;
+}
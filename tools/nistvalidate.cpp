@@ -0,0 +1,71 @@
+/*
+  \file   nistvalidate.cpp
+  \brief  Структурная проверка ANSI-NIST файлов
+
+  Сборка:
+     g++ -O2 -std=c++11 -DNIST_NO_DEBUG_OUTPUT -I.. nistvalidate.cpp ../nistvalidate.cpp ../nistparser.cpp ../nistmetrics.cpp -o nistvalidate -lpthread
+  Запуск:
+     ./nistvalidate [-j потоки] [-m нарушений на файл] файл...
+  Для каждого нарушения выводится строка: файл, смещение, номер записи, тип, поле, описание.
+  Код возврата 0, если все файлы корректны.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nistvalidate.h"
+
+static void usage()
+{
+   printf("usage: nistvalidate [-j threads] [-m max_violations] file...\n");
+}
+
+int main(int argc, char* argv[])
+{
+   unsigned threads = 0;
+   unsigned max_violations = 64;
+   std::vector<std::string> files;
+   for(int arg=1;arg<argc;arg++)
+   {
+      if(!strcmp(argv[arg],"-j") && arg + 1<argc)
+      {
+         threads = atoi(argv[++arg]);
+      }
+      else if(!strcmp(argv[arg],"-m") && arg + 1<argc)
+      {
+         max_violations = atoi(argv[++arg]);
+      }
+      else if(argv[arg][0]=='-')
+      {
+         usage();
+         return 2;
+      }
+      else
+      {
+         files.push_back(argv[arg]);
+      }
+   }
+   if(files.empty())
+   {
+      usage();
+      return 2;
+   }
+
+   nistValidator validator(max_violations,threads);
+   std::vector<std::vector<nistViolation> > results;
+   unsigned valid = validator.validateFiles(files,results);
+   for(size_t no=0;no<files.size();no++)
+   {
+      for(size_t violation_no=0;violation_no<results[no].size();violation_no++)
+      {
+         const nistViolation& violation = results[no][violation_no];
+         printf("%s: offset %llu record %u type %u field %u: %s\n",files[no].c_str(),violation.offset_,
+                violation.record_,violation.type_,violation.tag_,nistViolationText(violation.code_));
+      }
+   }
+   printf("%u of %u files valid\n",valid,(unsigned)files.size());
+   return valid==files.size() ? 0 : 1;
+}